@@ -28,6 +28,7 @@ using MatX = Eigen::Matrix<number_t, Eigen::Dynamic, Eigen::Dynamic>;
 using VecX = Eigen::Matrix<number_t, Eigen::Dynamic, 1>;
 using MatX2 = Eigen::Matrix<number_t, Eigen::Dynamic, 2>;
 using MatX3 = Eigen::Matrix<number_t, Eigen::Dynamic, 3>;
+using MatX4 = Eigen::Matrix<number_t, Eigen::Dynamic, 4>;
 using MatX6 = Eigen::Matrix<number_t, Eigen::Dynamic, 6>;
 using MatX7 = Eigen::Matrix<number_t, Eigen::Dynamic, 7>;
 
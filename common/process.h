@@ -1,6 +1,13 @@
 #pragma once
 // stl
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iterator>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <typeinfo>
 // 3rdparty
@@ -12,6 +19,12 @@
 
 namespace xivo {
 
+/** What `Process::Enqueue` does when the queue is full. */
+enum class OverflowPolicy {
+  BLOCK,        // wait for the consumer to make room
+  DROP_OLDEST,  // never wait: the backlog is discarded for the newest messages
+};
+
 // my little process wrapper of
 // the single producer single consumer queue
 // from facebook's folly library
@@ -22,47 +35,121 @@ public:
   //   std::atomic<bool> ready_;
   // };
 
-  Process(uint32_t size = 1000) : worker_{nullptr}, queue_{size} {}
+  struct Stats {
+    uint64_t enqueued, handled, dropped;
+    size_t max_depth;  // most messages ever waiting in the queue
+    double mean_latency_ms, max_latency_ms;  // from Enqueue to Handle
+  };
+
+  Process(uint32_t size = 1000, OverflowPolicy policy = OverflowPolicy::BLOCK)
+      : worker_{nullptr}, queue_{size}, policy_{policy}, overflowed_{false},
+        consumer_waiting_{false}, producer_waiting_{false}, quit_{false},
+        enqueued_{0}, handled_{0}, dropped_{0}, max_depth_{0},
+        total_latency_{0}, max_latency_{0} {}
 
   Process(const Process &) = delete;
   Process &operator=(const Process &) = delete;
 
+  /** Block until every message enqueued so far is handled (or dropped). */
   virtual void Wait() {
-    while (!queue_.isEmpty()) {
-      usleep(1);
-    }
+    std::unique_lock<std::mutex> lck(mtx_);
+    idle_.wait(lck, [this]() { return Idle(); });
   }
 
   virtual ~Process() {
-    if (worker_) {
-      worker_->join();
-      delete worker_;
-    }
-    LOG(INFO) << "process stopped";
+    Stop();
+    auto s = stats();
+    LOG(INFO) << StrFormat("process stopped: %lu handled, %lu dropped, "
+                           "max depth %lu, latency %0.3f ms (max %0.3f ms)",
+                           s.handled, s.dropped, s.max_depth,
+                           s.mean_latency_ms, s.max_latency_ms);
   }
 
   void Start() {
     worker_ = new std::thread([this]() {
-      for (;;) {
-        std::unique_ptr<MessageT> message;
-        while (!queue_.read(message)) {
-          continue;
-        }
-        if (!this->Handle(message.get())) {
+      Entry entry;
+      while (Next(entry)) {
+        int64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - entry.enqueued).count();
+        total_latency_ += latency;
+        if (latency > max_latency_) max_latency_ = latency;
+
+        if (!this->Handle(entry.message.get())) {
           LOG(FATAL) << "cannot handle unknown message type";
         }
+        entry.message.reset();
+        ++handled_;
+        NotifyIfIdle();
       }
     });
   }
 
+  /** Handle whatever is still queued, then stop the worker. Subclasses call
+   * this in their destructor, since their `Handle` must outlive the worker. */
+  void Stop() {
+    if (!worker_) return;
+    {
+      std::scoped_lock lck(mtx_);
+      quit_ = true;
+      not_empty_.notify_all();
+    }
+    worker_->join();
+    delete worker_;
+    worker_ = nullptr;
+  }
+
   void Enqueue(std::unique_ptr<MessageT> message) {
     // DLOG(INFO) << "enqueueing message ..." << std::endl;
-    while (!queue_.write(std::move(message))) {
-      continue;
+    Entry entry{std::move(message), std::chrono::steady_clock::now()};
+    ++enqueued_;
+
+    if (policy_ == OverflowPolicy::DROP_OLDEST) {
+      // once the queue overflows, messages are set aside until the consumer
+      // skips the stale ones still in the queue
+      if (overflowed_ || !queue_.write(std::move(entry))) {
+        std::scoped_lock lck(mtx_);
+        overflow_.push_back(std::move(entry));
+        if (overflow_.size() > queue_.capacity()) {
+          overflow_.pop_front();
+          ++dropped_;
+        }
+        overflowed_ = true;
+        not_empty_.notify_one();
+        return;
+      }
+    } else {
+      while (!queue_.write(std::move(entry))) {
+        std::unique_lock<std::mutex> lck(mtx_);
+        producer_waiting_ = true;
+        // pairs with the fence in Next: either the consumer sees us waiting,
+        // or we see the room it made
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        not_full_.wait(lck, [this]() { return quit_ || !queue_.isFull(); });
+        producer_waiting_ = false;
+      }
+    }
+    max_depth_ = std::max<size_t>(max_depth_, queue_.sizeGuess());
+
+    // wake up the consumer only if it is asleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (consumer_waiting_) {
+      std::scoped_lock lck(mtx_);
+      not_empty_.notify_one();
     }
     // DLOG(INFO) << "message euqueued" << std::endl;
   }
 
+  Stats stats() const {
+    Stats s;
+    s.enqueued = enqueued_;
+    s.handled = handled_;
+    s.dropped = dropped_;
+    s.max_depth = max_depth_;
+    s.mean_latency_ms = s.handled ? total_latency_ * 1e-6 / s.handled : 0;
+    s.max_latency_ms = max_latency_ * 1e-6;
+    return s;
+  }
+
 protected:
   // Message handler. Return true if the message is known to this process and
   // successfully processed; otherwise return false.
@@ -81,11 +168,85 @@ protected:
   }
 
 private:
+  struct Entry {
+    std::unique_ptr<MessageT> message;
+    std::chrono::steady_clock::time_point enqueued;
+  };
+
+  /** Consumer side: next message in order, sleeping while there is none.
+   * Returns false once stopped and drained. */
+  bool Next(Entry &entry) {
+    for (;;) {
+      if (overflowed_) {
+        // everything left in the queue is older than the overflow
+        Entry stale;
+        while (queue_.read(stale)) {
+          ++dropped_;
+        }
+        std::scoped_lock lck(mtx_);
+        std::move(overflow_.begin(), overflow_.end(),
+                  std::back_inserter(backlog_));
+        overflow_.clear();
+        overflowed_ = false;
+      }
+      if (!backlog_.empty()) {
+        entry = std::move(backlog_.front());
+        backlog_.pop_front();
+        return true;
+      }
+      if (queue_.read(entry)) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (producer_waiting_) {
+          std::scoped_lock lck(mtx_);
+          not_full_.notify_one();
+        }
+        return true;
+      }
+
+      std::unique_lock<std::mutex> lck(mtx_);
+      if (quit_ && !overflowed_ && queue_.isEmpty()) {
+        return false;
+      }
+      consumer_waiting_ = true;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      not_empty_.wait(lck, [this]() {
+        return quit_ || overflowed_ || !queue_.isEmpty();
+      });
+      consumer_waiting_ = false;
+    }
+  }
+
+  bool Idle() const { return handled_ + dropped_ == enqueued_; }
+
+  void NotifyIfIdle() {
+    if (Idle()) {
+      std::scoped_lock lck(mtx_);
+      idle_.notify_all();
+    }
+  }
+
   own<std::thread *> worker_;
   // folly::ProducerConsumerQueue<own<MessageT *>> queue_; // the queue owns the
   // pointers and need to delete them after use
-  folly::ProducerConsumerQueue<std::unique_ptr<MessageT>>
+  folly::ProducerConsumerQueue<Entry>
       queue_; // the queue owns the pointers and need to delete them after use
+  OverflowPolicy policy_;
+
+  // overflow of DROP_OLDEST, guarded by mtx_
+  std::deque<Entry> overflow_;
+  std::atomic<bool> overflowed_;
+  std::deque<Entry> backlog_;  // consumer side
+
+  // blocking: either side only takes the lock if the other one sleeps
+  std::mutex mtx_;
+  std::condition_variable not_empty_, not_full_, idle_;
+  std::atomic<bool> consumer_waiting_, producer_waiting_;
+  bool quit_;
+
+  // counters
+  std::atomic<uint64_t> enqueued_, handled_, dropped_;
+  std::atomic<size_t> max_depth_;
+  std::atomic<int64_t> total_latency_, max_latency_;  // nanoseconds
 };
 
 } // namespace xivo
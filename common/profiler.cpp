@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <unordered_map>
+
+#include "glog/logging.h"
+
+#include "profiler.h"
+#include "utils.h"
+
+namespace xivo {
+
+////////////////////////////////////////
+// HISTOGRAM
+////////////////////////////////////////
+// Latencies are counted in ticks of 1024 ns. Below kSubBuckets ticks every
+// tick has its bucket; above, each power of two is split into kSubBuckets by
+// the 3 bits following the leading one.
+
+void LatencyHistogram::Reset() {
+  counts_.fill(0);
+  count_ = total_ns_ = max_ns_ = 0;
+}
+
+void LatencyHistogram::Add(int64_t ns) {
+  uint64_t ticks = ns > 0 ? uint64_t(ns) >> 10 : 0;
+  int index;
+  if (ticks < kSubBuckets) {
+    index = ticks;
+  } else {
+    int msb = 63 - __builtin_clzll(ticks);
+    index = kSubBuckets * (msb - 2) + ((ticks >> (msb - 3)) & (kSubBuckets - 1));
+  }
+  ++counts_[std::min(index, kBuckets - 1)];
+  ++count_;
+  total_ns_ += ns;
+  max_ns_ = std::max(max_ns_, ns);
+}
+
+double LatencyHistogram::Quantile(double q) const {
+  if (count_ == 0) return 0;
+  int64_t rank = std::max<int64_t>(1, std::ceil(q * count_));
+  int64_t seen = 0;
+  for (int i = 0; i < kBuckets; ++i) {
+    seen += counts_[i];
+    if (seen < rank) continue;
+    // middle of the bucket
+    double lower, upper;
+    if (i < kSubBuckets) {
+      lower = i;
+      upper = i + 1;
+    } else {
+      int msb = i / kSubBuckets + 2;
+      int mantissa = i % kSubBuckets;
+      lower = double(kSubBuckets + mantissa) * (1ull << (msb - 3));
+      upper = double(kSubBuckets + mantissa + 1) * (1ull << (msb - 3));
+    }
+    double ns = 0.5 * (lower + upper) * 1024;
+    return std::min<double>(ns, max_ns_) * 1e-6;
+  }
+  return max_ms();
+}
+
+
+////////////////////////////////////////
+// PROFILER
+////////////////////////////////////////
+namespace {
+
+struct EventRegistry {
+  std::mutex mtx;
+  std::unordered_map<std::string, ProfileEventId> ids;
+  std::vector<std::string> names;
+};
+
+EventRegistry &Registry() {
+  // never destroyed: profilers owned by static objects (e.g., the estimator of
+  // the default EstimatorContext) still name their events at exit
+  static auto *registry = new EventRegistry;
+  return *registry;
+}
+
+} // namespace
+
+ProfileEventId Profiler::Intern(const std::string &name) {
+  auto &registry = Registry();
+  std::scoped_lock lck(registry.mtx);
+  auto it = registry.ids.find(name);
+  if (it != registry.ids.end()) {
+    return it->second;
+  }
+  registry.names.push_back(name);
+  return registry.ids[name] = registry.names.size() - 1;
+}
+
+std::string Profiler::EventName(ProfileEventId id) {
+  auto &registry = Registry();
+  std::scoped_lock lck(registry.mtx);
+  return registry.names.at(id);
+}
+
+Profiler::Profiler(const std::string &name, size_t trace_capacity)
+    : name_{name}, epoch_{Clock::now()}, budget_ms_{0}, in_frame_{false},
+      over_budget_{0}, trace_capacity_{0}, trace_next_{0} {
+  nodes_.push_back(Node{-1, -1});
+  set_trace_capacity(trace_capacity);
+}
+
+void Profiler::set_trace_capacity(size_t capacity) {
+  trace_capacity_ = capacity;
+  trace_.clear();
+  trace_.reserve(capacity);
+  trace_next_ = 0;
+}
+
+int Profiler::Child(int node, ProfileEventId id) {
+  for (int child : nodes_[node].children) {
+    if (nodes_[child].event == id) return child;
+  }
+  int child = nodes_.size();
+  nodes_.push_back(Node{id, node});
+  nodes_[node].children.push_back(child);
+  return child;
+}
+
+void Profiler::Begin(ProfileEventId id) {
+  int parent = stack_.empty() ? 0 : stack_.back().first;
+  stack_.emplace_back(Child(parent, id), Clock::now());
+}
+
+void Profiler::End() {
+  auto now = Clock::now();
+  CHECK(!stack_.empty()) << "profiler " << name_ << ": End without Begin";
+  auto [node, start] = stack_.back();
+  stack_.pop_back();
+
+  int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      now - start).count();
+  nodes_[node].latency.Add(ns);
+  nodes_[node].frame_ns += ns;
+
+  if (trace_capacity_ > 0) {
+    if (trace_.size() < trace_capacity_) {
+      trace_.push_back(Span{node, start, ns});
+    } else {
+      trace_[trace_next_] = Span{node, start, ns};
+    }
+    trace_next_ = (trace_next_ + 1) % trace_capacity_;
+  }
+}
+
+void Profiler::BeginFrame() {
+  for (auto &n : nodes_) {
+    n.frame_ns = 0;
+  }
+  in_frame_ = true;
+  frame_start_ = Clock::now();
+}
+
+void Profiler::EndFrame() {
+  if (!in_frame_) return;
+  in_frame_ = false;
+  int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now() - frame_start_).count();
+  frames_.Add(ns);
+  if (budget_ms_ > 0 && ns * 1e-6 > budget_ms_) {
+    ++over_budget_;
+  }
+  for (auto &n : nodes_) {
+    n.max_frame_ns = std::max(n.max_frame_ns, n.frame_ns);
+  }
+}
+
+void Profiler::Reset() {
+  nodes_.resize(1);
+  nodes_[0].children.clear();
+  stack_.clear();
+  in_frame_ = false;
+  frames_.Reset();
+  over_budget_ = 0;
+  set_trace_capacity(trace_capacity_);
+}
+
+std::string Profiler::Path(int node) const {
+  std::string path = EventName(nodes_[node].event);
+  for (int p = nodes_[node].parent; p > 0; p = nodes_[p].parent) {
+    path = EventName(nodes_[p].event) + "/" + path;
+  }
+  return path;
+}
+
+Json::Value Profiler::ToJson() const {
+  Json::Value out;
+  out["name"] = name_;
+  for (int i = 1; i < nodes_.size(); ++i) {
+    const auto &h = nodes_[i].latency;
+    Json::Value &event = out["events"][Path(i)];
+    event["count"] = (Json::Int64)h.count();
+    event["total_ms"] = h.total_ms();
+    event["mean_ms"] = h.mean_ms();
+    event["p50_ms"] = h.Quantile(0.5);
+    event["p95_ms"] = h.Quantile(0.95);
+    event["p99_ms"] = h.Quantile(0.99);
+    event["max_ms"] = h.max_ms();
+    if (frames_.count() > 0) {
+      event["max_per_frame_ms"] = nodes_[i].max_frame_ns * 1e-6;
+    }
+  }
+  if (frames_.count() > 0) {
+    Json::Value &frames = out["frames"];
+    frames["count"] = (Json::Int64)frames_.count();
+    frames["budget_ms"] = budget_ms_;
+    frames["over_budget"] = (Json::Int64)over_budget_;
+    frames["mean_ms"] = frames_.mean_ms();
+    frames["p50_ms"] = frames_.Quantile(0.5);
+    frames["p95_ms"] = frames_.Quantile(0.95);
+    frames["p99_ms"] = frames_.Quantile(0.99);
+    frames["max_ms"] = frames_.max_ms();
+  }
+  return out;
+}
+
+void Profiler::WriteChromeTrace(const std::string &path) const {
+  Json::Value trace;
+  Json::Value &events = trace["traceEvents"];
+  events = Json::arrayValue;
+  // oldest first
+  size_t first = trace_.size() < trace_capacity_ ? 0 : trace_next_;
+  for (size_t k = 0; k < trace_.size(); ++k) {
+    const Span &span = trace_[(first + k) % trace_.size()];
+    Json::Value event;
+    event["name"] = EventName(nodes_[span.node].event);
+    event["cat"] = name_;
+    event["ph"] = "X";
+    event["ts"] = std::chrono::duration<double, std::micro>(
+        span.start - epoch_).count();
+    event["dur"] = span.duration_ns * 1e-3;
+    event["pid"] = 0;
+    event["tid"] = name_;
+    events.append(event);
+  }
+  trace["displayTimeUnit"] = "ms";
+  SaveJson(trace, path);
+}
+
+void Profiler::Print(std::ostream &os, int node, int depth) const {
+  if (node > 0) {
+    const auto &h = nodes_[node].latency;
+    std::string label = std::string(2 * depth, ' ') +
+                        EventName(nodes_[node].event);
+    os << StrFormat("[%s] %-32s %8ld %9.3f %9.3f %9.3f %9.3f %9.3f",
+                    name_, label, h.count(), h.mean_ms(), h.Quantile(0.5),
+                    h.Quantile(0.95), h.Quantile(0.99), h.max_ms());
+    if (budget_ms_ > 0 && frames_.count() > 0) {
+      os << StrFormat(" %6.1f%%",
+                      100 * h.total_ms() / frames_.count() / budget_ms_);
+    }
+    os << "\n";
+  }
+  for (int child : nodes_[node].children) {
+    Print(os, child, node > 0 ? depth + 1 : 0);
+  }
+}
+
+std::ostream &operator<<(std::ostream &os, const Profiler &p) {
+  os << StrFormat("[%s] %-32s %8s %9s %9s %9s %9s %9s%s\n", p.name_, "(ms)",
+                  "count", "mean", "p50", "p95", "p99", "max",
+                  p.budget_ms_ > 0 ? " budget" : "");
+  p.Print(os, 0, 0);
+  if (p.frames_.count() > 0) {
+    os << StrFormat("[%s] %d frames: mean %0.3f, p99 %0.3f, max %0.3f ms",
+                    p.name_, (int)p.frames_.count(), p.frames_.mean_ms(),
+                    p.frames_.Quantile(0.99), p.frames_.max_ms());
+    if (p.budget_ms_ > 0) {
+      os << StrFormat(", %d over the %g ms budget", (int)p.over_budget_,
+                      p.budget_ms_);
+    }
+    os << "\n";
+  }
+  return os;
+}
+
+} // namespace xivo
@@ -0,0 +1,153 @@
+// Low-overhead hierarchical profiler: nested scopes, latency histograms,
+// per-frame budget and export to json & Chrome trace (chrome://tracing).
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "json/json.h"
+
+namespace xivo {
+
+using ProfileEventId = int;
+
+/** Latency histogram with logarithmic buckets, 8 per octave (~6% error), from
+ * 1 us up. The maximum is exact. */
+class LatencyHistogram {
+public:
+  LatencyHistogram() { Reset(); }
+  void Add(int64_t ns);
+  void Reset();
+
+  int64_t count() const { return count_; }
+  double total_ms() const { return total_ns_ * 1e-6; }
+  double mean_ms() const { return count_ ? total_ns_ * 1e-6 / count_ : 0; }
+  double max_ms() const { return max_ns_ * 1e-6; }
+  /** Latency at quantile `q` in [0, 1], in milliseconds. */
+  double Quantile(double q) const;
+
+private:
+  static constexpr int kSubBuckets = 8;
+  static constexpr int kBuckets = kSubBuckets * 40;
+  static_assert(kSubBuckets == 8, "3 bits per octave, see Add");
+
+  std::array<uint32_t, kBuckets> counts_;
+  int64_t count_, total_ns_, max_ns_;
+};
+
+
+/** Profiles nested scopes of a single thread. Events are identified by ids
+ * interned once per call site (see XIVO_PROFILE_ID), so the hot path does no
+ * string hashing. Every path of nested events (e.g. visual-meas/update/
+ * jacobian) is a node of a call tree with its own histogram. */
+class Profiler {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /** Id of the event called `name`, the same across all profilers. */
+  static ProfileEventId Intern(const std::string &name);
+  static std::string EventName(ProfileEventId id);
+
+  /** `trace_capacity` most recent scopes are kept for WriteChromeTrace. */
+  Profiler(const std::string &name = "default", size_t trace_capacity = 0);
+
+  void Begin(ProfileEventId id);
+  /** Close the innermost open scope. */
+  void End();
+
+  /** A frame is the unit the budget applies to, e.g., one image. */
+  void BeginFrame();
+  void EndFrame();
+  void set_budget_ms(double budget_ms) { budget_ms_ = budget_ms; }
+  void set_trace_capacity(size_t capacity);
+
+  void Reset();
+
+  /** Per-node count, total, mean and p50/p95/p99/max, plus the frame budget
+   * view. */
+  Json::Value ToJson() const;
+  /** Recent scopes in the Chrome trace event format. */
+  void WriteChromeTrace(const std::string &path) const;
+
+  friend std::ostream &operator<<(std::ostream &os, const Profiler &p);
+
+  class Scope {
+  public:
+    Scope(Profiler &profiler, ProfileEventId id, bool frame = false)
+        : profiler_{profiler}, frame_{frame} {
+      if (frame_) profiler_.BeginFrame();
+      profiler_.Begin(id);
+    }
+    ~Scope() {
+      profiler_.End();
+      if (frame_) profiler_.EndFrame();
+    }
+
+  private:
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+    Profiler &profiler_;
+    bool frame_;
+  };
+
+private:
+  struct Node {
+    ProfileEventId event;
+    int parent;
+    std::vector<int> children;
+    LatencyHistogram latency;
+    int64_t frame_ns, max_frame_ns;  // time spent in the current (worst) frame
+  };
+
+  struct Span {
+    int node;
+    Clock::time_point start;
+    int64_t duration_ns;
+  };
+
+  int Child(int node, ProfileEventId id);
+  std::string Path(int node) const;
+  void Print(std::ostream &os, int node, int depth) const;
+
+  std::string name_;
+  std::vector<Node> nodes_;  // nodes_[0] is the root
+  std::vector<std::pair<int, Clock::time_point>> stack_;  // open scopes
+  Clock::time_point epoch_;
+
+  // frames
+  double budget_ms_;
+  Clock::time_point frame_start_;
+  bool in_frame_;
+  LatencyHistogram frames_;
+  int64_t over_budget_;
+
+  // trace ring buffer
+  std::vector<Span> trace_;
+  size_t trace_capacity_, trace_next_;
+};
+
+} // namespace xivo
+
+#define XIVO_PROFILE_CONCAT_IMPL(a, b) a##b
+#define XIVO_PROFILE_CONCAT(a, b) XIVO_PROFILE_CONCAT_IMPL(a, b)
+
+/** Id of event `name`, interned on the first pass through the call site. */
+#define XIVO_PROFILE_ID(name)                                                  \
+  ([]() {                                                                      \
+    static const ::xivo::ProfileEventId id = ::xivo::Profiler::Intern(name);   \
+    return id;                                                                 \
+  }())
+
+/** Profile the rest of the enclosing block as event `name`. */
+#define XIVO_PROFILE_SCOPE(profiler, name)                                     \
+  ::xivo::Profiler::Scope XIVO_PROFILE_CONCAT(profile_scope_, __COUNTER__)(    \
+      profiler, XIVO_PROFILE_ID(name))
+
+/** Same as XIVO_PROFILE_SCOPE, and the block is a frame of the budget view. */
+#define XIVO_PROFILE_FRAME(profiler, name)                                     \
+  ::xivo::Profiler::Scope XIVO_PROFILE_CONCAT(profile_scope_, __COUNTER__)(    \
+      profiler, XIVO_PROFILE_ID(name), true)
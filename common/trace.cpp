@@ -0,0 +1,144 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <set>
+
+#include "glog/logging.h"
+
+#include "trace.h"
+
+namespace xivo {
+
+static_assert(sizeof(TraceRecord) == 32, "TraceRecord is dumped as is");
+
+namespace {
+
+volatile std::sig_atomic_t dump_requested = 0;
+
+void RequestDump(int) { dump_requested = 1; }
+
+int32_t ThreadIndex() {
+  static std::atomic<int32_t> num_threads{0};
+  thread_local int32_t index = num_threads++;
+  return index;
+}
+
+} // namespace
+
+TraceBuffer *TraceBuffer::instance() {
+  // never destroyed: the estimator of the default EstimatorContext dumps it
+  // from its destructor, after main returns
+  static auto *buffer = new TraceBuffer;
+  return buffer;
+}
+
+TraceBuffer::TraceBuffer() : capacity_{0}, next_{0} {
+  // nothing is recorded if tracing is compiled out
+  set_capacity(XIVO_TRACE_LEVEL > XIVO_TRACE_LEVEL_OFF ? 1 << 16 : 0);
+}
+
+void TraceBuffer::set_capacity(size_t capacity) {
+  capacity_ = capacity;
+  slots_.reset(capacity > 0 ? new Slot[capacity] : nullptr);
+  Clear();
+}
+
+void TraceBuffer::Clear() {
+  for (size_t i = 0; i < capacity_; ++i) {
+    slots_[i].seq.store(0, std::memory_order_relaxed);
+  }
+  next_.store(0, std::memory_order_release);
+}
+
+void TraceBuffer::Record(int32_t event, int32_t a, int32_t b, double value) {
+  if (capacity_ == 0) return;
+  int64_t ts = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  uint64_t index = next_.fetch_add(1, std::memory_order_relaxed);
+  Slot &slot = slots_[index % capacity_];
+
+  uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  slot.seq.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.words[0].store(ts, std::memory_order_relaxed);
+  slot.words[1].store(uint64_t(uint32_t(event)) << 32 | uint32_t(ThreadIndex()),
+                      std::memory_order_relaxed);
+  slot.words[2].store(uint64_t(uint32_t(a)) << 32 | uint32_t(b),
+                      std::memory_order_relaxed);
+  slot.words[3].store(bits, std::memory_order_relaxed);
+  slot.seq.store(index + 1, std::memory_order_release);
+}
+
+std::vector<TraceRecord> TraceBuffer::Snapshot() const {
+  std::vector<TraceRecord> records;
+  if (capacity_ == 0) return records;
+  uint64_t end = next_.load(std::memory_order_acquire);
+  uint64_t begin = end > capacity_ ? end - capacity_ : 0;
+  records.reserve(end - begin);
+  for (uint64_t i = begin; i < end; ++i) {
+    const Slot &slot = slots_[i % capacity_];
+    if (slot.seq.load(std::memory_order_acquire) != i + 1) continue;
+    uint64_t words[4];
+    for (int k = 0; k < 4; ++k) {
+      words[k] = slot.words[k].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // overwritten while we were reading
+    if (slot.seq.load(std::memory_order_relaxed) != i + 1) continue;
+
+    TraceRecord r;
+    r.ts_ns = words[0];
+    r.event = words[1] >> 32;
+    r.thread = uint32_t(words[1]);
+    r.a = words[2] >> 32;
+    r.b = uint32_t(words[2]);
+    std::memcpy(&r.value, &words[3], sizeof(r.value));
+    records.push_back(r);
+  }
+  return records;
+}
+
+size_t TraceBuffer::Dump(const std::string &path) const {
+  auto records = Snapshot();
+  std::ofstream ostream(path, std::ios::binary);
+  if (!ostream.is_open()) {
+    LOG(WARNING) << "failed to open " << path << " to dump traced events";
+    return 0;
+  }
+  ostream.write("XIVOTRC1", 8);
+
+  std::set<int32_t> events;
+  for (const auto &r : records) {
+    events.insert(r.event);
+  }
+  uint32_t num_events = events.size();
+  ostream.write(reinterpret_cast<const char *>(&num_events), sizeof(uint32_t));
+  for (int32_t event : events) {
+    std::string name = Profiler::EventName(event);
+    uint32_t id = event, length = name.size();
+    ostream.write(reinterpret_cast<const char *>(&id), sizeof(uint32_t));
+    ostream.write(reinterpret_cast<const char *>(&length), sizeof(uint32_t));
+    ostream.write(name.data(), length);
+  }
+
+  uint64_t count = records.size();
+  ostream.write(reinterpret_cast<const char *>(&count), sizeof(uint64_t));
+  ostream.write(reinterpret_cast<const char *>(records.data()),
+                count * sizeof(TraceRecord));
+  LOG(INFO) << count << " traced events dumped to " << path;
+  return count;
+}
+
+void TraceBuffer::DumpOnSignal(int signum, const std::string &path) {
+  signal_dump_path_ = path;
+  std::signal(signum, RequestDump);
+}
+
+void TraceBuffer::DumpIfRequested() {
+  if (!dump_requested) return;
+  dump_requested = 0;
+  Dump(signal_dump_path_);
+}
+
+} // namespace xivo
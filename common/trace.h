@@ -0,0 +1,103 @@
+// Structured event tracing for hot paths. Unlike LOG(INFO), events above the
+// compile-time XIVO_TRACE_LEVEL generate no code at all, and the ones kept are
+// a few words written to an in-memory ring buffer, dumped on demand.
+#pragma once
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "profiler.h"
+
+// trace levels
+#define XIVO_TRACE_LEVEL_OFF 0
+#define XIVO_TRACE_LEVEL_FRAME 1    // a few events per image
+#define XIVO_TRACE_LEVEL_FEATURE 2  // events per feature per image
+
+#ifndef XIVO_TRACE_LEVEL
+#ifdef NDEBUG
+#define XIVO_TRACE_LEVEL XIVO_TRACE_LEVEL_OFF
+#else
+#define XIVO_TRACE_LEVEL XIVO_TRACE_LEVEL_FEATURE
+#endif
+#endif
+
+namespace xivo {
+
+/** One traced event. `a`, `b` and `value` are event specific, typically ids
+ * of features and groups and a score. */
+struct TraceRecord {
+  int64_t ts_ns;  // steady clock
+  int32_t event;  // id interned by Profiler::Intern
+  int32_t thread; // small integer, in order of the first event of the thread
+  int32_t a, b;
+  double value;
+};
+
+/** Lock-free, multi-producer ring buffer keeping the most recent events.
+ * Every slot is a seqlock, so Snapshot and Dump can run while other threads
+ * record: slots being overwritten are skipped. */
+class TraceBuffer {
+public:
+  static TraceBuffer *instance();
+
+  /** Not thread-safe: call before any event is recorded. */
+  void set_capacity(size_t capacity);
+  size_t capacity() const { return capacity_; }
+
+  void Record(int32_t event, int32_t a = 0, int32_t b = 0, double value = 0);
+  void Clear();
+
+  /** Events still in the buffer, oldest first. */
+  std::vector<TraceRecord> Snapshot() const;
+
+  /** Binary dump: the "XIVOTRC1" magic, the event names as (uint32 id,
+   * uint32 length, chars), then the records as (uint64 count, TraceRecord[]).
+   * Returns the number of records written. */
+  size_t Dump(const std::string &path) const;
+
+  /** Request a dump upon signal `signum` (e.g. SIGUSR1). The handler only
+   * sets a flag: the dump itself happens in the next DumpIfRequested, called
+   * regularly by the traced thread. */
+  void DumpOnSignal(int signum, const std::string &path);
+  void DumpIfRequested();
+
+private:
+  TraceBuffer();
+  TraceBuffer(const TraceBuffer &) = delete;
+  TraceBuffer &operator=(const TraceBuffer &) = delete;
+
+  struct Slot {
+    // 0 while being written, otherwise 1 + the index of the record
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> words[4];
+  };
+
+  size_t capacity_;
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<uint64_t> next_;
+  std::string signal_dump_path_;
+};
+
+} // namespace xivo
+
+#define XIVO_TRACE_RECORD(name, ...)                                           \
+  ::xivo::TraceBuffer::instance()->Record(XIVO_PROFILE_ID(name), ##__VA_ARGS__)
+
+/** Trace event `name` with optional (a, b, value) at the frame level. When
+ * compiled out, the arguments are not evaluated. */
+#if XIVO_TRACE_LEVEL >= XIVO_TRACE_LEVEL_FRAME
+#define XIVO_TRACE_FRAME(name, ...) XIVO_TRACE_RECORD(name, ##__VA_ARGS__)
+#else
+#define XIVO_TRACE_FRAME(name, ...) ((void)0)
+#endif
+
+/** Same as XIVO_TRACE_FRAME, for events emitted per feature. */
+#if XIVO_TRACE_LEVEL >= XIVO_TRACE_LEVEL_FEATURE
+#define XIVO_TRACE_FEATURE(name, ...) XIVO_TRACE_RECORD(name, ##__VA_ARGS__)
+#else
+#define XIVO_TRACE_FEATURE(name, ...) ((void)0)
+#endif
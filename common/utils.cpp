@@ -4,6 +4,7 @@
 #include "dirent.h"
 // stl
 #include <iostream>
+#include <sstream>
 // I/O
 #include "json/json.h"
 
@@ -101,6 +102,21 @@ void MergeJson(Json::Value &a, const Json::Value &b) {
       a[key] = b[key];
 }
 
+void SetJsonPath(Json::Value &cfg, const std::string &path,
+                 const Json::Value &value) {
+  Json::Value *node = &cfg;
+  std::stringstream ss{path};
+  std::string key;
+  std::getline(ss, key, '.');
+  for (std::string next; std::getline(ss, next, '.'); key = next) {
+    node = &(*node)[key];
+    if (node->isString()) {
+      *node = LoadJson(node->asString());
+    }
+  }
+  (*node)[key] = value;
+}
+
 Json::Value LoadJson(const std::string &filename) {
   std::ifstream in(filename, std::ios::in);
   if (in.is_open()) {
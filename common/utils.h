@@ -229,6 +229,10 @@ void WriteMatrixToJson(Json::Value &d, const std::string &key,
 
 /// \brief: Merge json b to json a.
 void MergeJson(Json::Value &a, const Json::Value &b);
+/// \brief: Set the member of `cfg` at the "."-separated `path`. Configurations
+/// given as the path of a json file (e.g., "tracker_cfg") are loaded on the way.
+void SetJsonPath(Json::Value &cfg, const std::string &path,
+                 const Json::Value &value);
 Json::Value LoadJson(const std::string &filename);
 void SaveJson(const Json::Value &j, const std::string &filename);
 
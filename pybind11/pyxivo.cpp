@@ -3,8 +3,14 @@
 #include "pybind11/pybind11.h"
 #include <pybind11/stl.h>
 
+#include <mutex>
+#include <vector>
+
+#include "context.h"
 #include "estimator.h"
 #include "camera_manager.h"
+#include "frame_pool.h"
+#include "recording.h"
 #include "opencv2/core/eigen.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include "utils.h"
@@ -16,6 +22,99 @@
 namespace py = pybind11;
 using namespace xivo;
 
+#if CV_VERSION_MAJOR >= 4
+using AccessFlag = cv::AccessFlag;
+#else
+using AccessFlag = int;
+#endif
+
+/** Wraps numpy arrays into cv::Mat without copying. The estimator may hold a
+ * frame after VisualMeas returns (in its reorder buffer, or until the renderer
+ * has drawn it), so each wrapped array is referenced until the last cv::Mat
+ * sharing its memory is released. That may happen in a thread not holding the
+ * GIL, hence the references are only dropped in Collect. */
+class NumpyAllocator : public cv::MatAllocator {
+public:
+  static NumpyAllocator *instance() {
+    static NumpyAllocator allocator;
+    return &allocator;
+  }
+
+  /** Image sharing the memory of `array`, of shape (rows, cols) or
+   * (rows, cols, 1 or 3). Pixels of a row must be contiguous, rows may be
+   * padded; other layouts and types are converted (thus copied). */
+  cv::Mat Wrap(py::array array) {
+    if (array.ndim() < 2 || array.ndim() > 3) {
+      throw std::invalid_argument("image must have 2 or 3 dimensions");
+    }
+    int channels = array.ndim() == 3 ? array.shape(2) : 1;
+    if (channels != 1 && channels != 3) {
+      throw std::invalid_argument("image must have 1 or 3 channels");
+    }
+    bool compatible = array.dtype().is(py::dtype::of<uint8_t>()) &&
+                      array.strides(1) == channels &&
+                      (channels == 1 || array.strides(2) == 1) &&
+                      array.strides(0) >= array.shape(1) * channels;
+    if (!compatible) {
+      array = py::array_t<uint8_t, py::array::c_style | py::array::forcecast>::ensure(array);
+      if (!array) {
+        throw py::error_already_set();
+      }
+    }
+
+    int rows = array.shape(0), cols = array.shape(1);
+    size_t step = array.strides(0);
+    void *data = const_cast<void *>(array.data());
+    cv::Mat image(rows, cols, CV_8UC(channels), data, step);
+
+    cv::UMatData *u = new cv::UMatData(this);
+    u->data = u->origdata = static_cast<uchar *>(data);
+    u->size = step * rows;
+    u->userdata = array.release().ptr();  // our reference
+    u->refcount = 1;
+    image.u = u;
+    return image;
+  }
+
+  /** Drop the references to the arrays no longer used. Needs the GIL. */
+  void Collect() {
+    std::vector<PyObject *> released;
+    {
+      std::scoped_lock lck(mtx_);
+      released.swap(released_);
+    }
+    for (auto obj : released) {
+      Py_DECREF(obj);
+    }
+  }
+
+  // new allocations are left to the default allocator
+  cv::UMatData *allocate(int dims, const int *sizes, int type, void *data,
+                         size_t *step, AccessFlag flags,
+                         cv::UMatUsageFlags usage) const override {
+    return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step,
+                                                flags, usage);
+  }
+
+  bool allocate(cv::UMatData *u, AccessFlag flags,
+                cv::UMatUsageFlags usage) const override {
+    return cv::Mat::getStdAllocator()->allocate(u, flags, usage);
+  }
+
+  void deallocate(cv::UMatData *u) const override {
+    if (!u) return;
+    std::scoped_lock lck(mtx_);
+    released_.push_back(static_cast<PyObject *>(u->userdata));
+    delete u;
+  }
+
+private:
+  NumpyAllocator() = default;
+
+  mutable std::mutex mtx_;
+  mutable std::vector<PyObject *> released_;
+};
+
 class EstimatorWrapper {
 public:
   EstimatorWrapper(const std::string &cfg_path,
@@ -29,8 +128,11 @@ public:
       glog_init_ = true;
     }
 
+    // each wrapper is a system of its own
     auto cfg = LoadJson(cfg_path);
-    estimator_ = CreateSystem(cfg);
+    context_ = EstimatorContext::Create(cfg);
+    estimator_ = context_->estimator();
+    auto scope = Bind();
     camera_ = CameraManager::instance();
 
     if (!viewer_cfg_path.empty()) {
@@ -41,124 +143,119 @@ public:
 
   void InertialMeas(uint64_t ts, double wx, double wy, double wz, double ax,
                     double ay, double az) {
+    auto scope = Bind();
+    {
+      py::gil_scoped_release release;
+      estimator_->InertialMeas(timestamp_t{ts}, {wx, wy, wz}, {ax, ay, az});
+
+      if (viewer_) {
+        viewer_->Update_gsb(estimator_->gsb());
+        viewer_->Update_gsc(estimator_->gsc());
+      }
+    }
+    // frames the estimator was holding until the inertial stream caught up
+    NumpyAllocator::instance()->Collect();
+  }
 
-    estimator_->InertialMeas(timestamp_t{ts}, {wx, wy, wz}, {ax, ay, az});
+  /** Batch of inertial measurements: timestamps of shape (n,) and
+   * measurements (wx, wy, wz, ax, ay, az) of shape (n, 6). */
+  void InertialMeasBatch(
+    py::array_t<uint64_t, py::array::c_style | py::array::forcecast> ts,
+    py::array_t<double, py::array::c_style | py::array::forcecast> imu)
+  {
+    auto scope = Bind();
+    if (ts.ndim() != 1 || imu.ndim() != 2 || imu.shape(1) != 6 ||
+        imu.shape(0) != ts.shape(0)) {
+      throw std::invalid_argument(
+        "expected timestamps of shape (n,) and measurements of shape (n, 6)");
+    }
+    auto t = ts.unchecked<1>();
+    auto m = imu.unchecked<2>();
+    std::vector<InertialSample> samples(t.shape(0));
+    for (py::ssize_t i = 0; i < t.shape(0); ++i) {
+      samples[i].ts = timestamp_t{t(i)};
+      samples[i].gyro = {m(i, 0), m(i, 1), m(i, 2)};
+      samples[i].accel = {m(i, 3), m(i, 4), m(i, 5)};
+    }
+    {
+      py::gil_scoped_release release;
+      estimator_->InertialMeas(std::move(samples));
 
-    if (viewer_) {
-      viewer_->Update_gsb(estimator_->gsb());
-      viewer_->Update_gsc(estimator_->gsc());
+      if (viewer_) {
+        viewer_->Update_gsb(estimator_->gsb());
+        viewer_->Update_gsc(estimator_->gsc());
+      }
     }
+    NumpyAllocator::instance()->Collect();
   }
 
 
   void VisualMeasPointCloud(uint64_t ts,
                             const Eigen::Ref<const VecXi> &feature_ids,
                             const Eigen::Ref<const MatX2> &xps) {
+    auto scope = Bind();
+    py::gil_scoped_release release;
     estimator_->VisualMeasPointCloud(timestamp_t{ts}, feature_ids, xps);
-    if (viewer_) {
-      auto disp = Canvas::instance()->display();
-      if (!disp.empty()) {
-        LOG(INFO) << "Display image is ready";
-        viewer_->Update(disp);
-      }
-    }
+    UpdateViewer();
   }
 
   void VisualMeasPointCloudTrackerOnly(uint64_t ts,
                             const Eigen::Ref<const VecXi> &feature_ids,
                             const Eigen::Ref<const MatX2> &xps) {
+    auto scope = Bind();
+    py::gil_scoped_release release;
     estimator_->VisualMeasPointCloudTrackerOnly(timestamp_t{ts}, feature_ids, xps);
-    if (viewer_) {
-      auto disp = Canvas::instance()->display();
-      if (!disp.empty()) {
-        LOG(INFO) << "Display image is ready";
-        viewer_->Update(disp);
-      }
-    }
+    UpdateViewer();
   }
 
 
   void VisualMeas(uint64_t ts, std::string &image_path) {
-
-    auto image = cv::imread(image_path);
-
+    auto scope = Bind();
+    py::gil_scoped_release release;
+    auto image = FramePool::instance()->Read(image_path);
     estimator_->VisualMeas(timestamp_t{ts}, image);
-
-    if (viewer_) {
-      auto disp = Canvas::instance()->display();
-
-      if (!disp.empty()) {
-        LOG(INFO) << "Display image is ready";
-        viewer_->Update(disp);
-      }
-    }
+    UpdateViewer();
   }
 
-  void VisualMeas(uint64_t ts,
-    py::array_t<unsigned char, py::array::c_style | py::array::forcecast> b)
-  {
-    py::buffer_info info = b.request();
-
-    int size_row = info.strides[0];
-    int num_col = size_row / info.strides[1] / info.itemsize;
-    int num_row = info.size / size_row;
-
-    cv::Mat image(num_row, num_col, CV_8UC3, info.ptr);
-
-    estimator_->VisualMeas(timestamp_t{ts}, image);
-
-    if (viewer_) {
-      auto disp = Canvas::instance()->display();
-      if (!disp.empty()) {
-        LOG(INFO) << "Display image is ready";
-        viewer_->Update(disp);
-      }
+  void VisualMeas(uint64_t ts, py::array b) {
+    auto scope = Bind();
+    cv::Mat image = NumpyAllocator::instance()->Wrap(b);
+    {
+      py::gil_scoped_release release;
+      estimator_->VisualMeas(timestamp_t{ts}, image);
+      image.release();
+      UpdateViewer();
     }
+    NumpyAllocator::instance()->Collect();
   }
 
   void VisualMeasTrackerOnly(uint64_t ts, std::string &image_path) {
-
-    auto image = cv::imread(image_path);
-
+    auto scope = Bind();
+    py::gil_scoped_release release;
+    auto image = FramePool::instance()->Read(image_path);
     estimator_->VisualMeasTrackerOnly(timestamp_t{ts}, image);
-
-    if (viewer_) {
-      auto disp = Canvas::instance()->display();
-
-      if (!disp.empty()) {
-        LOG(INFO) << "Display image is ready";
-        viewer_->Update(disp);
-      }
-    }
+    UpdateViewer();
   }
 
-  void VisualMeasTrackerOnly(uint64_t ts,
-    py::array_t<unsigned char, py::array::c_style | py::array::forcecast> b)
-  {
-    py::buffer_info info = b.request();
-
-    int size_row = info.strides[0];
-    int num_col = size_row / info.strides[1] / info.itemsize;
-    int num_row = info.size / size_row;
-
-    cv::Mat image(num_row, num_col, CV_8UC3, info.ptr);
-
-    estimator_->VisualMeasTrackerOnly(timestamp_t{ts}, image);
-
-    if (viewer_) {
-      auto disp = Canvas::instance()->display();
-      if (!disp.empty()) {
-        LOG(INFO) << "Display image is ready";
-        viewer_->Update(disp);
-      }
+  void VisualMeasTrackerOnly(uint64_t ts, py::array b) {
+    auto scope = Bind();
+    cv::Mat image = NumpyAllocator::instance()->Wrap(b);
+    {
+      py::gil_scoped_release release;
+      estimator_->VisualMeasTrackerOnly(timestamp_t{ts}, image);
+      image.release();
+      UpdateViewer();
     }
+    NumpyAllocator::instance()->Collect();
   }
 
   void CloseLoop() {
+    auto scope = Bind();
     estimator_->CloseLoop();
   }
 
   std::vector<std::tuple<int, Vec2f, MatXf>> tracked_features() {
+    auto scope = Bind();
     return estimator_->tracked_features();
   }
 
@@ -187,58 +284,72 @@ public:
   int gauge_group() { return estimator_->gauge_group(); }
 
   MatX3 InstateFeaturePositions(int n_output) {
+    auto scope = Bind();
     return estimator_->InstateFeaturePositions(n_output);
   }
 
   MatX3 InstateFeaturePositions() {
+    auto scope = Bind();
     return estimator_->InstateFeaturePositions();
   }
 
   MatX6 InstateFeatureCovs(int n_output) {
+    auto scope = Bind();
     return estimator_->InstateFeatureCovs(n_output);
   }
 
   MatX6 InstateFeatureCovs() {
+    auto scope = Bind();
     return estimator_->InstateFeatureCovs();
   }
 
   VecXi InstateFeatureIDs(int n_output) {
+    auto scope = Bind();
     return estimator_->InstateFeatureIDs(n_output);
   }
 
   VecXi InstateFeatureIDs() {
+    auto scope = Bind();
     return estimator_->InstateFeatureIDs();
   }
 
   VecXi InstateFeatureSinds(int n_output) {
+    auto scope = Bind();
     return estimator_->InstateFeatureSinds(n_output);
   }
 
   MatX3 InstateFeatureXc(int n_output) {
+    auto scope = Bind();
     return estimator_->InstateFeatureXc(n_output);
   }
 
   MatX3 InstateFeatureXc() {
+    auto scope = Bind();
     return estimator_->InstateFeatureXc();
   }
 
   VecXi InstateFeatureSinds() {
+    auto scope = Bind();
     return estimator_->InstateFeatureSinds();
   }
 
   VecXi InstateGroupIDs() {
+    auto scope = Bind();
     return estimator_->InstateGroupIDs();
   }
 
   MatX7 InstateGroupPoses() {
+    auto scope = Bind();
     return estimator_->InstateGroupPoses();
   }
 
   MatX InstateGroupCovs() {
+    auto scope = Bind();
     return estimator_->InstateGroupCovs();
   }
 
   VecXi InstateGroupSinds() {
+    auto scope = Bind();
     return estimator_->InstateGroupSinds();
   }
 
@@ -255,6 +366,7 @@ public:
   int num_instate_groups() { return estimator_->num_instate_groups(); }
 
   bool UsingLoopClosure() {
+    auto scope = Bind();
     return estimator_->UsingLoopClosure();
   }
 
@@ -262,13 +374,41 @@ public:
     return estimator_->VisionInitialized();
   }
 
+  Telemetry telemetry() { return estimator_->telemetry(); }
+
+  std::shared_ptr<StateSnapshot> snapshot() {
+    // python has no const objects, the bindings below are read-only
+    return std::const_pointer_cast<StateSnapshot>(estimator_->snapshot());
+  }
+
   void Visualize() {
     if (viewer_)
       viewer_->Refresh();
   }
 
 private:
-  EstimatorPtr estimator_;
+  /** Binds the context of this wrapper to the calling thread, for the calls
+   * reaching the components through their instance() functions. */
+  EstimatorContext::Scope Bind() {
+    return EstimatorContext::Scope{context_.get()};
+  }
+
+  /** Show the latest canvas in the viewer. Called without the GIL, with the
+   * context bound. */
+  void UpdateViewer() {
+    if (viewer_) {
+      // wait for the renderer thread to draw this frame
+      Canvas::instance()->Flush();
+      auto disp = Canvas::instance()->display();
+      if (!disp.empty()) {
+        LOG(INFO) << "Display image is ready";
+        viewer_->Update(disp);
+      }
+    }
+  }
+
+  std::unique_ptr<EstimatorContext> context_;
+  EstimatorPtr estimator_;  // owned by context_
   CameraPtr camera_;
   std::unique_ptr<Viewer> viewer_;
   static bool glog_init_;
@@ -285,10 +425,11 @@ PYBIND11_MODULE(pyxivo, m) {
       .def(py::init<const std::string &, const std::string &,
                     const std::string &, bool>())
       .def("InertialMeas", &EstimatorWrapper::InertialMeas)
+      .def("InertialMeasBatch", &EstimatorWrapper::InertialMeasBatch)
       .def("VisualMeas", py::overload_cast<uint64_t, std::string &>(&EstimatorWrapper::VisualMeas))
-      .def("VisualMeas", py::overload_cast<uint64_t, py::array_t<unsigned char, py::array::c_style | py::array::forcecast>>(&EstimatorWrapper::VisualMeas))
+      .def("VisualMeas", py::overload_cast<uint64_t, py::array>(&EstimatorWrapper::VisualMeas))
       .def("VisualMeasTrackerOnly", py::overload_cast<uint64_t, std::string &>(&EstimatorWrapper::VisualMeasTrackerOnly))
-      .def("VisualMeasTrackerOnly", py::overload_cast<uint64_t, py::array_t<unsigned char, py::array::c_style | py::array::forcecast>>(&EstimatorWrapper::VisualMeasTrackerOnly))
+      .def("VisualMeasTrackerOnly", py::overload_cast<uint64_t, py::array>(&EstimatorWrapper::VisualMeasTrackerOnly))
       .def("VisualMeasPointCloud", &EstimatorWrapper::VisualMeasPointCloud)
       .def("VisualMeasPointCloudTrackerOnly", &EstimatorWrapper::VisualMeasPointCloudTrackerOnly)
       .def("CloseLoop", &EstimatorWrapper::CloseLoop)
@@ -331,5 +472,82 @@ PYBIND11_MODULE(pyxivo, m) {
       .def("CameraIntrinsics", &EstimatorWrapper::CameraIntrinsics)
       .def("CameraDistortionType", &EstimatorWrapper::CameraDistortionType)
       .def("MeasurementUpdateInitialized", &EstimatorWrapper::MeasurementUpdateInitialized)
-      .def("tracked_features", &EstimatorWrapper::tracked_features);
+      .def("tracked_features", &EstimatorWrapper::tracked_features)
+      .def("telemetry", &EstimatorWrapper::telemetry)
+      .def("snapshot", &EstimatorWrapper::snapshot);
+
+  // state after the last visual measurement; matrices are read-only views
+  // into the snapshot, which the estimator never modifies once published
+  py::class_<StateSnapshot, std::shared_ptr<StateSnapshot>>(m, "StateSnapshot")
+      .def_readonly("version", &StateSnapshot::version)
+      .def_property_readonly("ts", [](const StateSnapshot &s) { return uint64_t(s.ts.count()); })
+      .def_property_readonly("gsb", [](const StateSnapshot &s) { return s.gsb.matrix3x4(); })
+      .def_property_readonly("gbc", [](const StateSnapshot &s) { return s.gbc.matrix3x4(); })
+      .def_property_readonly("gsc", [](const StateSnapshot &s) { return s.gsc.matrix3x4(); })
+      .def_property_readonly("Vsb", [](const StateSnapshot &s) { return s.X.Vsb; })
+      .def_property_readonly("bg", [](const StateSnapshot &s) { return s.X.bg; })
+      .def_property_readonly("ba", [](const StateSnapshot &s) { return s.X.ba; })
+      .def_property_readonly("Rg", [](const StateSnapshot &s) { return s.X.Rsg.matrix(); })
+      .def_property_readonly("td", [](const StateSnapshot &s) { return s.X.td; })
+      .def_readonly("Ca", &StateSnapshot::Ca)
+      .def_readonly("Cg", &StateSnapshot::Cg)
+      .def_readonly("Pstate", &StateSnapshot::Pstate)
+      .def_readonly("CameraCov", &StateSnapshot::CameraCov)
+      .def_readonly("MeasurementUpdateInitialized", &StateSnapshot::measurement_update_initialized)
+      .def_readonly("inn_Wsb", &StateSnapshot::inn_Wsb)
+      .def_readonly("inn_Tsb", &StateSnapshot::inn_Tsb)
+      .def_readonly("inn_Vsb", &StateSnapshot::inn_Vsb)
+      .def_readonly("gauge_group", &StateSnapshot::gauge_group)
+      .def_readonly("feature_ids", &StateSnapshot::feature_ids)
+      .def_readonly("feature_positions", &StateSnapshot::feature_positions)
+      .def_readonly("feature_covs", &StateSnapshot::feature_covs)
+      .def_readonly("feature_pixels", &StateSnapshot::feature_pixels)
+      .def_readonly("group_ids", &StateSnapshot::group_ids)
+      .def_readonly("group_poses", &StateSnapshot::group_poses)
+      .def_readonly("group_covs", &StateSnapshot::group_covs)
+      .def_readonly("telemetry", &StateSnapshot::telemetry);
+
+  // statistics of the last visual measurement
+  py::class_<Telemetry>(m, "Telemetry")
+      .def_property_readonly("ts", [](const Telemetry &t) { return uint64_t(t.ts.count()); })
+      .def_readonly("frame", &Telemetry::frame)
+      .def_readonly("latency_ms", &Telemetry::latency_ms)
+      .def_readonly("num_tracked", &Telemetry::num_tracked)
+      .def_readonly("num_instate_features", &Telemetry::num_instate_features)
+      .def_readonly("num_instate_groups", &Telemetry::num_instate_groups)
+      .def_readonly("num_oos_features", &Telemetry::num_oos_features)
+      .def_readonly("num_mh_rejected", &Telemetry::num_mh_rejected)
+      .def_readonly("num_ransac_hypotheses", &Telemetry::num_ransac_hypotheses)
+      .def_readonly("num_ransac_rejected", &Telemetry::num_ransac_rejected)
+      .def_readonly("num_oos_rows", &Telemetry::num_oos_rows)
+      .def_readonly("num_update_rows", &Telemetry::num_update_rows)
+      .def_readonly("num_compressed_rows", &Telemetry::num_compressed_rows)
+      .def_property_readonly("compression_ratio", &Telemetry::compression_ratio)
+      .def_readonly("num_active_features", &Telemetry::num_active_features)
+      .def_readonly("max_features", &Telemetry::max_features)
+      .def_readonly("num_active_groups", &Telemetry::num_active_groups)
+      .def_readonly("max_groups", &Telemetry::max_groups)
+      .def_readonly("buffer_depth", &Telemetry::buffer_depth)
+      .def("to_dict", [](const Telemetry &t) {
+          py::dict d;
+          auto json = t.ToJson();
+          for (const auto &key : json.getMemberNames()) {
+            const auto &v = json[key];
+            if (v.type() == Json::realValue) d[key.c_str()] = v.asDouble();
+            else d[key.c_str()] = v.asLargestInt();
+          }
+          return d;
+        });
+
+  // record sessions (e.g. simulated point-cloud tracks) for replay with vio
+  py::class_<RecordingWriter>(m, "RecordingWriter")
+      .def(py::init<const std::string &>())
+      .def("WriteIMU", [](RecordingWriter &w, uint64_t ts, const Vec3 &gyro, const Vec3 &accel) {
+          w.WriteIMU(timestamp_t{ts}, gyro, accel); })
+      .def("WriteImageFile", [](RecordingWriter &w, uint64_t ts, const std::string &path) {
+          w.WriteImageFile(timestamp_t{ts}, path); })
+      .def("WritePointCloud", [](RecordingWriter &w, uint64_t ts, const VecXi &ids, const MatX2 &xp) {
+          w.WritePointCloud(timestamp_t{ts}, ids, xp); })
+      .def("Close", &RecordingWriter::Close)
+      .def("size", &RecordingWriter::size);
 }
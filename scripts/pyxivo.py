@@ -1,5 +1,6 @@
 import argparse
 import os, glob
+import numpy as np
 
 import sys
 sys.path.insert(0, 'lib')
@@ -149,20 +150,29 @@ def main(args):
     # we hit an exception (namely, KeyboardInterrupt)
     try:
         estimator = pyxivo.Estimator(args.cfg, viewer_cfg, args.seq, False)
+        # inertial measurements between two images are passed as one batch
+        imu_ts, imu_meas = [], []
         for i, (ts, content) in enumerate(data):
             if i > 0 and i % 1000 == 0:
                 print('{:6}/{:6}'.format(i, len(data)))
             if isinstance(content, tuple):
                 gyro, accel = content
-                estimator.InertialMeas(ts, gyro[0], gyro[1], gyro[2], accel[0],
-                                    accel[1], accel[2])
+                imu_ts.append(ts)
+                imu_meas.append(gyro + accel)
             else:
+                if imu_ts:
+                    estimator.InertialMeasBatch(np.array(imu_ts, dtype=np.uint64),
+                                                np.array(imu_meas))
+                    imu_ts, imu_meas = [], []
                 estimator.VisualMeas(ts, content)
                 if estimator.UsingLoopClosure():
                     estimator.CloseLoop()
                 estimator.Visualize()
                 if (args.mode != 'runOnly') and (estimator.VisionInitialized()):
                     saver.onVisionUpdate(estimator, datum=(ts, content))
+        if imu_ts:
+            estimator.InertialMeasBatch(np.array(imu_ts, dtype=np.uint64),
+                                        np.array(imu_meas))
 
     finally:
         if args.mode != 'runOnly':
@@ -0,0 +1,45 @@
+"""Print the events dumped by xivo::TraceBuffer::Dump (common/trace.h), one per
+line, optionally only those whose name contains a given string:
+
+  python scripts/read_trace.py trace.bin [update/mh-reject]
+"""
+import struct
+import sys
+
+import numpy as np
+
+RECORD = np.dtype([("ts_ns", "<i8"), ("event", "<i4"), ("thread", "<i4"),
+                   ("a", "<i4"), ("b", "<i4"), ("value", "<f8")])
+
+
+def read_trace(path):
+    """Returns the event names keyed by id and the records as a numpy array."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:8] != b"XIVOTRC1":
+        raise ValueError("{} is not a trace dump".format(path))
+    offset = 8
+    num_events, = struct.unpack_from("<I", data, offset)
+    offset += 4
+    names = {}
+    for _ in range(num_events):
+        event, length = struct.unpack_from("<II", data, offset)
+        offset += 8
+        names[event] = data[offset:offset + length].decode()
+        offset += length
+    count, = struct.unpack_from("<Q", data, offset)
+    offset += 8
+    records = np.frombuffer(data, dtype=RECORD, count=count, offset=offset)
+    return names, records
+
+
+if __name__ == "__main__":
+    names, records = read_trace(sys.argv[1])
+    pattern = sys.argv[2] if len(sys.argv) > 2 else ""
+    t0 = records["ts_ns"][0] if len(records) else 0
+    for r in records:
+        name = names[r["event"]]
+        if pattern in name:
+            print("{:12.3f} ms  [{}] {:32s} a={} b={} value={}".format(
+                (r["ts_ns"] - t0) * 1e-6, r["thread"], name, r["a"], r["b"],
+                r["value"]))
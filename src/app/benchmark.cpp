@@ -0,0 +1,271 @@
+// Batch evaluation of the estimator: every sequence is run with every
+// configuration variant, trajectories are scored against ground truth with
+// ATE/RPE and the per-stage timing of the estimator is collected, all into a
+// single json report.
+// Every run lives in its own forked process, so that a crashing run does not
+// take the others down, and up to --jobs of them run in parallel. See sweep.cpp
+// for runs sharing a decoded sequence as threads of one process.
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "estimator.h"
+#include "frame_pool.h"
+#include "loader.h"
+#include "metrics.h"
+#include "recording.h"
+
+// flags
+DEFINE_string(cfg, "cfg/benchmark.json",
+              "Benchmark configuration: datasets, sequences and variants.");
+DEFINE_string(report, "benchmark_report.json", "Output report path.");
+DEFINE_int32(jobs, 0, "Number of runs in parallel, 0 for one per core.");
+
+using namespace xivo;
+
+namespace {
+
+/** Overwrite the fields of `cfg` with the leaves of `overrides`, nested
+ * objects or "."-separated keys as in the sweep. Sub-configurations given as
+ * the path of a json file are loaded on the way. */
+void ApplyOverrides(Json::Value &cfg, const Json::Value &overrides,
+                    const std::string &prefix = "") {
+  if (!overrides.isObject()) return;
+  for (const auto &key : overrides.getMemberNames()) {
+    if (overrides[key].isObject()) {
+      ApplyOverrides(cfg, overrides[key], prefix + key + ".");
+    } else {
+      SetJsonPath(cfg, prefix + key, overrides[key]);
+    }
+  }
+}
+
+struct Run {
+  std::string variant, sequence;
+  std::string estimator_cfg, recording;
+  Json::Value overrides;
+};
+
+std::vector<Run> MakeRuns(const Json::Value &cfg) {
+  std::vector<Run> runs;
+  for (const auto &variant : cfg["variants"]) {
+    for (const auto &seq : cfg["sequences"]) {
+      Run run;
+      run.variant = variant["name"].asString();
+      run.estimator_cfg = variant["estimator_cfg"].asString();
+      run.overrides = variant["overrides"];
+      // either the name of the sequence, or {"seq": name, "recording": path}
+      if (seq.isObject()) {
+        run.sequence = seq["seq"].asString();
+        run.recording = seq.get("recording", "").asString();
+      } else {
+        run.sequence = seq.asString();
+      }
+      runs.push_back(run);
+    }
+  }
+  return runs;
+}
+
+/** Replay a sequence and evaluate the estimated trajectory. Runs in a child
+ * process. */
+Json::Value Evaluate(const Json::Value &cfg, const Run &run) {
+  std::string image_dir, imu_dir, mocap_dir;
+  std::tie(image_dir, imu_dir, mocap_dir) = GetDirs(
+      cfg["dataset"].asString(), cfg["root"].asString(), run.sequence,
+      cfg.get("cam_id", 0).asInt());
+
+  auto est_cfg = LoadJson(run.estimator_cfg);
+  ApplyOverrides(est_cfg, run.overrides);
+  auto est = CreateSystem(BatchEstimatorCfg(est_cfg));
+
+  std::vector<msg::Pose> traj_est;
+  int num_images{0};
+  auto start = std::chrono::steady_clock::now();
+  if (!run.recording.empty()) {
+    RecordingReader reader{run.recording};
+    RecordingReader::Entry entry;
+    for (int i = 0; i < reader.size(); ++i) {
+      reader.Get(i, entry);
+      switch (entry.type) {
+      case RecordType::IMU:
+        est->InertialMeas(entry.ts, entry.gyro, entry.accel);
+        break;
+      case RecordType::IMAGE:
+        est->VisualMeas(entry.ts, entry.image);
+        ++num_images;
+        break;
+      case RecordType::POINT_CLOUD:
+        est->VisualMeasPointCloud(entry.ts, entry.feature_ids, entry.xp);
+        ++num_images;
+        break;
+      }
+      if (est->UsingLoopClosure() && entry.type != RecordType::IMU) {
+        est->CloseLoop();
+      }
+      traj_est.emplace_back(est->ts(), est->gsb());
+    }
+    // frames are mapped from the recording, which is closed at the end of
+    // this block
+    est->Finish();
+  } else {
+    int lookahead = cfg.get("loader_lookahead", 8).asInt();
+    // the loader decodes on its own threads, which are bound to no context
+    auto pool = FramePool::instance();
+    pool->Reserve(lookahead + est->max_images_held());
+    StreamingLoader loader{image_dir, imu_dir, lookahead,
+      cfg.get("loader_threads", 2).asInt(),
+      [pool](const std::string &path) { return pool->Read(path); }};
+    for (auto &entry : loader) {
+      if (auto msg = dynamic_cast<msg::Image *>(entry.msg.get())) {
+        est->VisualMeas(msg->ts_, entry.image);
+        ++num_images;
+        if (est->UsingLoopClosure()) {
+          est->CloseLoop();
+        }
+      } else if (auto msg = dynamic_cast<msg::IMU *>(entry.msg.get())) {
+        est->InertialMeas(msg->ts_, msg->gyro_, msg->accel_);
+      } else {
+        LOG(FATAL) << "Invalid entry type.";
+      }
+      traj_est.emplace_back(est->ts(), est->gsb());
+    }
+    est->Finish();
+  }
+  if (traj_est.empty() || traj_est.back().ts_ != est->ts()) {
+    traj_est.emplace_back(est->ts(), est->gsb());
+  }
+  std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+
+  Json::Value out;
+  out["num_messages"] = (int)traj_est.size();
+  out["num_images"] = num_images;
+  out["wall_s"] = wall.count();
+  if (!traj_est.empty()) {
+    std::chrono::duration<double> duration =
+        traj_est.back().ts_ - traj_est.front().ts_;
+    out["duration_s"] = duration.count();
+    out["realtime_factor"] = duration.count() / wall.count();
+  }
+  if (num_images > 0) {
+    out["ms_per_image"] = 1000.0 * wall.count() / num_images;
+  }
+
+  auto traj_gt = DataLoader{image_dir}.LoadGroundTruthState(mocap_dir);
+  number_t resolution = cfg.get("resolution", 0.001).asDouble();
+  number_t rpe_interval = cfg.get("RPE_interval", 1.0).asDouble();
+  number_t ate, rpe_pos, rpe_rot;
+  SE3 g_est_gt;
+  std::tie(ate, g_est_gt) = ComputeATE(traj_est, traj_gt, resolution);
+  std::tie(rpe_pos, rpe_rot) =
+      ComputeRPE(traj_est, traj_gt, rpe_interval, resolution);
+  out["ATE"] = ate;
+  out["RPE_pos"] = rpe_pos;
+  out["RPE_rot_deg"] = rpe_rot < 0 ? rpe_rot : rpe_rot / M_PI * 180;
+
+  // latency distribution of every stage of the estimator
+  out["timing"] = est->profiler().ToJson();
+  return out;
+}
+
+std::string ResultPath(int i) {
+  return FLAGS_report + StrFormat(".run%d", i);
+}
+
+} // namespace
+
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto cfg = LoadJson(FLAGS_cfg);
+  auto runs = MakeRuns(cfg);
+  if (runs.empty()) {
+    LOG(FATAL) << "no sequence or variant to run in " << FLAGS_cfg;
+  }
+  int max_jobs = FLAGS_jobs > 0 ? FLAGS_jobs : sysconf(_SC_NPROCESSORS_ONLN);
+  max_jobs = std::max(1, std::min<int>(max_jobs, runs.size()));
+
+  Json::Value report;
+  report["cfg"] = cfg;
+  auto start = std::chrono::steady_clock::now();
+
+  // fork before anything spawns a thread, children never return
+  std::map<pid_t, int> running;
+  auto reap = [&]() {
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    CHECK(pid > 0) << "waitpid failed";
+    int i = running.at(pid);
+    running.erase(pid);
+
+    const Run &run = runs[i];
+    Json::Value &result = report["runs"][i];
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+      result = LoadJson(ResultPath(i));
+      result["status"] = "ok";
+    } else {
+      result["status"] = WIFSIGNALED(status)
+        ? StrFormat("killed by signal %d", WTERMSIG(status))
+        : StrFormat("exit code %d", WEXITSTATUS(status));
+    }
+    std::remove(ResultPath(i).c_str());
+    result["variant"] = run.variant;
+    result["sequence"] = run.sequence;
+
+    std::cout << StrFormat("[%s/%s] %s", run.variant, run.sequence,
+                           result["status"].asString());
+    if (result.isMember("ATE")) {
+      std::cout << StrFormat(" ATE=%0.4f m, RPE=[%0.4f m, %0.4f deg], %0.2f ms/image",
+                             result["ATE"].asDouble(), result["RPE_pos"].asDouble(),
+                             result["RPE_rot_deg"].asDouble(),
+                             result.get("ms_per_image", 0.0).asDouble());
+    }
+    std::cout << std::endl;
+  };
+
+  for (int i = 0; i < runs.size(); ++i) {
+    while ((int)running.size() >= max_jobs) {
+      reap();
+    }
+    pid_t pid = fork();
+    CHECK(pid >= 0) << "fork failed";
+    if (pid == 0) {
+      int code = 0;
+      try {
+        SaveJson(Evaluate(cfg, runs[i]), ResultPath(i));
+      } catch (const std::exception &e) {
+        LOG(ERROR) << runs[i].variant << "/" << runs[i].sequence << ": " << e.what();
+        code = 1;
+      }
+      // skip the destructors of the singletons
+      std::cout.flush();
+      _exit(code);
+    }
+    running[pid] = i;
+  }
+  while (!running.empty()) {
+    reap();
+  }
+
+  std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+  report["jobs"] = max_jobs;
+  report["wall_s"] = wall.count();
+  SaveJson(report, FLAGS_report);
+  std::cout << runs.size() << " runs written to " << FLAGS_report << std::endl;
+
+  for (const auto &result : report["runs"]) {
+    if (result["status"].asString() != "ok") {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -9,6 +9,7 @@
 
 #include "estimator.h"
 #include "estimator_process.h"
+#include "frame_pool.h"
 #include "metrics.h"
 #include "tracker.h"
 #include "loader.h"
@@ -43,13 +44,19 @@ int main(int argc, char **argv) {
 
   bool tracker_only = true;
 
-  // read the data
-  std::unique_ptr<DataLoader> loader(new DataLoader{image_dir});
-
   // create estimator
   auto est = CreateSystemTrackerOnly(
       LoadJson(cfg["estimator_cfg"].asString()));
 
+  // stream the data; images are decoded into the frame pool ahead of time
+  int lookahead = cfg.get("loader_lookahead", 8).asInt();
+  // the loader decodes on its own threads, which are bound to no context
+  auto pool = FramePool::instance();
+  pool->Reserve(lookahead + est->max_images_held());
+  StreamingLoader loader{image_dir, "", lookahead,
+    cfg.get("loader_threads", 2).asInt(),
+    [pool](const std::string &path) { return pool->Read(path); }};
+
   // create viewer
   std::unique_ptr<Viewer> viewer;
   if (cfg.get("visualize", false).asBool()) {
@@ -62,16 +69,15 @@ int main(int argc, char **argv) {
   // setup I/O for saving results
   if (std::ofstream ostream{FLAGS_out, std::ios::out}) {
 
-    for (int i = 0; i < loader->size(); ++i) {
-      auto raw_msg = loader->Get(i);
+    for (auto &entry : loader) {
+      auto raw_msg = entry.msg.get();
 
-      if (verbose && i % 1000 == 0) {
-        std::cout << i << "/" << loader->size() << std::endl;
+      if (verbose && loader.count() % 1000 == 0) {
+        std::cout << loader.count() << std::endl;
       }
 
       if (auto msg = dynamic_cast<msg::Image *>(raw_msg)) {
-        auto image = cv::imread(msg->image_path_);
-        est->VisualMeasTrackerOnly(msg->ts_, image);
+        est->VisualMeasTrackerOnly(msg->ts_, entry.image);
 
         if (viewer) {
 
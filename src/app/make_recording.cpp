@@ -0,0 +1,60 @@
+// Convert an ASL-style dataset (image folder + imu csv) into a binary
+// recording which vio replays with --recording.
+#include <iostream>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "loader.h"
+#include "recording.h"
+
+// flags
+DEFINE_string(root, "/home/feixh/Data/tumvi/exported/euroc/512_16/",
+              "Root directory containing tumvi dataset folder.");
+DEFINE_string(dataset, "tumvi", "xivo | euroc | tumvi");
+DEFINE_string(seq, "room1", "Sequence of TUM VI benchmark to play with.");
+DEFINE_int32(cam_id, 0, "Camera id.");
+DEFINE_string(out, "recording.bin", "Output recording path.");
+DEFINE_bool(raw, false,
+            "Store decoded pixels instead of the image files: larger, but "
+            "replay does not decode anything.");
+
+using namespace xivo;
+
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  std::string image_dir, imu_dir, mocap_dir;
+  std::tie(image_dir, imu_dir, mocap_dir) =
+      GetDirs(FLAGS_dataset, FLAGS_root, FLAGS_seq, FLAGS_cam_id);
+
+  // image files are copied as-is unless raw pixels are asked for
+  StreamingLoader loader{image_dir, imu_dir, 8, 2,
+    [](const std::string &path) {
+      return FLAGS_raw ? cv::imread(path) : cv::Mat();
+    }};
+
+  RecordingWriter writer{FLAGS_out};
+  for (auto &entry : loader) {
+    if (auto msg = dynamic_cast<msg::Image *>(entry.msg.get())) {
+      if (FLAGS_raw) {
+        if (entry.image.empty()) {
+          LOG(FATAL) << "failed to read image @ " << msg->image_path_;
+        }
+        writer.WriteImage(msg->ts_, entry.image);
+      } else {
+        writer.WriteImageFile(msg->ts_, msg->image_path_);
+      }
+    } else if (auto msg = dynamic_cast<msg::IMU *>(entry.msg.get())) {
+      writer.WriteIMU(msg->ts_, msg->gyro_, msg->accel_);
+    }
+
+    if (loader.count() % 1000 == 0) {
+      std::cout << loader.count() << std::endl;
+    }
+  }
+  writer.Close();
+  std::cout << writer.size() << " messages written to " << FLAGS_out << std::endl;
+}
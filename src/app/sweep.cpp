@@ -0,0 +1,426 @@
+// Hyperparameter sweep: every configuration of a grid (or drawn at random) is
+// run on every sequence, trajectories are scored against ground truth with
+// ATE/RPE, the latency of each frame is recorded, and the configurations on
+// the Pareto front of accuracy and latency are reported in a json report.
+// A sequence is decoded once and shared in memory by all the runs on it. Each
+// run owns an EstimatorContext, hence --jobs of them run concurrently as
+// threads of a single process. Since concurrent runs slow each other down,
+// the configurations on the front are timed again one at a time.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <thread>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "context.h"
+#include "estimator.h"
+#include "loader.h"
+#include "metrics.h"
+#include "recording.h"
+
+// flags
+DEFINE_string(cfg, "cfg/sweep.json",
+              "Sweep configuration: dataset, sequences and parameter space.");
+DEFINE_string(report, "sweep_report.json", "Output report path.");
+DEFINE_int32(jobs, 0, "Number of runs in parallel, 0 for one per core.");
+
+using namespace xivo;
+
+namespace {
+
+/** A sequence decoded in memory, read concurrently by all runs. */
+struct Dataset {
+  std::string name;
+  std::unique_ptr<RecordingReader> reader;  // frames may point into it
+  std::vector<RecordingReader::Entry> entries;
+  std::vector<msg::Pose> ground_truth;
+};
+
+Dataset Load(const Json::Value &cfg, const Json::Value &seq) {
+  Dataset data;
+  std::string recording;
+  // either the name of the sequence, or {"seq": name, "recording": path}
+  if (seq.isObject()) {
+    data.name = seq["seq"].asString();
+    recording = seq.get("recording", "").asString();
+  } else {
+    data.name = seq.asString();
+  }
+
+  std::string image_dir, imu_dir, mocap_dir;
+  std::tie(image_dir, imu_dir, mocap_dir) = GetDirs(
+      cfg["dataset"].asString(), cfg["root"].asString(), data.name,
+      cfg.get("cam_id", 0).asInt());
+
+  if (!recording.empty()) {
+    data.reader = std::make_unique<RecordingReader>(recording);
+    data.entries.resize(data.reader->size());
+    for (int i = 0; i < data.reader->size(); ++i) {
+      data.reader->Get(i, data.entries[i]);
+    }
+  } else {
+    StreamingLoader loader{image_dir, imu_dir,
+      cfg.get("loader_lookahead", 8).asInt(),
+      cfg.get("loader_threads", 2).asInt()};
+    for (auto &entry : loader) {
+      RecordingReader::Entry out;
+      out.ts = entry.msg->ts_;
+      if (dynamic_cast<msg::Image *>(entry.msg.get())) {
+        out.type = RecordType::IMAGE;
+        out.image = entry.image;
+      } else if (auto msg = dynamic_cast<msg::IMU *>(entry.msg.get())) {
+        out.type = RecordType::IMU;
+        out.gyro = msg->gyro_;
+        out.accel = msg->accel_;
+      } else {
+        LOG(FATAL) << "Invalid entry type.";
+      }
+      data.entries.push_back(std::move(out));
+    }
+  }
+  data.ground_truth = DataLoader{image_dir}.LoadGroundTruthState(mocap_dir);
+  return data;
+}
+
+
+/** Parameter values of every configuration: the cartesian product of the
+ * "grid", or "samples" draws from the distributions of "random". */
+std::vector<Json::Value> MakeConfigs(const Json::Value &cfg) {
+  std::vector<Json::Value> configs;
+  if (cfg.isMember("grid") == cfg.isMember("random")) {
+    throw std::invalid_argument("expected either a grid or a random search");
+  }
+
+  if (cfg.isMember("grid")) {
+    const auto &grid = cfg["grid"];
+    configs.push_back(Json::objectValue);
+    for (const auto &name : grid.getMemberNames()) {
+      if (!grid[name].isArray() || grid[name].empty()) {
+        throw std::invalid_argument("no value of " + name + " in the grid");
+      }
+      std::vector<Json::Value> product;
+      for (const auto &params : configs) {
+        for (const auto &value : grid[name]) {
+          product.push_back(params);
+          product.back()[name] = value;
+        }
+      }
+      configs.swap(product);
+    }
+    return configs;
+  }
+
+  // a parameter is either a list of choices, or {"min", "max"} sampled
+  // uniformly, on a log scale with "log": true, and rounded with "int": true
+  const auto &random = cfg["random"];
+  std::mt19937 rng(random.get("seed", 0).asUInt());
+  int samples = random.get("samples", 16).asInt();
+  for (int i = 0; i < samples; ++i) {
+    Json::Value params{Json::objectValue};
+    for (const auto &name : random["params"].getMemberNames()) {
+      const auto &spec = random["params"][name];
+      if (spec.isArray()) {
+        std::uniform_int_distribution<int> choice(0, spec.size() - 1);
+        params[name] = spec[choice(rng)];
+        continue;
+      }
+      double lo = spec["min"].asDouble(), hi = spec["max"].asDouble();
+      bool log_scale = spec.get("log", false).asBool();
+      if (lo > hi || (log_scale && lo <= 0)) {
+        throw std::invalid_argument("invalid range of " + name);
+      }
+      if (log_scale) {
+        lo = std::log(lo);
+        hi = std::log(hi);
+      }
+      double value = std::uniform_real_distribution<double>(lo, hi)(rng);
+      if (log_scale) {
+        value = std::exp(value);
+      }
+      if (spec.get("int", false).asBool()) {
+        params[name] = (int)std::round(value);
+      } else {
+        params[name] = value;
+      }
+    }
+    configs.push_back(params);
+  }
+  return configs;
+}
+
+/** Estimator configuration of a run: the base one with the swept parameters,
+ * and nothing that concurrent runs would fight over (files, the canvas) or
+ * that would skew their latency. */
+Json::Value MakeEstimatorCfg(const Json::Value &base,
+                             const Json::Value &params) {
+  Json::Value est_cfg = base;
+  for (const auto &name : params.getMemberNames()) {
+    SetJsonPath(est_cfg, name, params[name]);
+  }
+  return BatchEstimatorCfg(est_cfg);
+}
+
+
+/** Replay a sequence and evaluate the estimated trajectory. */
+Json::Value Evaluate(const Json::Value &cfg, const Json::Value &est_cfg,
+                     const Dataset &data) {
+  auto context = EstimatorContext::Create(est_cfg);
+  EstimatorContext::Scope scope{context.get()};
+  auto est = context->estimator();
+
+  std::vector<msg::Pose> traj_est;
+  traj_est.reserve(data.entries.size());
+  auto start = std::chrono::steady_clock::now();
+  for (const auto &entry : data.entries) {
+    switch (entry.type) {
+    case RecordType::IMU:
+      est->InertialMeas(entry.ts, entry.gyro, entry.accel);
+      break;
+    case RecordType::IMAGE:
+      est->VisualMeas(entry.ts, entry.image);
+      break;
+    case RecordType::POINT_CLOUD:
+      est->VisualMeasPointCloud(entry.ts, entry.feature_ids, entry.xp);
+      break;
+    }
+    if (est->UsingLoopClosure() && entry.type != RecordType::IMU) {
+      est->CloseLoop();
+    }
+    traj_est.emplace_back(est->ts(), est->gsb());
+  }
+  // measurements still held back by the reorder buffer
+  est->Finish();
+  if (traj_est.empty() || traj_est.back().ts_ != est->ts()) {
+    traj_est.emplace_back(est->ts(), est->gsb());
+  }
+  std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+
+  Json::Value out;
+  out["wall_s"] = wall.count();
+  // latency of each visual measurement, from the profiler of the estimator
+  out["latency"] = est->profiler().ToJson()["frames"];
+
+  number_t resolution = cfg.get("resolution", 0.001).asDouble();
+  number_t rpe_interval = cfg.get("RPE_interval", 1.0).asDouble();
+  number_t ate, rpe_pos, rpe_rot;
+  SE3 g_est_gt;
+  std::tie(ate, g_est_gt) = ComputeATE(traj_est, data.ground_truth, resolution);
+  std::tie(rpe_pos, rpe_rot) =
+      ComputeRPE(traj_est, data.ground_truth, rpe_interval, resolution);
+  out["ATE"] = ate;
+  out["RPE_pos"] = rpe_pos;
+  out["RPE_rot_deg"] = rpe_rot < 0 ? rpe_rot : rpe_rot / M_PI * 180;
+  return out;
+}
+
+/** Objectives of the configurations `indices`: the mean ATE and the mean
+ * latency over the sequences, the latter from the runs' `latency_key`. */
+void ComputeObjectives(Json::Value &configs, const std::vector<int> &indices,
+                       const std::string &latency_key,
+                       const std::string &latency_metric) {
+  for (int c : indices) {
+    Json::Value &config = configs[c];
+    if (config["status"].asString() != "ok") continue;
+    double ate{0}, latency{0};
+    for (const auto &run : config["runs"]) {
+      ate += run["ATE"].asDouble();
+      latency += run[latency_key].get(latency_metric, 0.0).asDouble();
+    }
+    config["ATE"] = ate / config["runs"].size();
+    config["latency_ms"] = latency / config["runs"].size();
+  }
+}
+
+/** Indices of the `candidates` no other one beats on both objectives, most
+ * accurate first. */
+std::vector<int> ParetoFront(const Json::Value &configs,
+                             const std::vector<int> &candidates) {
+  std::vector<int> front;
+  auto error = [&](int i) { return configs[i]["ATE"].asDouble(); };
+  auto latency = [&](int i) { return configs[i]["latency_ms"].asDouble(); };
+  for (int i : candidates) {
+    bool dominated = std::any_of(candidates.begin(), candidates.end(),
+      [&](int j) {
+        return error(j) <= error(i) && latency(j) <= latency(i) &&
+               (error(j) < error(i) || latency(j) < latency(i));
+      });
+    if (!dominated) {
+      front.push_back(i);
+    }
+  }
+  std::sort(front.begin(), front.end(),
+            [&](int i, int j) { return error(i) < error(j); });
+  return front;
+}
+
+} // namespace
+
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto cfg = LoadJson(FLAGS_cfg);
+  auto base_cfg = LoadJson(cfg["estimator_cfg"].asString());
+  auto params = MakeConfigs(cfg);
+  if (params.empty() || cfg["sequences"].empty()) {
+    LOG(FATAL) << "no sequence or configuration to run in " << FLAGS_cfg;
+  }
+  std::vector<Json::Value> est_cfgs;
+  for (const auto &p : params) {
+    est_cfgs.push_back(MakeEstimatorCfg(base_cfg, p));
+  }
+  // p50_ms, p95_ms, ... of the per-frame latency, see Profiler::ToJson
+  std::string latency_metric = cfg.get("latency_metric", "p95_ms").asString();
+
+  int max_jobs = FLAGS_jobs > 0 ? FLAGS_jobs
+                                : std::thread::hardware_concurrency();
+  max_jobs = std::max(1, std::min<int>(max_jobs, params.size()));
+  // the runs are the parallelism: opencv's own threads would only contend
+  // with them and inflate the latency measured
+  cv::setNumThreads(1);
+
+  Json::Value report;
+  report["cfg"] = cfg;
+  Json::Value &configs = report["configs"];
+  for (int c = 0; c < params.size(); ++c) {
+    configs[c]["params"] = params[c];
+    configs[c]["status"] = "ok";
+  }
+  auto start = std::chrono::steady_clock::now();
+
+  // Runs configurations `indices` on every sequence with up to `jobs` of
+  // them in parallel, storing each result in the configuration's "runs" under
+  // the sequence name, or as `key` of that run if not empty. One sequence at a
+  // time is in memory, all the configurations run on it.
+  auto run_sequences = [&](const std::vector<int> &indices, int jobs,
+                           const std::string &key) {
+    for (const auto &seq : cfg["sequences"]) {
+      auto decode_start = std::chrono::steady_clock::now();
+      const Dataset data = Load(cfg, seq);
+      std::chrono::duration<double> decode =
+          std::chrono::steady_clock::now() - decode_start;
+      if (key.empty()) {
+        report["decode_s"][data.name] = decode.count();
+      }
+      std::cout << StrFormat("[%s] %d messages decoded in %0.2f s", data.name,
+                             (int)data.entries.size(), decode.count())
+                << std::endl;
+
+      std::vector<Json::Value> results(indices.size());
+      std::atomic<int> next{0};
+      std::mutex print_mtx;
+      auto work = [&]() {
+        for (int i = next++; i < (int)indices.size(); i = next++) {
+          int c = indices[i];
+          Json::Value &result = results[i];
+          try {
+            result = Evaluate(cfg, est_cfgs[c], data);
+            result["status"] = "ok";
+          } catch (const std::exception &e) {
+            result["status"] = e.what();
+          }
+
+          std::scoped_lock lck(print_mtx);
+          std::cout << StrFormat("[%d/%s] %s", c, data.name,
+                                 result["status"].asString());
+          if (result.isMember("ATE")) {
+            std::cout << StrFormat(" ATE=%0.4f m, RPE=[%0.4f m, %0.4f deg], %s=%0.2f ms",
+                                   result["ATE"].asDouble(),
+                                   result["RPE_pos"].asDouble(),
+                                   result["RPE_rot_deg"].asDouble(),
+                                   latency_metric,
+                                   result["latency"].get(latency_metric, 0.0).asDouble());
+          }
+          std::cout << std::endl;
+        }
+      };
+      std::vector<std::thread> workers;
+      for (int i = 0; i < std::min<int>(jobs, indices.size()); ++i) {
+        workers.emplace_back(work);
+      }
+      for (auto &worker : workers) {
+        worker.join();
+      }
+
+      for (int i = 0; i < indices.size(); ++i) {
+        Json::Value &config = configs[indices[i]];
+        if (results[i]["status"].asString() != "ok") {
+          config["status"] = "failed on " + data.name;
+        }
+        if (key.empty()) {
+          config["runs"][data.name] = results[i];
+        } else {
+          config["runs"][data.name][key] = results[i]["latency"];
+        }
+      }
+    }
+  };
+
+  std::vector<int> all(params.size());
+  std::iota(all.begin(), all.end(), 0);
+  run_sequences(all, max_jobs, "");
+
+  // objectives: mean over the sequences; configurations with a failed run
+  // are left out
+  ComputeObjectives(configs, all, "latency", latency_metric);
+  std::vector<int> candidates;
+  for (int c : all) {
+    if (configs[c]["status"].asString() == "ok") {
+      candidates.push_back(c);
+    }
+  }
+  auto front = ParetoFront(configs, candidates);
+
+  // Concurrent runs contend for cores, caches and memory bandwidth, so their
+  // latency is inflated unevenly. The configurations on the front are timed
+  // again one at a time, and the front is taken among them with that latency.
+  bool retime = cfg.get("retime_pareto", true).asBool() && max_jobs > 1;
+  if (retime && !front.empty()) {
+    std::cout << "Timing " << front.size()
+              << " configurations of the Pareto front one at a time" << std::endl;
+    run_sequences(front, 1, "latency_serial");
+    ComputeObjectives(configs, front, "latency_serial", latency_metric);
+    candidates.clear();
+    for (int c : front) {
+      if (configs[c]["status"].asString() == "ok") {
+        candidates.push_back(c);
+      }
+    }
+    front = ParetoFront(configs, candidates);
+  }
+
+  report["pareto"] = Json::arrayValue;
+  for (int c : front) {
+    report["pareto"].append(c);
+    configs[c]["pareto"] = true;
+  }
+  report["latency_retimed"] = retime;
+
+  std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+  report["jobs"] = max_jobs;
+  report["latency_metric"] = latency_metric;
+  report["wall_s"] = wall.count();
+  SaveJson(report, FLAGS_report);
+
+  std::cout << "Pareto front (mean ATE, mean " << latency_metric << "):\n";
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  for (int c : front) {
+    std::cout << StrFormat("  [%d] %0.4f m, %0.2f ms: %s", c,
+                           configs[c]["ATE"].asDouble(),
+                           configs[c]["latency_ms"].asDouble(),
+                           Json::writeString(builder, configs[c]["params"]))
+              << std::endl;
+  }
+  std::cout << params.size() << " configurations written to " << FLAGS_report
+            << std::endl;
+  return front.empty() ? 1 : 0;
+}
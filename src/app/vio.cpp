@@ -9,9 +9,11 @@
 
 #include "estimator.h"
 #include "estimator_process.h"
+#include "frame_pool.h"
 #include "metrics.h"
 #include "tracker.h"
 #include "loader.h"
+#include "recording.h"
 #include "viewer.h"
 #include "visualize.h"
 #include "graphwriter.h"
@@ -26,6 +28,9 @@ DEFINE_string(seq, "room1", "Sequence of TUM VI benchmark to play with.");
 DEFINE_int32(cam_id, 0, "Camera id.");
 DEFINE_string(out, "out_state", "Output file path.");
 DEFINE_string(graphout, "", ".dot file to save output graph to");
+DEFINE_string(mapout, "", "binary file to save the map to, see mapper_cfg.load_map");
+DEFINE_string(recording, "",
+              "binary recording (see make_recording) to replay instead of the dataset");
 
 using namespace xivo;
 
@@ -41,14 +46,28 @@ int main(int argc, char **argv) {
   std::tie(image_dir, imu_dir, mocap_dir) =
       GetDirs(FLAGS_dataset, FLAGS_root, FLAGS_seq, FLAGS_cam_id);
 
-  std::unique_ptr<DataLoader> loader(new DataLoader{image_dir, imu_dir});
-
   // create estimator
   // auto est = std::make_unique<Estimator>(
   //     LoadJson(cfg["estimator_cfg"].asString()));
   auto est = CreateSystem(
       LoadJson(cfg["estimator_cfg"].asString()));
 
+  // either replay a recording in place, or stream the dataset with images
+  // decoded into the frame pool ahead of time
+  std::unique_ptr<RecordingReader> reader;
+  std::unique_ptr<StreamingLoader> loader;
+  if (!FLAGS_recording.empty()) {
+    reader = std::make_unique<RecordingReader>(FLAGS_recording);
+  } else {
+    int lookahead = cfg.get("loader_lookahead", 8).asInt();
+    // the loader decodes on its own threads, which are bound to no context
+    auto pool = FramePool::instance();
+    pool->Reserve(lookahead + est->max_images_held());
+    loader = std::make_unique<StreamingLoader>(image_dir, imu_dir, lookahead,
+      cfg.get("loader_threads", 2).asInt(),
+      [pool](const std::string &path) { return pool->Read(path); });
+  }
+
   // create viewer
   std::unique_ptr<Viewer> viewer;
   if (cfg.get("visualize", false).asBool()) {
@@ -61,49 +80,87 @@ int main(int argc, char **argv) {
 
     std::vector<msg::Pose> traj_est;
 
-    for (int i = 0; i < loader->size(); ++i) {
-      auto raw_msg = loader->Get(i);
-
-      if (verbose && i % 1000 == 0) {
-        std::cout << i << "/" << loader->size() << std::endl;
+    auto after_visual_meas = [&]() {
+      if (est->UsingLoopClosure()) {
+        est->CloseLoop();
       }
 
-      if (auto msg = dynamic_cast<msg::Image *>(raw_msg)) {
-        auto image = cv::imread(msg->image_path_);
-        est->VisualMeas(msg->ts_, image);
-
-        if (est->UsingLoopClosure()) {
-          est->CloseLoop();
-        }
+      if (viewer) {
+        viewer->Update_gsb(est->gsb());
+        viewer->Update_gsc(est->gsc());
 
-        if (viewer) {
-          viewer->Update_gsb(est->gsb());
-          viewer->Update_gsc(est->gsc());
+        cv::Mat disp = Canvas::instance()->display();
 
-          cv::Mat disp = Canvas::instance()->display();
-
-          if (!disp.empty()) {
-            LOG(INFO) << "Display image is ready";
-            viewer->Update(disp);
-            viewer->Refresh();
-          }
+        if (!disp.empty()) {
+          LOG(INFO) << "Display image is ready";
+          viewer->Update(disp);
+          viewer->Refresh();
         }
-      } else if (auto msg = dynamic_cast<msg::IMU *>(raw_msg)) {
-        est->InertialMeas(msg->ts_, msg->gyro_, msg->accel_);
-        // if (viewer) {
-        //   viewer->Update_gsb(est->gsb());
-        //   viewer->Update_gsc(est->gsc());
-        // }
-      } else {
-        LOG(FATAL) << "Invalid entry type.";
       }
+    };
 
+    auto save_state = [&]() {
       traj_est.emplace_back(est->ts(), est->gsb());
       ostream << StrFormat("%ld", est->ts().count()) << " "
         << est->gsb().translation().transpose() << " "
         << est->gsb().rotation().log().transpose() << std::endl;
+    };
+
+    if (reader) {
+      RecordingReader::Entry entry;
+      for (int i = 0; i < reader->size(); ++i) {
+        reader->Get(i, entry);
+
+        if (verbose && i % 1000 == 0) {
+          std::cout << i << "/" << reader->size() << std::endl;
+        }
 
-      // std::this_thread::sleep_for(std::chrono::milliseconds(3));
+        switch (entry.type) {
+        case RecordType::IMU:
+          est->InertialMeas(entry.ts, entry.gyro, entry.accel);
+          break;
+        case RecordType::IMAGE:
+          est->VisualMeas(entry.ts, entry.image);
+          after_visual_meas();
+          break;
+        case RecordType::POINT_CLOUD:
+          est->VisualMeasPointCloud(entry.ts, entry.feature_ids, entry.xp);
+          after_visual_meas();
+          break;
+        }
+        save_state();
+      }
+    } else {
+      for (auto &entry : *loader) {
+        auto raw_msg = entry.msg.get();
+
+        if (verbose && loader->count() % 1000 == 0) {
+          std::cout << loader->count() << std::endl;
+        }
+
+        if (auto msg = dynamic_cast<msg::Image *>(raw_msg)) {
+          est->VisualMeas(msg->ts_, entry.image);
+          after_visual_meas();
+        } else if (auto msg = dynamic_cast<msg::IMU *>(raw_msg)) {
+          est->InertialMeas(msg->ts_, msg->gyro_, msg->accel_);
+          // if (viewer) {
+          //   viewer->Update_gsb(est->gsb());
+          //   viewer->Update_gsc(est->gsc());
+          // }
+        } else {
+          LOG(FATAL) << "Invalid entry type.";
+        }
+
+        save_state();
+
+        // std::this_thread::sleep_for(std::chrono::milliseconds(3));
+      }
+    }
+    // process what the reorder buffer still holds while the frames (possibly
+    // mapped from the recording) are alive: the estimator itself outlives main
+    est->Finish();
+    if (traj_est.empty() || traj_est.back().ts_ != est->ts()) {
+      save_state();
     }
 
     // Dump output graph
@@ -116,6 +173,13 @@ int main(int argc, char **argv) {
       GW.WriteDot(FLAGS_graphout);
     }
 
+#ifdef USE_MAPPER
+    // Save the map for relocalization in later sessions
+    if (!FLAGS_mapout.empty()) {
+      Mapper::instance()->SaveMap(FLAGS_mapout);
+    }
+#endif
+
   } else {
     LOG(FATAL) << "failed to open output file @ " << FLAGS_out;
   }
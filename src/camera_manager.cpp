@@ -3,13 +3,12 @@
 #include "camera_manager.h"
 
 namespace xivo {
-std::unique_ptr<CameraManager> CameraManager::instance_ = nullptr;
-
 CameraManager *CameraManager::Create(const Json::Value &cfg) {
-  if (!instance_) {
-    instance_ = std::unique_ptr<CameraManager>(new CameraManager(cfg));
+  auto &instance = EstimatorContext::current()->camera_manager_;
+  if (!instance) {
+    instance = std::unique_ptr<CameraManager>(new CameraManager(cfg));
   }
-  return instance_.get();
+  return instance.get();
 }
 
 CameraManager::CameraManager(const Json::Value &cfg) : model_{Unknown{}} {
@@ -54,6 +53,176 @@ CameraManager::CameraManager(const Json::Value &cfg) : model_{Unknown{}} {
   cx_ = cx;
   cy_ = cy;
   fl_ = 0.5 * std::sqrt(fx * fx + fy * fy);
+
+  use_lut_ = false;
+  if (cfg.get("undistortion_lut", false).asBool()) {
+    if (cam_model == "pinhole") {
+      LOG(INFO) << "pinhole camera unprojects in closed form; lookup table skipped";
+    } else {
+      BuildLUT(cfg.get("lut_step", 1.0).asDouble());
+    }
+  }
+}
+
+void CameraManager::BuildLUT(number_t step) {
+  if (step <= 0) {
+    throw std::invalid_argument("undistortion lookup table step must be positive");
+  }
+  lut_step_ = step;
+  lut_cols_ = static_cast<int>(std::ceil((cols_ - 1) / step)) + 1;
+  lut_rows_ = static_cast<int>(std::ceil((rows_ - 1) / step)) + 1;
+  lut_xc_.resize(lut_rows_ * lut_cols_);
+  lut_jac_.resize(lut_rows_ * lut_cols_);
+
+  // the table is filled by the iterative solver of the camera model
+  use_lut_ = false;
+  for (int i = 0; i < lut_rows_; ++i) {
+    for (int j = 0; j < lut_cols_; ++j) {
+      int k = i * lut_cols_ + j;
+      Vec2 xp{j * step, i * step};
+      lut_xc_[k] = UnProject(xp, &lut_jac_[k]);
+      if (!lut_xc_[k].allFinite() || !lut_jac_[k].allFinite()) {
+        // some models are singular on the axes through the principal point
+        xp(0) += 1e-6;
+        lut_xc_[k] = UnProject(xp, &lut_jac_[k]);
+      }
+    }
+  }
+  use_lut_ = true;
+  LOG(INFO) << StrFormat("undistortion lookup table: %d x %d nodes, step=%0.2f",
+                         lut_rows_, lut_cols_, step);
+}
+
+void CameraManager::ReleaseLUT() {
+  use_lut_ = false;
+  lut_xc_.clear();
+  lut_xc_.shrink_to_fit();
+  lut_jac_.clear();
+  lut_jac_.shrink_to_fit();
+  LOG(INFO) << "intrinsics changed; undistortion lookup table released";
+}
+
+bool CameraManager::LookupUnProject(number_t x, number_t y, Vec2 &xc,
+                                    Mat2 *jac) const {
+  number_t u = x / lut_step_;
+  number_t v = y / lut_step_;
+  if (!(u >= 0 && v >= 0 && u <= lut_cols_ - 1 && v <= lut_rows_ - 1)) {
+    return false;
+  }
+  // top-left node of the cell, the last row/column is handled by the cell
+  // before it
+  int j = std::min(static_cast<int>(u), lut_cols_ - 2);
+  int i = std::min(static_cast<int>(v), lut_rows_ - 2);
+  number_t a = u - j;
+  number_t b = v - i;
+
+  int k00 = i * lut_cols_ + j;
+  int k01 = k00 + 1;
+  int k10 = k00 + lut_cols_;
+  int k11 = k10 + 1;
+  number_t w00 = (1 - a) * (1 - b);
+  number_t w01 = a * (1 - b);
+  number_t w10 = (1 - a) * b;
+  number_t w11 = a * b;
+
+  xc = w00 * lut_xc_[k00] + w01 * lut_xc_[k01] + w10 * lut_xc_[k10] +
+       w11 * lut_xc_[k11];
+  if (jac != nullptr) {
+    *jac = w00 * lut_jac_[k00] + w01 * lut_jac_[k01] + w10 * lut_jac_[k10] +
+           w11 * lut_jac_[k11];
+  }
+  return true;
+}
+
+template <typename Model>
+void CameraManager::ProjectKernel(const Model &model, const MatX2 &xc,
+                                  MatX2 &xp, MatX4 *jac) const {
+  Mat2 J;
+  for (int i = 0; i < xc.rows(); ++i) {
+    Vec2 x = xc.row(i).transpose();
+    xp.row(i) = model.Project(x, jac != nullptr ? &J : nullptr).transpose();
+    if (jac != nullptr) {
+      jac->row(i) << J(0, 0), J(0, 1), J(1, 0), J(1, 1);
+    }
+  }
+}
+
+template <typename Model>
+void CameraManager::UnProjectKernel(const Model &model, const MatX2 &xp,
+                                    MatX2 &xc, MatX4 *jac) const {
+  Vec2 x;
+  Mat2 J;
+  for (int i = 0; i < xp.rows(); ++i) {
+    if (!use_lut_ ||
+        !LookupUnProject(xp(i, 0), xp(i, 1), x, jac != nullptr ? &J : nullptr)) {
+      x = model.UnProject(Vec2{xp.row(i).transpose()},
+                          jac != nullptr ? &J : nullptr);
+    }
+    xc.row(i) = x.transpose();
+    if (jac != nullptr) {
+      jac->row(i) << J(0, 0), J(0, 1), J(1, 0), J(1, 1);
+    }
+  }
+}
+
+MatX2 CameraManager::ProjectBatch(const MatX2 &xc, MatX4 *jac) const {
+  MatX2 xp(xc.rows(), 2);
+  if (jac != nullptr) {
+    jac->resize(xc.rows(), 4);
+  }
+
+  if (std::holds_alternative<Pinhole>(model_)) {
+    // affine, evaluated column by column
+    xp.col(0) = (fx_ * xc.col(0)).array() + cx_;
+    xp.col(1) = (fy_ * xc.col(1)).array() + cy_;
+    if (jac != nullptr) {
+      jac->col(0).setConstant(fx_);
+      jac->col(1).setZero();
+      jac->col(2).setZero();
+      jac->col(3).setConstant(fy_);
+    }
+  } else if (std::holds_alternative<ATAN>(model_)) {
+    ProjectKernel(std::get<ATAN>(model_), xc, xp, jac);
+  } else if (std::holds_alternative<EquiDist>(model_)) {
+    ProjectKernel(std::get<EquiDist>(model_), xc, xp, jac);
+  } else if (std::holds_alternative<RadTan>(model_)) {
+    ProjectKernel(std::get<RadTan>(model_), xc, xp, jac);
+  } else {
+    LOG(FATAL) << "unknown camera model";
+  }
+  return xp;
+}
+
+MatX2 CameraManager::ProjectPoints(const MatX3 &Xc, MatX4 *jac) const {
+  MatX2 xc = Xc.leftCols<2>().array().colwise() / Xc.col(2).array();
+  return ProjectBatch(xc, jac);
+}
+
+MatX2 CameraManager::UnProjectBatch(const MatX2 &xp, MatX4 *jac) const {
+  MatX2 xc(xp.rows(), 2);
+  if (jac != nullptr) {
+    jac->resize(xp.rows(), 4);
+  }
+
+  if (std::holds_alternative<Pinhole>(model_)) {
+    xc.col(0) = (xp.col(0).array() - cx_) / fx_;
+    xc.col(1) = (xp.col(1).array() - cy_) / fy_;
+    if (jac != nullptr) {
+      jac->col(0).setConstant(1 / fx_);
+      jac->col(1).setZero();
+      jac->col(2).setZero();
+      jac->col(3).setConstant(1 / fy_);
+    }
+  } else if (std::holds_alternative<ATAN>(model_)) {
+    UnProjectKernel(std::get<ATAN>(model_), xp, xc, jac);
+  } else if (std::holds_alternative<EquiDist>(model_)) {
+    UnProjectKernel(std::get<EquiDist>(model_), xp, xc, jac);
+  } else if (std::holds_alternative<RadTan>(model_)) {
+    UnProjectKernel(std::get<RadTan>(model_), xp, xc, jac);
+  } else {
+    LOG(FATAL) << "unknown camera model";
+  }
+  return xc;
 }
 
 } // namespace xivo
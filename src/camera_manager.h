@@ -3,9 +3,11 @@
 #pragma once
 #include <ostream>
 #include <variant>
+#include <vector>
 
 #include "camera_autocalib.h"
 #include "alias.h"
+#include "context.h"
 #include "glog/logging.h"
 #include "utils.h"
 #include "json/json.h"
@@ -24,7 +26,9 @@ public:
   using Pinhole = A_PinholeCamera;
 
   static CameraManager *Create(const Json::Value &cfg);
-  static CameraManager *instance() { return instance_.get(); }
+  static CameraManager *instance() {
+    return EstimatorContext::current()->camera_manager_.get();
+  }
 
   // project a point from camera coordinatex xc to pixel coordinates xp.
   // xc: a point in camera coordinates.
@@ -61,6 +65,19 @@ public:
       LOG(FATAL) << "jacobian w.r.t. camera intrinsics (jacc) NOT implemented";
     }
 
+    if (use_lut_) {
+      Vec2 xc;
+      Mat2 dxc_dxp;
+      if (LookupUnProject(xp(0), xp(1), xc,
+                          jac != nullptr ? &dxc_dxp : nullptr)) {
+        if (jac != nullptr) {
+          *jac = dxc_dxp.cast<typename Derived::Scalar>();
+        }
+        return xc.cast<typename Derived::Scalar>();
+      }
+      // outside of the table: fall through to the iterative solver
+    }
+
     if (std::holds_alternative<ATAN>(model_)) {
       return std::get<ATAN>(model_).UnProject(xp, jac, jacc);
     } else if (std::holds_alternative<EquiDist>(model_)) {
@@ -74,6 +91,23 @@ public:
     }
   }
 
+  // Batched versions of Project and UnProject on points stored row-wise.
+  // The camera model is resolved once per batch instead of once per point,
+  // so the per-point kernel of each model is inlined into a tight loop.
+  // jac: if given, row i holds the 2x2 jacobian of point i in row-major
+  // order, i.e., [J(0,0), J(0,1), J(1,0), J(1,1)].
+
+  // project rows of xc (camera coordinates after perspective division) to
+  // pixel coordinates.
+  MatX2 ProjectBatch(const MatX2 &xc, MatX4 *jac = nullptr) const;
+
+  // project rows of Xc (3D points in the camera frame) to pixel coordinates.
+  // jac, if given, is the jacobian w.r.t. Xc/Z (see ProjectBatch).
+  MatX2 ProjectPoints(const MatX3 &Xc, MatX4 *jac = nullptr) const;
+
+  // unproject rows of xp (pixel coordinates) to camera coordinates.
+  MatX2 UnProjectBatch(const MatX2 &xp, MatX4 *jac = nullptr) const;
+
   void Print(std::ostream &out) const {
     if (std::holds_alternative<ATAN>(model_)) {
       std::get<ATAN>(model_).Print(out);
@@ -100,6 +134,10 @@ public:
     } else {
       LOG(FATAL) << "unknown camera model";
     }
+    // the lookup table is stale once the intrinsics change
+    if (use_lut_) {
+      ReleaseLUT();
+    }
     // also update intrinsics for the camera manager ...
     fx_ += dX(0);
     fy_ += dX(1);
@@ -116,6 +154,8 @@ public:
   number_t cx() const { return cx_; }
   number_t cy() const { return cy_; }
   int dim() const { return dim_; }
+  /** Whether `UnProject` currently reads from the undistortion lookup table. */
+  bool use_lut() const { return use_lut_; }
 
   Vec9 GetIntrinsics() { 
     if (std::holds_alternative<ATAN>(model_)) {
@@ -178,13 +218,36 @@ private:
   CameraManager(const CameraManager &) = delete;
 
   CameraManager(const Json::Value &cfg);
-  static std::unique_ptr<CameraManager> instance_;
+
+  /** Tabulates the (iterative) unprojection and its jacobian on a regular
+   *  pixel grid with spacing `step` covering the image. */
+  void BuildLUT(number_t step);
+  /** Drops the lookup table; `UnProject` falls back to the camera model. */
+  void ReleaseLUT();
+  /** Bilinear interpolation of the lookup table at pixel (x, y). Returns
+   *  false if the pixel is not covered by the table. */
+  bool LookupUnProject(number_t x, number_t y, Vec2 &xc, Mat2 *jac) const;
+
+  /** Per-model kernels of `ProjectBatch` and `UnProjectBatch`. */
+  template <typename Model>
+  void ProjectKernel(const Model &model, const MatX2 &xc, MatX2 &xp,
+                     MatX4 *jac) const;
+  template <typename Model>
+  void UnProjectKernel(const Model &model, const MatX2 &xp, MatX2 &xc,
+                       MatX4 *jac) const;
 
   int rows_, cols_;
   number_t fx_, fy_, cx_, cy_;
   number_t fl_; // focal length
   std::variant<Unknown, ATAN, EquiDist, RadTan, Pinhole> model_;
   int dim_; // number of intrinsic parameters
+
+  // undistortion lookup table
+  bool use_lut_;
+  number_t lut_step_;
+  int lut_rows_, lut_cols_; // number of grid nodes
+  std::vector<Vec2, Eigen::aligned_allocator<Vec2>> lut_xc_;
+  std::vector<Mat2, Eigen::aligned_allocator<Mat2>> lut_jac_;
 };
 
 } // namespace xivo
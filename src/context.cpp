@@ -0,0 +1,53 @@
+#include "context.h"
+#include "camera_manager.h"
+#include "estimator.h"
+#include "feature.h"
+#include "frame_pool.h"
+#include "graph.h"
+#include "mapper.h"
+#include "mm.h"
+#include "param.h"
+#include "tracker.h"
+#include "visualize.h"
+
+namespace xivo {
+
+EstimatorContext::EstimatorContext()
+    : feature_counter_{Feature::counter0}, group_counter_{0} {}
+
+EstimatorContext::~EstimatorContext() {
+  // components reach each other through instance() while shutting down
+  Scope scope{this};
+  // the estimator first: it flushes the canvas, and its worker thread uses
+  // everything else
+  estimator_.reset();
+  canvas_.reset();
+  window_optimizer_.reset();
+  optimizer_.reset();
+  mapper_.reset();
+  graph_.reset();
+  tracker_.reset();
+  frame_pool_.reset();
+  memory_manager_.reset();
+  camera_manager_.reset();
+  parameter_server_.reset();
+}
+
+std::unique_ptr<EstimatorContext>
+EstimatorContext::Create(const Json::Value &cfg, bool tracker_only) {
+  auto context = std::make_unique<EstimatorContext>();
+  Scope scope{context.get()};
+  if (tracker_only) {
+    CreateSystemTrackerOnly(cfg);
+  } else {
+    CreateSystem(cfg);
+  }
+  return context;
+}
+
+EstimatorContext *EstimatorContext::Default() {
+  static EstimatorContext context;
+  return &context;
+}
+
+} // namespace xivo
@@ -0,0 +1,102 @@
+// Everything one instance of the system owns: the estimator and the
+// components it reaches through their instance() functions.
+#pragma once
+#include <memory>
+
+#include "json/json.h"
+
+namespace xivo {
+
+class ParameterServer;
+class CameraManager;
+class MemoryManager;
+class FramePool;
+class Tracker;
+class Graph;
+class Mapper;
+class Optimizer;
+class WindowOptimizer;
+class Canvas;
+class Estimator;
+
+/** Owns the components of one system, which used to be process-wide
+ * singletons. `X::instance()` and `X::Create()` resolve to the context bound
+ * to the calling thread by a `Scope`, or to the process-wide default context
+ * if none is, so a single system works as before without ever mentioning a
+ * context.
+ *
+ * Several systems run in one process by giving each its own context, and
+ * binding it in every thread calling into the system. The threads of the
+ * system itself (asynchronous estimator, canvas renderer, EstimatorProcess)
+ * bind it on their own, and so does the estimator for incoming measurements.
+ * Accessors called from elsewhere need the caller's Scope. */
+class EstimatorContext {
+public:
+  EstimatorContext();
+  ~EstimatorContext();
+
+  /** A new context holding the system built from `cfg` as CreateSystem (or
+   * CreateSystemTrackerOnly) would. */
+  static std::unique_ptr<EstimatorContext> Create(const Json::Value &cfg,
+                                                  bool tracker_only = false);
+
+  /** The context of the calling thread. */
+  static EstimatorContext *current() { return bound_ ? bound_ : Default(); }
+  static EstimatorContext *Default();
+
+  /** Binds a context to the calling thread until destroyed; scopes nest. */
+  class Scope {
+  public:
+    explicit Scope(EstimatorContext *context) : previous_{bound_} {
+      bound_ = context;
+    }
+    ~Scope() { bound_ = previous_; }
+
+  private:
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+    EstimatorContext *previous_;
+  };
+
+  /** nullptr until created. */
+  Estimator *estimator() const { return estimator_.get(); }
+
+  /** Ids of new features and groups, unique within the system. */
+  int NewFeatureId() { return feature_counter_++; }
+  int NewGroupId() { return group_counter_++; }
+
+private:
+  EstimatorContext(const EstimatorContext &) = delete;
+  EstimatorContext &operator=(const EstimatorContext &) = delete;
+
+  friend class ParameterServer;
+  friend class CameraManager;
+  friend class MemoryManager;
+  friend class FramePool;
+  friend class Tracker;
+  friend class Graph;
+  friend class Mapper;
+  friend class Optimizer;
+  friend class WindowOptimizer;
+  friend class Canvas;
+  friend class Estimator;
+
+  static inline thread_local EstimatorContext *bound_{nullptr};
+
+  std::unique_ptr<ParameterServer> parameter_server_;
+  std::unique_ptr<CameraManager> camera_manager_;
+  std::unique_ptr<MemoryManager> memory_manager_;
+  std::unique_ptr<FramePool> frame_pool_;
+  std::unique_ptr<Tracker> tracker_;
+  std::unique_ptr<Graph> graph_;
+  std::unique_ptr<Mapper> mapper_;
+  // shared_ptr: deleted by the optional optimizer library, not by ours
+  std::shared_ptr<Optimizer> optimizer_;
+  std::shared_ptr<WindowOptimizer> window_optimizer_;
+  std::unique_ptr<Canvas> canvas_;
+  std::unique_ptr<Estimator> estimator_;
+
+  int feature_counter_, group_counter_;
+};
+
+} // namespace xivo
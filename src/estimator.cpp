@@ -16,6 +16,7 @@
 #include "tracker.h"
 #include "helpers.h"
 #include "mapper.h"
+#include "trace.h"
 
 #ifdef USE_G2O
 #include "optimizer.h"
@@ -23,22 +24,22 @@
 
 namespace xivo {
 
-std::unique_ptr<Estimator> Estimator::instance_{nullptr};
-
 EstimatorPtr Estimator::Create(const Json::Value &cfg) {
-  if (instance_) {
+  auto &instance = EstimatorContext::current()->estimator_;
+  if (instance) {
     LOG(WARNING) << "Estimator already exists!";
   } else {
-    instance_ = std::unique_ptr<Estimator>(new Estimator{cfg});
+    instance = std::unique_ptr<Estimator>(new Estimator{cfg});
   }
-  return instance_.get();
+  return instance.get();
 }
 
 EstimatorPtr Estimator::instance() {
-  if (!instance_) {
+  auto &instance = EstimatorContext::current()->estimator_;
+  if (!instance) {
     LOG(FATAL) << "Estimator NOT created yet!";
   }
-  return instance_.get();
+  return instance.get();
 }
 
 static const Mat3 I3{Mat3::Identity()};
@@ -46,16 +47,32 @@ static const Mat3 nI3{-I3};
 static const Mat2 I2{Mat2::Identity()};
 static const Mat2 nI2{-I2};
 
-static bool cmp(const std::unique_ptr<internal::Message> &m1,
-                const std::unique_ptr<internal::Message> &m2) {
-  return m1->ts() > m2->ts();
-}
 
 namespace internal {
 void Inertial::Execute(Estimator *est) {
   est->InertialMeasInternal(ts_, gyro_, accel_);
 }
 
+void InertialBatch::Execute(Estimator *est) {
+  XIVO_TRACE_FRAME("imu/batch", int(end_ - begin_));
+  for (size_t i = begin_; i < end_; ++i) {
+    const InertialSample &s = (*samples_)[i];
+    est->InertialMeasInternal(s.ts, s.gyro, s.accel);
+  }
+}
+
+std::unique_ptr<Message> InertialBatch::Split(const timestamp_t &ts) {
+  // keep at least the first sample
+  auto it = std::upper_bound(
+      samples_->begin() + begin_ + 1, samples_->begin() + end_, ts,
+      [](const timestamp_t &t, const InertialSample &s) { return t < s.ts; });
+  size_t mid = it - samples_->begin();
+  if (mid == end_) return nullptr;
+  auto rest = std::make_unique<InertialBatch>(samples_, mid, end_);
+  end_ = mid;
+  return rest;
+}
+
 void Visual::Execute(Estimator *est) { est->VisualMeasInternal(ts_, img_); }
 
 void VisualTrackerOnly::Execute(Estimator *est) { est->VisualMeasInternalTrackerOnly(ts_, img_); }
@@ -90,14 +107,30 @@ Estimator::~Estimator() {
   }
 
   if (worker_) {
+    buf_->Close();
     worker_->join();
     delete worker_;
   }
+  if (use_canvas_) {
+    // the renderer may still be drawing the last frames
+    Canvas::instance()->Flush();
+  }
+
+  if (!profiler_trace_path_.empty()) {
+    profiler_.WriteChromeTrace(profiler_trace_path_);
+  }
+  if (!profiler_report_path_.empty()) {
+    SaveJson(profiler_.ToJson(), profiler_report_path_);
+  }
+  if (!trace_dump_path_.empty()) {
+    TraceBuffer::instance()->Dump(trace_dump_path_);
+  }
 }
 
 Estimator::Estimator(const Json::Value &cfg)
-    : cfg_{cfg}, gauge_group_{-1}, worker_{nullptr}, timer_{"estimator"},
-      gauge_group_ptr_{nullptr} {
+    : context_{EstimatorContext::current()}, cfg_{cfg}, gauge_group_{-1},
+      worker_{nullptr}, profiler_{"estimator"}, gauge_group_ptr_{nullptr},
+      print_counter_{0} {
 
   // /////////////////////////////
   // Component flags
@@ -105,8 +138,34 @@ Estimator::Estimator(const Json::Value &cfg)
   simulation_ = cfg_.get("simulation", false).asBool();
   use_canvas_ = cfg_.get("use_canvas", true).asBool();
   print_timing_ = cfg_.get("print_timing", false).asBool();
+  const auto &profiler_cfg = cfg_["profiler"];
+  profiler_.set_budget_ms(profiler_cfg.get("budget_ms", 0.0).asDouble());
+  profiler_.set_trace_capacity(profiler_cfg.get("trace_capacity", 0).asInt());
+  profiler_trace_path_ = profiler_cfg.get("trace", "").asString();
+  profiler_report_path_ = profiler_cfg.get("report", "").asString();
+  // events below XIVO_TRACE_LEVEL are compiled out, see trace.h
+  const auto &trace_cfg = cfg_["trace"];
+  if (trace_cfg.isMember("capacity")) {
+    TraceBuffer::instance()->set_capacity(trace_cfg["capacity"].asInt());
+  }
+  trace_dump_path_ = trace_cfg.get("dump", "").asString();
+  if (cfg_.isMember("telemetry")) {
+    telemetry_writer_ = std::make_unique<TelemetryWriter>(cfg_["telemetry"]);
+  }
+  if (!trace_dump_path_.empty() &&
+      trace_cfg.get("dump_on_signal", false).asBool()) {
+    // kill -USR1 <pid> dumps the recent events without stopping
+    TraceBuffer::instance()->DumpOnSignal(SIGUSR1, trace_dump_path_);
+  }
   integration_method_ =
       cfg_.get("integration_method", "unspecified").asString();
+  rk4_stepsize_ = cfg_["RK4"].get("stepsize", 0.002).asDouble();
+  const auto &pd_cfg = cfg_["PrinceDormand"];
+  pd_.control_stepsize = pd_cfg.get("control_stepsize", false).asBool();
+  pd_.tolerance = pd_cfg.get("tolerance", 1e-3).asDouble();
+  pd_.min_scale_factor = pd_cfg.get("min_scale_factor", 0.125).asDouble();
+  pd_.max_scale_factor = pd_cfg.get("max_scale_factor", 4.0).asDouble();
+  pd_.h = pd_.h0 = pd_cfg.get("stepsize", 0.002).asDouble();
 
   // OOS update options
   use_OOS_ = cfg_.get("use_OOS", false).asBool();
@@ -392,6 +451,14 @@ Estimator::Estimator(const Json::Value &cfg)
   rng_ = std::unique_ptr<std::default_random_engine>(
       new std::default_random_engine);
 
+  last_Rsc_valid_ = false;
+
+  // IMU and visual streams are merged by timestamp; a stream lagging more than
+  // buffer_latency_ms behind is not waited for
+  buf_ = std::make_unique<ReorderBuffer<internal::Message>>(NUM_STREAMS,
+      std::chrono::milliseconds(cfg_.get("buffer_latency_ms", 50).asInt()),
+      cfg_.get("buffer_capacity", 512).asInt());
+  buffer_images_ = cfg_.get("buffer_images", 4).asInt();
   async_run_ = cfg_.get("async_run", false).asBool();
   if (async_run_) {
     Run();
@@ -400,20 +467,11 @@ Estimator::Estimator(const Json::Value &cfg)
 
 void Estimator::Run() {
   worker_ = new std::thread([this]() {
-    for (;;) {
-      std::unique_ptr<internal::Message> msg;
-      {
-        std::scoped_lock lck(buf_.mtx);
-        if (buf_.initialized && buf_.size() > InternalBuffer::MAX_SIZE) {
-          msg = std::move(buf_.front());
-          std::pop_heap(buf_.begin(), buf_.end(), cmp);
-          buf_.pop_back();
-        }
-      }
-      if (msg != nullptr) {
-        // std::cout << "executing\n";
-        msg->Execute(this);
-      }
+    EstimatorContext::Scope scope{context_};
+    // sleeps until a message can be released, returns once closed
+    while (auto msg = buf_->Pop(true)) {
+      msg->Execute(this);
+      TraceBuffer::instance()->DumpIfRequested();
     }
   });
 }
@@ -464,10 +522,9 @@ void Estimator::InertialMeasInternal(const timestamp_t &ts, const Vec3 &gyro,
   Vec3 gyro_new;
   Vec3 accel_new;
 
-  Vec3 grav_s = X_.Rsg * g_;
-  Vec3 grav_b = X_.Rsb.inv() * grav_s;
-
   if (clamp_signals_) {
+    Vec3 grav_s = X_.Rsg * g_;
+    Vec3 grav_b = X_.Rsb.inv() * grav_s;
 
     Vec3 accel_wout_grav = accel + grav_b;
 
@@ -524,7 +581,7 @@ void Estimator::Propagate(bool visual_meas) {
       << "state progagation with un-initialized imu module";
 #endif
 
-  timer_.Tick("propagation");
+  XIVO_PROFILE_SCOPE(profiler_, "propagation");
 
   number_t dt;
   Vec3 accel0, gyro0; // initial condition for integration
@@ -570,7 +627,6 @@ void Estimator::Propagate(bool visual_meas) {
   }
 
   P_.block<kMotionSize, kMotionSize>(0, 0).noalias() += Qmodel_;
-  timer_.Tock("propagation");
 }
 
 void Estimator::Fehlberg(const Vec3 &gyro0, const Vec3 &accel0, number_t dt) {
@@ -725,7 +781,7 @@ void Estimator::RemoveGroupFromState(GroupPtr g) {
   CHECK(gsel_[g->sind()]) << "Group not in state?!";
 #endif
 
-  VLOG(0) << "removing group #" << g->id();
+  XIVO_TRACE_FRAME("state/remove-group", g->id(), g->sind());
   // change the covariance and error state
   int index = g->sind();
 
@@ -751,7 +807,7 @@ void Estimator::RemoveFeatureFromState(FeaturePtr f) {
   CHECK(fsel_[f->sind()]) << "Feature not in state?!";
 #endif
 
-  VLOG(0) << "removing feature #" << f->id();
+  XIVO_TRACE_FEATURE("state/remove-feature", f->id(), f->sind());
   int index = f->sind();
 
   fsel_[index] = false;
@@ -797,8 +853,7 @@ void Estimator::AddGroupToState(GroupPtr g) {
     P_.block(0, offset + 3, err_.size(), 3) =
         P_.block(0, Index::Tsb, err_.size(), 3);
 
-    VLOG(0) << StrFormat("group #%d inserted @ %d/%d", g->id(), index,
-                               kMaxGroup);
+    XIVO_TRACE_FRAME("state/add-group", g->id(), index);
   } else {
     throw std::runtime_error("Failed to find slot in state for group.");
   }
@@ -820,8 +875,7 @@ void Estimator::AddFeatureToState(FeaturePtr f) {
     f->SetStatus(FeatureStatus::INSTATE);
     f->SetSind(index);
     f->FillCovarianceBlock(P_);
-    VLOG(0) << StrFormat("feature #%d inserted @ %d/%d", f->id(), index,
-                               kMaxFeature);
+    XIVO_TRACE_FEATURE("state/add-feature", f->id(), index);
   } else {
     throw std::runtime_error("Failed to find slot in state for feature.");
   }
@@ -902,24 +956,35 @@ void Estimator::AbsorbError() {
   err_.setZero();
 }
 
-void Estimator::MaintainBuffer() {
-  if (!buf_.initialized) {
-    if (buf_.size() >= InternalBuffer::MAX_SIZE) {
-      std::make_heap(buf_.begin(), buf_.end(), cmp);
-      buf_.initialized = true;
+void Estimator::Push(Stream stream, std::unique_ptr<internal::Message> msg) {
+  buf_->Push(stream, std::move(msg));
+  if (!async_run_) {
+    // execute here, in whichever thread feeds us
+    EstimatorContext::Scope scope{context_};
+    while (auto released = buf_->Pop(false)) {
+      released->Execute(this);
+      TraceBuffer::instance()->DumpIfRequested();
     }
-  } else {
-    std::push_heap(buf_.begin(), buf_.end(), cmp);
   }
+}
 
-  if (!async_run_) {
-    // execute here
-    if (buf_.initialized && buf_.size() > InternalBuffer::MAX_SIZE) {
-      buf_.front()->Execute(this);
-      std::pop_heap(buf_.begin(), buf_.end(), cmp);
-      buf_.pop_back();
+void Estimator::Finish() {
+  EstimatorContext::Scope scope{context_};
+  buf_->Close();
+  if (worker_) {
+    // the worker drains the closed buffer before it returns
+    worker_->join();
+    delete worker_;
+    worker_ = nullptr;
+    async_run_ = false;
+  } else {
+    while (auto released = buf_->Pop(false)) {
+      released->Execute(this);
     }
   }
+  if (use_canvas_) {
+    Canvas::instance()->Flush();
+  }
 }
 
 void Estimator::VisualMeas(const timestamp_t &ts_raw, const cv::Mat &img) {
@@ -931,14 +996,7 @@ void Estimator::VisualMeas(const timestamp_t &ts_raw, const cv::Mat &img) {
     ts -= timestamp_t(uint64_t(-X_.td * 1e9)); // seconds -> nanoseconds
   }
 #endif
-  if (async_run_) {
-    std::scoped_lock lck(buf_.mtx);
-    buf_.push_back(std::make_unique<internal::Visual>(ts, img));
-    MaintainBuffer();
-  } else {
-    buf_.push_back(std::make_unique<internal::Visual>(ts, img));
-    MaintainBuffer();
-  }
+  Push(VISUAL, std::make_unique<internal::Visual>(ts, img));
 }
 
 void Estimator::VisualMeasTrackerOnly(const timestamp_t &ts_raw, const cv::Mat &img) {
@@ -950,14 +1008,7 @@ void Estimator::VisualMeasTrackerOnly(const timestamp_t &ts_raw, const cv::Mat &
     ts -= timestamp_t(uint64_t(-X_.td * 1e9)); // seconds -> nanoseconds
   }
 #endif
-  if (async_run_) {
-    std::scoped_lock lck(buf_.mtx);
-    buf_.push_back(std::make_unique<internal::VisualTrackerOnly>(ts, img));
-    MaintainBuffer();
-  } else {
-    buf_.push_back(std::make_unique<internal::VisualTrackerOnly>(ts, img));
-    MaintainBuffer();
-  }
+  Push(VISUAL, std::make_unique<internal::VisualTrackerOnly>(ts, img));
 }
 
 
@@ -974,16 +1025,8 @@ void Estimator::VisualMeasPointCloud(
     ts -= timestamp_t(uint64_t(-X_.td * 1e9)); // seconds -> nanoseconds
   }
 #endif
-  if (async_run_) {
-    std::scoped_lock lck(buf_.mtx);
-    buf_.push_back(std::make_unique<internal::VisualPointCloud>(
-      ts, feature_ids, xp_vals));
-    MaintainBuffer();
-  } else {
-    buf_.push_back(std::make_unique<internal::VisualPointCloud>(
+  Push(VISUAL, std::make_unique<internal::VisualPointCloud>(
       ts, feature_ids, xp_vals));
-    MaintainBuffer();
-  }
 }
 
 
@@ -1000,16 +1043,8 @@ void Estimator::VisualMeasPointCloudTrackerOnly(
     ts -= timestamp_t(uint64_t(-X_.td * 1e9)); // seconds -> nanoseconds
   }
 #endif
-  if (async_run_) {
-    std::scoped_lock lck(buf_.mtx);
-    buf_.push_back(std::make_unique<internal::VisualPointCloudTrackerOnly>(
+  Push(VISUAL, std::make_unique<internal::VisualPointCloudTrackerOnly>(
       ts, feature_ids, xp_vals));
-    MaintainBuffer();
-  } else {
-    buf_.push_back(std::make_unique<internal::VisualPointCloudTrackerOnly>(
-      ts, feature_ids, xp_vals));
-    MaintainBuffer();
-  }
 
 }
 
@@ -1017,14 +1052,20 @@ void Estimator::VisualMeasPointCloudTrackerOnly(
 
 void Estimator::InertialMeas(const timestamp_t &ts, const Vec3 &gyro,
                              const Vec3 &accel) {
-  if (async_run_) {
-    std::scoped_lock lck(buf_.mtx);
-    buf_.push_back(std::make_unique<internal::Inertial>(ts, gyro, accel));
-    MaintainBuffer();
-  } else {
-    buf_.push_back(std::make_unique<internal::Inertial>(ts, gyro, accel));
-    MaintainBuffer();
-  }
+  Push(INERTIAL, std::make_unique<internal::Inertial>(ts, gyro, accel));
+}
+
+void Estimator::InertialMeas(std::vector<InertialSample> samples) {
+  if (samples.empty()) return;
+  size_t num_samples = samples.size();
+  Push(INERTIAL, std::make_unique<internal::InertialBatch>(
+      std::make_shared<const std::vector<InertialSample>>(std::move(samples)),
+      0, num_samples));
+}
+
+void Estimator::InertialMeas(const InertialSample *samples,
+                             size_t num_samples) {
+  InertialMeas(std::vector<InertialSample>(samples, samples + num_samples));
 }
 
 
@@ -1038,20 +1079,20 @@ void Estimator::VisualMeasInternalTrackerOnly(const timestamp_t &ts, const cv::M
   }
 
   ++vision_counter_;
-  timer_.Tick("visual-meas-tracker-only");
+  XIVO_PROFILE_FRAME(profiler_, "visual-meas-tracker-only");
   UpdateSystemClock(ts);
 
   if (use_canvas_) {
-    Canvas::instance()->Update(img);
+    Canvas::instance()->Update(img, ts);
   }
   auto tracker = Tracker::instance();
 
   // track features
-  timer_.Tick("track");
+  profiler_.Begin(XIVO_PROFILE_ID("track"));
   tracker->Update(img);
-  timer_.Tock("track");
+  profiler_.End();
   // process features
-  timer_.Tick("process-tracks");
+  profiler_.Begin(XIVO_PROFILE_ID("process-tracks"));
 
   if (use_canvas_) {
     for (auto f : tracker->features_)
@@ -1070,26 +1111,24 @@ void Estimator::VisualMeasInternalTrackerOnly(const timestamp_t &ts, const cv::M
     }
   }
 
-  static int print_counter{0};
-  if (print_timing_ && ++print_counter % 50 == 0) {
-    std::cout << print_counter << std::endl;
-    std::cout << timer_;
+  if (print_timing_ && ++print_counter_ % 50 == 0) {
+    std::cout << print_counter_ << std::endl;
+    std::cout << profiler_;
   }
 
-  // Save the frame (only if set to true in json file)
-  Canvas::instance()->SaveFrame();
+  // drawn (and saved if set in json file) by the renderer thread
+  Canvas::instance()->Submit();
 
-  timer_.Tock("process-tracks");
+  profiler_.End();
 
   if (gauge_group_ == -1) {
     SwitchRefGroup();
   }
-  timer_.Tock("visual-meas-tracker-only");
 }
 
 void Estimator::VisualMeasInternal(const timestamp_t &ts, const cv::Mat &img) {
   if (!GoodTimestamp(ts)) {
-    std::cout << "Dropping a visual frame because its timestamp was delayed too far back in the past. Make MESSAGE_BUFFER_SIZE bigger." << std::endl;
+    std::cout << "Dropping a visual frame because its timestamp was delayed too far back in the past. Make buffer_latency_ms bigger." << std::endl;
     return;
   }
   if (simulation_) {
@@ -1098,31 +1137,40 @@ void Estimator::VisualMeasInternal(const timestamp_t &ts, const cv::Mat &img) {
   }
 
   ++vision_counter_;
-  timer_.Tick("visual-meas");
+  XIVO_PROFILE_FRAME(profiler_, "visual-meas");
+  ResetTelemetry(ts);
   UpdateSystemClock(ts);
   if (vision_initialized_) {
     // propagate state upto current timestamp
     Propagate(true);
     if (use_canvas_) {
-      Canvas::instance()->Update(img);
+      Canvas::instance()->Update(img, ts);
     }
     // measurement prediction for feature tracking
     auto tracker = Tracker::instance();
     Predict(tracker->features_);
+    // rotation prior for outlier rejection in the tracker
+    Mat3 Rsc = gsc().R().matrix();
+    if (last_Rsc_valid_) {
+      tracker->SetRelativeRotation(Rsc.transpose() * last_Rsc_);
+    }
     // track features
-    timer_.Tick("track");
+    profiler_.Begin(XIVO_PROFILE_ID("track"));
     tracker->Update(img);
-    timer_.Tock("track");
+    profiler_.End();
     // process features
-    timer_.Tick("process-tracks");
+    profiler_.Begin(XIVO_PROFILE_ID("process-tracks"));
     ProcessTracks(ts, tracker->features_);
-    timer_.Tock("process-tracks");
+    profiler_.End();
 
     if (gauge_group_ == -1) {
       SwitchRefGroup();
     }
+    last_Rsc_ = gsc().R().matrix();
+    last_Rsc_valid_ = true;
   }
-  timer_.Tock("visual-meas");
+  FinishTelemetry();
+  PublishSnapshot();
 }
 
 
@@ -1140,31 +1188,33 @@ void Estimator::VisualMeasPointCloudInternal(
   }
 
   ++vision_counter_;
-  timer_.Tick("visual-meas");
+  XIVO_PROFILE_FRAME(profiler_, "visual-meas");
+  ResetTelemetry(ts);
   UpdateSystemClock(ts);
   if (vision_initialized_) {
     // propagate state upto current timestamp
     Propagate(true);
     if (use_canvas_) {
-      Canvas::instance()->UpdatePointCloud(xps);
+      Canvas::instance()->UpdatePointCloud(xps, ts);
     }
     // measurement prediction for feature tracking
     auto tracker = Tracker::instance();
     Predict(tracker->features_);
     // track features
-    timer_.Tick("track");
+    profiler_.Begin(XIVO_PROFILE_ID("track"));
     tracker->UpdatePointCloud(feature_ids, xps);
-    timer_.Tock("track");
+    profiler_.End();
     // process features
-    timer_.Tick("process-tracks");
+    profiler_.Begin(XIVO_PROFILE_ID("process-tracks"));
     ProcessTracks(ts, tracker->features_);
-    timer_.Tock("process-tracks");
+    profiler_.End();
 
     if (gauge_group_ == -1) {
       SwitchRefGroup();
     }
   }
-  timer_.Tock("visual-meas");
+  FinishTelemetry();
+  PublishSnapshot();
 }
 
 
@@ -1182,18 +1232,18 @@ void Estimator::VisualMeasPointCloudInternalTrackerOnly(
   }
 
   ++vision_counter_;
-  timer_.Tick("visual-meas-tracker-only");
+  XIVO_PROFILE_FRAME(profiler_, "visual-meas-tracker-only");
   UpdateSystemClock(ts);
 
   if (use_canvas_) {
-    Canvas::instance()->UpdatePointCloud(xps);
+    Canvas::instance()->UpdatePointCloud(xps, ts);
   }
 
   auto tracker = Tracker::instance();
   // track features
-  timer_.Tick("track");
+  profiler_.Begin(XIVO_PROFILE_ID("track"));
   tracker->UpdatePointCloud(feature_ids, xps);
-  timer_.Tock("track");
+  profiler_.End();
 
   if (use_canvas_) {
     for (auto f: tracker->features_)
@@ -1212,20 +1262,47 @@ void Estimator::VisualMeasPointCloudInternalTrackerOnly(
     }
   }
 
-  // Save the frame (only if set to true in json file)
-  Canvas::instance()->SaveFrame();
+  // drawn (and saved if set in json file) by the renderer thread
+  Canvas::instance()->Submit();
 
   if (gauge_group_ == -1) {
     SwitchRefGroup();
   }
 
-  timer_.Tock("visual-meas-tracker-only");
 }
 
 
 void Estimator::Predict(std::list<FeaturePtr> &features) {
+  if (!Tracker::instance()->UsePredictionCovariance()) {
+    Feature::PredictBatch({features.begin(), features.end()}, gsb(), gbc());
+    return;
+  }
   for (auto f : features) {
-    f->Predict(gsb(), gbc());
+    f->Predict(gsb(), gbc(), &P_);
+  }
+}
+
+void Estimator::ResetTelemetry(const timestamp_t &ts) {
+  telemetry_ = Telemetry{};
+  telemetry_.ts = ts;
+  telemetry_.frame = vision_counter_;
+  telemetry_start_ = std::chrono::steady_clock::now();
+}
+
+void Estimator::FinishTelemetry() {
+  telemetry_.latency_ms = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - telemetry_start_).count();
+  telemetry_.num_tracked = Tracker::instance()->features_.size();
+  telemetry_.num_instate_features = instate_features_.size();
+  telemetry_.num_instate_groups = instate_groups_.size();
+  auto mm = MemoryManager::instance();
+  telemetry_.num_active_features = mm->num_active_features();
+  telemetry_.max_features = mm->max_features();
+  telemetry_.num_active_groups = mm->num_active_groups();
+  telemetry_.max_groups = mm->max_groups();
+  telemetry_.buffer_depth = buf_->size();
+  if (telemetry_writer_) {
+    telemetry_writer_->Write(telemetry_);
   }
 }
 
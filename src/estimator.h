@@ -21,12 +21,17 @@
 #include "json/json.h"
 
 #include "component.h"
+#include "context.h"
 #include "core.h"
 #include "graph.h"
 #include "imu.h"
 #include "tracker.h"
 #include "visualize.h"
 #include "mapper.h"
+#include "message_buffer.h"
+#include "profiler.h"
+#include "snapshot.h"
+#include "telemetry.h"
 
 namespace xivo {
 
@@ -34,6 +39,18 @@ class Estimator;
 using EstimatorPtr = Estimator*;
 EstimatorPtr CreateSystem(const Json::Value &cfg);
 EstimatorPtr CreateSystemTrackerOnly(const Json::Value &cfg);
+/** `cfg` for runs in batch, e.g., by the benchmark and the sweep: without
+ *  the canvas, timing printouts, profiler reports, trace or telemetry, which
+ *  concurrent runs would fight over and which would skew their latency, and
+ *  with measurements processed on the calling thread. */
+Json::Value BatchEstimatorCfg(Json::Value cfg);
+
+
+/** One inertial measurement of a batch. */
+struct InertialSample {
+  timestamp_t ts;
+  Vec3 gyro, accel;
+};
 
 
 namespace internal {
@@ -44,6 +61,11 @@ public:
   virtual ~Message() = default;
   virtual void Execute(EstimatorPtr) {}
 
+  /** Batches span [ts(), last_ts()] and may be split by the reorder buffer,
+   * see `ReorderBuffer`. Other messages are never split. */
+  virtual timestamp_t last_ts() const { return ts_; }
+  virtual std::unique_ptr<Message> Split(const timestamp_t &) { return nullptr; }
+
 protected:
   timestamp_t ts_;
 };
@@ -54,6 +76,8 @@ public:
   void Execute(EstimatorPtr est);
 
 private:
+  /** Shallow reference to the frame; the pixels are never copied. The frame
+   *  retires to the `FramePool` once the message is destroyed. */
   cv::Mat img_;
 };
 
@@ -63,6 +87,7 @@ public:
   void Execute(EstimatorPtr est);
 
 private:
+  /** Shallow reference to the frame, see `Visual`. */
   cv::Mat img_;
 };
 
@@ -109,6 +134,23 @@ private:
   Vec3 gyro_, accel_;
 };
 
+/** Samples [begin, end) of a batch of inertial measurements. Split batches
+ * share the samples. */
+class InertialBatch : public Message {
+public:
+  InertialBatch(std::shared_ptr<const std::vector<InertialSample>> samples,
+                size_t begin, size_t end)
+      : Message{(*samples)[begin].ts}, samples_{std::move(samples)},
+        begin_{begin}, end_{end} {}
+  void Execute(EstimatorPtr est);
+  timestamp_t last_ts() const override { return (*samples_)[end_ - 1].ts; }
+  std::unique_ptr<Message> Split(const timestamp_t &ts) override;
+
+private:
+  std::shared_ptr<const std::vector<InertialSample>> samples_;
+  size_t begin_, end_;
+};
+
 } // namespace internal
 
 
@@ -118,6 +160,7 @@ class Estimator : public Component<Estimator, State> {
   friend class internal::VisualPointCloud;
   friend class internal::VisualPointCloudTrackerOnly;
   friend class internal::Inertial;
+  friend class internal::InertialBatch;
 
 public:
   static EstimatorPtr Create(const Json::Value &cfg);
@@ -131,6 +174,10 @@ public:
   void Run();
   // process inertial measurements
   void InertialMeas(const timestamp_t &ts, const Vec3 &gyro, const Vec3 &accel);
+  // process a batch of inertial measurements in non-decreasing timestamp
+  // order at once: one message, propagated in a single loop
+  void InertialMeas(std::vector<InertialSample> samples);
+  void InertialMeas(const InertialSample *samples, size_t num_samples);
   // perform tracking/matching to generate tracks
   void VisualMeas(const timestamp_t &ts_raw, const cv::Mat &img);
   // perform tracking/matching for feature tracker only application
@@ -143,6 +190,12 @@ public:
   void VisualMeasPointCloudTrackerOnly(const timestamp_t &ts,
                                        const VecXi &feature_ids,
                                        const MatX2 &xps);
+  /** End of the input: process the measurements still held by the reorder
+   *  buffer, regardless of lateness, and wait for the canvas to draw them.
+   *  Afterwards nothing references the images passed in, which may then be
+   *  released (e.g., frames mapped from a recording). Later measurements are
+   *  processed as they come, in the calling thread. */
+  void Finish();
 
 
   /** Loop Closure Measurement Update - older features, newer group. */
@@ -178,8 +231,26 @@ public:
   Vec3 inn_Vsb() const { return inn_.segment(Index::Vsb,3); }
   bool MeasurementUpdateInitialized() const { return MeasurementUpdateInitialized_; }
   int gauge_group() const { return gauge_group_; }
+  const Profiler &profiler() const { return profiler_; }
+  /** Bind with EstimatorContext::Scope to call into the estimator from a
+   *  thread other than its own, see EstimatorContext. */
+  EstimatorContext *context() const { return context_; }
+  /** Statistics of the last visual measurement, read from its snapshot.
+   *  Safe to call from any thread. */
+  Telemetry telemetry() const {
+    auto s = snapshot();
+    return s ? s->telemetry : Telemetry{};
+  }
+  /** State after the last visual measurement, nullptr before the first one.
+   *  Safe to call from any thread, never blocks the estimator. */
+  StateSnapshotPtr snapshot() const { return snapshot_.latest(); }
   int num_instate_features() const { return instate_features_.size(); };
   int num_instate_groups() const {return instate_groups_.size(); };
+  /** Most images referenced downstream of whatever feeds the estimator: those
+   *  held back by the reorder buffer ("buffer_images"), the one processed,
+   *  the tracker's and the canvas'. A frame pool decoded into ahead of time
+   *  needs this many buffers on top of its lookahead. */
+  int max_images_held() const;
   MatX3 InstateFeaturePositions(int n_output) const;
   MatX3 InstateFeaturePositions() const;
   MatX6 InstateFeatureCovs(int n_output) const;
@@ -310,7 +381,6 @@ private:
 
 private:
   Estimator(const Json::Value &cfg);
-  static std::unique_ptr<Estimator> instance_;
 
 private:
   std::vector<FeaturePtr> instate_features_; ///< in-state features
@@ -330,11 +400,19 @@ private:
   int group_degrees_fixed_;
 
 private:
+  EstimatorContext *context_;  // where the estimator and its components live
   Config cfg_;        // this is just a reference of the global parameter server
   bool simulation_;   // estimator used in simulation or not
   bool use_canvas_;   // visualization or not
   bool print_timing_; // show timing info
   std::string integration_method_; ///< motion integration numerical scheme
+  number_t rk4_stepsize_;          ///< negative for a single step
+  struct {
+    bool control_stepsize;
+    number_t tolerance, min_scale_factor, max_scale_factor;
+    number_t h, h0;  ///< adaptive and initial step sizes
+  } pd_;                           ///< Prince-Dormand options and step size
+  int print_counter_;
 
   /** Whether or not to sue 1-pt RANSAC in outlier rejection. */
   bool use_1pt_RANSAC_;
@@ -482,6 +560,11 @@ private:
   Vec3 last_accel_, last_gyro_; // accel & gyro measurement at last_time
   Vec3 slope_accel_, slope_gyro_;
 
+  /** Camera orientation at the last visual measurement, used to predict the
+   *  inter-frame rotation for outlier rejection in the tracker. */
+  Mat3 last_Rsc_;
+  bool last_Rsc_valid_;
+
   bool gravity_initialized_, vision_initialized_;
   int imu_counter_, vision_counter_;
   int strict_criteria_timesteps_;
@@ -493,27 +576,35 @@ private:
   int gravity_init_counter_;
   std::vector<Vec3> gravity_init_buf_; // buffer of accel measurements for
                                        // gravity initialization
-  // measurements buffer
-  struct InternalBuffer
-      : public std::vector<std::unique_ptr<internal::Message>> {
-#ifdef MESSAGE_BUFFER_SIZE
-    static constexpr int MAX_SIZE = MESSAGE_BUFFER_SIZE;
-#else
-    static constexpr int MAX_SIZE = 10;
-#endif
-    InternalBuffer() : initialized{false} {}
-    std::mutex mtx;
-    bool initialized;
-  } buf_;
+  // measurements buffer: IMU and visual streams merged by timestamp
+  enum Stream : int { INERTIAL = 0, VISUAL, NUM_STREAMS };
+  std::unique_ptr<ReorderBuffer<internal::Message>> buf_;
+  int buffer_images_;  // images expected to wait in buf_ at most
   bool async_run_; // if true, run in a separate thread
-  void MaintainBuffer();
+  /** Queue a message and, unless running asynchronously, execute whatever the
+   * buffer releases. */
+  void Push(Stream stream, std::unique_ptr<internal::Message> msg);
 
   own<std::thread *> worker_;
 
-  /** Computes the running average time for dynamics propatagion, visual measurement
-   *  processing, tracker, update tracker, jacobian, MH gating. (Those quantities
-   *  overlap). */
-  Timer timer_;
+  /** Latency of dynamics propagation, visual measurement processing, tracker,
+   *  update, jacobian, MH gating, ... as a tree of nested scopes; one visual
+   *  measurement is one frame of the budget. */
+  Profiler profiler_;
+  std::string profiler_trace_path_, profiler_report_path_;
+  /** Where to dump the traced events (see trace.h) upon destruction. */
+  std::string trace_dump_path_;
+
+  /** Filled along the processing of each visual measurement. */
+  Telemetry telemetry_;
+  std::chrono::steady_clock::time_point telemetry_start_;
+  std::unique_ptr<TelemetryWriter> telemetry_writer_;
+  void ResetTelemetry(const timestamp_t &ts);
+  void FinishTelemetry();
+
+  /** Double-buffered state published after each visual measurement. */
+  SnapshotBuffer<StateSnapshot> snapshot_;
+  void PublishSnapshot();
   std::unique_ptr<std::default_random_engine> rng_;
 
   /** store tracked feature information -
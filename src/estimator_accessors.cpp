@@ -1,5 +1,7 @@
 #include "estimator.h"
 
+#include <limits>
+
 #include <opencv2/core/eigen.hpp>
 
 
@@ -476,4 +478,48 @@ std::vector<std::tuple<int, Vec2f, MatXf>> Estimator::tracked_features() {
 }
 
 
+int Estimator::max_images_held() const {
+  // the image being processed and the one the tracker keeps
+  int images = buffer_images_ + 2;
+  if (use_canvas_) {
+    images += Canvas::kMaxInputImages + Canvas::kMaxDisplayImages;
+  }
+  return images;
+}
+
+
+void Estimator::PublishSnapshot() {
+  StateSnapshot &s = snapshot_.back();
+  s.version = snapshot_.version() + 1;
+  s.ts = curr_time_;
+
+  s.X = X_;
+  s.Ca = imu_.Ca();
+  s.Cg = imu_.Cg();
+  s.gsb = gsb();
+  s.gbc = gbc();
+  s.gsc = gsc();
+  // only the blocks publishers need, never the full covariance
+  s.Pstate = P_.block<kMotionSize, kMotionSize>(0, 0);
+  s.CameraCov = CameraCov();
+  s.measurement_update_initialized = MeasurementUpdateInitialized_;
+  if (MeasurementUpdateInitialized_) {
+    s.inn_Wsb = inn_Wsb();
+    s.inn_Tsb = inn_Tsb();
+    s.inn_Vsb = inn_Vsb();
+  }
+  s.gauge_group = gauge_group_;
+
+  int npts;
+  InstateFeaturePositionsAndCovs(std::numeric_limits<int>::max(), npts,
+    s.feature_positions, s.feature_covs, s.feature_pixels, s.feature_ids);
+  s.group_ids = InstateGroupIDs();
+  s.group_poses = InstateGroupPoses();
+  s.group_covs = InstateGroupCovs();
+  s.telemetry = telemetry_;
+
+  snapshot_.Publish();
+}
+
+
 }
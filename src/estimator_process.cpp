@@ -1,3 +1,5 @@
+// stl
+#include <algorithm>
 // 3rdparty
 #include "opencv2/highgui/highgui.hpp"
 // xivo
@@ -5,6 +7,9 @@
 #include "tracker.h"
 #include "visualize.h"
 #include "core.h"
+#ifdef USE_G2O
+#include "optimizer.h"
+#endif
 
 namespace xivo {
 
@@ -15,8 +20,8 @@ bool operator<(const std::unique_ptr<EstimatorMessage> &m1,
 
 void EstimatorProcess::Initialize(const std::string &config_path) {
   auto est_cfg = LoadJson(config_path);
-  // estimator_ = std::unique_ptr<Estimator>(new Estimator{est_cfg});
-  estimator_ = CreateSystem(est_cfg);
+  context_ = EstimatorContext::Create(est_cfg);
+  estimator_ = context_->estimator();
 }
 
 /*
@@ -33,69 +38,75 @@ bool EstimatorProcess::Handle(EstimatorMessage *message) {
   if (Process::Handle(message))
     return true;
 
+  EstimatorContext::Scope scope{context_.get()};
   message->Execute(estimator_);
 
   if (auto msg = dynamic_cast<VisualMeas *>(message)) {
-    // FIXME: instead of drawing on the canvas in the estimator
-    // the estimator can pass state and feature tracks to the publisher
-    // and let the publisher draw stuff.
-    // However, the publisher should live in its own thread, otherwise,
-    // the drawing is still performed in the current (estimator_process) thread,
-    // and will not make it more efficient.
+    // The canvas draws in its own thread: this is the most recent image it
+    // finished, possibly a frame or two behind.
     if (msg->viz() && publisher_ != nullptr) {
       publisher_->Publish(msg->ts(), Canvas::instance()->display());
     }
 
+    // every publisher reads the same snapshot: no full covariance copy, and
+    // the estimator may already be working on the next frame. Results are
+    // stamped with the time of the snapshot, not of the message; a message
+    // the estimator dropped or has not processed yet leaves the last
+    // snapshot in place, which is not published twice.
+    auto snapshot = estimator_->snapshot();
+    if (!snapshot || snapshot->version == published_version_) {
+      return true;
+    }
+    published_version_ = snapshot->version;
+
+    if (telemetry_publisher_ != nullptr) {
+      telemetry_publisher_->Publish(snapshot->ts, snapshot->telemetry);
+    }
+
     if (pose_publisher_ != nullptr) {
-      MatX fullcov = estimator_->Pstate();
-      Mat6 posecov = fullcov.block<6,6>(0,0);
-      pose_publisher_->Publish(msg->ts(), estimator_->gsb(), posecov);
+      Mat6 posecov = snapshot->Pstate.block<6,6>(0,0);
+      pose_publisher_->Publish(snapshot->ts, snapshot->gsb, posecov);
     }
 
     if (map_publisher_ != nullptr) {
-      Eigen::Matrix<number_t, Eigen::Dynamic, 3> InstateXs;
-      Eigen::Matrix<number_t, Eigen::Dynamic, 6> InstateCov;
-      Eigen::Matrix<number_t, Eigen::Dynamic, 2> InstatePx;
-      VecXi feature_ids;
-      int npts;
-      estimator_->InstateFeaturePositionsAndCovs(max_pts_to_publish_, npts,
-        InstateXs, InstateCov, InstatePx, feature_ids);
-      map_publisher_->Publish(msg->ts(), npts, InstateXs, InstateCov,
-        InstatePx, feature_ids);
+      int npts = std::min<int>(max_pts_to_publish_, snapshot->feature_ids.size());
+      map_publisher_->Publish(snapshot->ts, npts,
+        snapshot->feature_positions.topRows(npts),
+        snapshot->feature_covs.topRows(npts),
+        snapshot->feature_pixels.topRows(npts),
+        snapshot->feature_ids.head(npts));
     }
 
     if (full_state_publisher_ != nullptr) {
-      bool MeasurementsInitialized = estimator_->MeasurementUpdateInitialized();
-      Vec3 inn_Wsb;
-      Vec3 inn_Tsb;
-      Vec3 inn_Vsb;
-      if (MeasurementsInitialized) {
-        inn_Wsb = estimator_->inn_Wsb();
-        inn_Tsb = estimator_->inn_Tsb();
-        inn_Vsb = estimator_->inn_Vsb();
-      }
-
-      MatX CameraCov = estimator_->CameraCov();
-
       full_state_publisher_->Publish(
-        msg->ts(),
-        estimator_->X(),
-        estimator_->Ca(),
-        estimator_->Cg(),
-        estimator_->Pstate(),
-        MeasurementsInitialized,
-        inn_Wsb,
-        inn_Tsb,
-        inn_Vsb,
-        estimator_->gauge_group(),
-        estimator_->gsc(),
-        CameraCov);
+        snapshot->ts,
+        snapshot->X,
+        snapshot->Ca,
+        snapshot->Cg,
+        snapshot->Pstate,
+        snapshot->measurement_update_initialized,
+        snapshot->inn_Wsb,
+        snapshot->inn_Tsb,
+        snapshot->inn_Vsb,
+        snapshot->gauge_group,
+        snapshot->gsc,
+        snapshot->CameraCov);
     }
 
     if (twod_nav_publisher_ != nullptr) {
-      twod_nav_publisher_->Publish(msg->ts(), estimator_->gsb(),
-        estimator_->Vsb(), estimator_->Rsg(), estimator_->Pstate());
+      twod_nav_publisher_->Publish(snapshot->ts, snapshot->gsb,
+        snapshot->X.Vsb, snapshot->X.Rsg, snapshot->Pstate);
+    }
+
+#ifdef USE_G2O
+    if (corrected_pose_publisher_ != nullptr) {
+      auto optimizer = Optimizer::instance();
+      if (optimizer->corrected_poses_version() != corrected_poses_version_) {
+        auto poses = optimizer->GetCorrectedPoses(&corrected_poses_version_);
+        corrected_pose_publisher_->Publish(snapshot->ts, poses);
+      }
     }
+#endif
 
     return true;
   } else if (auto msg = dynamic_cast<InertialMeas *>(message)) {
@@ -5,9 +5,11 @@
 // stl
 #include <fstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 // xivo
 #include "alias.h"
+#include "context.h"
 #include "estimator.h"
 #include "message_types.h"
 #include "process.h"
@@ -32,6 +34,10 @@ public:
     const SE3 &gsc, const MatX &CameraCov) {}
   virtual void Publish(const timestamp_t &ts, const SE3 &gsb, const Vec3 &Vsb,
     const SO3 &Rg, const MatX &Cov) {}
+  virtual void Publish(const timestamp_t &ts, const Telemetry &telemetry) {}
+  // body-to-spatial poses of groups corrected by the back-end, keyed by id
+  virtual void Publish(const timestamp_t &ts,
+    const std::unordered_map<int, SE3> &poses) {}
 };
 
 class EstimatorMessage {
@@ -81,9 +87,14 @@ private:
 class EstimatorProcess : public Process<EstimatorMessage> {
 public:
   EstimatorProcess(const std::string &name, uint32_t size = 1000)
-      : Process{size}, name_{name}, estimator_{nullptr}, publisher_{nullptr} {
+      : Process{size}, name_{name}, estimator_{nullptr}, publisher_{nullptr},
+        pose_publisher_{nullptr}, map_publisher_{nullptr},
+        full_state_publisher_{nullptr}, twod_nav_publisher_{nullptr},
+        telemetry_publisher_{nullptr}, corrected_pose_publisher_{nullptr},
+        published_version_{0}, corrected_poses_version_{0} {
     LOG(INFO) << "Process " << name_ << " created!";
   }
+  ~EstimatorProcess() { Stop(); }
   void Initialize(const std::string &config_path);
   void SetPublisher(Publisher *publisher) { publisher_ = publisher; }
   void SetPosePublisher(Publisher *publisher) { pose_publisher_ = publisher; }
@@ -97,12 +108,23 @@ public:
   void Set2dNavStatePublisher(Publisher *publisher) {
     twod_nav_publisher_ = publisher;
   }
+  void SetTelemetryPublisher(Publisher *publisher) {
+    telemetry_publisher_ = publisher;
+  }
+  // each round of the back-end optimizer is published once, only with the
+  // groups it re-optimized; needs USE_G2O
+  void SetCorrectedPosePublisher(Publisher *publisher) {
+    corrected_pose_publisher_ = publisher;
+  }
 
   ////////////////////////////////////////
   // used for synchronized communication
   // call wait first, and then call the available accessors
   ////////////////////////////////////////
-  cv::Mat display() { return Canvas::instance()->display(); }
+  cv::Mat display() {
+    EstimatorContext::Scope scope{context_.get()};
+    return Canvas::instance()->display();
+  }
   // only call the following accessors when the process is properly synced
   SE3 gsb() const { return estimator_->gsb(); }
   SE3 gbc() const { return estimator_->gbc(); }
@@ -116,8 +138,9 @@ private:
 
 private:
   std::string name_;
-  // std::unique_ptr<Estimator> estimator_; // owned
-  EstimatorPtr estimator_; // owned
+  // the system of this process, independent of any other in the process
+  std::unique_ptr<EstimatorContext> context_;
+  EstimatorPtr estimator_; // owned by context_
   // results publisher for asynchronized communication for viewer
   Publisher *publisher_; // non-owned
   // results publisher for asynchronized communication for pose and map.
@@ -125,7 +148,13 @@ private:
   Publisher *map_publisher_;
   Publisher *full_state_publisher_;
   Publisher *twod_nav_publisher_;
+  Publisher *telemetry_publisher_;
+  Publisher *corrected_pose_publisher_;
   int max_pts_to_publish_;
+  // version of the last snapshot handed to the publishers
+  uint64_t published_version_;
+  // version of the last corrected poses handed to the publisher
+  int corrected_poses_version_;
 };                       // EstimatorProcess
 
 } // namespace xivo
@@ -1,7 +1,9 @@
 // factory method to create a system
 // Author: Xiaohan Fei (feixh@cs.ucla.edu)
 #include "param.h"
+#include "context.h"
 #include "camera_manager.h"
+#include "frame_pool.h"
 #include "mm.h"
 #include "tracker.h"
 #include "graph.h"
@@ -10,15 +12,15 @@
 
 #ifdef USE_G2O
 #include "optimizer.h"
+#include "window_optimizer.h"
 #endif
 
 namespace xivo {
 
 EstimatorPtr CreateSystem(const Json::Value &cfg) {
-  static bool system_created{false};
-
-  if (system_created) {
-    return Estimator::instance();
+  // one system per context
+  if (auto estimator = EstimatorContext::current()->estimator()) {
+    return estimator;
   }
 
   // Initialize paramter server
@@ -37,6 +39,11 @@ EstimatorPtr CreateSystem(const Json::Value &cfg) {
                         cfg["memory"].get("max_groups", 128).asInt());
   LOG(INFO) << "Memory management unit created";
 
+  // Initialize the pool of image buffers; apps streaming a dataset grow it to
+  // the loader lookahead plus Estimator::max_images_held()
+  FramePool::Create(cfg["memory"].get("max_frames", 8).asInt());
+  LOG(INFO) << "Frame pool created";
+
   // Initialize tracker
   auto tracker_cfg = cfg["tracker_cfg"].isString()
                          ? LoadJson(cfg["tracker_cfg"].asString())
@@ -61,6 +68,8 @@ EstimatorPtr CreateSystem(const Json::Value &cfg) {
   // Initialize the optimizer
   Optimizer::Create(cfg["optimizer"]);
   LOG(INFO) << "Optimizer created";
+  WindowOptimizer::Create(cfg["window_optimizer"]);
+  LOG(INFO) << "WindowOptimizer created";
 #endif
 
   // Initialize the estimator
@@ -76,17 +85,14 @@ EstimatorPtr CreateSystem(const Json::Value &cfg) {
   }
 #endif
 
-  system_created = true;
-
   return Estimator::instance();
 }
 
 
 EstimatorPtr CreateSystemTrackerOnly(const Json::Value &cfg) {
-  static bool system_created{false};
-
-  if (system_created) {
-    return Estimator::instance();
+  // one system per context
+  if (auto estimator = EstimatorContext::current()->estimator()) {
+    return estimator;
   }
 
   // Initialize paramter server
@@ -105,6 +111,11 @@ EstimatorPtr CreateSystemTrackerOnly(const Json::Value &cfg) {
                         cfg["memory"].get("max_groups", 128).asInt());
   LOG(INFO) << "Memory management unit created";
 
+  // Initialize the pool of image buffers; apps streaming a dataset grow it to
+  // the loader lookahead plus Estimator::max_images_held()
+  FramePool::Create(cfg["memory"].get("max_frames", 8).asInt());
+  LOG(INFO) << "Frame pool created";
+
   // Initialize tracker
   auto tracker_cfg = cfg["tracker_cfg"].isString()
                          ? LoadJson(cfg["tracker_cfg"].asString())
@@ -116,10 +127,20 @@ EstimatorPtr CreateSystemTrackerOnly(const Json::Value &cfg) {
   Estimator::Create(cfg);
   LOG(INFO) << "Estimator created";
 
-  system_created = true;
-
   return Estimator::instance();
 }
 
+
+Json::Value BatchEstimatorCfg(Json::Value cfg) {
+  cfg["use_canvas"] = false;
+  cfg["async_run"] = false;
+  cfg["print_timing"] = false;
+  cfg["profiler"]["trace"] = "";
+  cfg["profiler"]["report"] = "";
+  cfg.removeMember("trace");
+  cfg.removeMember("telemetry");
+  return cfg;
+}
+
  
 } // namespace xivo
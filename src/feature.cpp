@@ -1,5 +1,6 @@
 #include <algorithm>
 
+#include "context.h"
 #include "estimator.h"
 #include "feature.h"
 #include "group.h"
@@ -8,16 +9,16 @@
 #include "param.h"
 #include "alias.h"
 #include "rodrigues.h"
+#include "trace.h"
 
 #include "glog/logging.h"
 
 namespace xivo {
 
 // Feature
-int Feature::counter_ = Feature::counter0;
-int Feature::num_good_triangulations_ = 0;
-int Feature::num_bad_triangulations_ = 0;
-JacobianCache Feature::cache_ = {};
+std::atomic<int> Feature::num_good_triangulations_{0};
+std::atomic<int> Feature::num_bad_triangulations_{0};
+thread_local JacobianCache Feature::cache_ = {};
 
 // Operations for FeatureAdj
 void FeatureAdj::Add(const Observation &obs) { insert({obs.g->id(), obs.xp}); }
@@ -64,7 +65,7 @@ void Feature::Destroy(FeaturePtr f) {
 }
 
 void Feature::Reset(number_t x, number_t y) {
-  id_ = counter_++;
+  id_ = EstimatorContext::current()->NewFeatureId();
   sind_ = -1;
   init_counter_ = 0;
   lifetime_ = 0;
@@ -73,6 +74,7 @@ void Feature::Reset(number_t x, number_t y) {
   Track::Reset(x, y);
   x_ << x, y, 2.0;
   pred_ << -1, -1;
+  pred_cov_.setZero();
   J_.setZero();
   inn_ << 0, 0;
   outlier_counter_ = 0;
@@ -117,6 +119,88 @@ Vec3 Feature::Xs(const SE3 &gbc, Mat3 *J) {
   return Xs_;
 }
 
+const Vec2 &Feature::Predict(const SE3 &gsb, const SE3 &gbc, const MatX *P) {
+  SE3 gcs = (gsb * gbc).inv();
+  if (!P) {
+    Vec3 Xc = gcs * this->Xs(gbc);
+    pred_ = Camera::instance()->Project(project(Xc));
+    return pred_;
+  }
+
+  // Jacobians of Xc = Rbc' * (Rsb' * (Xs - Tsb) - Tbc), with
+  // Xs = Rsbr * (Rbc * Xr + Tbc) + Tsbr and Xr the point in the reference
+  // camera, w.r.t. the error state at zero (right perturbations of the
+  // rotations as in ComputeJacobian)
+  const Mat3 Rsb = gsb.R().matrix(), Rbc = gbc.R().matrix();
+  const Mat3 Rsbr = ref_->Rsb();
+  const Vec3 Tsb = gsb.T(), Tbc = gbc.T();
+  const Mat3 Rcs = Rbc.transpose() * Rsb.transpose();
+
+  Mat3 dXr_dx;
+  Vec3 Xr = Xc(&dXr_dx);
+  Vec3 Xb_ref = Rbc * Xr + Tbc;
+  Vec3 Xs = Rsbr * Xb_ref + ref_->Tsb();
+  Vec3 Xb = Rsb.transpose() * (Xs - Tsb);
+  Vec3 Xcn = Rbc.transpose() * (Xb - Tbc);
+
+  Mat23 dxc_dXc;
+  Mat2 dxp_dxc;
+  pred_ = Camera::instance()->Project(project(Xcn, &dxc_dXc), &dxp_dxc);
+  Mat23 dxp_dXc = dxp_dxc * dxc_dXc;
+
+  // offsets in the error state and 2x3 Jacobians of the blocks involved
+  int offset[7];
+  Mat23 J[7];
+  int n = 0;
+  offset[n] = Index::Wsb;
+  J[n++] = dxp_dXc * Rbc.transpose() * hat(Xb);
+  offset[n] = Index::Tsb;
+  J[n++] = -dxp_dXc * Rcs;
+  offset[n] = Index::Wbc;
+  J[n++] = dxp_dXc * (hat(Rbc.transpose() * (Xb - Tbc)) -
+                      Rcs * Rsbr * Rbc * hat(Xr));
+  offset[n] = Index::Tbc;
+  J[n++] = dxp_dXc * (Rcs * Rsbr - Rbc.transpose());
+  if (ref_->sind() != -1) {
+    int goff = kGroupBegin + kGroupSize * ref_->sind();
+    offset[n] = goff;
+    J[n++] = -dxp_dXc * Rcs * Rsbr * hat(Xb_ref);
+    offset[n] = goff + 3;
+    J[n++] = dxp_dXc * Rcs;
+  }
+  Mat23 dxp_dx = dxp_dXc * Rcs * Rsbr * Rbc * dXr_dx;
+  if (instate()) {
+    offset[n] = kFeatureBegin + kFeatureSize * sind_;
+    J[n++] = dxp_dx;
+  }
+
+  pred_cov_.setZero();
+  for (int a = 0; a < n; ++a) {
+    for (int b = 0; b < n; ++b) {
+      pred_cov_ += J[a] * P->block<3, 3>(offset[a], offset[b]) *
+                   J[b].transpose();
+    }
+  }
+  if (!instate()) {
+    // the depth subfilter, independent of the filter state
+    pred_cov_ += dxp_dx * P_ * dxp_dx.transpose();
+  }
+  return pred_;
+}
+
+void Feature::PredictBatch(const std::vector<FeaturePtr> &features,
+                           const SE3 &gsb, const SE3 &gbc) {
+  SE3 gcs = (gsb * gbc).inv();
+  MatX3 Xc(features.size(), 3);
+  for (int i = 0; i < features.size(); ++i) {
+    Xc.row(i) = (gcs * features[i]->Xs(gbc)).transpose();
+  }
+  MatX2 xp = Camera::instance()->ProjectPoints(Xc);
+  for (int i = 0; i < features.size(); ++i) {
+    features[i]->pred_ = xp.row(i).transpose();
+  }
+}
+
 number_t Feature::z() const {
 #ifdef USE_INVDEPTH
   return 1.0 / x_(2);
@@ -165,21 +249,13 @@ void Feature::SetRef(GroupPtr ref) {
   CHECK(ref_ == nullptr) << "reference already set!";
 #endif
   // be very careful when reset references
-  VLOG(0) << "ref group# " << ref->id() << " -> feature #" << id_;
+  XIVO_TRACE_FEATURE("feature/set-ref", id_, ref->id());
   ref_ = ref;
 }
 
 void Feature::ResetRef(GroupPtr nref) {
-
-  std::string str;
-  if (nref == nullptr) {
-    str = "nullptr";
-  } else {
-    str = "#" + std::to_string(nref->id());
-  }
-
-  VLOG(0) << "feature #" << id_ << " reset ref from #" << ref_->id() << " to "
-          << str;
+  // -1 for nullptr
+  XIVO_TRACE_FEATURE("feature/reset-ref", id_, nref ? nref->id() : -1);
 
   ref_ = nref;
 }
@@ -199,9 +275,10 @@ bool Feature::Merge(FeaturePtr f, const SE3& gbc) {
     for (auto px: *f) {
       UpdateTrack(px);
     }
-    // Merge descriptors
-    for (auto desc: f->GetAllDescriptors()) {
-      descriptors_.push_back(desc);
+    // Merge descriptors, along with the words already known
+    for (int i = 0; i < f->NumDescriptors(); ++i) {
+      descriptors_.push_back(f->GetAllDescriptors()[i]);
+      word_ids_.push_back(f->CachedWordId(i));
     }
   }
   return success;
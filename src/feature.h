@@ -1,7 +1,9 @@
 // The feature class.
 // Author: Xiaohan Fei (feixh@cs.ucla.edu)
 #pragma once
+#include <atomic>
 #include <functional>
+#include <limits>
 #include <memory>
 #include <ostream>
 #include <unordered_map>
@@ -13,6 +15,7 @@
 #include "options.h"
 #include "project.h"
 #include "fastbrief.h"
+#include "DBoW2/BowVector.h"
 
 namespace xivo {
 
@@ -37,13 +40,18 @@ public:
   /** Deletes the entire history of tracks and starts a new vector. */
   void Reset(number_t x, number_t y) {
     clear();
+    descriptors_.clear();
+    word_ids_.clear();
     status_ = TrackStatus::CREATED;
     push_back(Vec2(x, y));
   }
 
   TrackStatus status() const { return status_; }
   void SetStatus(TrackStatus status) { status_ = status; }
-  void SetDescriptor(const cv::Mat &descriptor) { descriptors_.push_back(descriptor); }
+  void SetDescriptor(const cv::Mat &descriptor) {
+    descriptors_.push_back(descriptor);
+    word_ids_.push_back(kNoWord);
+  }
   void SetKeypoint(const cv::KeyPoint &keypoint) { keypoint_ = keypoint; }
   const cv::KeyPoint &keypoint() const { return keypoint_; }
   cv::KeyPoint &keypoint() { return keypoint_; }
@@ -53,6 +61,25 @@ public:
   FastBrief::TDescriptor GetDBoWDesc();
   std::vector<FastBrief::TDescriptor> GetAllDBoWDesc();
 
+  /** Placeholder for a descriptor not yet transformed to a vocabulary word. */
+  static constexpr DBoW2::WordId kNoWord =
+    std::numeric_limits<DBoW2::WordId>::max();
+  /** Returns the vocabulary word of descriptor `i`. The descriptor is only
+   *  transformed by `voc` the first time. */
+  template <typename Vocabulary>
+  DBoW2::WordId GetWordId(int i, const Vocabulary &voc) {
+    if (word_ids_[i] == kNoWord) {
+      word_ids_[i] = voc.transform((FastBrief::TDescriptor)descriptors_[i].data);
+    }
+    return word_ids_[i];
+  }
+  /** Cached vocabulary word of descriptor `i`, `kNoWord` if not known yet. */
+  DBoW2::WordId CachedWordId(int i) const { return word_ids_[i]; }
+  /** Stores the word of descriptor `i` transformed elsewhere, e.g., on the
+   *  loop closure thread. */
+  void SetWordId(int i, DBoW2::WordId word_id) { word_ids_[i] = word_id; }
+  int NumDescriptors() const { return descriptors_.size(); }
+
 protected:
   /** CREATED, TRACKED, REJECTED, or DROPPED */
   TrackStatus status_;
@@ -62,6 +89,8 @@ protected:
 
   /** Descriptor of all observations. */
   std::vector<cv::Mat> descriptors_;
+  /** DBoW2 word of each descriptor in `descriptors_`, see `GetWordId`. */
+  std::vector<DBoW2::WordId> word_ids_;
 };
 
 
@@ -112,6 +141,9 @@ public:
   // get 3D coordinates in spatial frame, cam2body alignment is required
   Vec3 Xs(const SE3 &gbc, Mat3 *dXs_dx = nullptr);
   const Vec3& Xs() const { return Xs_; }
+  /** Overwrites the cached position in the spatial frame, e.g., of a feature
+   *  loaded from a map file. */
+  void SetXs(const Vec3 &Xs) { Xs_ = Xs; }
   /** Changes the owner of the feature. Returns false if this results in a
    * negative depth. If change in ownership results in negative depth, no
    * changes in any members of this feature are made. Used when reference
@@ -172,16 +204,27 @@ public:
   /** Returns the last-computed predicted measurement
    *  (does not compute a new prediction) */
   const Vec2 &pred() const { return pred_; }
+  /** Returns the covariance of the last-computed predicted measurement.
+   *  Only valid if `Predict` was called with `with_cov` set. */
+  const Mat2 &pred_cov() const { return pred_cov_; }
   /** Computes a new predicted measurement (in pixels) given transformations
-   *  `gsb` and `gbc` */
-  const Vec2 &Predict(const SE3 &gsb, const SE3 &gbc) {
-    Vec3 Xc = (gsb * gbc).inv() * this->Xs(gbc);
-    pred_ = Camera::instance()->Project(project(Xc));
-    return pred_;
-  }
+   *  `gsb` and `gbc`. Given the covariance `P` of the filter, also computes the
+   *  covariance of the prediction (see `pred_cov()`) from the uncertainty of
+   *  the pose, the camera-body alignment, the reference group and, for
+   *  instate features, the feature itself; features not in the state use the
+   *  covariance `P_` of their depth subfilter instead. */
+  const Vec2 &Predict(const SE3 &gsb, const SE3 &gbc, const MatX *P = nullptr);
+  /** Same as `Predict` without covariance, for all `features` at once: the
+   *  points are projected by a single call to `CameraManager::ProjectPoints`
+   *  instead of dispatching on the camera model per feature. */
+  static void PredictBatch(const std::vector<FeaturePtr> &features,
+                           const SE3 &gsb, const SE3 &gbc);
   /** Sets variable `pred_`, the last computed predicted measurement to (-1,-1),
    *  the default "invalid" value for a predicted measurement. */
-  void ResetPred() { pred_ << -1, -1; }
+  void ResetPred() {
+    pred_ << -1, -1;
+    pred_cov_.setZero();
+  }
 
   ////////////////////////////////////////
   // OOS Jacobians accessors
@@ -221,8 +264,8 @@ public:
   void SetState(const Vec3 &x) { x_ = x; }
   void UpdateState(const Vec3 &dx) { x_ += dx; }
 
-  /** Initial value of static variable `Feature::counter_`/smallest possible number
-   *  used for feature IDs. Its purpose is so that feature IDs and group IDs never
+  /** Initial value of the feature counter of the EstimatorContext/smallest
+   *  possible number used for feature IDs. Its purpose is so that feature IDs and group IDs never
    *  overlap.
    *  \todo Completely separate feature and group IDs so that we don't have
    *        problems if this SLAM code is ever run for a long, long time.  */
@@ -236,12 +279,8 @@ private:
   void Reset(number_t x, number_t y);
 
 private:
-  /** Total number of features ever created (never decremented) +
-   *  (static constexpr) `counter0`. Used for getting ID values of newly created
-   *  features. `counter_` starts at `counter0` so that feature and group IDs
-   *  do not overlap. */
-  static int counter_;
-  /** Feature ID. IDs are in order of creation. */
+  /** Feature ID. IDs are in order of creation within the EstimatorContext,
+   *  starting at `counter0` so that feature and group IDs do not overlap. */
   int id_;
   /** Index of feature in Estimator's array of instate features. Not set until
    *  `status_` is `FeatureStatus::READY`. */
@@ -272,6 +311,8 @@ private:
   /** Predicted pixel coordinates - computed right before the `Estimator` class's
    *  measurement update step in `Feature::Predict`. */
   Vec2 pred_;
+  /** Covariance of `pred_`, see `Feature::Predict`. */
+  Mat2 pred_cov_;
 
   /** 3D coordinates of the feature with respect to the current camera frame. */
   Vec3 Xc_;
@@ -294,8 +335,9 @@ private:
   number_t outlier_counter_;
 
   /** Contains current intermediate variables used to compute the Jacobians in both the
-   *  EKF and MSCKF measurement models. */
-  static JacobianCache cache_;
+   *  EKF and MSCKF measurement models. Per thread, as systems in different
+   *  threads compute their Jacobians concurrently. */
+  static thread_local JacobianCache cache_;
 
   /** Current MSCKF measurement Jacobians (both Hf and Hx) and innovation */
   OOSJacobian oos_;
@@ -320,8 +362,8 @@ private:
 
 public:
   // simulation
-  static int num_good_triangulations_;
-  static int num_bad_triangulations_;
+  static std::atomic<int> num_good_triangulations_;
+  static std::atomic<int> num_bad_triangulations_;
 
   struct {
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <fstream>
+
+#include "glog/logging.h"
+
+#include "context.h"
+#include "frame_pool.h"
+#include "utils.h"
+
+namespace xivo {
+
+// A buffer is free if the pool holds the only reference to it. Other threads
+// drop their references concurrently, so the count is read atomically.
+static bool InUse(const cv::Mat &buf) {
+  return buf.u != nullptr && CV_XADD(&buf.u->refcount, 0) > 1;
+}
+
+FramePoolPtr FramePool::Create(int max_buffers) {
+  auto &instance = EstimatorContext::current()->frame_pool_;
+  if (!instance) {
+    instance = std::unique_ptr<FramePool>(new FramePool(max_buffers));
+    LOG(INFO) << StrFormat("FramePool instance created with %d buffers",
+                           max_buffers);
+  } else {
+    LOG(WARNING) << "FramePool instance already created!";
+  }
+  return instance.get();
+}
+
+FramePoolPtr FramePool::instance() {
+  auto &instance = EstimatorContext::current()->frame_pool_;
+  if (!instance) {
+    throw std::runtime_error("FramePool instance not created yet");
+  }
+  return instance.get();
+}
+
+FramePool::FramePool(int max_buffers)
+    : max_buffers_{max_buffers}, last_rows_{0}, last_cols_{0}, last_type_{-1} {
+  buffers_.reserve(max_buffers_);
+}
+
+cv::Mat FramePool::Acquire(int rows, int cols, int type) {
+  std::scoped_lock lck(mtx_);
+  for (auto &buf : buffers_) {
+    if (!InUse(buf) && buf.rows == rows && buf.cols == cols &&
+        buf.type() == type) {
+      return buf;
+    }
+  }
+
+  cv::Mat img(rows, cols, type);
+  if (buffers_.size() < max_buffers_) {
+    buffers_.push_back(img);
+  } else {
+    // recycle a free buffer of the wrong geometry, if any
+    auto it = std::find_if(buffers_.begin(), buffers_.end(),
+                           [](const cv::Mat &buf) { return !InUse(buf); });
+    if (it != buffers_.end()) {
+      *it = img;
+    } else {
+      LOG_EVERY_N(WARNING, 100)
+          << "FramePool: all " << max_buffers_
+          << " buffers in use; allocating an unpooled frame";
+    }
+  }
+  return img;
+}
+
+void FramePool::Adopt(const cv::Mat &img) {
+  std::scoped_lock lck(mtx_);
+  for (const auto &buf : buffers_) {
+    if (buf.u == img.u) {
+      return;
+    }
+  }
+  if (buffers_.size() < max_buffers_) {
+    buffers_.push_back(img);
+  }
+}
+
+cv::Mat FramePool::Read(const std::string &path, int flags) {
+  std::ifstream in(path, std::ios::in | std::ios::binary | std::ios::ate);
+  if (!in.is_open()) {
+    LOG(WARNING) << "FramePool: failed to open " << path;
+    return cv::Mat();
+  }
+  std::vector<uchar> bytes(in.tellg());
+  in.seekg(0);
+  in.read(reinterpret_cast<char *>(bytes.data()), bytes.size());
+
+  int rows, cols, type;
+  {
+    std::scoped_lock lck(mtx_);
+    rows = last_rows_;
+    cols = last_cols_;
+    type = last_type_;
+  }
+
+  // imdecode writes into `img` in place if the geometry matches, otherwise
+  // it allocates new storage which is then adopted by the pool
+  cv::Mat img;
+  if (type >= 0) {
+    img = Acquire(rows, cols, type);
+  }
+  cv::imdecode(bytes, flags, &img);
+  if (img.empty()) {
+    return img;
+  }
+  if (img.rows != rows || img.cols != cols || img.type() != type) {
+    Adopt(img);
+    std::scoped_lock lck(mtx_);
+    last_rows_ = img.rows;
+    last_cols_ = img.cols;
+    last_type_ = img.type();
+  }
+  return img;
+}
+
+void FramePool::Reserve(int max_buffers) {
+  std::scoped_lock lck(mtx_);
+  if (max_buffers > max_buffers_) {
+    max_buffers_ = max_buffers;
+    buffers_.reserve(max_buffers_);
+  }
+}
+
+int FramePool::size() const {
+  std::scoped_lock lck(mtx_);
+  return buffers_.size();
+}
+
+int FramePool::num_in_use() const {
+  std::scoped_lock lck(mtx_);
+  return std::count_if(buffers_.begin(), buffers_.end(), InUse);
+}
+
+} // namespace xivo
@@ -0,0 +1,63 @@
+// Pool of reusable image buffers.
+// Images enter the system once (from the loader, a numpy buffer or a driver
+// callback) and are afterwards shared by reference -- cv::Mat headers -- by the
+// estimator, tracker and canvas. A buffer retires back to the pool as soon as
+// the last header referencing it goes away, so no explicit release is needed.
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgcodecs/imgcodecs.hpp"
+
+namespace xivo {
+
+class FramePool;
+using FramePoolPtr = FramePool *;
+
+class FramePool {
+public:
+  static FramePoolPtr Create(int max_buffers);
+  static FramePoolPtr instance();
+
+  /** Returns a `rows` x `cols` image of type `type` whose storage is recycled
+   *  from a retired frame if one of matching geometry exists. Pixel values are
+   *  undefined. If all `max_buffers` buffers are in use, a fresh (unpooled)
+   *  image is allocated. */
+  cv::Mat Acquire(int rows, int cols, int type);
+
+  /** Decodes the image file at `path` into a pooled buffer. Same semantics as
+   *  `cv::imread`: returns an empty image if the file cannot be read. */
+  cv::Mat Read(const std::string &path, int flags = cv::IMREAD_COLOR);
+
+  /** Raises the number of buffers the pool may own to at least
+   *  `max_buffers`, e.g., a loader's lookahead plus
+   *  `Estimator::max_images_held()`. Never shrinks the pool. */
+  void Reserve(int max_buffers);
+
+  /** Number of buffers owned by the pool. */
+  int size() const;
+  /** Number of pooled buffers currently referenced outside of the pool. */
+  int num_in_use() const;
+
+private:
+  FramePool() = delete;
+  FramePool(const FramePool &) = delete;
+  FramePool &operator=(const FramePool &) = delete;
+
+  FramePool(int max_buffers);
+
+  /** Takes (shared) ownership of `img` if there is room in the pool. */
+  void Adopt(const cv::Mat &img);
+
+  int max_buffers_;
+  std::vector<cv::Mat> buffers_;
+  /** Geometry of the last decoded frame, used to guess the buffer to decode
+   *  the next file into. */
+  int last_rows_, last_cols_, last_type_;
+  mutable std::mutex mtx_;
+};
+
+} // namespace xivo
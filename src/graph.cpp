@@ -1,30 +1,32 @@
 #include <algorithm>
 
 #include "graph.h"
+#include "context.h"
 #include "estimator.h"
 #include "feature.h"
 #include "group.h"
 #include "param.h"
 #include "geometry.h"
+#include "trace.h"
 
 
 namespace xivo {
 
-std::unique_ptr<Graph> Graph::instance_ = nullptr;
-
 Graph* Graph::Create() {
-  if (instance_ == nullptr) {
-    instance_ = std::unique_ptr<Graph>(new Graph);
+  auto &instance = EstimatorContext::current()->graph_;
+  if (instance == nullptr) {
+    instance = std::unique_ptr<Graph>(new Graph);
   }
-  return instance_.get();
+  return instance.get();
 }
 
 Graph* Graph::instance() {
-  if (instance_ == nullptr) {
+  auto &instance = EstimatorContext::current()->graph_;
+  if (instance == nullptr) {
     LOG(WARNING) << "Graph not created yet! Creating one ...";
     Graph::Create();
   }
-  return instance_.get();
+  return instance.get();
 }
 
 
@@ -34,7 +36,7 @@ void Graph::RemoveFeature(const FeaturePtr f) {
   // Removes feature from `gauge_features_` if it is a gauge feature.
   gauge_features_[f->ref()].erase(f);
 
-  LOG(INFO) << "feature #" << f->id() << " removed from Graph";
+  XIVO_TRACE_FEATURE("graph/remove-feature", f->id());
 }
 
 void Graph::RemoveFeatures(const std::vector<FeaturePtr> &features) {
@@ -46,7 +48,7 @@ void Graph::RemoveFeatures(const std::vector<FeaturePtr> &features) {
 void Graph::RemoveGroup(const GroupPtr g) {
   GraphBase::RemoveGroup(g);
   gauge_features_.erase(g);
-  LOG(INFO) << "group #" << g->id() << " removed from Graph";
+  XIVO_TRACE_FRAME("graph/remove-group", g->id());
 }
 
 void Graph::RemoveGroups(const std::vector<GroupPtr> &groups) {
@@ -57,14 +59,14 @@ void Graph::RemoveGroups(const std::vector<GroupPtr> &groups) {
 
 void Graph::AddFeature(FeaturePtr f) {
   GraphBase::AddFeature(f);
-  LOG(INFO) << "feature #" << f->id() << " added to graph";
+  XIVO_TRACE_FEATURE("graph/add-feature", f->id());
 }
 
 void Graph::AddGroup(GroupPtr g) {
   GraphBase::AddGroup(g);
   gauge_features_[g] = {};
   last_added_group_ = g;
-  LOG(INFO) << "group #" << g->id() << " added to graph";
+  XIVO_TRACE_FRAME("graph/add-group", g->id());
 }
 
 void Graph::AddGroupToFeature(GroupPtr g, FeaturePtr f) {
@@ -76,7 +78,7 @@ void Graph::AddGroupToFeature(GroupPtr g, FeaturePtr f) {
   CHECK(HasGroup(g)) << "group #" << gid << " not exists";
 
   feature_adj_.at(fid).Add({g, f->xp()});
-  LOG(INFO) << "group #" << gid << " added to feature #" << fid;
+  XIVO_TRACE_FEATURE("graph/add-group-to-feature", fid, gid);
 }
 
 void Graph::AddFeatureToGroup(FeaturePtr f, GroupPtr g) {
@@ -88,7 +90,7 @@ void Graph::AddFeatureToGroup(FeaturePtr f, GroupPtr g) {
   CHECK(HasGroup(g)) << "group #" << gid << " not exists";
 
   group_adj_[gid].Add(fid);
-  LOG(INFO) << "feature #" << fid << " added to group #" << gid;
+  XIVO_TRACE_FEATURE("graph/add-feature-to-group", fid, gid);
 }
 
 
@@ -157,8 +159,7 @@ std::vector<FeaturePtr> Graph::TransferFeatureOwnership(GroupPtr g,
         f->inflate_cov(cov_factor);
 
         if (success) {
-          LOG(INFO) << "feature #" << fid << " transfered from group #" << gid
-                    << " to group #" << nref->id();
+          XIVO_TRACE_FEATURE("graph/transfer-feature", fid, nref->id());
         }
         else {
           LOG(WARNING) << "Graph::TransferFeatureOwnership: " <<
@@ -314,7 +315,7 @@ std::vector<FeaturePtr> Graph::FindNewGaugeFeatures(GroupPtr g) {
 
   for (auto f: new_gauge_features_for_g) {
     f->SetStatus(FeatureStatus::GAUGE);
-    LOG(INFO) << "Feature " << f->id() << " is now a gauge feature for Group " << g->id();
+    XIVO_TRACE_FEATURE("graph/new-gauge-feature", f->id(), g->id());
   }
 
 #ifndef NDEBUG
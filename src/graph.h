@@ -104,7 +104,6 @@ private:
 
   Graph(const Graph&) = delete;
   Graph& operator=(const Graph&) = delete;
-  static std::unique_ptr<Graph> instance_;
 
   GroupPtr last_added_group_;
 
@@ -1,11 +1,10 @@
 #include "group.h"
+#include "context.h"
 #include "feature.h"
 #include "mm.h"
 
 namespace xivo {
 
-int Group::counter_ = 0;
-
 // For GroupAdj struct
 void GroupAdj::Add(int id) { insert(id); }
 void GroupAdj::Remove(int id) { erase(id); }
@@ -32,7 +31,7 @@ void Group::Destroy(GroupPtr g) {
 }
 
 void Group::Reset(const SO3 &Rsb, const Vec3 &Tsb) {
-  id_ = counter_++;
+  id_ = EstimatorContext::current()->NewGroupId();
   if (id_ >= Feature::counter0) {
     LOG(FATAL) << "Group index overflow!!!";
   }
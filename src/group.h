@@ -81,11 +81,8 @@ private:
   void Reset(const SO3 &Rsb, const Vec3 &Tsb);
 
 private:
-
-  /** Total number of groups created */
-  static int counter_;
-
-  /** ID of group - IDs are in order of group creation and not reused */
+  /** ID of group - IDs are in order of group creation within the
+   *  EstimatorContext and not reused */
   int id_;
 
   /** Group's slot index in the Estimator's array of groups. This is set only when
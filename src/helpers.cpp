@@ -370,4 +370,106 @@ bool check_parallax(const Vec3 &Rf0_prime, const Vec3 &f1_prime, float beta_thre
   return true;
 }
 
+number_t SampsonError(const Mat3 &E, const Vec2 &xc0, const Vec2 &xc1) {
+  Vec3 b0{xc0(0), xc0(1), 1};
+  Vec3 b1{xc1(0), xc1(1), 1};
+  Vec3 Eb0 = E * b0;
+  Vec3 Etb1 = E.transpose() * b1;
+  number_t den = Eb0.head<2>().squaredNorm() + Etb1.head<2>().squaredNorm();
+  if (den < 1e-12) {
+    return 0;
+  }
+  return std::fabs(b1.dot(Eb0)) / std::sqrt(den);
+}
+
+int TwoPointRANSAC(const std::vector<Vec2> &xc0, const std::vector<Vec2> &xc1,
+                   const Mat3 &R10, number_t thresh, int max_iters,
+                   number_t confidence, std::vector<uint8_t> &inliers, Vec3 &t,
+                   std::default_random_engine *rng) {
+  CHECK(xc0.size() == xc1.size());
+  int n = xc0.size();
+  inliers.assign(n, 0);
+  t.setZero();
+
+  // Each match gives a linear constraint a_i' * t = 0 on the translation,
+  // where a_i = (R10 * b0_i) x b1_i, from the epipolar constraint.
+  std::vector<Vec3> a(n);
+  std::vector<Vec3> Rb0(n);
+  for (int i = 0; i < n; ++i) {
+    Rb0[i] = R10 * Vec3{xc0[i](0), xc0[i](1), 1};
+    a[i] = Rb0[i].cross(Vec3{xc1[i](0), xc1[i](1), 1});
+  }
+
+  // Hypothesis 0: pure rotation.
+  int best{0};
+  for (int i = 0; i < n; ++i) {
+    inliers[i] = (Rb0[i].head<2>() / Rb0[i](2) - xc1[i]).norm() < thresh;
+    best += inliers[i];
+  }
+  if (n < 2) {
+    return best;
+  }
+
+  std::default_random_engine local_rng;
+  if (rng == nullptr) {
+    rng = &local_rng;
+  }
+  std::uniform_int_distribution<int> distribution(0, n - 1);
+
+  auto count_inliers = [&](const Vec3 &th, std::vector<uint8_t> &mask) {
+    Mat3 E = hat(th) * R10;
+    int count{0};
+    for (int i = 0; i < n; ++i) {
+      mask[i] = SampsonError(E, xc0[i], xc1[i]) < thresh;
+      count += mask[i];
+    }
+    return count;
+  };
+
+  std::vector<uint8_t> mask(n);
+  int iters = max_iters;
+  for (int k = 0; k < iters; ++k) {
+    int i = distribution(*rng);
+    int j = distribution(*rng);
+    Vec3 th = a[i].cross(a[j]);
+    if (i == j || th.norm() < 1e-9) {
+      continue; // degenerate sample
+    }
+    th.normalize();
+    int count = count_inliers(th, mask);
+    if (count > best) {
+      best = count;
+      inliers = mask;
+      t = th;
+      number_t w = best / number_t(n);
+      if (w >= 1) {
+        break;
+      }
+      // RANSAC minimum number of trials for a sample of size 2
+      iters = std::min<int>(
+          max_iters, std::log(1 - confidence) / std::log(1 - w * w) + 1);
+    }
+  }
+
+  // Refine the translation direction with all the inliers: t is the null
+  // vector of the stacked constraints a_i.
+  if (!t.isZero() && best > 2) {
+    Mat3 AtA{Mat3::Zero()};
+    for (int i = 0; i < n; ++i) {
+      if (inliers[i]) {
+        AtA += a[i] * a[i].transpose();
+      }
+    }
+    Eigen::SelfAdjointEigenSolver<Mat3> es(AtA);
+    Vec3 th = es.eigenvectors().col(0);
+    int count = count_inliers(th, mask);
+    if (count >= best) {
+      best = count;
+      inliers = mask;
+      t = th;
+    }
+  }
+  return best;
+}
+
 } // namespace xivo
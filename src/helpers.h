@@ -2,6 +2,7 @@
 // Author: Xiaohan Fei (feixh@cs.ucla.edu)
 #pragma once
 #include <algorithm>
+#include <random>
 #include <vector>
 
 #include "alias.h"
@@ -72,4 +73,28 @@ bool check_angular_reprojection(const Vec3 &Rf0, const Vec3 &Rf0_prime, const Ve
 // Check parallex error for above methods
 bool check_parallax(const Vec3 &Rf0_prime, const Vec3 &f1_prime, float beta_thesh);
 
+// Sampson distance of the correspondence (xc0, xc1) w.r.t. essential matrix E,
+// i.e., the first-order approximation of the reprojection error. Both points
+// are in normalized camera coordinates, and xc1' * E * xc0 = 0 for inliers.
+number_t SampsonError(const Mat3 &E, const Vec2 &xc0, const Vec2 &xc1);
+
+// Rotation-aided two-point RANSAC.
+// With the rotation R10 between the two views known (e.g., from the gyro), the
+// essential matrix E = hat(t) * R10 only has the 2-DoF translation direction t
+// left to estimate, which two correspondences determine. Far fewer hypotheses
+// are needed than for a homography or the 5-point algorithm.
+// Args:
+//  xc0, xc1: matched points in normalized camera coordinates in view 0 and 1
+//  R10: rotation from view 0 to view 1, i.e., X1 = R10 * X0 + t
+//  thresh: inlier threshold on the Sampson distance (normalized coordinates)
+//  max_iters, confidence: RANSAC termination criteria
+//  inliers: inlier mask (output)
+//  t: unit translation direction, or zero if a pure rotation explains the
+//  matches better (output)
+// Returns: number of inliers
+int TwoPointRANSAC(const std::vector<Vec2> &xc0, const std::vector<Vec2> &xc1,
+                   const Mat3 &R10, number_t thresh, int max_iters,
+                   number_t confidence, std::vector<uint8_t> &inliers, Vec3 &t,
+                   std::default_random_engine *rng = nullptr);
+
 } // namespace xivo
@@ -0,0 +1,75 @@
+#include <cstring>
+
+#include "glog/logging.h"
+
+#include "inverted_index.h"
+
+namespace xivo {
+
+// don't bother compacting small indices
+static constexpr int kMinSlotsToCompact = 1024;
+
+InvertedIndex::InvertedIndex(int num_words, number_t compaction_ratio)
+    : postings_(num_words), num_tombstones_{0},
+      compaction_ratio_{compaction_ratio} {}
+
+void InvertedIndex::Add(DBoW2::WordId word_id, int fid,
+                        const FastBrief::TDescriptor desc) {
+  if (word_id >= postings_.size()) {
+    postings_.resize(word_id + 1);
+  }
+  uint32_t slot = fids_.size();
+  fids_.push_back(fid);
+  descs_.emplace_back();
+  std::memcpy(descs_.back().data(), desc, BRIEF_BYTES);
+  words_.push_back(word_id);
+
+  postings_[word_id].push_back(slot);
+  slots_of_[fid].push_back(slot);
+}
+
+void InvertedIndex::Remove(int fid) {
+  auto it = slots_of_.find(fid);
+  if (it == slots_of_.end()) {
+    return;
+  }
+  for (uint32_t slot : it->second) {
+    fids_[slot] = -1;
+  }
+  num_tombstones_ += it->second.size();
+  slots_of_.erase(it);
+
+  if (fids_.size() >= kMinSlotsToCompact &&
+      num_tombstones_ > compaction_ratio_ * fids_.size()) {
+    Compact();
+  }
+}
+
+void InvertedIndex::Compact() {
+  // move the live slots to the front, in order
+  uint32_t n = 0;
+  for (uint32_t slot = 0; slot < fids_.size(); ++slot) {
+    if (fids_[slot] >= 0) {
+      fids_[n] = fids_[slot];
+      descs_[n] = descs_[slot];
+      words_[n] = words_[slot];
+      ++n;
+    }
+  }
+  LOG(INFO) << "InvertedIndex: compacted " << fids_.size() << " slots to " << n;
+  fids_.resize(n);
+  descs_.resize(n);
+  words_.resize(n);
+
+  for (auto &posting : postings_) {
+    posting.clear();
+  }
+  slots_of_.clear();
+  for (uint32_t slot = 0; slot < n; ++slot) {
+    postings_[words_[slot]].push_back(slot);
+    slots_of_[fids_[slot]].push_back(slot);
+  }
+  num_tombstones_ = 0;
+}
+
+} // namespace xivo
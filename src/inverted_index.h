@@ -0,0 +1,66 @@
+// Flat inverted index from vocabulary words to map features.
+#pragma once
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "DBoW2/BowVector.h"
+
+#include "alias.h"
+#include "fastbrief.h"
+
+namespace xivo {
+
+/** Inverted index used by the `Mapper` to find loop closure candidates.
+ *  Every (feature, descriptor) pair added is stored once in a slot; slots live
+ *  in contiguous arrays which keep the feature id and a copy of the
+ *  descriptor, so that scanning a posting list touches neither the features
+ *  nor the hash maps. Each word owns a posting list of slot indices.
+ *  Removed features only tombstone their slots; the arrays are compacted once
+ *  the fraction of tombstones exceeds `compaction_ratio`. */
+class InvertedIndex {
+public:
+  using Descriptor = std::array<uint64_t, BRIEF_BYTES / 8>;
+
+  InvertedIndex(int num_words = 0, number_t compaction_ratio = 0.5);
+
+  /** Adds descriptor `desc` of feature `fid` under word `word_id`. */
+  void Add(DBoW2::WordId word_id, int fid, const FastBrief::TDescriptor desc);
+  /** Tombstones all the slots of feature `fid`. */
+  void Remove(int fid);
+  /** Calls `visit(fid, desc)` for every live slot in the posting list of
+   *  `word_id`, where `desc` is a `FastBrief::TDescriptor`. */
+  template <typename Visitor>
+  void Visit(DBoW2::WordId word_id, Visitor &&visit) const {
+    if (word_id >= postings_.size()) {
+      return;
+    }
+    for (uint32_t slot : postings_[word_id]) {
+      if (fids_[slot] >= 0) {
+        visit(fids_[slot], (FastBrief::TDescriptor)descs_[slot].data());
+      }
+    }
+  }
+  /** Drops the tombstones and renumbers the slots. */
+  void Compact();
+
+  /** Number of live slots. */
+  int size() const { return fids_.size() - num_tombstones_; }
+  int num_tombstones() const { return num_tombstones_; }
+
+private:
+  /** posting list of each word: indices into the slot arrays below */
+  std::vector<std::vector<uint32_t>> postings_;
+  // slot arrays
+  std::vector<int> fids_; // -1 for a tombstone
+  std::vector<Descriptor> descs_;
+  std::vector<DBoW2::WordId> words_;
+  /** slots of each feature, for removal */
+  std::unordered_map<int, std::vector<uint32_t>> slots_of_;
+
+  int num_tombstones_;
+  number_t compaction_ratio_;
+};
+
+} // namespace xivo
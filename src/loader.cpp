@@ -1,16 +1,52 @@
 // Dataloader for ASL-compatible dataset.
 // Author: Xiaohan Fei (feixh@cs.ucla.edu)
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 
 #include "glog/logging.h"
+#include "opencv2/imgcodecs/imgcodecs.hpp"
 
 #include "message_types.h"
 #include "loader.h"
 
 namespace xivo {
 
+namespace {
+
+// Next row of a csv file which is not a comment. False at the end of file.
+bool NextRow(std::istream &is, std::string &line) {
+  while (is >> line) {
+    if (line.front() != '#') return true;
+  }
+  return false;
+}
+
+// timestamp,filename
+std::unique_ptr<msg::Image> ParseImageRow(const std::string &line,
+                                          const std::string &image_dir) {
+  std::vector<std::string> content = StrSplit(line, ',');
+  auto ts{timestamp_t(std::stoll(content[0]))};
+  std::string image_path = image_dir + "/data/" + content[1];
+  return std::make_unique<msg::Image>(ts, image_path);
+}
+
+// timestamp,wx,wy,wz,ax,ay,az
+std::unique_ptr<msg::IMU> ParseIMURow(const std::string &line) {
+  std::vector<std::string> content = StrSplit(line, ',');
+  auto ts{timestamp_t(std::stoll(content[0]))};
+  Vec3 gyro;
+  Vec3 accel;
+  for (int i = 0; i < 3; ++i)
+    gyro(i) = std::stod(content[i + 1]);
+  for (int i = 0; i < 3; ++i)
+    accel(i) = std::stod(content[i + 4]);
+  return std::make_unique<msg::IMU>(ts, gyro, accel);
+}
+
+} // namespace
+
 DataLoader::DataLoader(const std::string &image_dir,
                          const std::string &imu_dir) {
 
@@ -19,13 +55,8 @@ DataLoader::DataLoader(const std::string &image_dir,
   if (std::ifstream is{image_data}) {
     std::string line;
     std::getline(is, line); // get rid of the header
-    while (is >> line) {
-      if (line.front() != '#') {
-        std::vector<std::string> content = StrSplit(line, ',');
-        auto ts{timestamp_t(std::stoll(content[0]))};
-        std::string image_path = image_dir + "/data/" + content[1];
-        entries_.emplace_back(std::make_unique<msg::Image>(ts, image_path));
-      }
+    while (NextRow(is, line)) {
+      entries_.emplace_back(ParseImageRow(line, image_dir));
     }
   } else {
     LOG(FATAL) << "failed to open image csv @ " << image_data;
@@ -36,18 +67,8 @@ DataLoader::DataLoader(const std::string &image_dir,
   if (std::ifstream is{imu_data}) {
     std::string line;
     std::getline(is, line); // get rid of the header
-    while (is >> line) {
-      if (line.front() != '#') {
-        std::vector<std::string> content = StrSplit(line, ',');
-        auto ts{timestamp_t(std::stoll(content[0]))};
-        Vec3 gyro;
-        Vec3 accel;
-        for (int i = 0; i < 3; ++i)
-          gyro(i) = std::stod(content[i + 1]);
-        for (int i = 0; i < 3; ++i)
-          accel(i) = std::stod(content[i + 4]);
-        entries_.emplace_back(std::make_unique<msg::IMU>(ts, gyro, accel));
-      }
+    while (NextRow(is, line)) {
+      entries_.emplace_back(ParseIMURow(line));
     }
   } else {
     LOG(FATAL) << "failed to open data.csv @ " << imu_data;
@@ -65,13 +86,8 @@ DataLoader::DataLoader(const std::string &image_dir) {
   if (std::ifstream is{image_data}) {
     std::string line;
     std::getline(is, line); // get rid of the header
-    while (is >> line) {
-      if (line.front() != '#') {
-        std::vector<std::string> content = StrSplit(line, ',');
-        auto ts{timestamp_t(std::stoll(content[0]))};
-        std::string image_path = image_dir + "/data/" + content[1];
-        entries_.emplace_back(std::make_unique<msg::Image>(ts, image_path));
-      }
+    while (NextRow(is, line)) {
+      entries_.emplace_back(ParseImageRow(line, image_dir));
     }
   } else {
     LOG(FATAL) << "failed to open image csv @ " << image_data;
@@ -82,6 +98,118 @@ DataLoader::DataLoader(const std::string &image_dir) {
             [](const auto &e1, const auto &e2) { return e1->ts_ < e2->ts_; });
 }
 
+StreamingLoader::StreamingLoader(const std::string &image_dir,
+                                 const std::string &imu_dir,
+                                 int lookahead, int num_threads, Decoder decode)
+    : image_dir_{image_dir}, lookahead_{std::max(lookahead, 1)},
+      decode_{decode}, count_{0},
+      last_image_ts_{timestamp_t::min()}, last_imu_ts_{timestamp_t::min()},
+      quit_{false} {
+  if (!decode_) {
+    decode_ = [](const std::string &path) { return cv::imread(path); };
+  }
+
+  std::string line;
+  std::string image_data = image_dir + "/data.csv";
+  image_is_.open(image_data);
+  if (!image_is_.is_open()) {
+    LOG(FATAL) << "failed to open image csv @ " << image_data;
+  }
+  std::getline(image_is_, line); // get rid of the header
+
+  if (!imu_dir.empty()) {
+    std::string imu_data = imu_dir + "/data.csv";
+    imu_is_.open(imu_data);
+    if (!imu_is_.is_open()) {
+      LOG(FATAL) << "failed to open data.csv @ " << imu_data;
+    }
+    std::getline(imu_is_, line); // get rid of the header
+    ReadIMU();
+  }
+
+  for (int i = 0; i < std::max(num_threads, 1); ++i) {
+    workers_.emplace_back(&StreamingLoader::Work, this);
+  }
+  Prefetch();
+}
+
+StreamingLoader::~StreamingLoader() {
+  {
+    std::scoped_lock lck(mtx_);
+    quit_ = true;
+  }
+  cv_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+void StreamingLoader::Prefetch() {
+  std::string line;
+  while ((int)frames_.size() < lookahead_ && NextRow(image_is_, line)) {
+    auto image = ParseImageRow(line, image_dir_);
+    if (image->ts_ < last_image_ts_) {
+      LOG(WARNING) << "image csv not sorted by timestamp @ " << image->ts_.count();
+    }
+    last_image_ts_ = image->ts_;
+
+    std::packaged_task<cv::Mat()> job{
+      [decode = decode_, path = image->image_path_]() { return decode(path); }};
+    frames_.push_back(Frame{image->ts_, image->image_path_, job.get_future()});
+    {
+      std::scoped_lock lck(mtx_);
+      jobs_.push_back(std::move(job));
+    }
+    cv_.notify_one();
+  }
+}
+
+void StreamingLoader::ReadIMU() {
+  imu_next_.reset();
+  std::string line;
+  if (NextRow(imu_is_, line)) {
+    imu_next_ = ParseIMURow(line);
+    if (imu_next_->ts_ < last_imu_ts_) {
+      LOG(WARNING) << "imu csv not sorted by timestamp @ " << imu_next_->ts_.count();
+    }
+    last_imu_ts_ = imu_next_->ts_;
+  }
+}
+
+bool StreamingLoader::Next(Entry &entry) {
+  if (frames_.empty() && !imu_next_) {
+    return false;
+  }
+
+  if (imu_next_ && (frames_.empty() || imu_next_->ts_ <= frames_.front().ts)) {
+    entry.msg = std::move(imu_next_);
+    entry.image = cv::Mat();
+    ReadIMU();
+  } else {
+    Frame &frame = frames_.front();
+    entry.image = frame.image.get();  // blocks if still decoding
+    entry.msg = std::make_unique<msg::Image>(frame.ts, frame.path);
+    frames_.pop_front();
+    Prefetch();
+  }
+  ++count_;
+  return true;
+}
+
+void StreamingLoader::Work() {
+  while (true) {
+    std::packaged_task<cv::Mat()> job;
+    {
+      std::unique_lock lck(mtx_);
+      cv_.wait(lck, [this]() { return quit_ || !jobs_.empty(); });
+      if (quit_) break;
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    job();
+  }
+}
+
 std::vector<msg::Pose>
 DataLoader::LoadGroundTruthState(const std::string &state_dir) {
   std::string state_data = state_dir + "/data.csv";
@@ -1,10 +1,20 @@
 // Dataloader for ASL-compatible dataset.
 // Author: Xiaohan Fei (feixh@cs.ucla.edu)
 #pragma once
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "opencv2/core/core.hpp"
+
 #include "core.h"
 #include "message_types.h"
 
@@ -29,6 +39,96 @@ private:
 using TUMVILoader = DataLoader;
 using EuRoCLoader = DataLoader;
 
+
+/** Streaming counterpart of DataLoader. The image and IMU csv files are read
+ * lazily and merged by timestamp as messages are consumed (each file must be
+ * sorted, as in ASL datasets), while up to `lookahead` images are decoded
+ * ahead of time by a pool of prefetch threads. Memory use is bounded by the
+ * lookahead instead of the length of the sequence. */
+class StreamingLoader {
+public:
+  using Decoder = std::function<cv::Mat(const std::string &)>;
+
+  struct Entry {
+    std::unique_ptr<msg::Message> msg;
+    cv::Mat image;  // decoded frame if `msg` is a msg::Image
+  };
+
+  /** Input iterator over the remaining entries. */
+  class iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Entry;
+    using difference_type = std::ptrdiff_t;
+    using pointer = Entry *;
+    using reference = Entry &;
+
+    iterator() : loader_{nullptr} {}
+    explicit iterator(StreamingLoader *loader) : loader_{loader} { ++(*this); }
+
+    Entry &operator*() { return entry_; }
+    Entry *operator->() { return &entry_; }
+    iterator &operator++() {
+      if (loader_ && !loader_->Next(entry_)) loader_ = nullptr;
+      return *this;
+    }
+    bool operator==(const iterator &other) const { return loader_ == other.loader_; }
+    bool operator!=(const iterator &other) const { return loader_ != other.loader_; }
+
+  private:
+    StreamingLoader *loader_;
+    Entry entry_;
+  };
+
+  /** `decode` defaults to cv::imread. An empty `imu_dir` streams images only. */
+  StreamingLoader(const std::string &image_dir, const std::string &imu_dir,
+                  int lookahead=8, int num_threads=2, Decoder decode=nullptr);
+  ~StreamingLoader();
+
+  /** Fetch the next message in timestamp order. Returns false at the end of
+   * both streams. Ties go to the IMU so propagation reaches the frame. */
+  bool Next(Entry &entry);
+
+  iterator begin() { return iterator{this}; }
+  iterator end() { return iterator{}; }
+
+  /** Number of messages handed out so far. */
+  int count() const { return count_; }
+
+private:
+  StreamingLoader(const StreamingLoader &) = delete;
+  StreamingLoader &operator=(const StreamingLoader &) = delete;
+
+  /** Read csv rows until `lookahead_` images are scheduled for decoding. */
+  void Prefetch();
+  /** Parse the next IMU row into `imu_next_`. */
+  void ReadIMU();
+  void Work();
+
+  struct Frame {
+    timestamp_t ts;
+    std::string path;
+    std::future<cv::Mat> image;
+  };
+
+  std::string image_dir_;
+  int lookahead_;
+  Decoder decode_;
+  int count_;
+
+  std::ifstream image_is_, imu_is_;
+  std::deque<Frame> frames_;
+  std::unique_ptr<msg::IMU> imu_next_;
+  timestamp_t last_image_ts_, last_imu_ts_;
+
+  // prefetch pool
+  std::vector<std::thread> workers_;
+  std::deque<std::packaged_task<cv::Mat()>> jobs_;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  bool quit_;
+};
+
 // Get image, imu and groundtruth directories for TUMVI and EuRoC dataset
 std::tuple<std::string, std::string, std::string>
 GetDirs(const std::string dataset, const std::string root,
@@ -12,6 +12,11 @@
 #include "tracker.h"
 #include "mapper.h"
 #include "camera_manager.h"
+#include "trace.h"
+
+#ifdef USE_G2O
+#include "optimizer_adapters.h"
+#endif
 
 namespace xivo {
 
@@ -60,10 +65,11 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
 #endif
       graph.RemoveFeature(f);
       if (f->instate()) {
-        LOG(INFO) << "Tracker rejected feature #" << f->id();
+        XIVO_TRACE_FEATURE("manager/tracker-reject", f->id());
         if (f->status() == FeatureStatus::GAUGE) {
           needs_new_gauge_features.push_back(affected_group);
-          LOG(INFO) << "Group # " << affected_group->id() << " just lost a gauge feature rejected by tracker.";
+          XIVO_TRACE_FEATURE("manager/tracker-lost-gauge", f->id(),
+                             affected_group->id());
         }
         RemoveFeatureFromState(f);
         affected_groups.insert(affected_group);
@@ -293,7 +299,7 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
   DiscardFeatures(nullref_features);
   DiscardGroups(discards);
   for (auto nf: nullref_features) {
-    LOG(INFO) << "Removed nullref feature " << nf->id();
+    XIVO_TRACE_FEATURE("manager/remove-nullref-feature", nf->id());
   }
 
   // initialize those newly detected featuers
@@ -408,6 +414,23 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
   //   Group::Delete(g);
   // }
 
+#ifdef USE_G2O
+  // sliding-window refinement runs behind the filter; the worker publishes
+  // the refined poses of the last window (WindowOptimizer::GetRefinedPoses),
+  // the filter state is not corrected by them
+  auto window_optimizer = WindowOptimizer::instance();
+  if (window_optimizer->enabled()) {
+    if (auto result = window_optimizer->Poll()) {
+      VLOG(0) << "window BA: " << result->groups.size() << " groups refined in "
+        << result->elapsed_ms << " ms" << (result->out_of_time ? " (out of time)" : "");
+    }
+    if (vision_counter_ % window_optimizer->period() == 0) {
+      window_optimizer->Submit(
+          adapter::MakeWindowProblem(window_optimizer->window_size()));
+    }
+  }
+#endif
+
   if (use_canvas_) {
     for (auto f : tracks) 
       Canvas::instance()->Draw(f);
@@ -416,14 +439,13 @@ void Estimator::ProcessTracks(const timestamp_t &ts,
       CameraManager::instance()->GetIntrinsics());
   }
 
-  static int print_counter{0};
-  if (print_timing_ && ++print_counter % 50 == 0) {
-    std::cout << print_counter << std::endl;
-    std::cout << timer_;
+  if (print_timing_ && ++print_counter_ % 50 == 0) {
+    std::cout << print_counter_ << std::endl;
+    std::cout << profiler_;
   }
 
-  // Save the frame (only if set to true in json file)
-  Canvas::instance()->SaveFrame();
+  // drawn (and saved if set in json file) by the renderer thread
+  Canvas::instance()->Submit();
 }
 
 } // namespace xivo
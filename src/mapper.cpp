@@ -1,6 +1,11 @@
+#include <algorithm>
+
 #include "mapper.h"
+#include "context.h"
 #include "feature.h"
+#include "graph.h"
 #include "group.h"
+#include "trace.h"
 
 #ifdef USE_G2O
 #include "optimizer_adapters.h"
@@ -49,9 +54,9 @@ void PrintT(T v) {
 namespace xivo {
 
 
-std::unique_ptr<Mapper> Mapper::instance_{nullptr};
-
-Mapper* Mapper::instance() {  return instance_.get(); }
+Mapper* Mapper::instance() {
+  return EstimatorContext::current()->mapper_.get();
+}
 
 
 cvl::PnpParams* GetRANSACParams(const Json::Value &cfg) {
@@ -73,22 +78,41 @@ cvl::PnpParams* GetRANSACParams(const Json::Value &cfg) {
 }
 
 
-void GetPnPInput(const std::vector<LCMatch> &matches,
-                 const SE3 &gbc,
+LCQuery MakeLCQuery(const std::vector<FeaturePtr> &instate_features, int gid)
+{
+  LCQuery query;
+  query.gid = gid;
+  query.fids.reserve(instate_features.size());
+  MatX2 xp(instate_features.size(), 2);
+  query.descriptors.create(instate_features.size(), BRIEF_BYTES, CV_8UC1);
+  query.desc_idx.reserve(instate_features.size());
+  query.word_ids.reserve(instate_features.size());
+  for (int i=0; i<instate_features.size(); i++) {
+    FeaturePtr f = instate_features[i];
+    query.fids.push_back(f->id());
+    xp.row(i) = f->back().transpose();
+    int k = f->NumDescriptors() - 1;
+    query.desc_idx.push_back(k);
+    query.word_ids.push_back(f->CachedWordId(k));
+    std::copy_n(reinterpret_cast<const uchar *>(f->GetDBoWDesc()), BRIEF_BYTES,
+                query.descriptors.ptr(i));
+  }
+  query.xc = Camera::instance()->UnProjectBatch(xp);
+  return query;
+}
+
+
+void GetPnPInput(const std::vector<FeaturePtr> &map_features,
+                 const MatX2 &xc,
                  std::vector<cvl::Vector3D> &xs,
                  std::vector<cvl::Vector2D> &yns)
 {
-  xs.resize(matches.size());
-  yns.resize(matches.size());
-  for (int i=0; i<matches.size(); i++) {
-    LCMatch m = matches[i];
-    FeaturePtr ekf_feat = m.first;
-    FeaturePtr map_feat = m.second;
-
-    Vec2 y_px = ekf_feat->back();
-    Vec2 y = Camera::instance()->UnProject(y_px);
-    Vec3 X = map_feat->Xs();
-    cvl::Vector2D last_obs(y(0), y(1)); 
+  xs.resize(map_features.size());
+  yns.resize(map_features.size());
+
+  for (int i=0; i<map_features.size(); i++) {
+    Vec3 X = map_features[i]->Xs();
+    cvl::Vector2D last_obs(xc(i, 0), xc(i, 1));
     cvl::Vector3D map_pos(X(0), X(1), X(2));
 
     xs[i] = map_pos;
@@ -97,33 +121,23 @@ void GetPnPInput(const std::vector<LCMatch> &matches,
 }
 
 
-void GetInlierMatches(std::vector<LCMatch> &matches,
-                      std::vector<cvl::Vector3D> &Xs,
-                      std::vector<cvl::Vector2D> &yns,
-                      cvl::PoseD ransac_soln,
-                      double tol,
-                      std::vector<LCMatch> &ransac_matches)
+std::vector<int> GetInliers(const std::vector<cvl::Vector3D> &Xs,
+                            const std::vector<cvl::Vector2D> &yns,
+                            cvl::PoseD ransac_soln,
+                            double tol)
 {
-  // Transform all Xs to camera frame using ransac solution
-  std::vector<cvl::Vector3D> Xc;
-  cvl::apply(ransac_soln, Xs, Xc);
-
   // compare points to projected points
   std::vector<cvl::Vector2D> yns_soln;
   cvl::apply_and_project(ransac_soln, Xs, yns_soln);
+  std::vector<int> inliers;
   for (int i=0; i<Xs.size(); i++) {
     cvl::Vector2D diff = yns_soln[i] - yns[i];
     double dist = diff.norm();
     if (dist < tol) {
-      //std::cout << "diff inlier: " << diff[0] << ", " << diff[1] << std::endl;
-      //std::cout << "dist inlier: " << dist << std::endl;
-      ransac_matches.push_back(matches[i]);
+      inliers.push_back(i);
     }
-    //else {
-      //std::cout << "diff outlier: " << diff[0] << ", " << diff[1] << std::endl;
-      //std::cout << "dist outlier: " << dist << std::endl;
-    //}
   }
+  return inliers;
 }
 
 
@@ -141,18 +155,47 @@ Mapper::Mapper(const Json::Value &cfg) {
   feature_merge_cov_factor_ = cfg.get("feature_merge_cov_factor", 1.0).asDouble();
 
   ransac_params_ = GetRANSACParams(cfg["RANSAC"]);
+
+  inv_index_ = InvertedIndex(voc_->size(),
+    cfg.get("index_compaction_ratio", 0.5).asDouble());
+
+  async_loop_closure_ = use_loop_closure_ &&
+    cfg.get("async_loop_closure", false).asBool();
+  lc_quit_ = false;
+  if (async_loop_closure_) {
+    lc_thread_ = std::thread([this, context = EstimatorContext::current()]() {
+      EstimatorContext::Scope scope{context};
+      LoopClosureLoop();
+    });
+  }
 }
 
 
 MapperPtr Mapper::Create(const Json::Value &cfg) {
-  if (instance_ == nullptr) {
-    instance_ = std::unique_ptr<Mapper>(new Mapper(cfg));
+  auto &instance = EstimatorContext::current()->mapper_;
+  if (instance == nullptr) {
+    instance = std::unique_ptr<Mapper>(new Mapper(cfg));
+    // after the instance exists: the memory manager might recycle slots of
+    // loaded features, which removes them from the mapper
+    std::string map_file = cfg.get("load_map", "").asString();
+    if (!map_file.empty()) {
+      instance->LoadMap(map_file);
+    }
   }
-  return instance_.get();
+  return instance.get();
 }
 
 
-Mapper::~Mapper() {}
+Mapper::~Mapper() {
+  if (lc_thread_.joinable()) {
+    {
+      std::scoped_lock lck(lc_mtx_);
+      lc_quit_ = true;
+    }
+    lc_cv_.notify_one();
+    lc_thread_.join();
+  }
+}
 
 
 void Mapper::AddFeature(FeaturePtr f, const FeatureAdj& f_obs, const SE3 &gbc) {
@@ -200,11 +243,16 @@ void Mapper::AddFeature(FeaturePtr f, const FeatureAdj& f_obs, const SE3 &gbc) {
 
   // Add all feature descriptors to invese index
   FeaturePtr fptr = (matched_map_feat_id == -1) ? f : features_[matched_map_feat_id];
+  std::vector<DBoW2::WordId> word_ids;
   std::vector<FastBrief::TDescriptor> all_descriptors = f->GetAllDBoWDesc();
-  for (auto desc: all_descriptors) {
-    DBoW2::WordId wid = voc_->transform(desc);
-    UpdateInverseIndex(wid, fptr);
+  for (int i=0; i<f->NumDescriptors(); i++) {
+    word_ids.push_back(f->GetWordId(i, *voc_));
+  }
+  features_mtx.lock();
+  for (int i=0; i<word_ids.size(); i++) {
+    inv_index_.Add(word_ids[i], fptr->id(), all_descriptors[i]);
   }
+  features_mtx.unlock();
 
   // If the feature has been merged with a previous feature, then we will
   // destroy it and its slot in the MemoryManager will become uninitialized.
@@ -212,11 +260,10 @@ void Mapper::AddFeature(FeaturePtr f, const FeatureAdj& f_obs, const SE3 &gbc) {
     Feature::Destroy(f);
     //std::cout << "feature #" << fid << " merged with feature " <<
     //  matched_map_feat_id << std::endl;
-    LOG(INFO) << "feature #" << fid << " merged with feature " <<
-      matched_map_feat_id;
+    XIVO_TRACE_FEATURE("mapper/merge-feature", fid, matched_map_feat_id);
   }
   else {
-    LOG(INFO) << "feature #" << fid << " added to mapper";
+    XIVO_TRACE_FEATURE("mapper/add-feature", fid);
     //std::cout << "feature #" << fid << " added to mapper" << std::endl;
   }
 }
@@ -236,7 +283,7 @@ void Mapper::AddGroup(GroupPtr g, const GroupAdj& g_features) {
   group_adj_[gid] = g_features;
   groups_mtx.unlock();
 
-  LOG(INFO) << "group #" << gid << " added to mapper-graph";
+  XIVO_TRACE_FRAME("mapper/add-group", gid);
 }
 
 
@@ -253,9 +300,11 @@ void Mapper::RemoveFeature(const FeaturePtr f) {
     }
   }
   feature_adj_.erase(fid);
+  // the loop closure search must not find the feature anymore
+  inv_index_.Remove(fid);
   features_mtx.unlock();
 
-  LOG(INFO) << "feature #" << fid << " removed from mapper-graph";
+  XIVO_TRACE_FEATURE("mapper/remove-feature", fid);
 }
 
 void Mapper::RemoveGroup(const GroupPtr g) {
@@ -281,7 +330,7 @@ void Mapper::RemoveGroup(const GroupPtr g) {
   group_adj_.erase(gid);
   groups_mtx.unlock();
 
-  LOG(INFO) << "group #" << gid << " removed from mapper-graph";
+  XIVO_TRACE_FRAME("mapper/remove-group", gid);
 }
 
 
@@ -307,115 +356,223 @@ std::vector<GroupPtr> Mapper::GetGroupsOf(FeaturePtr f) const {
 }
 
 
-void Mapper::UpdateInverseIndex(const DBoW2::WordId &word_id, FeaturePtr f) {
-  if (InvIndex_.count(word_id) > 0) {
-    InvIndex_[word_id].insert(f);
+FeaturePtr Mapper::FindLoopClosureCandidate(const DBoW2::WordId& word_id,
+                                            const FastBrief::TDescriptor desc)
+{
+  auto it = search_words_.find(word_id);
+  if (it == search_words_.end()) {
+    const DBoW2::NodeId &node_id(voc_->getParentNode(word_id, uplevel_word_search_));
+    std::vector<DBoW2::WordId> words_under_node;
+    voc_->getWordsFromNode(node_id, words_under_node);
+    it = search_words_.insert({word_id, words_under_node}).first;
   }
-  else {
-    InvIndex_.insert({word_id, {f}});
+
+  // Only use the matches that close enough to the descriptor
+  double distance = nn_dist_thresh_;
+  int best_fid = -1;
+  for (auto w: it->second) {
+    inv_index_.Visit(w, [&](int fid, FastBrief::TDescriptor desc1) {
+      double d = FastBrief::distance(desc, desc1);
+      if (d < distance) {
+        distance = d;
+        best_fid = fid;
+      }
+    });
   }
+  return best_fid == -1 ? nullptr : features_.at(best_fid);
 }
 
-std::unordered_set<FeaturePtr> Mapper::GetLoopClosureCandidates(
-  const DBoW2::WordId& word_id)
+
+std::vector<LCMatch> Mapper::DetectLoopClosures(const std::vector<FeaturePtr>& instate_features, const SE3 &gbc)
 {
-  const DBoW2::NodeId &node_id(voc_->getParentNode(word_id, uplevel_word_search_));
-  std::vector<DBoW2::WordId> words_under_node;
-  voc_->getWordsFromNode(node_id, words_under_node);
-
-  std::unordered_set<FeaturePtr> ret;
-  for (auto w: words_under_node) {
-    std::unordered_set<FeaturePtr> features_in_word = InvIndex_[w];
-    ret.merge(features_in_word);
-  }
-  return ret;
+  int gid = Graph::instance()->LastAddedGroup()->id();
+  return ResolveLoopClosures(
+    DetectLoopClosures(MakeLCQuery(instate_features, gid)));
 }
 
 
-std::vector<LCMatch> Mapper::DetectLoopClosures(const std::vector<FeaturePtr>& instate_features, const SE3 &gbc)
+LCResult Mapper::DetectLoopClosures(const LCQuery &query)
 {
+  LCResult result;
+  result.gid = query.gid;
+
+  // indices into the query and the map features they are matched to
+  std::vector<int> query_idx;
+  std::vector<FeaturePtr> best_matches;
+
+  // Convert descriptors to words, unless the tracks know them already
+  std::vector<DBoW2::WordId> word_ids = query.word_ids;
+  for (int i=0; i<query.fids.size(); i++) {
+    if (word_ids[i] == Track::kNoWord) {
+      word_ids[i] = voc_->transform(
+        (FastBrief::TDescriptor) query.descriptors.ptr(i));
+      result.new_word_ids.push_back({query.fids[i], query.desc_idx[i], word_ids[i]});
+    }
+  }
 
-  std::vector<LCMatch> matches;
-  std::vector<LCMatch> ransac_matches;
-
-  for (auto f: instate_features) {
-    FastBrief::TDescriptor desc = f->GetDBoWDesc();
-
-    // Convert descriptor to word and find other features that match to the
-    // same word
-    const DBoW2::WordId& word_id(voc_->transform(desc));
-    std::unordered_set<FeaturePtr> other_matches =
-      GetLoopClosureCandidates(word_id);
-
-    // Only use the matches that close enough to the descriptor
-    double distance = nn_dist_thresh_;
-    FeaturePtr best_match = nullptr;
-    for (auto f1: other_matches) {
-      FastBrief::TDescriptor desc1 = f1->GetDBoWDesc();
-      double d = FastBrief::distance(desc, desc1);
-      if (d < distance) {
-        distance = d;
-        best_match = f1;
+  // The map is read under `features_mtx` since the filter keeps adding and
+  // removing map features while the loop closure thread runs.
+  std::vector<cvl::Vector3D> Xs;
+  std::vector<cvl::Vector2D> yns;
+  std::vector<int> map_fids;
+  {
+    std::scoped_lock lck(features_mtx);
+
+    for (int i=0; i<query.fids.size(); i++) {
+      FastBrief::TDescriptor desc =
+        (FastBrief::TDescriptor) query.descriptors.ptr(i);
+
+      // Find other features that match to the same word
+      FeaturePtr best_match = FindLoopClosureCandidate(word_ids[i], desc);
+      if (best_match != nullptr) {
+        XIVO_TRACE_FEATURE("mapper/loop-closure-match", query.fids[i],
+                           best_match->id());
+        query_idx.push_back(i);
+        best_matches.push_back(best_match);
       }
     }
 
-    if (best_match != nullptr) {
-      LOG(INFO) << "Mapper: matched feature " << f->id() << " to feature "
-        << best_match->id() << std::endl;
-      matches.push_back(LCMatch(f, best_match));
-      f->SetLCMatch(best_match->id());
+    // If number of matches is at least 5, check with P3P RANSAC. Otherwise,
+    // don't return anything. Technically, we only need 4, but then the
+    // probability that RANSAC fits an outlier is too high.
+    if (best_matches.size() < 5) {
+      return result;
     }
-  }
-
-  // If number of matches is at least 5, check with P3P RANSAC. Otherwise, don't
-  // return anything. Technically, we only need 4, but then the probability that
-  // RANSAC fits an outlier is too high.
-  if (matches.size() >= 5) {
-    //std::cout << std::endl;
-    //std::cout << "Mapper: matched " << matches.size() << " features" << std::endl;
-    LOG(INFO) << "Mapper: matched " << matches.size() << " features" << std::endl;
+    LOG(INFO) << "Mapper: matched " << best_matches.size() << " features"
+      << std::endl;
 
     // debug printing -- this block is useful for adjusting parameters
     // `nn_dist_thresh` and `RANSAC.threshold` in configuration files.
     // If the filter is working as intended, then the position of matches in
     // the spatial frame should be "pretty close".
     /*
-    for (int j=0; j< matches.size(); j++) {
-      LCMatch m = matches[j];
+    for (int j=0; j< best_matches.size(); j++) {
       std::cout << "Match " << j << std::endl;
-      PrintT(m.first->Xs(gbc));
-      PrintT(m.second->Xs(gbc));
+      PrintT(best_matches[j]->Xs());
     }
     */
 
-    std::vector<cvl::Vector3D> Xs;
-    std::vector<cvl::Vector2D> yns;
-    GetPnPInput(matches, gbc, Xs, yns);
-    cvl::PoseD camera_pose = cvl::pnp_ransac(Xs, yns, *ransac_params_);
-    GetInlierMatches(matches, Xs, yns, camera_pose, ransac_params_->threshold,
-                     ransac_matches);
-
-    LOG(INFO) << "Mapper: RANSAC kept " << ransac_matches.size() << " matches" << std::endl;
-    // more debug printing to make sure that RANSAC is working.
-    /*
-    std::cout << "Mapper: RANSAC kept " << ransac_matches.size() << " matches" << std::endl;
-    for (int j=0; j< ransac_matches.size(); j++) {
-      LCMatch m = ransac_matches[j];
-      std::cout << "Match " << j << std::endl;
-      PrintT(m.first->Xs());
-      PrintT(m.second->Xs());
+    MatX2 xc(query_idx.size(), 2);
+    for (int j=0; j<query_idx.size(); j++) {
+      xc.row(j) = query.xc.row(query_idx[j]);
+      map_fids.push_back(best_matches[j]->id());
     }
-    */
+    GetPnPInput(best_matches, xc, Xs, yns);
   }
 
+  cvl::PoseD camera_pose = cvl::pnp_ransac(Xs, yns, *ransac_params_);
+  std::vector<int> inliers =
+    GetInliers(Xs, yns, camera_pose, ransac_params_->threshold);
+  LOG(INFO) << "Mapper: RANSAC kept " << inliers.size() << " matches" << std::endl;
+
   // If RANSAC only kept 4 matches, it might be by chance, so let's get rid
   // of them.
-  if (ransac_matches.size() <= 4) {
-    ransac_matches.clear();
+  if (inliers.size() <= 4) {
+    return result;
+  }
+  for (int j: inliers) {
+    result.matches.push_back({query.fids[query_idx[j]], map_fids[j]});
+  }
+  return result;
+}
+
+
+std::vector<LCMatch> Mapper::ResolveLoopClosures(const LCResult &result)
+{
+  Graph& graph{*Graph::instance()};
+  for (const auto &[fid, k, word_id]: result.new_word_ids) {
+    // the feature might have been destroyed and its slot reused since
+    if (graph.HasFeature(fid) && graph.GetFeature(fid)->NumDescriptors() > k) {
+      graph.GetFeature(fid)->SetWordId(k, word_id);
+    }
+  }
+
+  std::vector<LCMatch> matches;
+  if (!graph.HasGroup(result.gid)) {
+    return matches;
+  }
+  GroupPtr g = graph.GetGroup(result.gid);
+  // the result arrives frames after the query: the group may have left the
+  // state since, and the measurement is built at its (then stale) slot
+  if (!g->instate()) {
+    return matches;
+  }
+
+  std::scoped_lock lck(features_mtx);
+  for (const auto &m: result.matches) {
+    if (!graph.HasFeature(m.first) || !features_.count(m.second)) {
+      continue;
+    }
+    FeaturePtr f = graph.GetFeature(m.first);
+    // likewise for the features, and for the groups they are anchored to
+    if (!f->instate() || !f->ref() || !f->ref()->instate() ||
+        !graph.GetFeatureAdj(f).count(g->id())) {
+      continue;
+    }
+    f->SetLCMatch(m.second);
+    matches.push_back(LCMatch(f, features_.at(m.second)));
+  }
+  return matches;
+}
+
+
+void Mapper::SubmitLoopClosureQuery(LCQuery query)
+{
+  {
+    std::scoped_lock lck(lc_mtx_);
+    if (lc_query_) {
+      LOG(INFO) << "Mapper: loop closure thread busy, dropping query of group #"
+        << lc_query_->gid;
+    }
+    lc_query_ = std::move(query);
+  }
+  lc_cv_.notify_one();
+}
+
+
+bool Mapper::PollLoopClosures(LCResult &result)
+{
+  std::scoped_lock lck(lc_mtx_);
+  if (!lc_result_) {
+    return false;
   }
+  result = std::move(*lc_result_);
+  lc_result_.reset();
+  return true;
+}
 
-  return ransac_matches;
+
+void Mapper::LoopClosureLoop()
+{
+  for (;;) {
+    LCQuery query;
+    {
+      std::unique_lock<std::mutex> lck(lc_mtx_);
+      lc_cv_.wait(lck, [this] { return lc_quit_ || lc_query_.has_value(); });
+      if (lc_quit_) {
+        return;
+      }
+      query = std::move(*lc_query_);
+      lc_query_.reset();
+    }
+
+    LCResult result = DetectLoopClosures(query);
+
+    // published even without matches, so that the new words get cached
+    std::scoped_lock lck(lc_mtx_);
+    if (lc_result_) {
+      // the filter has not picked up the previous result yet
+      if (result.matches.empty()) {
+        std::swap(result.matches, lc_result_->matches);
+        result.gid = lc_result_->gid;
+      }
+      result.new_word_ids.insert(result.new_word_ids.end(),
+                                 lc_result_->new_word_ids.begin(),
+                                 lc_result_->new_word_ids.end());
+    }
+    lc_result_ = std::move(result);
+  }
 }
 
 
-}
\ No newline at end of file
+}
@@ -2,7 +2,11 @@
 // Author: Stephanie Tsuei (stephanietsuei@ucla.edu)
 #pragma once
 
+#include <condition_variable>
 #include <mutex>
+#include <optional>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -15,6 +19,7 @@
 #include "group.h"
 #include "graphbase.h"
 #include "fastbrief.h"
+#include "inverted_index.h"
 
 namespace xivo {
 
@@ -30,15 +35,51 @@ using FastBriefVocabulary =
 using LCMatch = std::pair<FeaturePtr, FeaturePtr>;
 
 
+/** Copy of the instate features needed to search for loop closures, so that
+ *  the search can run on the loop closure thread while the filter moves on. */
+struct LCQuery {
+  /** id of the group in which the observations `xc` were made */
+  int gid;
+  /** ids of the instate features */
+  std::vector<int> fids;
+  /** latest descriptor of each feature, one row each */
+  cv::Mat descriptors;
+  /** latest observation of each feature in normalized coordinates, one row
+   *  each. Unprojected by the filter: the camera is not safe to use from the
+   *  loop closure thread, e.g. while its LUT is rebuilt by online
+   *  calibration. */
+  MatX2 xc;
+  /** index of the latest descriptor in the track of each feature and its
+   *  cached vocabulary word (`Track::kNoWord` if not transformed yet) */
+  std::vector<int> desc_idx;
+  std::vector<DBoW2::WordId> word_ids;
+};
+
+/** Verified loop closures of an `LCQuery`. */
+struct LCResult {
+  int gid;
+  /** (instate feature id, map feature id) pairs */
+  std::vector<std::pair<int, int>> matches;
+  /** vocabulary words computed for the query, to be cached in the tracks:
+   *  feature id, descriptor index and word */
+  std::vector<std::tuple<int, int, DBoW2::WordId>> new_word_ids;
+};
+
+/** Snapshots the latest descriptors and observations of `instate_features`,
+ *  observed in group `gid`. */
+LCQuery MakeLCQuery(const std::vector<FeaturePtr> &instate_features, int gid);
+
+
 // Helper functions for interfacing with Lambdatwist PnP RANSAC
 cvl::PnpParams* GetRANSACParams(const Json::Value &cfg);
-void GetPnPInput(std::vector<LCMatch> &matches,
+void GetPnPInput(const std::vector<FeaturePtr> &map_features,
+                 const MatX2 &xc,
                  std::vector<cvl::Vector3D> &xs,
                  std::vector<cvl::Vector2D> &yns);
-std::vector<LCMatch> GetInlierMatches(std::vector<LCMatch> &matches,
-                                      std::vector<cvl::Vector3D> &xs,
-                                      std::vector<cvl::Vector2D> &yns,
-                                      cvl::PoseD soln);
+std::vector<int> GetInliers(const std::vector<cvl::Vector3D> &xs,
+                            const std::vector<cvl::Vector2D> &yns,
+                            cvl::PoseD soln,
+                            double tol);
 
 
 class Mapper : public GraphBase {
@@ -62,6 +103,32 @@ public:
   bool UseLoopClosure() const { return use_loop_closure_; }
   std::vector<LCMatch> DetectLoopClosures(
     const std::vector<FeaturePtr>& instate_features, const SE3 &gbc);
+  LCResult DetectLoopClosures(const LCQuery &query);
+
+  /** Looks up the features of `result` and marks the instate ones with their
+   *  loop closure match. Features that left the state or the graph since the
+   *  query was made are skipped. Also caches the words computed for the
+   *  query in the feature tracks. */
+  std::vector<LCMatch> ResolveLoopClosures(const LCResult &result);
+
+  /** Whether loop closures are searched on a dedicated thread. */
+  bool AsyncLoopClosure() const { return async_loop_closure_; }
+  /** Hands `query` to the loop closure thread. A query still waiting to be
+   *  picked up is replaced, since its observations are older. */
+  void SubmitLoopClosureQuery(LCQuery query);
+  /** Moves the result of the last finished query, if any, to `result`. */
+  bool PollLoopClosures(LCResult &result);
+
+  /** Writes map features (state, covariance, descriptors and their words),
+   *  groups (poses) and their adjacency to the binary map file `path`. */
+  void SaveMap(const std::string &path);
+  /** Adds the map stored at `path` by `SaveMap` to the mapper, so that loop
+   *  closures against it are found right away. Features and groups get new
+   *  ids. Throws std::runtime_error if the file cannot be read.
+   *  The map is not pinned: it takes slots of the MemoryManager, which
+   *  recycles them oldest first, loaded entities included, once the session
+   *  has used up `max_features` or `max_groups`. */
+  void LoadMap(const std::string &path);
 
 private:
   Mapper() = default;
@@ -69,8 +136,6 @@ private:
   Mapper(const Mapper &) = delete;
   Mapper &operator=(const Mapper &) = delete;
 
-  static std::unique_ptr<Mapper> instance_;
-
   // Loop closure variables
   bool use_loop_closure_;
   bool merge_features_;
@@ -79,13 +144,18 @@ private:
   double nn_dist_thresh_;
   FastBriefVocabulary* voc_;
 
-  /** Maps DBoW2 words to a set of features that map to the same word in the
-   *  vocabulary. */
-  std::unordered_map<DBoW2::WordId, std::unordered_set<FeaturePtr>> InvIndex_;
+  /** Maps DBoW2 words to the map features (and their descriptors) that map
+   *  to the same word in the vocabulary. */
+  InvertedIndex inv_index_;
+  /** Words searched for loop closure candidates of a word, i.e., the words
+   *  under its ancestor `uplevel_word_search_` levels up. Filled on demand. */
+  std::unordered_map<DBoW2::WordId, std::vector<DBoW2::WordId>> search_words_;
 
   // Functions related to loop closure
-  std::unordered_set<FeaturePtr> GetLoopClosureCandidates(const DBoW2::WordId& word_id);
-  void UpdateInverseIndex(const DBoW2::WordId &word_id, FeaturePtr f);
+  /** Returns the map feature whose descriptor is closest to `desc` among the
+   *  candidates of `word_id`, or nullptr if none is within `nn_dist_thresh_`. */
+  FeaturePtr FindLoopClosureCandidate(const DBoW2::WordId& word_id,
+                                      const FastBrief::TDescriptor desc);
 
   /** Solves the P3P problem for outlier rejection of loop closure matches.
    *  Contains an interface to the lambdatwist P3P solver.
@@ -94,6 +164,18 @@ private:
 
   // RANSAC parameters
   cvl::PnpParams* ransac_params_;
+
+  // Loop closure thread
+  bool async_loop_closure_;
+  std::thread lc_thread_;
+  std::mutex lc_mtx_;
+  std::condition_variable lc_cv_;
+  /** query waiting to be picked up by the loop closure thread */
+  std::optional<LCQuery> lc_query_;
+  /** result waiting to be picked up by the filter */
+  std::optional<LCResult> lc_result_;
+  bool lc_quit_;
+  void LoopClosureLoop();
 };
 
 
@@ -0,0 +1,392 @@
+// Binary map files of the Mapper.
+//
+// Layout (native byte order, checked with `kByteOrderMark`): a MapHeader
+// followed by flat arrays of the records below, in the order
+//   groups, group adjacency (feature ids), features, descriptors,
+//   observations,
+// where groups and features refer to their slices of the adjacency,
+// descriptor and observation arrays by offset and count. All records are
+// plain old data, so the file can also be memory-mapped and read in place.
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include <unordered_set>
+
+#include "glog/logging.h"
+
+#include "feature.h"
+#include "group.h"
+#include "mapper.h"
+#include "mm.h"
+
+namespace xivo {
+
+namespace {
+
+constexpr char kMapMagic[8] = {'X', 'I', 'V', 'O', 'M', 'A', 'P', '\0'};
+constexpr uint32_t kMapVersion = 1;
+constexpr uint32_t kByteOrderMark = 0x01020304;
+
+struct MapHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t num_groups;
+  uint64_t num_group_adj;
+  uint64_t num_features;
+  uint64_t num_descriptors;
+  uint64_t num_observations;
+};
+
+struct GroupRecord {
+  int32_t id;
+  uint32_t num_adj;
+  uint64_t adj_begin;
+  double Rsb[9]; // row-major
+  double Tsb[3];
+};
+
+struct FeatureRecord {
+  int32_t id;
+  int32_t ref_id; // -1 if the reference group is not in the map
+  uint32_t num_descriptors;
+  uint32_t num_observations;
+  uint64_t descriptor_begin;
+  uint64_t observation_begin;
+  double x[3];
+  double P[9]; // row-major
+  double Xs[3];
+};
+
+struct DescriptorRecord {
+  uint8_t desc[BRIEF_BYTES];
+  uint32_t word_id;
+  uint32_t padding;
+};
+
+struct ObservationRecord {
+  int32_t gid;
+  uint32_t padding;
+  double xp[2];
+};
+
+static_assert(std::is_trivially_copyable_v<MapHeader> &&
+              std::is_trivially_copyable_v<GroupRecord> &&
+              std::is_trivially_copyable_v<FeatureRecord> &&
+              std::is_trivially_copyable_v<DescriptorRecord> &&
+              std::is_trivially_copyable_v<ObservationRecord>,
+              "map file records must be plain old data");
+
+template <typename T>
+void WriteArray(std::ofstream &out, const std::vector<T> &v) {
+  out.write(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(T));
+}
+
+template <typename T>
+void ReadArray(std::ifstream &in, std::vector<T> &v, uint64_t n) {
+  v.resize(n);
+  in.read(reinterpret_cast<char *>(v.data()), n * sizeof(T));
+}
+
+/** Adds the size of `n` records of type `T` to `total`, false if the sum
+ *  exceeds `limit`. Checked before allocating, so a corrupt count cannot
+ *  overflow or ask for more memory than the file holds. */
+template <typename T>
+bool AddSectionSize(uint64_t n, uint64_t limit, uint64_t &total) {
+  if (n > (limit - total) / sizeof(T)) {
+    return false;
+  }
+  total += n * sizeof(T);
+  return true;
+}
+
+/** Whether the slice [begin, begin+count) lies within a section of `size`
+ *  records. */
+bool InSection(uint64_t begin, uint64_t count, uint64_t size) {
+  return begin <= size && count <= size - begin;
+}
+
+} // namespace
+
+
+void Mapper::SaveMap(const std::string &path) {
+  std::vector<GroupRecord> groups;
+  std::vector<int32_t> group_adj;
+  std::vector<FeatureRecord> features;
+  std::vector<DescriptorRecord> descriptors;
+  std::vector<ObservationRecord> observations;
+
+  {
+    std::scoped_lock lck(features_mtx, groups_mtx);
+
+    for (const auto &[gid, g]: groups_) {
+      GroupRecord r;
+      r.id = gid;
+      r.adj_begin = group_adj.size();
+      for (int fid: group_adj_.at(gid)) {
+        // the adjacency also lists features which never made it to the map
+        if (features_.count(fid)) {
+          group_adj.push_back(fid);
+        }
+      }
+      r.num_adj = group_adj.size() - r.adj_begin;
+      Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>(r.Rsb) =
+        g->Rsb().matrix().cast<double>();
+      Eigen::Map<Eigen::Vector3d>(r.Tsb) = g->Tsb().cast<double>();
+      groups.push_back(r);
+    }
+
+    for (const auto &[fid, f]: features_) {
+      FeatureRecord r;
+      r.id = fid;
+      r.ref_id = (f->ref() != nullptr && groups_.count(f->ref()->id()))
+        ? f->ref()->id() : -1;
+      Eigen::Map<Eigen::Vector3d>(r.x) = f->x().cast<double>();
+      Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>(r.P) =
+        f->P().cast<double>();
+      Eigen::Map<Eigen::Vector3d>(r.Xs) = f->Xs().cast<double>();
+
+      r.descriptor_begin = descriptors.size();
+      r.num_descriptors = f->NumDescriptors();
+      for (int i=0; i<f->NumDescriptors(); i++) {
+        DescriptorRecord d;
+        std::memcpy(d.desc, f->GetAllDescriptors()[i].data, BRIEF_BYTES);
+        d.word_id = f->GetWordId(i, *voc_);
+        d.padding = 0;
+        descriptors.push_back(d);
+      }
+
+      r.observation_begin = observations.size();
+      for (const auto &obs: feature_adj_.at(fid)) {
+        if (groups_.count(obs.first)) {
+          ObservationRecord o;
+          o.gid = obs.first;
+          o.padding = 0;
+          o.xp[0] = obs.second(0);
+          o.xp[1] = obs.second(1);
+          observations.push_back(o);
+        }
+      }
+      r.num_observations = observations.size() - r.observation_begin;
+      features.push_back(r);
+    }
+  }
+
+  MapHeader header;
+  std::memcpy(header.magic, kMapMagic, sizeof(kMapMagic));
+  header.version = kMapVersion;
+  header.byte_order = kByteOrderMark;
+  header.num_groups = groups.size();
+  header.num_group_adj = group_adj.size();
+  header.num_features = features.size();
+  header.num_descriptors = descriptors.size();
+  header.num_observations = observations.size();
+
+  std::ofstream out(path, std::ios::out | std::ios::binary);
+  if (!out.is_open()) {
+    throw std::runtime_error("failed to open map file " + path + " for writing");
+  }
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  WriteArray(out, groups);
+  WriteArray(out, group_adj);
+  WriteArray(out, features);
+  WriteArray(out, descriptors);
+  WriteArray(out, observations);
+
+  LOG(INFO) << "Mapper: saved " << features.size() << " features and "
+    << groups.size() << " groups to " << path;
+}
+
+
+void Mapper::LoadMap(const std::string &path) {
+  std::ifstream in(path, std::ios::in | std::ios::binary);
+  if (!in.is_open()) {
+    throw std::runtime_error("failed to open map file " + path);
+  }
+
+  MapHeader header;
+  in.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!in || std::memcmp(header.magic, kMapMagic, sizeof(kMapMagic)) != 0) {
+    throw std::runtime_error(path + " is not a map file");
+  }
+  if (header.version != kMapVersion) {
+    throw std::runtime_error(StrFormat("map file version %d not supported",
+                                       header.version));
+  }
+  if (header.byte_order != kByteOrderMark) {
+    throw std::runtime_error("map file written with a different byte order");
+  }
+
+  in.seekg(0, std::ios::end);
+  const uint64_t file_size = in.tellg();
+  in.seekg(sizeof(header), std::ios::beg);
+  uint64_t expected_size = sizeof(header);
+  if (!AddSectionSize<GroupRecord>(header.num_groups, file_size, expected_size) ||
+      !AddSectionSize<int32_t>(header.num_group_adj, file_size, expected_size) ||
+      !AddSectionSize<FeatureRecord>(header.num_features, file_size, expected_size) ||
+      !AddSectionSize<DescriptorRecord>(header.num_descriptors, file_size, expected_size) ||
+      !AddSectionSize<ObservationRecord>(header.num_observations, file_size, expected_size)) {
+    throw std::runtime_error("map file " + path + " is truncated");
+  }
+  if (expected_size != file_size) {
+    throw std::runtime_error(StrFormat(
+      "map file %s has %lu bytes, its header accounts for %lu", path.c_str(),
+      (unsigned long)file_size, (unsigned long)expected_size));
+  }
+
+  std::vector<GroupRecord> groups;
+  std::vector<int32_t> group_adj;
+  std::vector<FeatureRecord> features;
+  std::vector<DescriptorRecord> descriptors;
+  std::vector<ObservationRecord> observations;
+  ReadArray(in, groups, header.num_groups);
+  ReadArray(in, group_adj, header.num_group_adj);
+  ReadArray(in, features, header.num_features);
+  ReadArray(in, descriptors, header.num_descriptors);
+  ReadArray(in, observations, header.num_observations);
+  if (!in) {
+    throw std::runtime_error("map file " + path + " is truncated");
+  }
+
+  // Validate all the cross references before creating any entity, such that
+  // a corrupt file leaves the mapper untouched.
+  auto corrupt = [&path](const std::string &what) {
+    return std::runtime_error("corrupt map file " + path + ": " + what);
+  };
+  std::unordered_set<int> group_ids, feature_ids;
+  for (const auto &r: groups) {
+    if (!group_ids.insert(r.id).second) {
+      throw corrupt(StrFormat("duplicate group %d", r.id));
+    }
+  }
+  for (const auto &r: features) {
+    if (!feature_ids.insert(r.id).second) {
+      throw corrupt(StrFormat("duplicate feature %d", r.id));
+    }
+  }
+  for (const auto &r: groups) {
+    if (!InSection(r.adj_begin, r.num_adj, group_adj.size())) {
+      throw corrupt(StrFormat("adjacency of group %d out of range", r.id));
+    }
+    for (uint64_t i=r.adj_begin; i<r.adj_begin+r.num_adj; i++) {
+      if (!feature_ids.count(group_adj[i])) {
+        throw corrupt(StrFormat("group %d lists unknown feature %d", r.id,
+                                group_adj[i]));
+      }
+    }
+  }
+  for (const auto &r: features) {
+    if (r.ref_id != -1 && !group_ids.count(r.ref_id)) {
+      throw corrupt(StrFormat("feature %d refers to unknown group %d", r.id,
+                              r.ref_id));
+    }
+    if (!InSection(r.descriptor_begin, r.num_descriptors, descriptors.size())) {
+      throw corrupt(StrFormat("descriptors of feature %d out of range", r.id));
+    }
+    for (uint64_t i=r.descriptor_begin; i<r.descriptor_begin+r.num_descriptors; i++) {
+      if (descriptors[i].word_id >= voc_->size()) {
+        throw corrupt(StrFormat("feature %d has word %u beyond the vocabulary",
+                                r.id, descriptors[i].word_id));
+      }
+    }
+    if (!InSection(r.observation_begin, r.num_observations, observations.size())) {
+      throw corrupt(StrFormat("observations of feature %d out of range", r.id));
+    }
+    for (uint64_t i=r.observation_begin; i<r.observation_begin+r.num_observations; i++) {
+      if (!group_ids.count(observations[i].gid)) {
+        throw corrupt(StrFormat("feature %d observed by unknown group %d",
+                                r.id, observations[i].gid));
+      }
+    }
+  }
+
+  // The map lives in the slots of the memory manager, and is recycled from
+  // the oldest entity on as the filter needs slots.
+  auto mm = MemoryManager::instance();
+  if (features.size() >= mm->max_features() ||
+      groups.size() >= mm->max_groups()) {
+    throw std::runtime_error(StrFormat(
+      "map of %d features and %d groups does not fit into the memory manager "
+      "(max_features=%d, max_groups=%d)", (int)features.size(), (int)groups.size(),
+      mm->max_features(), mm->max_groups()));
+  }
+
+  // Entities are created anew, so they get ids of this session. Then they
+  // are deactivated, just like the ones handed to the mapper by the
+  // estimator.
+  std::unordered_map<int, GroupPtr> new_groups;
+  for (const auto &r: groups) {
+    Mat3 R = Eigen::Map<const Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>(
+      r.Rsb).cast<number_t>();
+    Vec3 T = Eigen::Map<const Eigen::Vector3d>(r.Tsb).cast<number_t>();
+    new_groups[r.id] = Group::Create(SO3{R}, T);
+  }
+
+  std::unordered_map<int, FeaturePtr> new_features;
+  for (const auto &r: features) {
+    Vec2 xp{-1, -1};
+    if (r.num_observations > 0) {
+      const ObservationRecord &o =
+        observations[r.observation_begin + r.num_observations - 1];
+      xp << o.xp[0], o.xp[1];
+    }
+    FeaturePtr f = Feature::Create(xp(0), xp(1));
+    f->SetState(Eigen::Map<const Eigen::Vector3d>(r.x).cast<number_t>());
+    f->P() = Eigen::Map<const Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>(
+      r.P).cast<number_t>();
+    f->SetXs(Eigen::Map<const Eigen::Vector3d>(r.Xs).cast<number_t>());
+    if (r.ref_id != -1) {
+      f->SetRef(new_groups[r.ref_id]);
+    }
+    for (int i=0; i<r.num_descriptors; i++) {
+      const DescriptorRecord &d = descriptors[r.descriptor_begin + i];
+      cv::Mat desc(1, BRIEF_BYTES, CV_8UC1);
+      std::memcpy(desc.data, d.desc, BRIEF_BYTES);
+      f->SetDescriptor(desc);
+      f->SetWordId(i, d.word_id);
+    }
+    new_features[r.id] = f;
+  }
+
+  {
+    std::scoped_lock lck(features_mtx, groups_mtx);
+    for (const auto &r: groups) {
+      GroupPtr g = new_groups[r.id];
+      GroupAdj adj;
+      for (int i=0; i<r.num_adj; i++) {
+        adj.Add(new_features[group_adj[r.adj_begin + i]]->id());
+      }
+      groups_[g->id()] = g;
+      group_adj_[g->id()] = adj;
+    }
+
+    for (const auto &r: features) {
+      FeaturePtr f = new_features[r.id];
+      FeatureAdj adj;
+      for (int i=0; i<r.num_observations; i++) {
+        const ObservationRecord &o = observations[r.observation_begin + i];
+        adj[new_groups[o.gid]->id()] = Vec2{o.xp[0], o.xp[1]};
+      }
+      features_[f->id()] = f;
+      feature_adj_[f->id()] = adj;
+
+      auto dbow_desc = f->GetAllDBoWDesc();
+      for (int i=0; i<r.num_descriptors; i++) {
+        inv_index_.Add(descriptors[r.descriptor_begin + i].word_id, f->id(),
+                       dbow_desc[i]);
+      }
+    }
+  }
+
+  for (auto p: new_features) {
+    Feature::Deactivate(p.second);
+  }
+  for (auto p: new_groups) {
+    Group::Deactivate(p.second);
+  }
+
+  LOG(INFO) << "Mapper: loaded " << features.size() << " features and "
+    << groups.size() << " groups from " << path;
+}
+
+}
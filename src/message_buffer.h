@@ -0,0 +1,255 @@
+// Reorder buffer merging timestamped sensor streams for the estimator.
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#include "core.h"
+
+namespace xivo {
+
+/** Bounded lock-free queue for exactly one producer and one consumer thread. */
+template <typename T>
+class SPSCRing {
+public:
+  SPSCRing(size_t capacity) : slots_(capacity + 1), head_{0}, tail_{0} {}
+
+  /** Producer side. Returns false, leaving `item` untouched, if full. */
+  bool TryPush(T &item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t next = (tail + 1) % slots_.size();
+    if (next == head_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    slots_[tail] = std::move(item);
+    tail_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  /** Consumer side. Returns false if empty. */
+  bool TryPop(T &item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = std::move(slots_[head]);
+    head_.store((head + 1) % slots_.size(), std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+  /** Exact on the consumer side, a guess elsewhere. */
+  size_t size() const {
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    return (tail + slots_.size() - head) % slots_.size();
+  }
+
+private:
+  std::vector<T> slots_;  // one slot is kept free to tell full from empty
+  // written by the consumer and the producer respectively
+  alignas(64) std::atomic<size_t> head_;
+  alignas(64) std::atomic<size_t> tail_;
+};
+
+
+/** Merges several streams of messages (anything with `ts()`) into a single
+ * stream in timestamp order.
+ *
+ * Every stream has its own SPSC ring, so pushing a message takes no lock: each
+ * stream must be fed by one thread at a time, with non-decreasing timestamps.
+ * The consumer moves the messages into a local heap and releases the oldest
+ * one as soon as either
+ *  - every stream has delivered a message at least as recent, so nothing
+ *    older can arrive any more, or
+ *  - some stream is `max_latency` ahead of it: a stream lagging behind more
+ *    than that (or silent, e.g., no IMU) is not waited for, and its late
+ *    messages come out of order.
+ * The consumer blocks on a condition variable, not on a spin, while nothing can
+ * be released.
+ *
+ * A message may also be a batch spanning [ts(), last_ts()], if it has
+ * `last_ts()` and `Split(ts)`, the latter cutting off and returning the part
+ * after `ts` (or nullptr if nothing is left), always keeping the first item.
+ * A batch is released as one message up to the next message of any stream, or
+ * the next one that may still arrive; the rest goes back into the buffer. */
+template <typename T>
+class ReorderBuffer {
+public:
+  using Ptr = std::unique_ptr<T>;
+
+  ReorderBuffer(int num_streams, const timestamp_t &max_latency,
+                size_t capacity = 512)
+      : max_latency_{max_latency}, last_ts_(num_streams, kNever),
+        newest_{kNever}, waiting_{false}, closed_{false} {
+    for (int i = 0; i < num_streams; ++i) {
+      rings_.emplace_back(new SPSCRing<Ptr>(capacity));
+    }
+  }
+
+  /** Producer side of `stream`. Only blocks if the consumer is `capacity`
+   * messages behind. */
+  void Push(int stream, Ptr msg) {
+    while (!rings_[stream]->TryPush(msg)) {
+      std::unique_lock<std::mutex> lck(mtx_);
+      not_full_.wait_for(lck, std::chrono::milliseconds(1));
+    }
+    // pairs with the fence in Pop: either the consumer sees the message, or
+    // we see it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting_.load(std::memory_order_relaxed)) {
+      std::scoped_lock lck(mtx_);
+      not_empty_.notify_one();
+    }
+  }
+
+  /** Consumer side. Next message in timestamp order, or nullptr if none can
+   * be released yet and `block` is false. If `block` is true, wait for one,
+   * returning nullptr only once the buffer is closed and drained. */
+  Ptr Pop(bool block) {
+    for (;;) {
+      if (Drain()) {
+        not_full_.notify_all();
+      }
+      if (Releasable()) {
+        std::pop_heap(heap_.begin(), heap_.end(), Later);
+        Ptr msg = std::move(heap_.back());
+        heap_.pop_back();
+        if constexpr (kBatches) {
+          SplitBatch(msg);
+        }
+        return msg;
+      }
+      if (!block) return nullptr;
+
+      std::unique_lock<std::mutex> lck(mtx_);
+      waiting_.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      not_empty_.wait(lck, [this]() { return closed_ || !RingsEmpty(); });
+      waiting_.store(false, std::memory_order_relaxed);
+      if (closed_ && RingsEmpty() && heap_.empty()) {
+        return nullptr;
+      }
+    }
+  }
+
+  /** Consumer side. Messages pushed but not released yet. */
+  size_t size() const {
+    size_t n = heap_.size();
+    for (const auto &ring : rings_) {
+      n += ring->size();
+    }
+    return n;
+  }
+
+  /** Release everything left, regardless of lateness, and wake up a blocked
+   * consumer. */
+  void Close() {
+    std::scoped_lock lck(mtx_);
+    closed_ = true;
+    not_empty_.notify_all();
+  }
+
+private:
+  static constexpr int64_t kNever = std::numeric_limits<int64_t>::min();
+
+  template <typename U, typename = void>
+  struct IsBatch : std::false_type {};
+  template <typename U>
+  struct IsBatch<U, std::void_t<decltype(std::declval<U &>().Split(
+                        std::declval<const timestamp_t &>()))>>
+      : std::true_type {};
+  static constexpr bool kBatches = IsBatch<T>::value;
+
+  static int64_t LastTs(const T &msg) {
+    if constexpr (kBatches) {
+      return msg.last_ts().count();
+    } else {
+      return msg.ts().count();
+    }
+  }
+
+  /** Put back the part of a released batch which would come after messages
+   * already in the heap or still to arrive. */
+  void SplitBatch(Ptr &msg) {
+    if (LastTs(*msg) == msg->ts().count()) return;
+    int64_t horizon = std::numeric_limits<int64_t>::max();
+    if (!closed_.load()) {
+      // nothing older can arrive, or is waited for; see Releasable
+      horizon = std::max(*std::min_element(last_ts_.begin(), last_ts_.end()),
+                         newest_ - max_latency_.count());
+    }
+    if (!heap_.empty()) {
+      horizon = std::min(horizon, heap_.front()->ts().count());
+    }
+    if (LastTs(*msg) <= horizon) return;
+    if (Ptr rest{msg->Split(timestamp_t{horizon})}) {
+      heap_.push_back(std::move(rest));
+      std::push_heap(heap_.begin(), heap_.end(), Later);
+    }
+  }
+
+  static bool Later(const Ptr &m1, const Ptr &m2) {
+    return m1->ts() > m2->ts();
+  }
+
+  /** Move whatever the producers pushed into the heap. */
+  bool Drain() {
+    bool drained{false};
+    Ptr msg;
+    for (int i = 0; i < rings_.size(); ++i) {
+      while (rings_[i]->TryPop(msg)) {
+        int64_t ts = LastTs(*msg);
+        last_ts_[i] = std::max(last_ts_[i], ts);
+        newest_ = std::max(newest_, ts);
+        heap_.push_back(std::move(msg));
+        std::push_heap(heap_.begin(), heap_.end(), Later);
+        drained = true;
+      }
+    }
+    return drained;
+  }
+
+  bool Releasable() const {
+    if (heap_.empty()) return false;
+    int64_t ts = heap_.front()->ts().count();
+    if (closed_.load() || ts + max_latency_.count() <= newest_) {
+      return true;
+    }
+    for (int64_t last : last_ts_) {
+      if (last < ts) return false;
+    }
+    return true;
+  }
+
+  bool RingsEmpty() const {
+    for (const auto &ring : rings_) {
+      if (!ring->empty()) return false;
+    }
+    return true;
+  }
+
+  timestamp_t max_latency_;
+  std::vector<std::unique_ptr<SPSCRing<Ptr>>> rings_;
+
+  // owned by the consumer
+  std::vector<Ptr> heap_;
+  std::vector<int64_t> last_ts_;  // newest timestamp of each stream
+  int64_t newest_;  // newest timestamp of all
+
+  std::mutex mtx_;
+  std::condition_variable not_empty_, not_full_;
+  std::atomic<bool> waiting_, closed_;
+};
+
+} // namespace xivo
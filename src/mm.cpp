@@ -1,4 +1,5 @@
 #include "mm.h"
+#include "context.h"
 #include "feature.h"
 #include "group.h"
 #include "mapper.h"
@@ -137,11 +138,10 @@ void CircBufWithHash<Group>::RemoveFromMapper(GroupPtr item) {
 }
 
 
-std::unique_ptr<MemoryManager> MemoryManager::instance_ = nullptr;
-
 MemoryManagerPtr MemoryManager::Create(int max_features, int max_groups) {
-  if (!instance_) {
-    instance_ = std::unique_ptr<MemoryManager>(
+  auto &instance = EstimatorContext::current()->memory_manager_;
+  if (!instance) {
+    instance = std::unique_ptr<MemoryManager>(
         new MemoryManager(max_features, max_groups));
     LOG(INFO) << StrFormat(
         "MemoryManager instance created with %d features and %d groups",
@@ -149,7 +149,7 @@ MemoryManagerPtr MemoryManager::Create(int max_features, int max_groups) {
   } else {
     LOG(WARNING) << "MemoryManager instance already created!";
   }
-  return instance_.get();
+  return instance.get();
 }
 
 MemoryManager::MemoryManager(int max_features, int max_groups) {
@@ -163,10 +163,11 @@ MemoryManager::~MemoryManager() {
 }
 
 MemoryManagerPtr MemoryManager::instance() {
-  if (!instance_) {
+  auto &instance = EstimatorContext::current()->memory_manager_;
+  if (!instance) {
     throw std::runtime_error("MemoryManager instance not created yet");
   }
-  return instance_.get();
+  return instance.get();
 }
 
 FeaturePtr MemoryManager::GetFeature() {
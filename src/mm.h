@@ -21,6 +21,8 @@ public:
   T* GetItem();
   void DeactivateItem(T* item);
   void DestroyItem(T *item);
+  int max_items() const { return max_items_; }
+  int num_active_items() const { return num_slots_active_; }
 
 private:
   int max_items_;
@@ -56,6 +58,11 @@ public:
   void DeactivateGroup(GroupPtr);
   void DestroyGroup(GroupPtr);
 
+  int max_features() const { return feature_slots_->max_items(); }
+  int max_groups() const { return group_slots_->max_items(); }
+  int num_active_features() const { return feature_slots_->num_active_items(); }
+  int num_active_groups() const { return group_slots_->num_active_items(); }
+
 private:
   MemoryManager() = delete;
   MemoryManager(const MemoryManager &) = delete;
@@ -63,8 +70,6 @@ private:
 
   MemoryManager(int max_features = 512, int max_groups = 128);
 
-  static std::unique_ptr<MemoryManager> instance_;
-
   CircBufWithHash<Feature> *feature_slots_;
   CircBufWithHash<Group> *group_slots_;
 };
@@ -1,64 +1,100 @@
+#include <algorithm>
 #include <iostream>
 
 // 3rdparty
 #include "glog/logging.h"
 
 // xivo
+#include "context.h"
 #include "optimizer.h"
 #include "utils.h"
 
 namespace xivo {
 
-std::unique_ptr<Optimizer> Optimizer::instance_ = nullptr;
+namespace {
+
+bool Connected(FeatureVertex *fv, GroupVertex *gv) {
+  for (auto e : fv->edges()) {
+    if (e->vertex(1) == gv) return true;
+  }
+  return false;
+}
+
+} // namespace
+
+g2o::OptimizationAlgorithm* CreateAlgorithm(const std::string &solver_type) {
+  // _6_3: poses are parametrized by 6-dim vectors and landmarks by 3-dim vectors
+  std::unique_ptr<g2o::BlockSolver_6_3::LinearSolverType> solver;
+  if (solver_type == "cholmod") {
+    solver = g2o::make_unique<g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType>>();
+  } else if (solver_type == "csparse") {
+    solver = g2o::make_unique<g2o::LinearSolverCSparse<g2o::BlockSolver_6_3::PoseMatrixType>>();
+  } else if (solver_type == "dense") {
+    solver = g2o::make_unique<g2o::LinearSolverDense<g2o::BlockSolver_6_3::PoseMatrixType>>();
+  } else {
+    // default to cholmod
+    LOG(WARNING) << "unknown linear solver type; default to cholmod";
+    solver = g2o::make_unique<g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType>>();
+  }
+  return new g2o::OptimizationAlgorithmLevenberg(
+      g2o::make_unique<g2o::BlockSolver_6_3>(std::move(solver)));
+}
+
 
 OptimizerPtr Optimizer::Create(const Json::Value &cfg) {
-  if (instance_) {
+  auto &instance = EstimatorContext::current()->optimizer_;
+  if (instance) {
     LOG(WARNING) << 
       "Optimizer instance already created! Returning existing one ...";
   } else {
-    instance_ = std::unique_ptr<Optimizer>(new Optimizer(cfg));
+    instance = std::shared_ptr<Optimizer>(new Optimizer(cfg));
   }
-  return instance_.get();
+  return instance.get();
 } 
 
 OptimizerPtr Optimizer::instance() {
-  CHECK(instance_ != nullptr);
-  return instance_.get();
+  auto &instance = EstimatorContext::current()->optimizer_;
+  CHECK(instance != nullptr);
+  return instance.get();
 }
 
 Optimizer::~Optimizer() {
+  if (worker_.joinable()) {
+    {
+      std::scoped_lock lck(queue_mtx_);
+      quit_ = true;
+    }
+    queue_cv_.notify_one();
+    worker_.join();
+  }
+  optimizer_.removePostIterationAction(&budget_);
 }
 
 Optimizer::Optimizer(const Json::Value &cfg) 
-  : verbose_{false}, solver_type_{"cholmod"}, use_robust_kernel_{false}, initialized_{false}
-
+  : verbose_{false}, solver_type_{"cholmod"}, use_robust_kernel_{false}, initialized_{false},
+  async_{false}, max_iters_{10}, time_budget_ms_{20}, window_size_{10},
+  stop_{false}, quit_{false}, budget_{&stop_, &quit_}
 {
   // setup flags
   verbose_ = cfg.get("verbose", true).asBool();
   solver_type_ = cfg.get("solver", "cholmod").asString();
   use_robust_kernel_ = cfg.get("use_robust_kernel", true).asBool();
-
-  // _6_3: poses are parametrized by 6-dim vectors and landmarks by 3-dim vectors
-  std::unique_ptr<g2o::BlockSolver_6_3::LinearSolverType> solver;
-  if (solver_type_ == "cholmod") {
-    solver = g2o::make_unique<g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType>>();
-  } else if (solver_type_ == "csparse") {
-    solver = g2o::make_unique<g2o::LinearSolverCSparse<g2o::BlockSolver_6_3::PoseMatrixType>>();
-  } else if (solver_type_ == "dense") {
-    solver = g2o::make_unique<g2o::LinearSolverDense<g2o::BlockSolver_6_3::PoseMatrixType>>();
-  } else {
-    // default to cholmod
-    LOG(WARNING) << "unknown linear solver type; default to cholmod";
-    solver = g2o::make_unique<g2o::LinearSolverCholmod<g2o::BlockSolver_6_3::PoseMatrixType>>();
-  }
-
+  async_ = cfg.get("async", false).asBool();
+  max_iters_ = cfg.get("max_iters", 10).asInt();
+  time_budget_ms_ = cfg.get("time_budget_ms", 20.0).asDouble();
+  window_size_ = cfg.get("window_size", 10).asInt();
 
   optimizer_.setVerbose(verbose_);
+  optimizer_.setAlgorithm(CreateAlgorithm(solver_type_));
+  optimizer_.setForceStopFlag(&stop_);
+  optimizer_.addPostIterationAction(&budget_);
 
-  auto algorithm = new g2o::OptimizationAlgorithmLevenberg(
-      g2o::make_unique<g2o::BlockSolver_6_3>(std::move(solver)));
-
-  optimizer_.setAlgorithm(algorithm);
+  if (async_) {
+    worker_ = std::thread([this, context = EstimatorContext::current()]() {
+      EstimatorContext::Scope scope{context};
+      Run();
+    });
+  }
 }
 
 
@@ -76,9 +112,10 @@ GroupVertex* Optimizer::CreateGroupVertex(const GroupAdapter &g) {
   auto gv = new GroupVertex();
   gv->setId(g.id);
   gv->setEstimate(g.gsb);
-  // FIXME (xfei): to fix gauge freedom
-  // gv->setFixed(true);  
+  // the first pose fixes the gauge freedom
+  gv->setFixed(gvertices_.empty());
   gvertices_[g.id] = gv;
+  group_order_.push_back(g.id);
   optimizer_.addVertex(gv);
   return gv;
 }
@@ -102,7 +139,39 @@ Edge* Optimizer::CreateEdge(FeatureVertex *fv, GroupVertex *gv, const Vec2 &xp,
   return e;
 }
 
-void Optimizer::AddFeature(const FeatureAdapter &f, const VectorObsAdapterG &obs) {
+void Optimizer::AddFeature(const FeatureAdapter &f, const VectorObsAdapterG &obs,
+                           bool loop_closure) {
+  if (!async_) {
+    std::scoped_lock lck(graph_mtx_);
+    InsertFeature(f, obs);
+    return;
+  }
+  {
+    std::scoped_lock lck(queue_mtx_);
+    pending_features_.push_back({f, obs, loop_closure});
+  }
+  queue_cv_.notify_one();
+}
+
+void Optimizer::AddGroup(const GroupAdapter &g, const VectorObsAdapterF &obs) {
+  if (!async_) {
+    std::scoped_lock lck(graph_mtx_);
+    InsertGroup(g, obs);
+    return;
+  }
+  {
+    std::scoped_lock lck(queue_mtx_);
+    pending_groups_.push_back({g, obs});
+  }
+  queue_cv_.notify_one();
+}
+
+void Optimizer::SetCameraToBody(const SE3 &gbc) {
+  std::scoped_lock lck(queue_mtx_);
+  gbc_ = gbc;
+}
+
+void Optimizer::InsertFeature(const FeatureAdapter &f, const VectorObsAdapterG &obs) {
   // CHECK(!fvertices_.count(f->id()) << "Feature #" << f->id() << " already in optimization graph";
   if (!fvertices_.count(f.id)) {
     // feature vertex not exist, create one
@@ -116,12 +185,13 @@ void Optimizer::AddFeature(const FeatureAdapter &f, const VectorObsAdapterG &obs
       CreateGroupVertex(g);
     }
     auto gv = gvertices_.at(g.id);
-    // FIXME (xfei): make sure no duplicate edges are added
-    CreateEdge(fv, gv, xp, IM);
+    if (!Connected(fv, gv)) {
+      CreateEdge(fv, gv, xp, IM);
+    }
   }
 }
 
-void Optimizer::AddGroup(const GroupAdapter &g, const VectorObsAdapterF &obs) {
+void Optimizer::InsertGroup(const GroupAdapter &g, const VectorObsAdapterF &obs) {
   if (!gvertices_.count(g.id)) {
     CreateGroupVertex(g);
   }
@@ -132,12 +202,19 @@ void Optimizer::AddGroup(const GroupAdapter &g, const VectorObsAdapterF &obs) {
       CreateFeatureVertex(f);
     }
     auto fv = fvertices_.at(f.id);
-    // FIXME (xfei): make sure no duplicate edges are added
-    CreateEdge(fv, gv, xp, IM);
+    if (!Connected(fv, gv)) {
+      CreateEdge(fv, gv, xp, IM);
+    }
   }
 }
 
 void Optimizer::Solve(int max_iters) {
+  std::scoped_lock lck(graph_mtx_);
+  if (async_) {
+    std::unordered_set<int> groups, loop_features;
+    Flush(groups, loop_features);
+  }
+
   if (!initialized_) {
     optimizer_.initializeOptimization();
     initialized_ = true;
@@ -155,10 +232,152 @@ void Optimizer::Solve(int max_iters) {
   int num_active_edges = optimizer_.activeEdges().size();
   number_t init_average_chi2 = optimizer_.chi2() / num_active_edges;
 
+  stop_ = false;
+  budget_.Start(0);
   optimizer_.optimize(max_iters);
 
   number_t average_chi2 = optimizer_.chi2() / num_active_edges;
   std::cout << StrFormat("average chi2: %0.2f -> %0.2f\n", init_average_chi2, average_chi2);
+
+  std::unordered_set<int> groups(group_order_.begin(), group_order_.end());
+  Publish(groups);
+}
+
+
+void Optimizer::Run() {
+  while (true) {
+    {
+      std::unique_lock lck(queue_mtx_);
+      queue_cv_.wait(lck, [this]() {
+        return quit_ || !pending_features_.empty() || !pending_groups_.empty();
+      });
+      if (quit_) break;
+    }
+
+    std::scoped_lock lck(graph_mtx_);
+    std::unordered_set<int> groups, loop_features;
+    if (!Flush(groups, loop_features)) continue;
+
+    // a loop closure re-linearizes every pose which observed the closing
+    // features, old ones included
+    for (int fid : loop_features) {
+      for (auto e : fvertices_.at(fid)->edges()) {
+        groups.insert(e->vertex(1)->id());
+      }
+    }
+    int start = std::max(0, (int)group_order_.size() - window_size_);
+    for (int i = start; i < group_order_.size(); ++i) {
+      groups.insert(group_order_[i]);
+    }
+    // rounds cut short by the budget are resumed with the next batch
+    groups.insert(unfinished_groups_.begin(), unfinished_groups_.end());
+    unfinished_groups_.clear();
+
+    SolveLocal(groups);
+    if (stop_ && !quit_) {
+      unfinished_groups_ = groups;
+    }
+    Publish(groups);
+  }
+}
+
+
+bool Optimizer::Flush(std::unordered_set<int> &touched_groups,
+                      std::unordered_set<int> &loop_features) {
+  std::vector<PendingFeature> features;
+  std::vector<PendingGroup> groups;
+  {
+    std::scoped_lock lck(queue_mtx_);
+    std::swap(features, pending_features_);
+    std::swap(groups, pending_groups_);
+  }
+  if (features.empty() && groups.empty()) {
+    return false;
+  }
+
+  for (const auto &pg : groups) {
+    InsertGroup(pg.g, pg.obs);
+    touched_groups.insert(pg.g.id);
+  }
+  for (const auto &pf : features) {
+    InsertFeature(pf.f, pf.obs);
+    for (const auto &obs : pf.obs) {
+      touched_groups.insert(std::get<0>(obs).id);
+    }
+    if (pf.loop_closure) {
+      loop_features.insert(pf.f.id);
+    }
+  }
+  return true;
+}
+
+
+void Optimizer::SolveLocal(const std::unordered_set<int> &groups) {
+  // all measurements of the features seen from the window
+  g2o::HyperGraph::EdgeSet eset;
+  for (int gid : groups) {
+    for (auto e : gvertices_.at(gid)->edges()) {
+      for (auto fe : e->vertex(0)->edges()) {
+        eset.insert(fe);
+      }
+    }
+  }
+  if (eset.empty()) return;
+
+  // poses outside of the window only anchor it
+  std::vector<GroupVertex*> held;
+  bool anchored = false;
+  for (auto e : eset) {
+    auto gv = static_cast<GroupVertex*>(e->vertex(1));
+    if (!groups.count(gv->id())) {
+      if (!gv->fixed()) {
+        gv->setFixed(true);
+        held.push_back(gv);
+      }
+      anchored = true;
+    } else if (gv->fixed()) {
+      anchored = true;
+    }
+  }
+  if (!anchored) {
+    auto gv = gvertices_.at(*std::min_element(groups.begin(), groups.end()));
+    gv->setFixed(true);
+    held.push_back(gv);
+  }
+
+  optimizer_.setVerbose(false);
+  optimizer_.initializeOptimization(eset);
+  optimizer_.computeActiveErrors();
+  number_t init_chi2 = optimizer_.chi2();
+
+  stop_ = false;
+  budget_.Start(time_budget_ms_);
+  optimizer_.optimize(max_iters_);
+
+  if (verbose_) {
+    LOG(INFO) << StrFormat("Optimizer: %d groups, %d edges, chi2 %0.2f -> %0.2f%s",
+                           (int)groups.size(), (int)eset.size(),
+                           init_chi2, optimizer_.chi2(),
+                           stop_ ? " (out of time)" : "");
+  }
+
+  for (auto gv : held) {
+    gv->setFixed(false);
+  }
+}
+
+
+void Optimizer::Publish(const std::unordered_set<int> &groups) {
+  SE3 gcb;
+  {
+    std::scoped_lock lck(queue_mtx_);
+    gcb = gbc_.inv();
+  }
+  std::unordered_map<int, SE3> poses;
+  for (int gid : groups) {
+    poses[gid] = gvertices_.at(gid)->estimate() * gcb;
+  }
+  corrected_poses_.Publish(std::move(poses));
 }
 
 
@@ -1,10 +1,19 @@
 // Bundle Adjustment/Pose Graph Optimization module.
-// Run in the background, trigger every ... seconds?
+// With "async" on, vertices and edges are queued by the filter thread and
+// folded into the graph by a worker, which re-optimizes a local window (or the
+// neighborhood of a loop closure) under a wall-clock budget.
 // Reference:
 //  g2o/examples/bal/bal_demo.cpp
 // Author: Xiaohan Fei (feixh@cs.ucla.edu)
 #pragma once
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "json/json.h"
 
@@ -16,16 +25,42 @@ namespace xivo {
 class Optimizer;
 using OptimizerPtr = Optimizer*;
 
+/** Levenberg-Marquardt over a 6-3 block solver with the given linear solver
+ * ("cholmod", "csparse" or "dense"). */
+g2o::OptimizationAlgorithm* CreateAlgorithm(const std::string &solver_type);
+
 
 class Optimizer {
 public:
   ~Optimizer();
   static OptimizerPtr Create(const Json::Value &cfg);
   static OptimizerPtr instance();
+  /** Batch optimization over the whole graph. Blocks the incremental worker. */
   void Solve(int iters=1);
 
-  void AddFeature(const FeatureAdapter &f, const VectorObsAdapterG &obs);
+  /** Add a feature and its observations. A feature which closes a loop should
+   * carry the id of the map feature it matched so its observations attach to
+   * the existing vertex; the worker then re-optimizes the loop's
+   * neighborhood. */
+  void AddFeature(const FeatureAdapter &f, const VectorObsAdapterG &obs,
+                  bool loop_closure=false);
   void AddGroup(const GroupAdapter &g, const VectorObsAdapterF &obs);
+  /** Camera-to-body transformation the added poses are composed with, used
+   * to publish the corrected poses of the body. */
+  void SetCameraToBody(const SE3 &gbc);
+
+  /** Body-to-spatial poses of the groups re-optimized by the last round,
+   * keyed by group id. Earlier rounds are not accumulated: a consumer which
+   * keeps the whole trajectory merges each version as it is published.
+   * `version`, if given, receives the version of the returned poses. */
+  std::unordered_map<int, SE3> GetCorrectedPoses(int *version=nullptr) const {
+    return corrected_poses_.Get(version);
+  }
+  bool GetCorrectedPose(int gid, SE3 &gsb) const {
+    return corrected_poses_.Get(gid, gsb);
+  }
+  /** Incremented every time the worker publishes new poses. */
+  int corrected_poses_version() const { return corrected_poses_.version(); }
 
 private:
   Optimizer() = delete;
@@ -38,21 +73,61 @@ private:
   GroupVertex* CreateGroupVertex(const GroupAdapter &g);
   Edge* CreateEdge(FeatureVertex *fv, GroupVertex *gv, const Vec2 &xp, const Mat2 &IM);
 
-  // the instance class memeber
-  static std::unique_ptr<Optimizer> instance_;
+  void InsertFeature(const FeatureAdapter &f, const VectorObsAdapterG &obs);
+  void InsertGroup(const GroupAdapter &g, const VectorObsAdapterF &obs);
+
+  // incremental back-end
+  void Run();
+  /** Move queued additions into the graph. Returns false if nothing changed. */
+  bool Flush(std::unordered_set<int> &touched_groups,
+             std::unordered_set<int> &loop_features);
+  /** Optimize the features seen by `groups` and the poses of `groups`.
+   * Other groups observing those features are held fixed. */
+  void SolveLocal(const std::unordered_set<int> &groups);
+  void Publish(const std::unordered_set<int> &groups);
+
+  struct PendingFeature {
+    FeatureAdapter f;
+    VectorObsAdapterG obs;
+    bool loop_closure;
+  };
+  struct PendingGroup {
+    GroupAdapter g;
+    VectorObsAdapterF obs;
+  };
 
   // flags
   bool verbose_;
   std::string solver_type_;
   bool use_robust_kernel_;
   bool initialized_;
+  bool async_;
+  int max_iters_;
+  double time_budget_ms_;  // per optimization round
+  int window_size_;  // number of latest groups re-optimized per round
   
   // graph structure: features & groups as vertices
   std::unordered_map<int, FeatureVertex*> fvertices_;
   std::unordered_map<int, GroupVertex*> gvertices_;
+  std::vector<int> group_order_;  // group ids in order of insertion
 
   // g2o variables
   g2o::SparseOptimizer optimizer_;
+  bool stop_;
+  std::atomic<bool> quit_;
+  TimeBudget budget_;
+  std::mutex graph_mtx_;  // guards the g2o graph and the vertex tables
+
+  // queue filled by the filter thread, drained by the worker
+  std::thread worker_;
+  std::mutex queue_mtx_;
+  std::condition_variable queue_cv_;
+  std::vector<PendingFeature> pending_features_;
+  std::vector<PendingGroup> pending_groups_;
+  std::unordered_set<int> unfinished_groups_;  // worker-only
+  SE3 gbc_;  // guarded by queue_mtx_
+
+  PublishedPoses corrected_poses_;
 };
 
 } // namespace xivo
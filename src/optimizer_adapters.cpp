@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <unordered_set>
+
 #include "optimizer_adapters.h"
 #include "optimizer.h"
 #include "graph.h"
@@ -11,8 +14,11 @@ void AddFeature(FeaturePtr f) {
   if (!Graph::instance()->HasFeature(f)) {
     return;
   }
-  // adapt feature
-  FeatureAdapter adapter_f{f->id(), f->Xs()};
+  // adapt feature; a feature closing a loop is merged into the map feature
+  // it matched, so its observations become edges of that vertex
+  int matched_id = f->LoopClosureMatch();
+  bool loop_closure = (matched_id != -1);
+  FeatureAdapter adapter_f{loop_closure ? matched_id : f->id(), f->Xs()};
   VectorObsAdapterG adapter_obs;
 
   // adapt observations
@@ -26,7 +32,8 @@ void AddFeature(FeaturePtr f) {
   }
   LOG(INFO) << "Optimizer: adding feature #" << adapter_f.id <<
     " with " << adapter_obs.size() << " groups" << std::endl;
-  Optimizer::instance()->AddFeature(adapter_f, adapter_obs);
+  Optimizer::instance()->SetCameraToBody(gbc);
+  Optimizer::instance()->AddFeature(adapter_f, adapter_obs, loop_closure);
 }
 
 void AddGroup(GroupPtr g) {
@@ -50,9 +57,53 @@ void AddGroup(GroupPtr g) {
 
   LOG(INFO) << "Optimizer: adding group #" << adapter_g.id <<
     " with " << adapter_obs.size() << " features" << std::endl;
+  Optimizer::instance()->SetCameraToBody(gbc);
   Optimizer::instance()->AddGroup(adapter_g, adapter_obs);
 }
 
+WindowProblem MakeWindowProblem(int window_size) {
+  Graph& graph{*Graph::instance()};
+  auto gbc{Estimator::instance()->gbc()};
+
+  // group ids are increasing in time
+  std::vector<GroupPtr> groups = graph.GetGroups();
+  std::sort(groups.begin(), groups.end(),
+            [](GroupPtr g1, GroupPtr g2) { return g1->id() < g2->id(); });
+  if ((int)groups.size() > window_size) {
+    groups.erase(groups.begin(), groups.end() - window_size);
+  }
+
+  WindowProblem problem;
+  problem.gbc = gbc;
+  std::unordered_set<int> gids;
+  for (GroupPtr g : groups) {
+    problem.groups.push_back(GroupAdapter{g->id(), g->gsb() * gbc});
+    gids.insert(g->id());
+  }
+
+  std::unordered_set<int> visited;
+  for (GroupPtr g : groups) {
+    for (FeaturePtr f : graph.GetFeaturesOf(g)) {
+      if (!visited.insert(f->id()).second) continue;
+      if (!f->instate() && f->status() != FeatureStatus::READY) continue;
+
+      std::vector<std::pair<int, Vec2>> obs;
+      for (const auto& [gid, xp] : graph.GetFeatureAdj(f)) {
+        if (gids.count(gid)) {
+          obs.emplace_back(gid, Camera::instance()->UnProject(xp));
+        }
+      }
+      if (obs.size() < 2) continue;
+
+      problem.features.push_back(FeatureAdapter{f->id(), f->Xs(gbc)});
+      for (const auto& [gid, xc] : obs) {
+        problem.obs.emplace_back(f->id(), gid, xc);
+      }
+    }
+  }
+  return problem;
+}
+
 } // namespace adapter
 
 } // namespace xivo
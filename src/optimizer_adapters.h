@@ -2,6 +2,7 @@
 // the optimizer.
 #pragma once
 #include "optimizer_types.h"
+#include "window_optimizer.h"
 #include "feature.h"
 #include "group.h"
 
@@ -12,6 +13,10 @@ namespace adapter {
 void AddFeature(FeaturePtr f);
 void AddGroup(GroupPtr g);
 
+/** Snapshot of the latest `window_size` groups of the graph and the features
+ * with a depth estimate observed at least twice among them. */
+WindowProblem MakeWindowProblem(int window_size);
+
 } // namespace adapter
 
 } // namespace xivo
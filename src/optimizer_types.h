@@ -1,7 +1,11 @@
 // Elements for pose graph optimization.
 // Author: Xiaohan Fei (feixh@cs.ucla.edu)
 #pragma once
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <tuple>
+#include <unordered_map>
 
 #include "g2o_setup.h"
 
@@ -103,6 +107,102 @@ public:
   }
 };
 
+// Prior on a pose, e.g. the marginal of states which left a sliding window.
+class GroupPriorEdge: public g2o::BaseUnaryEdge<6, SE3, GroupVertex> {
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  GroupPriorEdge() = default;
+
+  void computeError() {
+    const GroupVertex* gv = static_cast<const GroupVertex*>(_vertices[0]);
+    // same parametrization as GroupVertex::oplusImpl
+    _error.head<3>() = SO3::log(_measurement.R().inv() * gv->estimate().R());
+    _error.tail<3>() = gv->estimate().T() - _measurement.T();
+  }
+
+  virtual bool read(std::istream& is) {
+    std::cerr << __PRETTY_FUNCTION__ << " not implemented yet" << std::endl;
+    return false;
+  }
+
+  virtual bool write(std::ostream& os) const {
+    std::cerr << __PRETTY_FUNCTION__ << " not implemented yet" << std::endl;
+    return false;
+  }
+};
+
+// Post-iteration action which raises g2o's stop flag once the time budget of
+// an optimization round is spent, or when `quit` is set.
+class TimeBudget : public g2o::HyperGraphAction {
+public:
+  TimeBudget(bool *stop, const std::atomic<bool> *quit)
+    : stop_{stop}, quit_{quit} {}
+
+  /** Arm the deadline; a non-positive budget means no deadline. */
+  void Start(double budget_ms) {
+    if (budget_ms > 0) {
+      deadline_ = std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double, std::milli>(budget_ms));
+    } else {
+      deadline_ = std::chrono::steady_clock::time_point::max();
+    }
+  }
+
+  HyperGraphAction* operator()(const g2o::HyperGraph *graph,
+                               Parameters *parameters=0) override {
+    if (*quit_ || std::chrono::steady_clock::now() > deadline_) {
+      *stop_ = true;
+    }
+    return this;
+  }
+
+private:
+  bool *stop_;
+  const std::atomic<bool> *quit_;
+  std::chrono::steady_clock::time_point deadline_;
+};
+
+// Poses an optimizer worker publishes for other threads: the body-to-spatial
+// poses of the groups of its latest round, keyed by group id. The vertices
+// are camera poses (GroupAdapter::gsb composed with gbc), publishers convert. Each round
+// replaces the previous one, so the store is bounded by the round's window.
+class PublishedPoses {
+public:
+  void Publish(std::unordered_map<int, SE3> poses) {
+    std::scoped_lock lck(mtx_);
+    std::swap(poses_, poses);
+    ++version_;
+  }
+
+  /** `version`, if given, receives the version of the returned poses. */
+  std::unordered_map<int, SE3> Get(int *version=nullptr) const {
+    std::scoped_lock lck(mtx_);
+    if (version) {
+      *version = version_;
+    }
+    return poses_;
+  }
+
+  bool Get(int gid, SE3 &gsb) const {
+    std::scoped_lock lck(mtx_);
+    auto it = poses_.find(gid);
+    if (it == poses_.end()) {
+      return false;
+    }
+    gsb = it->second;
+    return true;
+  }
+
+  /** Incremented by every Publish. */
+  int version() const { return version_; }
+
+private:
+  mutable std::mutex mtx_;
+  std::unordered_map<int, SE3> poses_;
+  std::atomic<int> version_{0};
+};
+
 struct FeatureAdapter {
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   int id;
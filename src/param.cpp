@@ -6,15 +6,14 @@
 
 namespace xivo {
 
-std::unique_ptr<ParameterServer> ParameterServer::instance_ = nullptr;
-
 ParameterServerPtr ParameterServer::Create(const Json::Value &value) {
-  if (instance_) {
+  auto &instance = EstimatorContext::current()->parameter_server_;
+  if (instance) {
     LOG(WARNING) << "parameter server already created!";
   } else {
-    instance_ = std::unique_ptr<ParameterServer>(new ParameterServer(value));
+    instance = std::unique_ptr<ParameterServer>(new ParameterServer(value));
   }
-  return instance_.get();
+  return instance.get();
 }
 
 ParameterServer::ParameterServer(const Json::Value &value)
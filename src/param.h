@@ -5,6 +5,8 @@
 #include "json/json.h"
 #include <memory>
 
+#include "context.h"
+
 namespace xivo {
 
 class ParameterServer;
@@ -12,15 +14,15 @@ using ParameterServerPtr = ParameterServer *;
 class ParameterServer : public Json::Value {
 public:
   static ParameterServerPtr Create(const Json::Value &value);
-  static ParameterServerPtr instance() { return instance_.get(); }
+  static ParameterServerPtr instance() {
+    return EstimatorContext::current()->parameter_server_.get();
+  }
 
 private:
   ParameterServer() = delete;
   ParameterServer(const ParameterServer &) = delete;
   ParameterServer &operator=(const ParameterServer &) = delete;
   ParameterServer(const Json::Value &value);
-
-  static std::unique_ptr<ParameterServer> instance_;
 };
 
 } // namespace xivo
@@ -9,21 +9,12 @@ void Estimator::PrinceDormand(const Vec3 &gyro0, const Vec3 &accel0, number_t dt
   // http://www.mymathlib.com/c_source/diffeq/embedded_runge_kutta/embedded_prince_dormand_v3_4_5.c
   // reference 2:
   // http://depa.fquim.unam.mx/amyd/archivero/DormandPrince_19856.pdf
-  static bool pd_initialized{false}, control_stepsize{false};
-  static number_t tolerance, min_scale_factor, max_scale_factor, h, h0;
-  static int attempts;
-
-  if (!pd_initialized) {
-    auto pd_cfg = cfg_["PrinceDormand"];
-    control_stepsize = pd_cfg.get("control_stepsize", false).asBool();
-    tolerance = pd_cfg.get("tolerance", 1e-3).asDouble();
-    attempts = pd_cfg.get("attempts", 12).asInt();
-    min_scale_factor = pd_cfg.get("min_scale_factor", 0.125).asDouble();
-    max_scale_factor = pd_cfg.get("max_scale_factor", 4.0).asDouble();
-    h = pd_cfg.get("stepsize", 0.002).asDouble();
-    h0 = h;
-    pd_initialized = true;
-  }
+  const bool control_stepsize = pd_.control_stepsize;
+  const number_t tolerance = pd_.tolerance;
+  const number_t min_scale_factor = pd_.min_scale_factor;
+  const number_t max_scale_factor = pd_.max_scale_factor;
+  const number_t h0 = pd_.h0;
+  number_t &h = pd_.h;  // adapted across calls
 
   if (control_stepsize) {
 
@@ -66,7 +57,7 @@ void Estimator::PrinceDormand(const Vec3 &gyro0, const Vec3 &accel0, number_t dt
 
       Vec3 gyro{gyro0}, accel{accel0};
       while (total_step < dt) {
-        number_t h = h0; // this shadows the static variable h
+        number_t h = h0; // this shadows the adaptive step h
         if (total_step + h > dt) {
           h = dt - total_step;
         } else if (total_step + h + 0.5 * h > dt) {
@@ -92,10 +83,11 @@ number_t Estimator::PrinceDormandStep(const Vec3 &gyro0, const Vec3 &accel0,
   static const number_t r_28 = 1.0 / 28.0;
   static const number_t r_400 = 1.0 / 400.0;
 
-  static State X0;
-  static Vec3 K1, K2, K3, K4, K5, K6, K7;
-  static MatX FK1, FK2, FK3, FK4, FK5, FK6, FK7;
-  static MatX PK1, PK2, PK3, PK4, PK5, PK6, PK7;
+  // scratch, per thread since several estimators may run at once
+  static thread_local State X0;
+  static thread_local Vec3 K1, K2, K3, K4, K5, K6, K7;
+  static thread_local MatX FK1, FK2, FK3, FK4, FK5, FK6, FK7;
+  static thread_local MatX PK1, PK2, PK3, PK4, PK5, PK6, PK7;
 
   number_t step;
   Eigen::Matrix<number_t, 6, 1> slope;
@@ -191,7 +183,7 @@ number_t Estimator::PrinceDormandStep(const Vec3 &gyro0, const Vec3 &accel0,
            dt;
   PK7 = F_ * P0 + P0 * F_.transpose() + G_ * Qimu_ * G_.transpose();
 
-  static MatX K, FK, PK;
+  static thread_local MatX K, FK, PK;
   K = 0.0862 * K1 + 0.6660 * K3 - 0.7857 * K4 + 0.9570 * K5 + 0.0965 * K6 -
       0.0200 * K7;
   FK = 0.0862 * FK1 + 0.6660 * FK3 - 0.7857 * FK4 + 0.9570 * FK5 +
@@ -18,8 +18,10 @@ protected:
 
 class ViewDisplayMessage : public ViewMessage {
 public:
+  // No deep copy: the canvas draws each frame into a new pooled buffer, so the
+  // image referenced here is never modified after it is published.
   ViewDisplayMessage(const timestamp_t &ts, const cv::Mat &image)
-      : ViewMessage{ts}, image_{image.clone()} {}
+      : ViewMessage{ts}, image_{image} {}
   void Execute(Viewer *viewer) override {
     if (!image_.empty()) {
       viewer->Update(image_);
@@ -45,11 +47,14 @@ private:
   SE3 gsb_, gbc_;
 };
 
+// A slow viewer never holds back the estimator: once the queue is full, stale
+// messages are dropped.
 class ViewPublisher : public Publisher, public Process<ViewMessage> {
 public:
   ViewPublisher(const Json::Value &cfg, const std::string &name = "",
-                uint32_t size = 1000)
-      : Process{size}, viewer_{cfg, name} {}
+                uint32_t size = 100)
+      : Process{size, OverflowPolicy::DROP_OLDEST}, viewer_{cfg, name} {}
+  ~ViewPublisher() { Stop(); }
   virtual void Publish(const timestamp_t &ts, const cv::Mat &image) override;
   virtual void Publish(const timestamp_t &ts, const SE3 &gsb,
                        const SE3 &gbc) override;
@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "glog/logging.h"
+
+#include "recording.h"
+
+namespace xivo {
+
+namespace {
+
+constexpr char kRecordingMagic[8] = {'X', 'I', 'V', 'O', 'R', 'E', 'C', '\0'};
+constexpr uint32_t kRecordingVersion = 1;
+constexpr uint32_t kByteOrderMark = 0x01020304;
+
+static_assert(std::is_trivially_copyable_v<RecordingHeader> &&
+              std::is_trivially_copyable_v<ChunkHeader> &&
+              std::is_trivially_copyable_v<ImageInfo> &&
+              std::is_trivially_copyable_v<IndexRecord>,
+              "recording records must be plain old data");
+static_assert(sizeof(RecordingHeader) % 8 == 0 && sizeof(ChunkHeader) % 8 == 0 &&
+              sizeof(ImageInfo) % 8 == 0 && sizeof(IndexRecord) % 8 == 0,
+              "recording records must keep 8-byte alignment");
+
+size_t Pad8(size_t n) {
+  return (8 - n % 8) % 8;
+}
+
+} // namespace
+
+
+////////////////////////////////////////
+// WRITER
+////////////////////////////////////////
+RecordingWriter::RecordingWriter(const std::string &path)
+    : path_{path}, last_ts_{std::numeric_limits<int64_t>::min()},
+      closed_{false} {
+  out_.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!out_.is_open()) {
+    throw std::runtime_error("failed to open recording @ " + path);
+  }
+  // the header is rewritten with the index location by Close()
+  RecordingHeader header{};
+  std::memcpy(header.magic, kRecordingMagic, sizeof(kRecordingMagic));
+  header.version = kRecordingVersion;
+  header.byte_order = kByteOrderMark;
+  out_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+RecordingWriter::~RecordingWriter() {
+  if (!closed_) {
+    Close();
+  }
+}
+
+void RecordingWriter::WriteChunk(
+    RecordType type, const timestamp_t &ts,
+    const std::vector<std::pair<const void *, size_t>> &parts) {
+  if (closed_) {
+    throw std::runtime_error("recording @ " + path_ + " already closed");
+  }
+  if (ts.count() < last_ts_) {
+    throw std::invalid_argument(StrFormat(
+        "recording timestamps must be non-decreasing: %ld after %ld",
+        ts.count(), last_ts_));
+  }
+  last_ts_ = ts.count();
+
+  ChunkHeader chunk{};
+  chunk.type = static_cast<uint32_t>(type);
+  chunk.ts = ts.count();
+  for (const auto &[data, size] : parts) {
+    chunk.size += size;
+  }
+
+  IndexRecord record{};
+  record.ts = chunk.ts;
+  record.type = chunk.type;
+  record.offset = out_.tellp();
+  index_.push_back(record);
+
+  static const char zeros[8] = {0};
+  out_.write(reinterpret_cast<const char *>(&chunk), sizeof(chunk));
+  for (const auto &[data, size] : parts) {
+    out_.write(reinterpret_cast<const char *>(data), size);
+  }
+  out_.write(zeros, Pad8(chunk.size));
+}
+
+void RecordingWriter::WriteIMU(const timestamp_t &ts, const Vec3 &gyro,
+                               const Vec3 &accel) {
+  double values[6];
+  for (int i = 0; i < 3; ++i) {
+    values[i] = gyro(i);
+    values[i + 3] = accel(i);
+  }
+  WriteChunk(RecordType::IMU, ts, {{values, sizeof(values)}});
+}
+
+void RecordingWriter::WriteImage(const timestamp_t &ts, const cv::Mat &img) {
+  cv::Mat pixels = img.isContinuous() ? img : img.clone();
+  ImageInfo info{pixels.rows, pixels.cols, pixels.type(),
+                 static_cast<uint32_t>(ImageEncoding::RAW)};
+  WriteChunk(RecordType::IMAGE, ts,
+             {{&info, sizeof(info)},
+              {pixels.data, pixels.total() * pixels.elemSize()}});
+}
+
+void RecordingWriter::WriteImageFile(const timestamp_t &ts,
+                                     const std::string &image_path) {
+  std::ifstream in(image_path, std::ios::in | std::ios::binary | std::ios::ate);
+  if (!in.is_open()) {
+    throw std::runtime_error("failed to open image @ " + image_path);
+  }
+  std::vector<char> bytes(in.tellg());
+  in.seekg(0);
+  in.read(bytes.data(), bytes.size());
+
+  // geometry is only known once decoded
+  ImageInfo info{0, 0, -1, static_cast<uint32_t>(ImageEncoding::ENCODED)};
+  WriteChunk(RecordType::IMAGE, ts,
+             {{&info, sizeof(info)}, {bytes.data(), bytes.size()}});
+}
+
+void RecordingWriter::WritePointCloud(const timestamp_t &ts,
+                                      const VecXi &feature_ids,
+                                      const MatX2 &xp) {
+  CHECK(feature_ids.size() == xp.rows()) << "one feature id per point expected";
+  uint64_t n = feature_ids.size();
+  std::vector<int32_t> ids(feature_ids.data(), feature_ids.data() + n);
+  ids.resize(n + Pad8(n * sizeof(int32_t)) / sizeof(int32_t), 0);
+  std::vector<double> values(2 * n);
+  for (int i = 0; i < n; ++i) {
+    values[2 * i] = xp(i, 0);
+    values[2 * i + 1] = xp(i, 1);
+  }
+  WriteChunk(RecordType::POINT_CLOUD, ts,
+             {{&n, sizeof(n)},
+              {ids.data(), ids.size() * sizeof(int32_t)},
+              {values.data(), values.size() * sizeof(double)}});
+}
+
+void RecordingWriter::Close() {
+  if (closed_) return;
+
+  RecordingHeader header{};
+  std::memcpy(header.magic, kRecordingMagic, sizeof(kRecordingMagic));
+  header.version = kRecordingVersion;
+  header.byte_order = kByteOrderMark;
+  header.num_chunks = index_.size();
+  header.index_offset = out_.tellp();
+
+  out_.write(reinterpret_cast<const char *>(index_.data()),
+             index_.size() * sizeof(IndexRecord));
+  out_.seekp(0);
+  out_.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out_.close();
+  closed_ = true;
+
+  if (!out_) {
+    LOG(ERROR) << "failed to write recording @ " << path_;
+  }
+}
+
+
+////////////////////////////////////////
+// READER
+////////////////////////////////////////
+RecordingReader::RecordingReader(const std::string &path)
+    : data_{nullptr}, size_{0}, header_{nullptr}, index_{nullptr} {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("failed to open recording @ " + path);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < sizeof(RecordingHeader)) {
+    close(fd);
+    throw std::runtime_error("invalid recording @ " + path);
+  }
+  size_ = st.st_size;
+  // private & writable: frames handed out in place may be modified by the
+  // consumer without touching the file
+  void *addr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    throw std::runtime_error("failed to map recording @ " + path);
+  }
+  data_ = static_cast<uint8_t *>(addr);
+  madvise(data_, size_, MADV_SEQUENTIAL);
+
+  header_ = reinterpret_cast<const RecordingHeader *>(data_);
+  std::string error;
+  if (std::memcmp(header_->magic, kRecordingMagic, sizeof(kRecordingMagic))) {
+    error = "not a recording";
+  } else if (header_->byte_order != kByteOrderMark) {
+    error = "recording written with a different byte order";
+  } else if (header_->version != kRecordingVersion) {
+    error = StrFormat("unsupported recording version %d", (int)header_->version);
+  } else if (header_->index_offset == 0) {
+    error = "recording was not closed";
+  } else if (header_->index_offset < sizeof(RecordingHeader) ||
+             header_->index_offset > size_ ||
+             header_->index_offset % 8 != 0 ||
+             header_->num_chunks >
+               (size_ - header_->index_offset) / sizeof(IndexRecord)) {
+    error = "truncated recording";
+  } else {
+    // chunk headers must lie between the file header and the index; their
+    // payloads are checked by Get, so opening does not touch every chunk
+    index_ = reinterpret_cast<const IndexRecord *>(data_ + header_->index_offset);
+    for (uint64_t i = 0; i < header_->num_chunks; ++i) {
+      uint64_t offset = index_[i].offset;
+      if (offset < sizeof(RecordingHeader) || offset % 8 != 0 ||
+          offset > header_->index_offset ||
+          header_->index_offset - offset < sizeof(ChunkHeader)) {
+        error = StrFormat("chunk #%lu out of range", i);
+        break;
+      }
+    }
+  }
+  if (!error.empty()) {
+    munmap(data_, size_);
+    throw std::runtime_error(error + " @ " + path);
+  }
+}
+
+RecordingReader::~RecordingReader() {
+  if (data_) {
+    munmap(data_, size_);
+  }
+}
+
+void RecordingReader::Get(int i, Entry &entry, int imread_flags) const {
+  CHECK(i >= 0 && i < size()) << "message #" << i << " out of range";
+  const IndexRecord &record = index_[i];
+  auto chunk = reinterpret_cast<const ChunkHeader *>(data_ + record.offset);
+  uint8_t *payload = data_ + record.offset + sizeof(ChunkHeader);
+  auto corrupt = [i](const std::string &what) {
+    return std::runtime_error(StrFormat("corrupt recording: message #%d %s",
+                                        i, what.c_str()));
+  };
+  // the constructor made sure the chunk header is within the file
+  if (chunk->size >
+      header_->index_offset - record.offset - sizeof(ChunkHeader)) {
+    throw corrupt("extends past the end of the chunks");
+  }
+  if (chunk->type != record.type) {
+    throw corrupt("does not match its index record");
+  }
+
+  entry.type = RecordType(chunk->type);
+  entry.ts = timestamp_t(chunk->ts);
+
+  switch (entry.type) {
+  case RecordType::IMU: {
+    if (chunk->size != 6 * sizeof(double)) {
+      throw corrupt("is not an inertial measurement");
+    }
+    auto values = reinterpret_cast<const double *>(payload);
+    for (int j = 0; j < 3; ++j) {
+      entry.gyro(j) = values[j];
+      entry.accel(j) = values[j + 3];
+    }
+    break;
+  }
+  case RecordType::IMAGE: {
+    if (chunk->size < sizeof(ImageInfo)) {
+      throw corrupt("has no image info");
+    }
+    auto info = reinterpret_cast<const ImageInfo *>(payload);
+    uint8_t *bytes = payload + sizeof(ImageInfo);
+    if (ImageEncoding(info->encoding) == ImageEncoding::RAW) {
+      if (info->rows < 0 || info->cols < 0 || info->type < 0 ||
+          info->type != CV_MAT_TYPE(info->type) ||
+          chunk->size - sizeof(ImageInfo) !=
+            uint64_t(info->rows) * info->cols * CV_ELEM_SIZE(info->type)) {
+        throw corrupt(StrFormat("does not hold a %dx%d image of type %d",
+                                info->rows, info->cols, info->type));
+      }
+      entry.image = cv::Mat(info->rows, info->cols, info->type, bytes);
+    } else {
+      int num_bytes = chunk->size - sizeof(ImageInfo);
+      entry.image = cv::imdecode(cv::Mat(1, num_bytes, CV_8UC1, bytes),
+                                 imread_flags);
+    }
+    break;
+  }
+  case RecordType::POINT_CLOUD: {
+    if (chunk->size < sizeof(uint64_t)) {
+      throw corrupt("has no point count");
+    }
+    uint64_t n = *reinterpret_cast<const uint64_t *>(payload);
+    // ids padded to 8 bytes and two coordinates per point
+    constexpr size_t kBytesPerPoint = sizeof(int32_t) + 2 * sizeof(double);
+    if (n > (chunk->size - sizeof(uint64_t)) / kBytesPerPoint ||
+        chunk->size != sizeof(uint64_t) + n * sizeof(int32_t) +
+                        Pad8(n * sizeof(int32_t)) + 2 * n * sizeof(double)) {
+      throw corrupt(StrFormat("does not hold %lu points", n));
+    }
+    auto ids = reinterpret_cast<const int32_t *>(payload + sizeof(uint64_t));
+    size_t ids_bytes = n * sizeof(int32_t);
+    auto values = reinterpret_cast<const double *>(
+        payload + sizeof(uint64_t) + ids_bytes + Pad8(ids_bytes));
+    entry.feature_ids.resize(n);
+    entry.xp.resize(n, 2);
+    for (int j = 0; j < n; ++j) {
+      entry.feature_ids(j) = ids[j];
+      entry.xp(j, 0) = values[2 * j];
+      entry.xp(j, 1) = values[2 * j + 1];
+    }
+    break;
+  }
+  default:
+    throw corrupt(StrFormat("has unknown type %u", chunk->type));
+  }
+}
+
+int RecordingReader::LowerBound(const timestamp_t &ts) const {
+  auto it = std::lower_bound(
+      index_, index_ + size(), ts.count(),
+      [](const IndexRecord &record, int64_t t) { return record.ts < t; });
+  return it - index_;
+}
+
+} // namespace xivo
@@ -0,0 +1,141 @@
+// Binary recordings of sensor sessions for replay.
+//
+// Layout (native byte order, checked with `byte_order` of the header):
+//   RecordingHeader, chunk, chunk, ..., index
+// Every chunk is a ChunkHeader followed by its payload, padded to 8 bytes:
+//   IMU          gyro[3], accel[3] (double)
+//   IMAGE        ImageInfo followed by the pixels (RAW, row-major, no
+//                padding) or by an encoded image file (ENCODED, e.g. PNG)
+//   POINT_CLOUD  uint64 number of points n, int32 ids[n] padded to 8 bytes,
+//                double xp[n][2]
+// The index is an array of IndexRecord, one per chunk in file order, at
+// `index_offset`, so any message can be reached without scanning the file.
+// Timestamps are non-decreasing.
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "opencv2/core/core.hpp"
+#include "opencv2/imgcodecs/imgcodecs.hpp"
+
+#include "core.h"
+
+namespace xivo {
+
+enum class RecordType : uint32_t {
+  IMU = 0,
+  IMAGE = 1,
+  POINT_CLOUD = 2,
+};
+
+enum class ImageEncoding : uint32_t {
+  RAW = 0,
+  ENCODED = 1,
+};
+
+struct RecordingHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t num_chunks;
+  uint64_t index_offset;  // 0 if the recording was not closed properly
+};
+
+struct ChunkHeader {
+  uint32_t type;  // RecordType
+  uint32_t padding;
+  int64_t ts;  // nanoseconds
+  uint64_t size;  // payload bytes, excluding padding
+};
+
+struct ImageInfo {
+  int32_t rows;
+  int32_t cols;
+  int32_t type;  // OpenCV type of RAW frames
+  uint32_t encoding;  // ImageEncoding
+};
+
+struct IndexRecord {
+  int64_t ts;
+  uint32_t type;
+  uint32_t padding;
+  uint64_t offset;  // of the ChunkHeader
+};
+
+
+class RecordingWriter {
+public:
+  RecordingWriter(const std::string &path);
+  ~RecordingWriter();
+
+  void WriteIMU(const timestamp_t &ts, const Vec3 &gyro, const Vec3 &accel);
+  /** Store the pixels of `img` as they are. */
+  void WriteImage(const timestamp_t &ts, const cv::Mat &img);
+  /** Store an encoded image file (PNG, JPEG, ...) without decoding it. */
+  void WriteImageFile(const timestamp_t &ts, const std::string &image_path);
+  /** Store feature tracks for Estimator::VisualMeasPointCloud. */
+  void WritePointCloud(const timestamp_t &ts, const VecXi &feature_ids,
+                       const MatX2 &xp);
+
+  /** Write the index. Further writes are not allowed. */
+  void Close();
+  int size() const { return index_.size(); }
+
+private:
+  RecordingWriter(const RecordingWriter &) = delete;
+  RecordingWriter &operator=(const RecordingWriter &) = delete;
+
+  /** Write a chunk whose payload is the concatenation of `parts`. */
+  void WriteChunk(RecordType type, const timestamp_t &ts,
+                  const std::vector<std::pair<const void *, size_t>> &parts);
+
+  std::string path_;
+  std::ofstream out_;
+  std::vector<IndexRecord> index_;
+  int64_t last_ts_;
+  bool closed_;
+};
+
+
+/** Read-only view of a recording, memory-mapped so that messages are read in
+ * place: nothing is parsed and raw frames are not even copied. */
+class RecordingReader {
+public:
+  struct Entry {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    RecordType type;
+    timestamp_t ts;
+    Vec3 gyro, accel;  // IMU
+    cv::Mat image;  // IMAGE
+    VecXi feature_ids;  // POINT_CLOUD
+    MatX2 xp;
+  };
+
+  RecordingReader(const std::string &path);
+  ~RecordingReader();
+
+  int size() const { return header_->num_chunks; }
+  RecordType type(int i) const { return RecordType(index_[i].type); }
+  timestamp_t ts(int i) const { return timestamp_t(index_[i].ts); }
+
+  /** Load the i-th message. RAW frames refer to the mapping (copy-on-write)
+   * and are valid as long as the reader; ENCODED ones are decoded with
+   * `imread_flags`. */
+  void Get(int i, Entry &entry, int imread_flags=cv::IMREAD_COLOR) const;
+
+  /** Index of the first message at or after `ts`. */
+  int LowerBound(const timestamp_t &ts) const;
+
+private:
+  RecordingReader(const RecordingReader &) = delete;
+  RecordingReader &operator=(const RecordingReader &) = delete;
+
+  uint8_t *data_;
+  size_t size_;
+  const RecordingHeader *header_;
+  const IndexRecord *index_;
+};
+
+} // namespace xivo
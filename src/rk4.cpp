@@ -3,12 +3,7 @@
 namespace xivo {
 
 void Estimator::RK4(const Vec3 &gyro0, const Vec3 &accel0, number_t dt) {
-  static bool rk4_initialized{false};
-  static number_t stepsize{-1};
-  if (!rk4_initialized) {
-    stepsize = cfg_["RK4"].get("stepsize", 0.002).asDouble();
-    rk4_initialized = true;
-  }
+  const number_t stepsize = rk4_stepsize_;
 
   if (stepsize < 0) {
     RK4Step(gyro0, accel0, dt);
@@ -35,10 +30,11 @@ void Estimator::RK4(const Vec3 &gyro0, const Vec3 &accel0, number_t dt) {
 void Estimator::RK4Step(const Vec3 &gyro0, const Vec3 &accel0, number_t dt) {
   number_t halfstep = 0.5 * dt;
 
-  static State X0;
-  static Vec3 K1, K2, K3, K4;
-  static MatX FK1, FK2, FK3, FK4;
-  static MatX PK1, PK2, PK3, PK4;
+  // scratch, per thread since several estimators may run at once
+  static thread_local State X0;
+  static thread_local Vec3 K1, K2, K3, K4;
+  static thread_local MatX FK1, FK2, FK3, FK4;
+  static thread_local MatX PK1, PK2, PK3, PK4;
 
   Eigen::Matrix<number_t, 6, 1> slope;
   slope << slope_gyro_, slope_accel_;
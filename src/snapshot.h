@@ -0,0 +1,94 @@
+// Immutable snapshots of the estimator state for publishers and python.
+#pragma once
+#include <atomic>
+#include <memory>
+
+#include "core.h"
+#include "telemetry.h"
+
+namespace xivo {
+
+/** What is published after each visual measurement: the nominal state, the
+ * covariance blocks publishers need (not the full covariance) and the
+ * instate features and groups. */
+struct StateSnapshot {
+  uint64_t version;  // 1 for the first snapshot, incremented by each one
+  timestamp_t ts;
+
+  State X;
+  Mat3 Ca, Cg;
+  SE3 gsb, gbc, gsc;
+  MatX Pstate;     // covariance of the motion state
+  MatX CameraCov;  // covariance of the camera intrinsics
+  bool measurement_update_initialized;
+  Vec3 inn_Wsb, inn_Tsb, inn_Vsb;
+  int gauge_group;
+
+  // instate features, least uncertain first; covariances are the upper
+  // triangles (xx, xy, xz, yy, yz, zz) of the 3x3 blocks
+  VecXi feature_ids;
+  MatX3 feature_positions;
+  MatX6 feature_covs;
+  MatX2 feature_pixels;  // last observation
+
+  // instate groups, poses as (qx, qy, qz, qw, tx, ty, tz), covariances as
+  // returned by Estimator::InstateGroupCovs
+  VecXi group_ids;
+  MatX7 group_poses;
+  MatX group_covs;
+
+  // statistics of the visual measurement
+  Telemetry telemetry;
+};
+
+using StateSnapshotPtr = std::shared_ptr<const StateSnapshot>;
+
+
+/** Single writer, many readers. The writer fills the back buffer and publishes
+ * it atomically; readers get a shared pointer to the latest snapshot, which
+ * stays valid and unchanged for as long as they hold it. Neither side ever
+ * waits. The writer reuses the two buffers, and with them their allocated
+ * matrices, unless a reader still holds the back buffer. */
+template <typename T>
+class SnapshotBuffer {
+public:
+  using Ptr = std::shared_ptr<const T>;
+
+  SnapshotBuffer() : version_{0} {}
+
+  /** Reader side. nullptr until the first Publish. */
+  Ptr latest() const { return std::atomic_load(&front_); }
+  uint64_t version() const { return version_.load(std::memory_order_acquire); }
+
+  /** Writer side. Buffer to fill for the next Publish, holding the snapshot
+   * before the latest (or a new one). */
+  T &back() {
+    if (!back_ || back_.use_count() > 1) {
+      back_ = std::make_shared<T>();
+    } else {
+      // use_count() is a relaxed load: the last reader may have released the
+      // buffer right after reading it in another thread. Order those reads
+      // before the writes about to reuse the buffer.
+      std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return *back_;
+  }
+
+  /** Writer side. Make the back buffer the latest snapshot. */
+  void Publish() {
+    std::atomic_store(&front_, Ptr{back_});
+    std::swap(back_, writable_front_);
+    version_.fetch_add(1, std::memory_order_release);
+  }
+
+private:
+  SnapshotBuffer(const SnapshotBuffer &) = delete;
+  SnapshotBuffer &operator=(const SnapshotBuffer &) = delete;
+
+  Ptr front_;                         // shared with the readers
+  std::shared_ptr<T> writable_front_; // same as front_, writer's handle
+  std::shared_ptr<T> back_;
+  std::atomic<uint64_t> version_;
+};
+
+} // namespace xivo
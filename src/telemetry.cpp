@@ -0,0 +1,102 @@
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "glog/logging.h"
+
+#include "telemetry.h"
+
+namespace xivo {
+
+Telemetry::Telemetry()
+    : ts{0}, frame{0}, latency_ms{0}, num_tracked{0}, num_instate_features{0},
+      num_instate_groups{0}, num_oos_features{0}, num_mh_rejected{0},
+      num_ransac_hypotheses{0}, num_ransac_rejected{0}, num_oos_rows{0},
+      num_update_rows{0}, num_compressed_rows{0}, num_active_features{0},
+      max_features{0}, num_active_groups{0}, max_groups{0}, buffer_depth{0} {}
+
+Json::Value Telemetry::ToJson() const {
+  Json::Value out;
+  out["ts"] = (Json::UInt64)ts.count();
+  out["frame"] = frame;
+  out["latency_ms"] = latency_ms;
+  out["num_tracked"] = num_tracked;
+  out["num_instate_features"] = num_instate_features;
+  out["num_instate_groups"] = num_instate_groups;
+  out["num_oos_features"] = num_oos_features;
+  out["num_mh_rejected"] = num_mh_rejected;
+  out["num_ransac_hypotheses"] = num_ransac_hypotheses;
+  out["num_ransac_rejected"] = num_ransac_rejected;
+  out["num_oos_rows"] = num_oos_rows;
+  out["num_update_rows"] = num_update_rows;
+  out["num_compressed_rows"] = num_compressed_rows;
+  out["compression_ratio"] = compression_ratio();
+  out["num_active_features"] = num_active_features;
+  out["max_features"] = max_features;
+  out["num_active_groups"] = num_active_groups;
+  out["max_groups"] = max_groups;
+  out["buffer_depth"] = buffer_depth;
+  return out;
+}
+
+TelemetryWriter::TelemetryWriter(const Json::Value &cfg) : socket_{-1} {
+  std::string file = cfg.get("file", "").asString();
+  if (!file.empty()) {
+    ostream_.open(file, std::ios::out);
+    if (!ostream_.is_open()) {
+      throw std::runtime_error("failed to open telemetry file @ " + file);
+    }
+  }
+
+  std::string udp = cfg.get("udp", "").asString();
+  if (!udp.empty()) {
+    auto pos = udp.rfind(':');
+    if (pos == std::string::npos) {
+      throw std::invalid_argument("telemetry udp destination not host:port: " +
+                                  udp);
+    }
+    addrinfo hints{}, *result;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(udp.substr(0, pos).c_str(), udp.substr(pos + 1).c_str(),
+                    &hints, &result) != 0) {
+      throw std::invalid_argument("failed to resolve telemetry destination " +
+                                  udp);
+    }
+    address_.assign(reinterpret_cast<const char *>(result->ai_addr),
+                    result->ai_addrlen);
+    freeaddrinfo(result);
+    socket_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socket_ < 0) {
+      throw std::runtime_error("failed to create telemetry socket");
+    }
+    LOG(INFO) << "sending telemetry to " << udp;
+  }
+}
+
+TelemetryWriter::~TelemetryWriter() {
+  if (socket_ >= 0) {
+    close(socket_);
+  }
+}
+
+void TelemetryWriter::Write(const Telemetry &telemetry) {
+  if (!enabled()) return;
+  Json::StreamWriterBuilder builder;
+  builder["commentStyle"] = "None";
+  builder["indentation"] = "";
+  std::string line = Json::writeString(builder, telemetry.ToJson());
+
+  if (ostream_.is_open()) {
+    ostream_ << line << "\n";
+  }
+  if (socket_ >= 0) {
+    // best effort: nobody listening is not an error
+    sendto(socket_, line.data(), line.size(), MSG_DONTWAIT,
+           reinterpret_cast<const sockaddr *>(address_.data()),
+           address_.size());
+  }
+}
+
+} // namespace xivo
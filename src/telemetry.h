@@ -0,0 +1,63 @@
+// Per-frame filter statistics: what the filter did with the last image and how
+// close it is to its limits. Filled once per visual measurement.
+#pragma once
+#include <fstream>
+#include <string>
+
+#include "json/json.h"
+
+#include "core.h"
+
+namespace xivo {
+
+struct Telemetry {
+  timestamp_t ts;
+  int frame;          // number of visual measurements so far
+  double latency_ms;  // time spent processing the visual measurement
+
+  // tracker & filter
+  int num_tracked;  // features tracked in the image
+  int num_instate_features, num_instate_groups;
+  int num_oos_features;  // out-of-state features used in the update
+  int num_mh_rejected;   // rejected by Mahalanobis gating
+  int num_ransac_hypotheses, num_ransac_rejected;  // one-point RANSAC
+  int num_oos_rows;  // rows of the out-of-state jacobians
+  // rows of the measurement model before and after measurement compression;
+  // the same if not compressed
+  int num_update_rows, num_compressed_rows;
+
+  // resources
+  int num_active_features, max_features;  // memory manager slots
+  int num_active_groups, max_groups;
+  int buffer_depth;  // messages waiting in the reorder buffer
+
+  Telemetry();
+  /** Compressed over uncompressed rows, 1 if not compressed. */
+  double compression_ratio() const {
+    return num_update_rows > 0 ? double(num_compressed_rows) / num_update_rows
+                               : 1.0;
+  }
+  Json::Value ToJson() const;
+};
+
+/** Exports telemetry as json lines to a file and/or as one UDP datagram per
+ * frame, per the "telemetry" section of the estimator configuration:
+ *   "file": path of the json lines file, empty for none,
+ *   "udp": "host:port" to send to, empty for none. */
+class TelemetryWriter {
+public:
+  TelemetryWriter(const Json::Value &cfg);
+  ~TelemetryWriter();
+  bool enabled() const { return ostream_.is_open() || socket_ >= 0; }
+  void Write(const Telemetry &telemetry);
+
+private:
+  TelemetryWriter(const TelemetryWriter &) = delete;
+  TelemetryWriter &operator=(const TelemetryWriter &) = delete;
+
+  std::ofstream ostream_;
+  int socket_;
+  std::string address_;  // sockaddr_in of the udp destination
+};
+
+} // namespace xivo
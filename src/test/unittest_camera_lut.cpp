@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+
+#include "core.h"
+
+#include <random>
+
+using namespace Eigen;
+using namespace xivo;
+
+
+
+TEST(CamerasLUT, LUTProjectUnproject) {
+  auto cfg_ = LoadJson("src/test/camera_configs.json");
+  CameraManager *cam = Camera::Create(cfg_["phab_equi_lut"]);
+  ASSERT_TRUE(cam->use_lut());
+
+  std::default_random_engine generator;
+  std::uniform_real_distribution<number_t> col(0.0, cam->cols() - 1);
+  std::uniform_real_distribution<number_t> row(0.0, cam->rows() - 1);
+
+  for (int i = 0; i < 100; ++i) {
+    Vec2 xp{col(generator), row(generator)};
+    Mat2 jac;
+    Vec2 xc = cam->UnProject(xp, &jac);
+
+    // the interpolated point projects back to within a small fraction of a
+    // pixel
+    Mat2 proj_jac;
+    Vec2 xp2 = cam->Project(xc, &proj_jac);
+    EXPECT_NEAR((xp2 - xp).norm(), 0, 1e-3);
+
+    // the interpolated jacobian is the inverse of the projection jacobian
+    EXPECT_NEAR((jac * proj_jac - Mat2::Identity()).norm(), 0, 1e-2);
+  }
+}
+
+
+TEST(CamerasLUT, LUTOutsideImage) {
+  auto cfg_ = LoadJson("src/test/camera_configs.json");
+  CameraManager *cam = Camera::Create(cfg_["phab_equi_lut"]);
+
+  // pixels not covered by the table go through the iterative solver
+  Vec2 xp{-5.0, cam->rows() + 5.0};
+  Vec2 xc = cam->UnProject(xp);
+  Vec2 xp2 = cam->Project(xc);
+
+  EXPECT_NEAR(xp2(0), xp(0), 1e-6);
+  EXPECT_NEAR(xp2(1), xp(1), 1e-6);
+}
@@ -153,4 +153,39 @@ TEST(CamerasRadtan, RadTanProjectionJacc) {
   EXPECT_FLOAT_EQ((px_proj_k2(0) - px_proj(0)) / delta, px_jacc(0,8));
   EXPECT_FLOAT_EQ((px_proj_k2(1) - px_proj(1)) / delta, px_jacc(1,8));
   cam->UpdateState(-dX_k2);
-}
\ No newline at end of file
+}
+
+TEST(CamerasRadtan, RadTanBatch) {
+  auto cfg_ = LoadJson("src/test/camera_configs.json");
+  CameraManager *cam = Camera::Create(cfg_["realsense_radtan"]);
+
+  std::default_random_engine generator;
+  std::uniform_real_distribution<number_t> distribution(-0.5, 0.5);
+
+  MatX2 xc(20, 2);
+  for (int i = 0; i < xc.rows(); ++i) {
+    xc(i, 0) = distribution(generator);
+    xc(i, 1) = distribution(generator);
+  }
+
+  MatX4 jac, jac_inv;
+  MatX2 xp = cam->ProjectBatch(xc, &jac);
+  MatX2 xc2 = cam->UnProjectBatch(xp, &jac_inv);
+
+  for (int i = 0; i < xc.rows(); ++i) {
+    Mat2 J;
+    Vec2 xp_i = cam->Project(Vec2{xc.row(i).transpose()}, &J);
+    EXPECT_FLOAT_EQ(xp_i(0), xp(i, 0));
+    EXPECT_FLOAT_EQ(xp_i(1), xp(i, 1));
+    EXPECT_FLOAT_EQ(J(0, 0), jac(i, 0));
+    EXPECT_FLOAT_EQ(J(0, 1), jac(i, 1));
+    EXPECT_FLOAT_EQ(J(1, 0), jac(i, 2));
+    EXPECT_FLOAT_EQ(J(1, 1), jac(i, 3));
+
+    Vec2 xc_i = cam->UnProject(Vec2{xp.row(i).transpose()}, &J);
+    EXPECT_FLOAT_EQ(xc_i(0), xc2(i, 0));
+    EXPECT_FLOAT_EQ(xc_i(1), xc2(i, 1));
+    EXPECT_FLOAT_EQ(J(0, 0), jac_inv(i, 0));
+    EXPECT_FLOAT_EQ(J(1, 1), jac_inv(i, 3));
+  }
+}
@@ -0,0 +1,170 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+
+#include "context.h"
+#include "estimator.h"
+#include "feature.h"
+
+using namespace xivo;
+
+TEST(EstimatorContext, ScopesNest) {
+  EstimatorContext a, b;
+  auto *fallback = EstimatorContext::current();
+  EXPECT_EQ(fallback, EstimatorContext::Default());
+  {
+    EstimatorContext::Scope outer{&a};
+    EXPECT_EQ(EstimatorContext::current(), &a);
+    {
+      EstimatorContext::Scope inner{&b};
+      EXPECT_EQ(EstimatorContext::current(), &b);
+    }
+    EXPECT_EQ(EstimatorContext::current(), &a);
+  }
+  EXPECT_EQ(EstimatorContext::current(), fallback);
+}
+
+TEST(EstimatorContext, BindingIsPerThread) {
+  EstimatorContext a, b;
+  EstimatorContext::Scope scope{&a};
+  EstimatorContext *seen{nullptr};
+  std::thread worker{[&]() {
+    // not inherited from the spawning thread
+    EXPECT_EQ(EstimatorContext::current(), EstimatorContext::Default());
+    EstimatorContext::Scope scope{&b};
+    seen = EstimatorContext::current();
+  }};
+  worker.join();
+  EXPECT_EQ(seen, &b);
+  EXPECT_EQ(EstimatorContext::current(), &a);
+}
+
+TEST(EstimatorContext, IdsAreIndependent) {
+  EstimatorContext a, b;
+  EXPECT_EQ(a.NewFeatureId(), Feature::counter0);
+  EXPECT_EQ(a.NewFeatureId(), Feature::counter0 + 1);
+  EXPECT_EQ(b.NewFeatureId(), Feature::counter0);
+  EXPECT_EQ(a.NewGroupId(), 0);
+  EXPECT_EQ(b.NewGroupId(), 0);
+  EXPECT_EQ(b.NewGroupId(), 1);
+}
+
+
+namespace {
+
+/** Inertial and point cloud measurements of a camera swaying in front of a
+ * random point cloud, generated for the configuration of cfg/pcw.json:
+ * gravity along -z, camera looking along +y of the body. */
+struct Simulation {
+  struct Imu {
+    timestamp_t ts;
+    Vec3 gyro, accel;
+  };
+  struct Frame {
+    timestamp_t ts;
+    VecXi feature_ids;
+    MatX2 xp;
+  };
+  std::vector<Imu> imu;
+  std::vector<Frame> frames;
+};
+
+Simulation Simulate(unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<number_t> lateral(-2, 2), depth(3, 6);
+  std::vector<Vec3> points(200);
+  for (auto &X : points) {
+    X << lateral(rng), depth(rng), lateral(rng);
+  }
+
+  const number_t f = 275, cx = 320, cy = 240;
+  Mat3 Rbc = Eigen::AngleAxis<number_t>(-M_PI / 2, Vec3::UnitX()).matrix();
+
+  Simulation sim;
+  const int kImuPerFrame = 10;
+  for (int i = 0; i <= 600; ++i) {
+    number_t t = i * 0.005;
+    timestamp_t ts{int64_t(t * 1e9) + 1};
+    // Tsb = 0.1 (1 - cos t) along x, starting at rest
+    sim.imu.push_back({ts, Vec3::Zero(), Vec3{0.1 * cos(t), 0, 9.8}});
+    if (i % kImuPerFrame != 0) continue;
+
+    Vec3 Tsb{0.1 * (1 - cos(t)), 0, 0};
+    std::vector<int> ids;
+    std::vector<Vec2> xps;
+    for (int j = 0; j < points.size(); ++j) {
+      Vec3 Xc = Rbc.transpose() * (points[j] - Tsb);
+      Vec2 xp{f * Xc(0) / Xc(2) + cx, f * Xc(1) / Xc(2) + cy};
+      if (Xc(2) > 0 && xp(0) >= 0 && xp(0) < 640 && xp(1) >= 0 && xp(1) < 480) {
+        ids.push_back(j);
+        xps.push_back(xp);
+      }
+    }
+    Simulation::Frame frame{ts, VecXi(ids.size()), MatX2(ids.size(), 2)};
+    for (int j = 0; j < ids.size(); ++j) {
+      frame.feature_ids(j) = ids[j];
+      frame.xp.row(j) = xps[j].transpose();
+    }
+    sim.frames.push_back(frame);
+  }
+  return sim;
+}
+
+/** Replays `sim` with a system of its own, returns the body pose after every
+ * frame and at the end. */
+std::vector<Mat34> Replay(const Json::Value &cfg, const Simulation &sim) {
+  auto context = EstimatorContext::Create(cfg);
+  EstimatorContext::Scope scope{context.get()};
+  auto est = context->estimator();
+
+  std::vector<Mat34> poses;
+  auto frame = sim.frames.begin();
+  for (const auto &imu : sim.imu) {
+    est->InertialMeas(imu.ts, imu.gyro, imu.accel);
+    if (frame != sim.frames.end() && frame->ts == imu.ts) {
+      est->VisualMeasPointCloud(frame->ts, frame->feature_ids, frame->xp);
+      poses.push_back(est->gsb().matrix3x4());
+      ++frame;
+    }
+  }
+  est->Finish();
+  poses.push_back(est->gsb().matrix3x4());
+  return poses;
+}
+
+} // namespace
+
+
+TEST(EstimatorContext, ConcurrentRunsMatchSerialRuns) {
+  auto cfg = BatchEstimatorCfg(LoadJson("cfg/pcw.json"));
+  cfg["memory"]["max_features"] = 1000;
+  cfg["memory"]["max_groups"] = 200;
+  cfg["mapper_cfg"]["detectLoopClosures"] = false;
+
+  Simulation sims[2] = {Simulate(0), Simulate(1)};
+  std::vector<Mat34> serial[2], concurrent[2];
+  for (int i = 0; i < 2; ++i) {
+    serial[i] = Replay(cfg, sims[i]);
+  }
+  {
+    std::thread workers[2];
+    for (int i = 0; i < 2; ++i) {
+      workers[i] = std::thread([&, i]() { concurrent[i] = Replay(cfg, sims[i]); });
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(serial[i].size(), sims[i].frames.size() + 1);
+    ASSERT_EQ(concurrent[i].size(), serial[i].size());
+    for (int j = 0; j < serial[i].size(); ++j) {
+      // the same computation, so bit for bit the same
+      EXPECT_TRUE(concurrent[i][j] == serial[i][j])
+        << "run " << i << " differs after frame " << j;
+    }
+  }
+  // the runs did not share anything
+  EXPECT_FALSE(serial[0].back() == serial[1].back());
+}
@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+#include <map>
+
+#include "inverted_index.h"
+
+using namespace xivo;
+
+
+class InvertedIndexTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override {
+      for (int i = 0; i < 4; ++i) {
+        descs[i].fill(i);
+      }
+    }
+
+    // fid -> first word of the descriptor for each live slot under `word_id`
+    std::multimap<int, uint64_t> Collect(DBoW2::WordId word_id) {
+      std::multimap<int, uint64_t> out;
+      index.Visit(word_id, [&](int fid, FastBrief::TDescriptor desc) {
+        out.insert({fid, desc[0]});
+      });
+      return out;
+    }
+
+    InvertedIndex index{10};
+    InvertedIndex::Descriptor descs[4];
+};
+
+
+TEST_F(InvertedIndexTest, AddVisit) {
+  index.Add(3, 100, descs[0].data());
+  index.Add(3, 101, descs[1].data());
+  index.Add(5, 100, descs[2].data());
+  // words beyond the initial vocabulary size grow the index
+  index.Add(42, 102, descs[3].data());
+
+  EXPECT_EQ(index.size(), 4);
+  EXPECT_EQ(Collect(3), (std::multimap<int, uint64_t>{{100, 0}, {101, 1}}));
+  EXPECT_EQ(Collect(5), (std::multimap<int, uint64_t>{{100, 2}}));
+  EXPECT_EQ(Collect(42), (std::multimap<int, uint64_t>{{102, 3}}));
+  EXPECT_TRUE(Collect(7).empty());
+  EXPECT_TRUE(Collect(1000).empty());
+}
+
+
+TEST_F(InvertedIndexTest, RemoveCompact) {
+  index.Add(3, 100, descs[0].data());
+  index.Add(3, 101, descs[1].data());
+  index.Add(5, 100, descs[2].data());
+
+  index.Remove(100);
+  EXPECT_EQ(index.size(), 1);
+  EXPECT_EQ(index.num_tombstones(), 2);
+  EXPECT_EQ(Collect(3), (std::multimap<int, uint64_t>{{101, 1}}));
+  EXPECT_TRUE(Collect(5).empty());
+
+  index.Compact();
+  EXPECT_EQ(index.size(), 1);
+  EXPECT_EQ(index.num_tombstones(), 0);
+  EXPECT_EQ(Collect(3), (std::multimap<int, uint64_t>{{101, 1}}));
+
+  // slots added after compaction are found, and removing them again works
+  index.Add(5, 102, descs[3].data());
+  EXPECT_EQ(Collect(5), (std::multimap<int, uint64_t>{{102, 3}}));
+  index.Remove(101);
+  index.Remove(102);
+  EXPECT_EQ(index.size(), 0);
+}
@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <fstream>
+#include <sys/stat.h>
+
+#include "loader.h"
+
+using namespace xivo;
+
+class StreamingLoaderTest : public ::testing::Test
+{
+  protected:
+    void SetUp() override {
+      image_dir = testing::TempDir() + "/xivo_loader_cam0";
+      imu_dir = testing::TempDir() + "/xivo_loader_imu0";
+      mkdir(image_dir.c_str(), 0755);
+      mkdir(imu_dir.c_str(), 0755);
+
+      std::ofstream images{image_dir + "/data.csv"};
+      images << "#timestamp [ns],filename\n";
+      for (int ts : {10, 20, 30}) {
+        images << ts << "," << ts << ".png\n";
+      }
+      std::ofstream imu{imu_dir + "/data.csv"};
+      imu << "#timestamp [ns],w_x,w_y,w_z,a_x,a_y,a_z\n";
+      for (int ts : {5, 10, 15, 25, 35}) {
+        imu << ts << ",0.1,0.2,0.3,0,0,9.8\n";
+      }
+
+      decoded = 0;
+      decode = [this](const std::string &path) {
+        ++decoded;
+        return cv::Mat(1, 1, CV_8UC1, cv::Scalar(path.size()));
+      };
+    }
+
+    std::string image_dir, imu_dir;
+    std::atomic<int> decoded;
+    StreamingLoader::Decoder decode;
+};
+
+TEST_F(StreamingLoaderTest, MergeByTimestamp) {
+  StreamingLoader loader{image_dir, imu_dir, 2, 2, decode};
+
+  std::vector<std::pair<int, bool>> expected{
+    {5, false}, {10, false}, {10, true}, {15, false},
+    {20, true}, {25, false}, {30, true}, {35, false}};
+  int i = 0;
+  for (auto &entry : loader) {
+    ASSERT_LT(i, expected.size());
+    EXPECT_EQ(entry.msg->ts_.count(), expected[i].first);
+    auto image = dynamic_cast<msg::Image *>(entry.msg.get());
+    EXPECT_EQ(image != nullptr, expected[i].second);
+    if (image) {
+      EXPECT_FALSE(entry.image.empty());
+      EXPECT_EQ(image->image_path_,
+                image_dir + "/data/" + std::to_string(expected[i].first) + ".png");
+    } else {
+      auto imu = dynamic_cast<msg::IMU *>(entry.msg.get());
+      ASSERT_NE(imu, nullptr);
+      EXPECT_DOUBLE_EQ(imu->accel_(2), 9.8);
+    }
+    ++i;
+  }
+  EXPECT_EQ(i, expected.size());
+  EXPECT_EQ(loader.count(), expected.size());
+  EXPECT_EQ(decoded, 3);
+}
+
+TEST_F(StreamingLoaderTest, BoundedLookahead) {
+  StreamingLoader loader{image_dir, "", 1, 2, decode};
+  // nothing but the first frame is scheduled before it is consumed
+  EXPECT_LE(decoded, 1);
+
+  StreamingLoader::Entry entry;
+  ASSERT_TRUE(loader.Next(entry));
+  EXPECT_EQ(entry.msg->ts_.count(), 10);
+  EXPECT_LE(decoded, 2);
+  ASSERT_TRUE(loader.Next(entry));
+  ASSERT_TRUE(loader.Next(entry));
+  EXPECT_EQ(entry.msg->ts_.count(), 30);
+  EXPECT_FALSE(loader.Next(entry));
+}
@@ -0,0 +1,178 @@
+#include <cstdio>
+#include <fstream>
+#include <gtest/gtest.h>
+
+#include "context.h"
+#include "feature.h"
+#include "group.h"
+#include "mapper.h"
+#include "mm.h"
+
+using namespace xivo;
+
+namespace {
+
+constexpr char kMapFile[] = "unittest_mapper_io.map";
+
+Json::Value MapperConfig() {
+  Json::Value cfg;
+  cfg["detectLoopClosures"] = false;
+  cfg["merge_features"] = false;
+  return cfg;
+}
+
+/** Fills the mapper of the current context with two groups which both
+ *  observe three features referenced to the first group. */
+void BuildMap(MapperPtr mapper) {
+  std::vector<GroupPtr> groups{
+    Group::Create(SO3::exp(Vec3{0.1, -0.2, 0.3}), Vec3{1, 2, 3}),
+    Group::Create(SO3::exp(Vec3{-0.3, 0.2, 0.1}), Vec3{4, 5, 6})};
+
+  std::vector<FeaturePtr> features;
+  for (int i=0; i<3; i++) {
+    FeaturePtr f = Feature::Create(10 * i, 20 * i);
+    f->SetState(Vec3{0.1 * i, -0.1 * i, 1.0 + i});
+    f->P() = Mat3::Identity() * (i + 1);
+    f->P()(0, 1) = f->P()(1, 0) = 0.1 * i;
+    f->SetXs(Vec3{i, 2.0 * i, 3.0 * i});
+    f->SetRef(groups[0]);
+    for (int j=0; j<=i; j++) {
+      cv::Mat desc(1, BRIEF_BYTES, CV_8UC1);
+      cv::randu(desc, 0, 256);
+      f->SetDescriptor(desc);
+    }
+    features.push_back(f);
+  }
+
+  GroupAdj group_adj;
+  for (auto f: features) {
+    group_adj.Add(f->id());
+  }
+  for (auto g: groups) {
+    mapper->AddGroup(g, group_adj);
+  }
+  for (int i=0; i<features.size(); i++) {
+    FeatureAdj feature_adj;
+    feature_adj[groups[0]->id()] = Vec2{10 * i, 20 * i};
+    feature_adj[groups[1]->id()] = Vec2{11 * i, 21 * i};
+    mapper->AddFeature(features[i], feature_adj, SE3{});
+  }
+}
+
+/** Finds the feature of `mapper` at `Xs`, since loading assigns new ids. */
+FeaturePtr FindByXs(MapperPtr mapper, const Vec3 &Xs) {
+  for (auto f: mapper->GetFeatures()) {
+    if ((f->Xs() - Xs).norm() < 1e-9) {
+      return f;
+    }
+  }
+  return nullptr;
+}
+
+} // namespace
+
+
+class MapperIOTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    EstimatorContext::Scope scope{&saved_context};
+    MemoryManager::Create(64, 32);
+    saved = Mapper::Create(MapperConfig());
+    BuildMap(saved);
+    saved->SaveMap(kMapFile);
+  }
+
+  void TearDown() override {
+    std::remove(kMapFile);
+  }
+
+  EstimatorContext saved_context, loaded_context;
+  MapperPtr saved;
+};
+
+
+TEST_F(MapperIOTest, RoundTrip) {
+  EstimatorContext::Scope scope{&loaded_context};
+  MemoryManager::Create(64, 32);
+  auto loaded = Mapper::Create(MapperConfig());
+  loaded->LoadMap(kMapFile);
+
+  ASSERT_EQ(loaded->GetFeatures().size(), saved->GetFeatures().size());
+  ASSERT_EQ(loaded->GetGroups().size(), saved->GetGroups().size());
+
+  for (auto f: saved->GetFeatures()) {
+    FeaturePtr g = FindByXs(loaded, f->Xs());
+    ASSERT_NE(g, nullptr);
+    EXPECT_TRUE(g->x().isApprox(f->x()));
+    EXPECT_TRUE(g->P().isApprox(f->P()));
+
+    ASSERT_EQ(g->NumDescriptors(), f->NumDescriptors());
+    for (int i=0; i<f->NumDescriptors(); i++) {
+      EXPECT_EQ(cv::norm(g->GetAllDescriptors()[i], f->GetAllDescriptors()[i],
+                         cv::NORM_HAMMING), 0);
+      EXPECT_EQ(g->CachedWordId(i), f->CachedWordId(i));
+    }
+
+    ASSERT_NE(g->ref(), nullptr);
+    EXPECT_TRUE(g->ref()->Tsb().isApprox(f->ref()->Tsb()));
+    EXPECT_TRUE(g->ref()->Rsb().matrix().isApprox(f->ref()->Rsb().matrix()));
+
+    // observations, matched up by the pose of the observing group
+    auto saved_obs = saved->GetObservationsOf(f);
+    auto loaded_obs = loaded->GetObservationsOf(g);
+    ASSERT_EQ(loaded_obs.size(), saved_obs.size());
+    for (const auto &so: saved_obs) {
+      int matches = 0;
+      for (const auto &lo: loaded_obs) {
+        if (lo.g->Tsb().isApprox(so.g->Tsb()) && lo.xp.isApprox(so.xp)) {
+          matches++;
+        }
+      }
+      EXPECT_EQ(matches, 1);
+    }
+  }
+
+  for (auto g: loaded->GetGroups()) {
+    EXPECT_EQ(loaded->GetFeaturesOf(g).size(), 3);
+  }
+}
+
+
+TEST_F(MapperIOTest, TruncatedFileThrows) {
+  std::string content;
+  {
+    std::ifstream in(kMapFile, std::ios::binary);
+    content.assign(std::istreambuf_iterator<char>(in), {});
+  }
+  {
+    std::ofstream out(kMapFile, std::ios::binary | std::ios::trunc);
+    out.write(content.data(), content.size() - 1);
+  }
+
+  EstimatorContext::Scope scope{&loaded_context};
+  MemoryManager::Create(64, 32);
+  auto loaded = Mapper::Create(MapperConfig());
+  EXPECT_THROW(loaded->LoadMap(kMapFile), std::runtime_error);
+  EXPECT_TRUE(loaded->GetFeatures().empty());
+  EXPECT_TRUE(loaded->GetGroups().empty());
+}
+
+
+TEST_F(MapperIOTest, OutOfRangeAdjacencyThrows) {
+  // num_adj of the first group record, which follows the 56-byte header
+  // after the group id
+  constexpr std::streamoff kNumAdjOffset = 56 + sizeof(int32_t);
+  {
+    std::fstream io(kMapFile, std::ios::in | std::ios::out | std::ios::binary);
+    uint32_t num_adj = 1000;
+    io.seekp(kNumAdjOffset);
+    io.write(reinterpret_cast<const char *>(&num_adj), sizeof(num_adj));
+  }
+
+  EstimatorContext::Scope scope{&loaded_context};
+  MemoryManager::Create(64, 32);
+  auto loaded = Mapper::Create(MapperConfig());
+  EXPECT_THROW(loaded->LoadMap(kMapFile), std::runtime_error);
+  EXPECT_TRUE(loaded->GetFeatures().empty());
+  EXPECT_TRUE(loaded->GetGroups().empty());
+}
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "message_buffer.h"
+
+using namespace xivo;
+
+struct TestMessage {
+  TestMessage(int64_t ts, int stream) : ts_{ts}, stream{stream} {}
+  timestamp_t ts() const { return ts_; }
+  timestamp_t ts_;
+  int stream;
+};
+
+using Buffer = ReorderBuffer<TestMessage>;
+
+static void Push(Buffer &buf, int stream, int64_t ts) {
+  buf.Push(stream, std::make_unique<TestMessage>(ts, stream));
+}
+
+TEST(ReorderBuffer, MergeStreams) {
+  Buffer buf{2, timestamp_t(100)};
+  Push(buf, 0, 10);
+  Push(buf, 0, 20);
+  // the other stream may still deliver something older
+  EXPECT_EQ(buf.Pop(false), nullptr);
+  EXPECT_EQ(buf.size(), 2);
+
+  Push(buf, 1, 15);
+  auto msg = buf.Pop(false);
+  ASSERT_NE(msg, nullptr);
+  EXPECT_EQ(msg->ts().count(), 10);
+  msg = buf.Pop(false);
+  ASSERT_NE(msg, nullptr);
+  EXPECT_EQ(msg->ts().count(), 15);
+  // stream 1 has nothing as recent as 20 yet
+  EXPECT_EQ(buf.Pop(false), nullptr);
+
+  Push(buf, 1, 30);
+  msg = buf.Pop(false);
+  ASSERT_NE(msg, nullptr);
+  EXPECT_EQ(msg->ts().count(), 20);
+  EXPECT_EQ(buf.size(), 1);
+}
+
+TEST(ReorderBuffer, LatencyBound) {
+  Buffer buf{2, timestamp_t(100)};
+  // stream 1 is silent: stream 0 waits no longer than 100 ns for it
+  Push(buf, 0, 10);
+  Push(buf, 0, 50);
+  EXPECT_EQ(buf.Pop(false), nullptr);
+  Push(buf, 0, 110);
+  auto msg = buf.Pop(false);
+  ASSERT_NE(msg, nullptr);
+  EXPECT_EQ(msg->ts().count(), 10);
+  EXPECT_EQ(buf.Pop(false), nullptr);
+
+  buf.Close();
+  EXPECT_EQ(buf.Pop(false)->ts().count(), 50);
+  EXPECT_EQ(buf.Pop(false)->ts().count(), 110);
+  EXPECT_EQ(buf.Pop(true), nullptr);
+}
+
+TEST(ReorderBuffer, BlockingConsumer) {
+  Buffer buf{2, timestamp_t(1000), 4};
+  std::vector<int64_t> popped;
+  std::thread consumer([&]() {
+    while (auto msg = buf.Pop(true)) {
+      popped.push_back(msg->ts().count());
+    }
+  });
+  // more than the capacity of the rings, fed from two threads
+  std::thread producer([&]() {
+    for (int i = 0; i < 100; ++i) Push(buf, 0, 2 * i);
+  });
+  for (int i = 0; i < 100; ++i) Push(buf, 1, 2 * i + 1);
+  producer.join();
+  buf.Close();
+  consumer.join();
+
+  ASSERT_EQ(popped.size(), 200);
+  for (int i = 0; i < 200; ++i) {
+    EXPECT_EQ(popped[i], i);
+  }
+}
+
+struct TestBatch {
+  TestBatch(std::vector<int64_t> ts) : ts_{std::move(ts)} {}
+  timestamp_t ts() const { return timestamp_t(ts_.front()); }
+  timestamp_t last_ts() const { return timestamp_t(ts_.back()); }
+  std::unique_ptr<TestBatch> Split(const timestamp_t &ts) {
+    auto it = std::upper_bound(ts_.begin() + 1, ts_.end(), ts.count());
+    if (it == ts_.end()) return nullptr;
+    auto rest = std::make_unique<TestBatch>(std::vector<int64_t>(it, ts_.end()));
+    ts_.erase(it, ts_.end());
+    return rest;
+  }
+  std::vector<int64_t> ts_;
+};
+
+TEST(ReorderBuffer, SplitBatches) {
+  ReorderBuffer<TestBatch> buf{2, timestamp_t(100)};
+  buf.Push(0, std::make_unique<TestBatch>(std::vector<int64_t>{10, 20, 30, 40}));
+  // stream 1 may still deliver something older than 10
+  EXPECT_EQ(buf.Pop(false), nullptr);
+
+  buf.Push(1, std::make_unique<TestBatch>(std::vector<int64_t>{25}));
+  auto msg = buf.Pop(false);
+  ASSERT_NE(msg, nullptr);
+  EXPECT_EQ(msg->ts_, (std::vector<int64_t>{10, 20}));
+  msg = buf.Pop(false);
+  ASSERT_NE(msg, nullptr);
+  EXPECT_EQ(msg->ts_, (std::vector<int64_t>{25}));
+  // stream 1 has nothing beyond 25 yet, but 30 is not older than that
+  EXPECT_EQ(buf.Pop(false), nullptr);
+
+  buf.Push(1, std::make_unique<TestBatch>(std::vector<int64_t>{35}));
+  msg = buf.Pop(false);
+  ASSERT_NE(msg, nullptr);
+  EXPECT_EQ(msg->ts_, (std::vector<int64_t>{30}));
+  EXPECT_EQ(buf.Pop(false)->ts_, (std::vector<int64_t>{35}));
+
+  buf.Close();
+  EXPECT_EQ(buf.Pop(false)->ts_, (std::vector<int64_t>{40}));
+  EXPECT_EQ(buf.Pop(false), nullptr);
+}
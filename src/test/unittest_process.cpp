@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "process.h"
+
+using namespace xivo;
+
+struct Number {
+  Number(int value) : value{value} {}
+  int value;
+};
+
+class Collector : public Process<Number> {
+public:
+  Collector(uint32_t size, OverflowPolicy policy, int delay_ms = 0)
+      : Process{size, policy}, delay_ms_{delay_ms} {}
+  ~Collector() { Stop(); }
+
+  std::vector<int> values;
+
+private:
+  bool Handle(Number *message) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms_));
+    values.push_back(message->value);
+    return true;
+  }
+  int delay_ms_;
+};
+
+TEST(Process, BlockKeepsEverything) {
+  Collector proc{4, OverflowPolicy::BLOCK};
+  proc.Start();
+  for (int i = 0; i < 1000; ++i) {
+    proc.Enqueue(std::make_unique<Number>(i));
+  }
+  proc.Wait();
+  ASSERT_EQ(proc.values.size(), 1000);
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(proc.values[i], i);
+  }
+  auto stats = proc.stats();
+  EXPECT_EQ(stats.handled, 1000);
+  EXPECT_EQ(stats.dropped, 0);
+  EXPECT_LE(stats.max_depth, 3);
+}
+
+TEST(Process, DropOldestNeverBlocks) {
+  Collector proc{4, OverflowPolicy::DROP_OLDEST, 20};
+  proc.Start();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 100; ++i) {
+    proc.Enqueue(std::make_unique<Number>(i));
+  }
+  // 100 messages at 20 ms each would take 2 seconds if the producer waited
+  EXPECT_LT(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(500));
+  proc.Wait();
+
+  auto stats = proc.stats();
+  EXPECT_GT(stats.dropped, 0);
+  EXPECT_EQ(stats.handled + stats.dropped, 100);
+  EXPECT_EQ(proc.values.size(), stats.handled);
+  // the newest message always makes it, in order
+  EXPECT_EQ(proc.values.back(), 99);
+  for (int i = 1; i < proc.values.size(); ++i) {
+    EXPECT_LT(proc.values[i - 1], proc.values[i]);
+  }
+}
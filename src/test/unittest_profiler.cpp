@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <thread>
+
+#include "profiler.h"
+
+using namespace xivo;
+
+TEST(LatencyHistogram, Quantiles) {
+  LatencyHistogram h;
+  // 1, 2, ..., 1000 microseconds
+  for (int i = 1; i <= 1000; ++i) {
+    h.Add(i * 1000);
+  }
+  EXPECT_EQ(h.count(), 1000);
+  EXPECT_NEAR(h.mean_ms(), 0.5005, 1e-9);
+  EXPECT_DOUBLE_EQ(h.max_ms(), 1.0);
+  // within the bucket resolution
+  EXPECT_NEAR(h.Quantile(0.5), 0.5, 0.5 * 0.07);
+  EXPECT_NEAR(h.Quantile(0.95), 0.95, 0.95 * 0.07);
+  EXPECT_NEAR(h.Quantile(0.99), 0.99, 0.99 * 0.07);
+  EXPECT_LE(h.Quantile(1.0), h.max_ms());
+}
+
+TEST(Profiler, NestedScopes) {
+  Profiler profiler{"test", 16};
+  profiler.set_budget_ms(1000);
+  for (int i = 0; i < 3; ++i) {
+    XIVO_PROFILE_FRAME(profiler, "frame");
+    {
+      XIVO_PROFILE_SCOPE(profiler, "inner");
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    XIVO_PROFILE_SCOPE(profiler, "other");
+  }
+  {
+    // same event outside of the frame is a different node
+    XIVO_PROFILE_SCOPE(profiler, "inner");
+  }
+
+  auto report = profiler.ToJson();
+  ASSERT_TRUE(report["events"].isMember("frame/inner"));
+  ASSERT_TRUE(report["events"].isMember("frame/other"));
+  ASSERT_TRUE(report["events"].isMember("inner"));
+  EXPECT_EQ(report["events"]["frame"]["count"].asInt(), 3);
+  EXPECT_EQ(report["events"]["frame/inner"]["count"].asInt(), 3);
+  EXPECT_EQ(report["events"]["inner"]["count"].asInt(), 1);
+  EXPECT_GE(report["events"]["frame/inner"]["p50_ms"].asDouble(), 0.9);
+  EXPECT_EQ(report["frames"]["count"].asInt(), 3);
+  EXPECT_EQ(report["frames"]["over_budget"].asInt(), 0);
+  EXPECT_GE(report["frames"]["max_ms"].asDouble(),
+            report["events"]["frame/inner"]["max_ms"].asDouble());
+}
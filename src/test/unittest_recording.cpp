@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+
+#include "recording.h"
+
+using namespace xivo;
+
+class Recording : public ::testing::Test
+{
+  protected:
+    void SetUp() override {
+      path = testing::TempDir() + "/xivo_recording.bin";
+
+      image = cv::Mat(4, 6, CV_8UC3);
+      for (int i = 0; i < image.total() * image.elemSize(); ++i) {
+        image.data[i] = i;
+      }
+      ids.resize(3);
+      ids << 7, 11, 13;
+      xp.resize(3, 2);
+      xp << 1, 2, 3, 4, 5, 6;
+
+      RecordingWriter writer{path};
+      writer.WriteIMU(timestamp_t(10), Vec3{1, 2, 3}, Vec3{4, 5, 6});
+      writer.WriteImage(timestamp_t(20), image);
+      writer.WriteIMU(timestamp_t(20), Vec3{0, 0, 0}, Vec3{0, 0, 9.8});
+      writer.WritePointCloud(timestamp_t(30), ids, xp);
+      writer.Close();
+    }
+
+    void TearDown() override {
+      std::remove(path.c_str());
+    }
+
+    std::string path;
+    cv::Mat image;
+    VecXi ids;
+    MatX2 xp;
+};
+
+TEST_F(Recording, RoundTrip) {
+  RecordingReader reader{path};
+  ASSERT_EQ(reader.size(), 4);
+
+  RecordingReader::Entry entry;
+  reader.Get(0, entry);
+  EXPECT_EQ(entry.type, RecordType::IMU);
+  EXPECT_EQ(entry.ts.count(), 10);
+  EXPECT_EQ(entry.gyro, Vec3(1, 2, 3));
+  EXPECT_EQ(entry.accel, Vec3(4, 5, 6));
+
+  reader.Get(1, entry);
+  EXPECT_EQ(entry.type, RecordType::IMAGE);
+  ASSERT_EQ(entry.image.rows, image.rows);
+  ASSERT_EQ(entry.image.cols, image.cols);
+  ASSERT_EQ(entry.image.type(), image.type());
+  EXPECT_EQ(std::memcmp(entry.image.data, image.data,
+                        image.total() * image.elemSize()), 0);
+
+  reader.Get(3, entry);
+  EXPECT_EQ(entry.type, RecordType::POINT_CLOUD);
+  EXPECT_EQ(entry.feature_ids, ids);
+  EXPECT_EQ(entry.xp, xp);
+}
+
+TEST_F(Recording, LowerBound) {
+  RecordingReader reader{path};
+  EXPECT_EQ(reader.LowerBound(timestamp_t(0)), 0);
+  EXPECT_EQ(reader.LowerBound(timestamp_t(20)), 1);
+  EXPECT_EQ(reader.LowerBound(timestamp_t(21)), 3);
+  EXPECT_EQ(reader.LowerBound(timestamp_t(31)), reader.size());
+  EXPECT_EQ(reader.type(2), RecordType::IMU);
+  EXPECT_EQ(reader.ts(3).count(), 30);
+}
+
+TEST_F(Recording, Errors) {
+  RecordingWriter writer{path};
+  writer.WriteIMU(timestamp_t(10), Vec3::Zero(), Vec3::Zero());
+  EXPECT_THROW(writer.WriteIMU(timestamp_t(5), Vec3::Zero(), Vec3::Zero()),
+               std::invalid_argument);
+  // not closed yet
+  EXPECT_THROW(RecordingReader{path}, std::runtime_error);
+  EXPECT_THROW(RecordingReader{path + ".missing"}, std::runtime_error);
+}
+
+TEST_F(Recording, Corrupt) {
+  RecordingHeader header;
+  IndexRecord image_record;
+  std::fstream io(path, std::ios::in | std::ios::out | std::ios::binary);
+  io.read(reinterpret_cast<char *>(&header), sizeof(header));
+  io.seekg(header.index_offset + sizeof(IndexRecord));
+  io.read(reinterpret_cast<char *>(&image_record), sizeof(image_record));
+
+  // geometry of the frame no longer matches its payload
+  int32_t rows = image.rows + 1;
+  io.seekp(image_record.offset + sizeof(ChunkHeader));
+  io.write(reinterpret_cast<const char *>(&rows), sizeof(rows));
+  io.flush();
+  {
+    RecordingReader reader{path};
+    RecordingReader::Entry entry;
+    EXPECT_THROW(reader.Get(1, entry), std::runtime_error);
+    EXPECT_NO_THROW(reader.Get(0, entry));
+  }
+
+  // index refers past the chunks
+  uint64_t offset = header.index_offset;
+  io.seekp(header.index_offset + sizeof(IndexRecord) +
+           offsetof(IndexRecord, offset));
+  io.write(reinterpret_cast<const char *>(&offset), sizeof(offset));
+  io.flush();
+  EXPECT_THROW(RecordingReader{path}, std::runtime_error);
+}
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "snapshot.h"
+
+using namespace xivo;
+
+struct Numbers {
+  uint64_t version;
+  std::vector<uint64_t> values;  // all equal to version
+};
+
+static void Fill(Numbers &n, uint64_t version) {
+  n.version = version;
+  n.values.assign(64, version);
+}
+
+TEST(SnapshotBuffer, ReusesBuffersNobodyHolds) {
+  SnapshotBuffer<Numbers> buf;
+  EXPECT_EQ(buf.latest(), nullptr);
+
+  Numbers *first = &buf.back();
+  Fill(*first, 1);
+  buf.Publish();
+  Numbers *second = &buf.back();
+  EXPECT_NE(first, second);
+  Fill(*second, 2);
+  buf.Publish();
+  EXPECT_EQ(buf.version(), 2);
+  EXPECT_EQ(buf.latest()->version, 2);
+  // double buffering: back to the first one
+  EXPECT_EQ(&buf.back(), first);
+}
+
+TEST(SnapshotBuffer, HeldSnapshotsNeverChange) {
+  SnapshotBuffer<Numbers> buf;
+  Fill(buf.back(), 1);
+  buf.Publish();
+  auto held = buf.latest();
+  for (uint64_t v = 2; v < 5; ++v) {
+    Fill(buf.back(), v);
+    buf.Publish();
+  }
+  EXPECT_EQ(held->version, 1);
+  EXPECT_EQ(held->values.front(), 1);
+  EXPECT_EQ(buf.latest()->version, 4);
+}
+
+TEST(SnapshotBuffer, ConcurrentReaders) {
+  SnapshotBuffer<Numbers> buf;
+  std::atomic<bool> done{false};
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 3; ++i) {
+    readers.emplace_back([&]() {
+      uint64_t last = 0;
+      while (!done) {
+        auto s = buf.latest();
+        if (!s) continue;
+        ASSERT_GE(s->version, last);
+        for (auto v : s->values) {
+          ASSERT_EQ(v, s->version);
+        }
+        last = s->version;
+      }
+    });
+  }
+  for (uint64_t v = 1; v <= 2000; ++v) {
+    Fill(buf.back(), v);
+    buf.Publish();
+  }
+  done = true;
+  for (auto &t : readers) t.join();
+  EXPECT_EQ(buf.latest()->version, 2000);
+}
@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+// trace everything, whatever the build type
+#undef XIVO_TRACE_LEVEL
+#define XIVO_TRACE_LEVEL XIVO_TRACE_LEVEL_FEATURE
+#include "trace.h"
+
+using namespace xivo;
+
+TEST(Trace, KeepsMostRecentEvents) {
+  auto buffer = TraceBuffer::instance();
+  buffer->set_capacity(16);
+  for (int i = 0; i < 40; ++i) {
+    XIVO_TRACE_FEATURE("test/add-feature", i, -i, 0.5 * i);
+  }
+  auto records = buffer->Snapshot();
+  ASSERT_EQ(records.size(), 16);
+  int event = Profiler::Intern("test/add-feature");
+  for (int k = 0; k < 16; ++k) {
+    EXPECT_EQ(records[k].event, event);
+    EXPECT_EQ(records[k].a, 24 + k);
+    EXPECT_EQ(records[k].b, -24 - k);
+    EXPECT_DOUBLE_EQ(records[k].value, 0.5 * (24 + k));
+    if (k > 0) EXPECT_GE(records[k].ts_ns, records[k - 1].ts_ns);
+  }
+
+  std::string path = testing::TempDir() + "unittest_trace.bin";
+  ASSERT_EQ(buffer->Dump(path), 16);
+  std::ifstream is(path, std::ios::binary | std::ios::ate);
+  // magic, 1 event name, count and the records
+  size_t name_size = std::string("test/add-feature").size();
+  EXPECT_EQ(size_t(is.tellg()),
+            8 + 4 + (8 + name_size) + 8 + 16 * sizeof(TraceRecord));
+  std::remove(path.c_str());
+}
+
+TEST(Trace, ConcurrentProducers) {
+  auto buffer = TraceBuffer::instance();
+  buffer->set_capacity(1 << 12);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([t]() {
+      for (int i = 0; i < 1000; ++i) {
+        XIVO_TRACE_FRAME("test/frame", t, i);
+      }
+    });
+  }
+  // snapshots taken meanwhile only see complete records
+  for (int k = 0; k < 10; ++k) {
+    for (const auto &r : buffer->Snapshot()) {
+      ASSERT_LT(r.a, 4);
+      ASSERT_LT(r.b, 1000);
+    }
+  }
+  for (auto &t : threads) t.join();
+
+  auto records = buffer->Snapshot();
+  ASSERT_EQ(records.size(), 4000);
+  std::vector<int> last(4, -1);
+  for (const auto &r : records) {
+    // in order per producer
+    EXPECT_EQ(r.b, last[r.a] + 1);
+    last[r.a] = r.b;
+  }
+}
@@ -0,0 +1,70 @@
+#include <gtest/gtest.h>
+#include <random>
+
+#include "core.h"
+
+using namespace Eigen;
+using namespace xivo;
+
+class TwoPoint : public ::testing::Test
+{
+  protected:
+    void SetUp() override {
+      R10 = rodrigues(Vec3{0.02, -0.05, 0.01});
+      T10 << 0.3, -0.1, 0.05;
+
+      std::default_random_engine engine(0);
+      std::uniform_real_distribution<number_t> xy(-2, 2);
+      std::uniform_real_distribution<number_t> z(2, 10);
+      for (int i = 0; i < num_points; ++i) {
+        Vec3 X0{xy(engine), xy(engine), z(engine)};
+        Vec3 X1 = R10 * X0 + T10;
+        xc0.push_back(X0.head<2>() / X0(2));
+        xc1.push_back(X1.head<2>() / X1(2));
+      }
+    }
+
+    static constexpr int num_points = 100;
+    static constexpr number_t thresh = 1e-3;
+    Mat3 R10;
+    Vec3 T10;
+    std::vector<Vec2> xc0, xc1;
+};
+
+TEST_F(TwoPoint, AllInliers) {
+  std::vector<uint8_t> inliers;
+  Vec3 t;
+  int n = TwoPointRANSAC(xc0, xc1, R10, thresh, 100, 0.995, inliers, t);
+  EXPECT_EQ(n, num_points);
+  // translation direction is recovered up to sign
+  EXPECT_NEAR(std::fabs(t.dot(T10.normalized())), 1.0, 1e-6);
+}
+
+TEST_F(TwoPoint, Outliers) {
+  // corrupt every 4th match
+  std::default_random_engine engine(1);
+  std::uniform_real_distribution<number_t> noise(0.05, 0.2);
+  for (int i = 0; i < num_points; i += 4) {
+    xc1[i] += Vec2{noise(engine), -noise(engine)};
+  }
+
+  std::vector<uint8_t> inliers;
+  Vec3 t;
+  int n = TwoPointRANSAC(xc0, xc1, R10, thresh, 100, 0.995, inliers, t);
+  EXPECT_EQ(n, num_points - num_points / 4);
+  for (int i = 0; i < num_points; ++i) {
+    EXPECT_EQ(inliers[i], i % 4 != 0);
+  }
+  EXPECT_NEAR(std::fabs(t.dot(T10.normalized())), 1.0, 1e-6);
+}
+
+TEST_F(TwoPoint, PureRotation) {
+  for (int i = 0; i < num_points; ++i) {
+    Vec3 X1 = R10 * Vec3{xc0[i](0), xc0[i](1), 1};
+    xc1[i] = X1.head<2>() / X1(2);
+  }
+  std::vector<uint8_t> inliers;
+  Vec3 t;
+  int n = TwoPointRANSAC(xc0, xc1, R10, thresh, 100, 0.995, inliers, t);
+  EXPECT_EQ(n, num_points);
+}
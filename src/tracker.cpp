@@ -10,7 +10,9 @@
 #include "opencv2/calib3d.hpp"
 
 #include "feature.h"
+#include "helpers.h"
 #include "tracker.h"
+#include "trace.h"
 #include "visualize.h"
 
 namespace xivo {
@@ -87,25 +89,26 @@ cv::Ptr<cv::FeatureDetector> GetOpenCVDetectorDescriptor(
 }
 
 
-std::unique_ptr<Tracker> Tracker::instance_ = nullptr;
-
 TrackerPtr Tracker::Create(const Json::Value &cfg) {
-  if (instance_ == nullptr) {
-    instance_ = std::unique_ptr<Tracker>(new Tracker(cfg));
+  auto &instance = EstimatorContext::current()->tracker_;
+  if (instance == nullptr) {
+    instance = std::unique_ptr<Tracker>(new Tracker(cfg));
   } else {
     LOG(WARNING) << "tracker already created";
   }
-  return instance_.get();
+  return instance.get();
 }
 
 Tracker::Tracker(const Json::Value &cfg) : cfg_{cfg} {
   initialized_ = false;
+  has_R10_ = false;
   mask_size_ = cfg_.get("mask_size", 15).asInt();
   margin_ = cfg_.get("margin", 16).asInt();
   num_features_min_ = cfg_.get("num_features_min", 120).asInt();
   num_features_max_ = cfg_.get("num_features_max", 150).asInt();
   max_pixel_displacement_ = cfg_.get("max_pixel_displacement", 64).asInt();
   differential_ = cfg_.get("differential", true).asBool();
+  normalize_ = cfg_.get("normalize", false).asBool();
 
   std::string tracker_type = cfg_.get("tracker_type", "LK").asString();
   if (tracker_type == "LK") {
@@ -128,7 +131,13 @@ Tracker::Tracker(const Json::Value &cfg) : cfg_{cfg} {
     outlier_rejection_cfg.get("RANSAC_reproj_thresh", 3.0).asDouble();
   std::string outlier_rejection_method =
     outlier_rejection_cfg.get("method", "RANSAC").asString();
-  if (outlier_rejection_method == "RANSAC") {
+  use_two_point_ = false;
+  if (outlier_rejection_method == "2PT") {
+    // rotation-aided 2-point RANSAC; falls back to a homography RANSAC when
+    // the relative rotation is not available
+    use_two_point_ = true;
+    outlier_rejection_method_ = cv::RANSAC;
+  } else if (outlier_rejection_method == "RANSAC") {
     outlier_rejection_method_ = cv::RANSAC;
   } else if (outlier_rejection_method == "LMEDS") {
     outlier_rejection_method_ = cv::LMEDS;
@@ -145,6 +154,10 @@ Tracker::Tracker(const Json::Value &cfg) : cfg_{cfg} {
   max_level_ = klt_cfg.get("max_level", 4).asInt();
   max_iter_ = klt_cfg.get("max_iter", 15).asInt();
   eps_ = klt_cfg.get("eps", 0.01).asDouble();
+  adaptive_klt_ = klt_cfg.get("adaptive", false).asBool();
+  klt_sigma_multiplier_ = klt_cfg.get("sigma_multiplier", 3.0).asDouble();
+  klt_displacement_ratio_ = klt_cfg.get("displacement_ratio", 0.25).asDouble();
+  min_win_size_ = klt_cfg.get("min_win_size", 7).asInt();
 
   std::string detector_type = cfg_.get("detector", "FAST").asString();
   LOG(INFO) << "detector type=" << detector_type;
@@ -208,7 +221,7 @@ Tracker::Tracker(const Json::Value &cfg) : cfg_{cfg} {
 
 void Tracker::DetectLK(const cv::Mat &img, int num_to_add,
                        std::vector<FeaturePtr> newly_dropped_tracks,
-                       bool check_homography, cv::Mat H)
+                       TwoViewModel model, cv::Mat H)
 {
   std::vector<cv::KeyPoint> kps;
   detector_->detect(img, kps, mask_);
@@ -261,8 +274,12 @@ void Tracker::DetectLK(const cv::Mat &img, int num_to_add,
       
       // check reprojection error
       bool reprojection_error_check_passed;
-      if (!check_homography) {
+      if (model == TwoViewModel::NONE) {
         reprojection_error_check_passed = true;
+      } else if (model == TwoViewModel::ESSENTIAL) {
+        reprojection_error_check_passed =
+          CheckEssential(newly_dropped_tracks[D.queryIdx]->keypoint().pt,
+                         kps[D.trainIdx].pt);
       } else {
         reprojection_error_check_passed =
           CheckHomography(newly_dropped_tracks[D.queryIdx]->keypoint().pt,
@@ -294,7 +311,7 @@ void Tracker::DetectLK(const cv::Mat &img, int num_to_add,
         }
         f1->UpdateTrack(kp.pt.x, kp.pt.y);
         f1->SetTrackStatus(TrackStatus::TRACKED);
-        LOG(INFO) << "Potentially rescued dropped feature #" << f1->id();
+        XIVO_TRACE_FEATURE("tracker/rescue-dropped", f1->id());
         MaskOut(mask_, kp.pt.x, kp.pt.y, mask_size_);
         --num_to_add;
         continue;
@@ -325,14 +342,33 @@ void Tracker::Update(const cv::Mat &image) {
   } else {
     UpdateMatch(image);
   }
+  // drop our reference so that the frame can retire to the pool
+  img_.release();
+  // the rotation prior is only valid for this frame
+  has_R10_ = false;
 }
 
 
-void Tracker::UpdateMatch(const cv::Mat &image) {
-  img_ = image.clone();
-  if (cfg_.get("normalize", false).asBool()) {
-    cv::normalize(image, img_, 0, 255, cv::NORM_MINMAX);
+void Tracker::SetRelativeRotation(const Mat3 &R10) {
+  R10_ = R10;
+  has_R10_ = true;
+}
+
+
+void Tracker::SetImage(const cv::Mat &image) {
+  if (normalize_) {
+    // normalize into our own buffer, which is re-used across frames
+    cv::normalize(image, normalized_img_, 0, 255, cv::NORM_MINMAX);
+    img_ = normalized_img_;
+  } else {
+    // reference the incoming frame, no copy
+    img_ = image;
   }
+}
+
+
+void Tracker::UpdateMatch(const cv::Mat &image) {
+  SetImage(image);
 
   // detect features in the new image
   std::vector<cv::KeyPoint> new_kps;
@@ -448,10 +484,7 @@ void Tracker::UpdateMatch(const cv::Mat &image) {
 
 
 void Tracker::UpdateLK(const cv::Mat &image) {
-  img_ = image.clone();
-  if (cfg_.get("normalize", false).asBool()) {
-    cv::normalize(image, img_, 0, 255, cv::NORM_MINMAX);
-  }
+  SetImage(image);
 
   if (!initialized_) {
     rows_ = img_.rows;
@@ -459,9 +492,10 @@ void Tracker::UpdateLK(const cv::Mat &image) {
     mask_ = cv::Mat(rows_, cols_, CV_8UC1);
     mask_.setTo(0);
 
-    // build image pyramid
-    cv::buildOpticalFlowPyramid(img_, pyramid_, cv::Size(win_size_, win_size_),
-                                max_level_);
+    // build image pyramid; the adaptive tracker adds levels on demand
+    pyramid_levels_ = cv::buildOpticalFlowPyramid(
+        img_, pyramid_, cv::Size(win_size_, win_size_),
+        adaptive_klt_ ? 0 : max_level_);
     // setup the mask
     ResetMask(mask_(
         cv::Rect(margin_, margin_, cols_ - 2 * margin_, rows_ - 2 * margin_)));
@@ -475,11 +509,6 @@ void Tracker::UpdateLK(const cv::Mat &image) {
   ResetMask(mask_(
       cv::Rect(margin_, margin_, cols_ - 2 * margin_, rows_ - 2 * margin_)));
 
-  // build new pyramid
-  std::vector<cv::Mat> pyramid;
-  cv::buildOpticalFlowPyramid(img_, pyramid, cv::Size(win_size_, win_size_),
-                              max_level_);
-
   // prepare for optical flow
   cv::TermCriteria criteria(cv::TermCriteria::MAX_ITER | cv::TermCriteria::EPS,
                             max_iter_, eps_);
@@ -487,9 +516,14 @@ void Tracker::UpdateLK(const cv::Mat &image) {
   std::vector<cv::Point2f> pts0, pts1;
   std::vector<uint8_t> status;
   std::vector<float> err;
+  // coarsest pyramid level and search radius needed by each feature
+  std::vector<int> levels;
+  std::vector<number_t> radii;
 
   pts0.reserve(features_.size());
   pts1.reserve(pts0.size());
+  levels.reserve(pts0.size());
+  radii.reserve(pts0.size());
 
   for (auto f : features_) {
     const Vec2 &pt(f->xp());
@@ -499,9 +533,18 @@ void Tracker::UpdateLK(const cv::Mat &image) {
     auto pred = f->pred();
     if (pred(0) != -1 && pred(1) != -1) {
       pts1.emplace_back(pred(0), pred(1));
+      if (adaptive_klt_) {
+        radii.push_back(SearchRadius(f->pred_cov(), (pred - pt).norm()));
+        levels.push_back(KLTLevel(radii.back()));
+      }
       f->ResetPred(); // reset
     } else {
       pts1.emplace_back(pt[0], pt[1]);
+      if (adaptive_klt_) {
+        // no prediction: search at full scale
+        radii.push_back(max_pixel_displacement_);
+        levels.push_back(max_level_);
+      }
     }
   }
 
@@ -510,9 +553,26 @@ void Tracker::UpdateLK(const cv::Mat &image) {
     return;
   }
 
-  cv::calcOpticalFlowPyrLK(pyramid_, pyramid, pts0, pts1, status, err,
-                           cv::Size(win_size_, win_size_), max_level_, criteria,
-                           cv::OPTFLOW_USE_INITIAL_FLOW);
+  // build new pyramid
+  std::vector<cv::Mat> pyramid;
+  int num_levels = adaptive_klt_ ?
+    *std::max_element(levels.begin(), levels.end()) : max_level_;
+  int pyramid_levels = cv::buildOpticalFlowPyramid(
+      img_, pyramid, cv::Size(win_size_, win_size_), num_levels);
+
+  if (!adaptive_klt_) {
+    cv::calcOpticalFlowPyrLK(pyramid_, pyramid, pts0, pts1, status, err,
+                             cv::Size(win_size_, win_size_), max_level_,
+                             criteria, cv::OPTFLOW_USE_INITIAL_FLOW);
+  } else {
+    // the last pyramid might have been built with fewer levels
+    if (pyramid_levels_ < pyramid_levels) {
+      pyramid_levels_ = ExtendPyramid(pyramid_, pyramid_levels_,
+                                      pyramid_levels,
+                                      cv::Size(win_size_, win_size_));
+    }
+    AdaptiveLK(pyramid, pts0, pts1, levels, radii, criteria, status);
+  }
 
   std::vector<cv::KeyPoint> kps;
   cv::Mat descriptors;
@@ -576,9 +636,9 @@ void Tracker::UpdateLK(const cv::Mat &image) {
   }
 
   cv::Mat H;
-  bool outlier_rejection_success;
+  TwoViewModel model{TwoViewModel::NONE};
   if (do_outlier_rejection_) {
-    outlier_rejection_success = OutlierRejection(pts0, pts1, status, H);
+    model = OutlierRejection(pts0, pts1, status, H);
   }
 
   // Mark newly dropped tracks for possible rescue
@@ -594,9 +654,8 @@ void Tracker::UpdateLK(const cv::Mat &image) {
   // detect a new set of features
   // this can rescue dropped featuers by matching them to newly detected ones
   if (num_valid_features < num_features_min_) {
-    bool check_homography = outlier_rejection_success && do_outlier_rejection_;
     DetectLK(img_, num_features_max_ - num_valid_features,
-             newly_dropped_tracks, check_homography, H);
+             newly_dropped_tracks, model, H);
   }
 
   // Mark all features that are still in newly_dropped_tracks_ at this point
@@ -608,10 +667,86 @@ void Tracker::UpdateLK(const cv::Mat &image) {
 
   // swap buffers ...
   std::swap(pyramid, pyramid_);
+  pyramid_levels_ = pyramid_levels;
 
 }
 
 
+number_t Tracker::SearchRadius(const Mat2 &cov, number_t displacement) const {
+  // largest eigenvalue of the 2x2 covariance of the predicted pixel location
+  number_t a = cov(0, 0), b = cov(0, 1), c = cov(1, 1);
+  number_t lambda = 0.5 * (a + c) + std::sqrt(0.25 * (a - c) * (a - c) + b * b);
+  // errors in the propagated motion grow with the predicted displacement
+  number_t radius = klt_sigma_multiplier_ * std::sqrt(lambda) +
+                    klt_displacement_ratio_ * displacement;
+  return std::min<number_t>(radius, max_pixel_displacement_);
+}
+
+
+int Tracker::KLTLevel(number_t radius) const {
+  // At level L, a window of half size win_size_/2 covers a displacement of
+  // 2^L * win_size_/2 pixels at full resolution.
+  int level = 0;
+  number_t reach = 0.5 * win_size_;
+  while (reach < radius && level < max_level_) {
+    reach *= 2;
+    ++level;
+  }
+  return level;
+}
+
+
+void Tracker::AdaptiveLK(const std::vector<cv::Mat> &pyramid,
+                         const std::vector<cv::Point2f> &pts0,
+                         std::vector<cv::Point2f> &pts1,
+                         const std::vector<int> &levels,
+                         const std::vector<number_t> &radii,
+                         const cv::TermCriteria &criteria,
+                         std::vector<uint8_t> &status) {
+  status.assign(pts0.size(), 0);
+
+  // group features by pyramid level, one KLT call per group
+  std::vector<std::vector<int>> groups(max_level_ + 1);
+  for (int i = 0; i < levels.size(); ++i) {
+    groups[levels[i]].push_back(i);
+  }
+
+  std::vector<cv::Point2f> gpts0, gpts1;
+  std::vector<uint8_t> gstatus;
+  std::vector<float> gerr;
+  for (int level = 0; level <= max_level_; ++level) {
+    const auto &group = groups[level];
+    if (group.empty()) {
+      continue;
+    }
+    gpts0.clear();
+    gpts1.clear();
+    number_t max_radius{0};
+    for (int i : group) {
+      gpts0.push_back(pts0[i]);
+      gpts1.push_back(pts1[i]);
+      max_radius = std::max(max_radius, radii[i]);
+    }
+
+    // features accurately predicted at full resolution can use a smaller window
+    int win_size = win_size_;
+    if (level == 0) {
+      win_size = std::clamp(2 * int(std::ceil(max_radius)) + 1,
+                            min_win_size_, win_size_);
+    }
+
+    cv::calcOpticalFlowPyrLK(pyramid_, pyramid, gpts0, gpts1, gstatus, gerr,
+                             cv::Size(win_size, win_size), level, criteria,
+                             cv::OPTFLOW_USE_INITIAL_FLOW);
+
+    for (int k = 0; k < group.size(); ++k) {
+      pts1[group[k]] = gpts1[k];
+      status[group[k]] = gstatus[k];
+    }
+  }
+}
+
+
 void Tracker::UpdatePointCloud(const VecXi &feature_ids, const MatX2 &xps)
 {
   // Turn input into a hash table for measurements.
@@ -670,16 +805,16 @@ void Tracker::UpdatePointCloud(const VecXi &feature_ids, const MatX2 &xps)
 }
 
 
-bool Tracker::OutlierRejection(const std::vector<cv::Point2f> pts0,
-                               const std::vector<cv::Point2f> pts1,
-                               std::vector<uint8_t>& match_status,
-                               cv::Mat& H)
+TwoViewModel Tracker::OutlierRejection(const std::vector<cv::Point2f> pts0,
+                                       const std::vector<cv::Point2f> pts1,
+                                       std::vector<uint8_t>& match_status,
+                                       cv::Mat& H)
 {
   CHECK(pts0.size() == pts1.size());
 
   // Check that we have at least 4 valid points
   if (sum_total(match_status) < 4) {
-    return false;
+    return TwoViewModel::NONE;
   }
 
   // Remove all points that are already marked as rejected
@@ -698,12 +833,22 @@ bool Tracker::OutlierRejection(const std::vector<cv::Point2f> pts0,
     }
   }
 
+  if (use_two_point_ && has_R10_) {
+    H = cv::Mat();
+    return TwoPointOutlierRejection(pts0_valid, pts1_valid, idx_map,
+                                    match_status);
+  }
+
   // Call OpenCV
   cv::Mat inlier_outlier_mask(1, pts0_valid.size(), CV_8UC1);
   H = cv::findHomography(
     pts0_valid, pts1_valid, outlier_rejection_method_,
     outlier_rejection_reproj_thresh_, inlier_outlier_mask,
     outlier_rejection_maxiters_, outlier_rejection_confidence_);
+  if (H.empty()) {
+    // no homography found, the mask is meaningless
+    return TwoViewModel::NONE;
+  }
 
   // Mark outliers in `match_status`
   for (int i=0; i<pts0.size(); i++) {
@@ -714,18 +859,88 @@ bool Tracker::OutlierRejection(const std::vector<cv::Point2f> pts0,
     }
   }
 
-  return true;
+  return TwoViewModel::HOMOGRAPHY;
+}
+
+
+
+TwoViewModel Tracker::TwoPointOutlierRejection(
+    const std::vector<cv::Point2f> &pts0_valid,
+    const std::vector<cv::Point2f> &pts1_valid,
+    const std::vector<int> &idx_map,
+    std::vector<uint8_t> &match_status)
+{
+  auto camera = Camera::instance();
+  MatX2 xp0(pts0_valid.size(), 2), xp1(pts1_valid.size(), 2);
+  for (int i = 0; i < pts0_valid.size(); ++i) {
+    xp0.row(i) << pts0_valid[i].x, pts0_valid[i].y;
+    xp1.row(i) << pts1_valid[i].x, pts1_valid[i].y;
+  }
+  MatX2 xc0_batch = camera->UnProjectBatch(xp0);
+  MatX2 xc1_batch = camera->UnProjectBatch(xp1);
+  std::vector<Vec2> xc0(xc0_batch.rows()), xc1(xc1_batch.rows());
+  for (int i = 0; i < xc0.size(); ++i) {
+    xc0[i] = xc0_batch.row(i).transpose();
+    xc1[i] = xc1_batch.row(i).transpose();
+  }
+
+  std::vector<uint8_t> inliers;
+  int num_inliers = TwoPointRANSAC(
+    xc0, xc1, R10_,
+    outlier_rejection_reproj_thresh_ / camera->GetFocalLength(),
+    outlier_rejection_maxiters_, outlier_rejection_confidence_, inliers, t10_);
+  XIVO_TRACE_FRAME("tracker/2pt-inliers", num_inliers, (int)xc0.size());
+  if (num_inliers == 0) {
+    // no model (poor rotation prior, too little texture): keep the tracks, as
+    // when the homography cannot be estimated
+    return TwoViewModel::NONE;
+  }
+
+  // Mark outliers in `match_status`
+  for (int i = 0; i < match_status.size(); i++) {
+    if (match_status[i] != 0 && inliers[idx_map[i]] == 0) {
+      match_status[i] = 0;
+    }
+  }
+
+  // DetectLK checks rescued tracks with `CheckEssential`
+  return TwoViewModel::ESSENTIAL;
 }
 
 
+bool Tracker::CheckEssential(cv::Point2f p0, cv::Point2f p1) const {
+  auto camera = Camera::instance();
+  Vec2 xc0 = camera->UnProject(Vec2{p0.x, p0.y});
+  Vec2 xc1 = camera->UnProject(Vec2{p1.x, p1.y});
+  number_t thresh =
+    outlier_rejection_reproj_thresh_ / camera->GetFocalLength();
+  if (t10_.isZero()) {
+    // pure rotation
+    Vec3 Rb0 = R10_ * Vec3{xc0(0), xc0(1), 1};
+    return (Rb0.head<2>() / Rb0(2) - xc1).norm() < thresh;
+  }
+  return SampsonError(hat(t10_) * R10_, xc0, xc1) < thresh;
+}
+
 
 ////////////////////////////////////////
 // helpers
 ////////////////////////////////////////
+int ExtendPyramid(std::vector<cv::Mat> &pyramid, int levels, int target,
+                  cv::Size win_size) {
+  // layout of a pyramid with derivatives: [img0, deriv0, img1, deriv1, ...]
+  std::vector<cv::Mat> ext;
+  int ext_levels = cv::buildOpticalFlowPyramid(pyramid[2 * levels], ext,
+                                               win_size, target - levels);
+  // the first level of `ext` duplicates the coarsest level of `pyramid`
+  pyramid.insert(pyramid.end(), ext.begin() + 2, ext.end());
+  return levels + ext_levels;
+}
+
 void ResetMask(cv::Mat mask) { mask.setTo(255); }
 
 void MaskOut(cv::Mat mask, number_t x, number_t y, int mask_size) {
-  static int half_size = (mask_size >> 1);
+  int half_size = (mask_size >> 1);
   cv::rectangle(mask, cv::Point2d(x - half_size, y - half_size),
                 cv::Point2d(x + half_size, y + half_size), cv::Scalar(0), -1);
 }
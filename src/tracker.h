@@ -11,6 +11,7 @@
 #include "json/json.h"
 #include "mapper.h"
 
+#include "context.h"
 #include "core.h"
 
 namespace xivo {
@@ -22,11 +23,21 @@ enum TrackerType : int {
   POINTCLOUD = 2
 };
 
+/** Two-view model estimated by outlier rejection, which rescued tracks are
+ *  then checked against. */
+enum class TwoViewModel : int {
+  NONE = 0,        // outlier rejection failed or did not run
+  HOMOGRAPHY = 1,  // `findHomography`
+  ESSENTIAL = 2    // rotation-aided two-point RANSAC
+};
+
 class Tracker {
 public:
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   static TrackerPtr Create(const Json::Value &cfg);
-  static TrackerPtr instance() { return instance_.get(); }
+  static TrackerPtr instance() {
+    return EstimatorContext::current()->tracker_.get();
+  }
 
   /** Matches features found on incoming image `img` to features in `features_`
    *  using LK-pyramid and detects a new set of features to be tracked.
@@ -40,6 +51,17 @@ public:
 
   void UpdatePointCloud(const VecXi &feature_ids, const MatX2 &xps);
 
+  /** Sets the rotation of the camera from the last frame to the incoming one,
+   *  i.e., X1 = R10 * X0 + t, usually predicted by integrating the gyro. Used
+   *  by the two-point outlier rejection for the next call to `Update` only. */
+  void SetRelativeRotation(const Mat3 &R10);
+
+  /** Whether the LK tracker picks pyramid levels from the covariance of the
+   *  predicted feature locations, which then need to be computed. */
+  bool UsePredictionCovariance() const {
+    return tracker_type_ == TrackerType::LK && adaptive_klt_;
+  }
+
   /** Called by function `CreateSystem` to force extraction of descriptors when
    * we want to use loop closure. */
   bool IsExtractingDescriptors() { return extract_descriptor_; }
@@ -52,7 +74,6 @@ private:
   Tracker &operator=(const Tracker &other) = delete;
 
   Tracker(const Json::Value &cfg);
-  static std::unique_ptr<Tracker> instance_;
 
   // variables
   bool differential_;
@@ -67,11 +88,27 @@ private:
   int outlier_rejection_maxiters_;
   number_t outlier_rejection_confidence_;
   number_t outlier_rejection_reproj_thresh_;
-
+  /** Use the rotation-aided two-point RANSAC for outlier rejection. */
+  bool use_two_point_;
+  /** Relative rotation prior set by `SetRelativeRotation`. */
+  Mat3 R10_;
+  bool has_R10_;
+  /** Translation direction estimated by the two-point RANSAC, zero for a pure
+   *  rotation. */
+  Vec3 t10_;
+
+  bool normalize_;
+
+  /** The image being processed. References the incoming frame (no copy), or
+   *  `normalized_img_` if `normalize_` is set. Released after each update. */
   cv::Mat img_;
+  /** Buffer holding the normalized image, re-used across frames. */
+  cv::Mat normalized_img_;
 
   /** Last computed LK pyramid */
   std::vector<cv::Mat> pyramid_;
+  /** Number of levels (excluding the full resolution one) in `pyramid_` */
+  int pyramid_levels_;
 
   /** Number of rows in the input image. */
   int rows_;
@@ -103,6 +140,18 @@ private:
   int max_iter_;
   number_t eps_;
 
+  /** If set, each feature is tracked starting at the coarsest pyramid level
+   *  needed to cover the uncertainty of its predicted location, and only the
+   *  levels needed in the current frame are built. */
+  bool adaptive_klt_;
+  /** Search radius = `klt_sigma_multiplier_` x the largest standard deviation
+   *  of the predicted location + `klt_displacement_ratio_` x the predicted
+   *  displacement. */
+  number_t klt_sigma_multiplier_;
+  number_t klt_displacement_ratio_;
+  /** Smallest window used for features tracked at full resolution only. */
+  int min_win_size_;
+
   // feature detector params
   int num_features_min_;
   int num_features_max_;
@@ -112,19 +161,61 @@ private:
   cv::Ptr<cv::BFMatcher> matcher_;
 
 private:
+  /** Points `img_` to the incoming frame, normalizing it if needed. */
+  void SetImage(const cv::Mat &image);
+
+  /** Rescued tracks are checked against `model` (`H` if a homography)
+   *  unless it is NONE. */
   void DetectLK(const cv::Mat &img, int num_to_add,
                 std::vector<FeaturePtr> newly_dropped_tracks,
-                bool check_homography, cv::Mat H);
-
-  /** An interface to OpenCV's `findHomography` that checks for outliers. */
-  bool OutlierRejection(const std::vector<cv::Point2f> pts0,
-                        const std::vector<cv::Point2f> pts1,
-                        std::vector<uint8_t>& match_status,
-                        cv::Mat& H);
+                TwoViewModel model, cv::Mat H);
+
+  /** Search radius in pixels around the predicted location of a feature given
+   *  the covariance of the prediction and the predicted displacement. */
+  number_t SearchRadius(const Mat2 &cov, number_t displacement) const;
+  /** Coarsest pyramid level needed to find a feature within `radius` pixels
+   *  of its predicted location. */
+  int KLTLevel(number_t radius) const;
+  /** Runs LK once per group of features sharing the same pyramid level. */
+  void AdaptiveLK(const std::vector<cv::Mat> &pyramid,
+                  const std::vector<cv::Point2f> &pts0,
+                  std::vector<cv::Point2f> &pts1,
+                  const std::vector<int> &levels,
+                  const std::vector<number_t> &radii,
+                  const cv::TermCriteria &criteria,
+                  std::vector<uint8_t> &status);
+
+  /** An interface to OpenCV's `findHomography` that checks for outliers. If
+   *  the two-point method is selected and a rotation prior is available,
+   *  `TwoPointOutlierRejection` is used instead and `H` is left empty.
+   *  Returns the model estimated, NONE on failure. */
+  TwoViewModel OutlierRejection(const std::vector<cv::Point2f> pts0,
+                                const std::vector<cv::Point2f> pts1,
+                                std::vector<uint8_t>& match_status,
+                                cv::Mat& H);
+
+  /** Rotation-aided two-point essential matrix RANSAC on the matches not
+   *  yet rejected. `idx_map` maps indices of `match_status` to indices of
+   *  `pts0_valid` and `pts1_valid`. */
+  TwoViewModel TwoPointOutlierRejection(
+      const std::vector<cv::Point2f> &pts0_valid,
+      const std::vector<cv::Point2f> &pts1_valid,
+      const std::vector<int> &idx_map,
+      std::vector<uint8_t> &match_status);
+
+  /** Checks a match against the epipolar geometry found by
+   *  `TwoPointOutlierRejection`. */
+  bool CheckEssential(cv::Point2f p0, cv::Point2f p1) const;
 };
 
 // helpers
 
+/** Adds levels `levels+1` to `target` to an LK pyramid (with derivatives) that
+ *  currently has `levels` levels above full resolution. Returns the new number
+ *  of levels, which can be smaller than `target` for small images. */
+int ExtendPyramid(std::vector<cv::Mat> &pyramid, int levels, int target,
+                  cv::Size win_size);
+
 /** Called right before detecting a set of features on a new image. Makes all of
  *  `mask_` white. */
 void ResetMask(cv::Mat mask);
@@ -17,6 +17,7 @@
 #include "group.h"
 #include "tracker.h"
 #include "graph.h"
+#include "trace.h"
 
 namespace xivo {
 
@@ -29,12 +30,12 @@ void Estimator::Update(std::vector<GroupPtr>& needs_new_gauge_features) {
   if (instate_features_.empty() && oos_features_.empty())
     return;
 
-  timer_.Tick("update");
+  XIVO_PROFILE_SCOPE(profiler_, "update");
   std::vector<FeaturePtr> inliers; // individually compatible matches
   std::vector<number_t> dist,
       inlier_dist; // MH distance of features & inlier features
 
-  timer_.Tick("jacobian");
+  profiler_.Begin(XIVO_PROFILE_ID("jacobian"));
   for (auto f : instate_features_) {
     f->ComputeJacobian(X_.Rsb, X_.Tsb, X_.Rbc, X_.Tbc, last_gyro_, imu_.Cg(),
                        X_.bg, X_.Vsb, X_.td, err_);
@@ -48,9 +49,9 @@ void Estimator::Update(std::vector<GroupPtr>& needs_new_gauge_features) {
     number_t mh_dist = res.dot(S.llt().solve(res));
     dist.push_back(mh_dist);
   }
-  timer_.Tock("jacobian");
+  profiler_.End();
 
-  timer_.Tick("MH-gating");
+  profiler_.Begin(XIVO_PROFILE_ID("MH-gating"));
 
   int num_mh_rejected = 0;
   if (use_MH_gating_ && instate_features_.size() > min_required_inliers_) {
@@ -64,6 +65,8 @@ void Estimator::Update(std::vector<GroupPtr>& needs_new_gauge_features) {
         }
       }
       inliers.clear();
+      // only the pass with the final threshold counts
+      num_mh_rejected = 0;
       // mark inliers
       for (int i = 0; i < instate_features_.size(); ++i) {
         auto f = instate_features_[i];
@@ -73,10 +76,10 @@ void Estimator::Update(std::vector<GroupPtr>& needs_new_gauge_features) {
           num_mh_rejected++;
           if (f->status() == FeatureStatus::GAUGE) {
             needs_new_gauge_features.push_back(f->ref());
-            LOG(INFO) << "Group # " << f->ref()->id() << " just lost a gauge feature rejected by MH-gating";
+            XIVO_TRACE_FEATURE("update/mh-lost-gauge", f->id(), f->ref()->id());
           }
           f->SetStatus(FeatureStatus::REJECTED_BY_FILTER);
-          LOG(INFO) << "feature #" << f->id() << " rejected by MH-gating";
+          XIVO_TRACE_FEATURE("update/mh-reject", f->id(), 0, dist[i]);
         }
       }
       // relax the threshold
@@ -87,9 +90,10 @@ void Estimator::Update(std::vector<GroupPtr>& needs_new_gauge_features) {
     std::copy(instate_features_.begin(), instate_features_.end(),
               inliers.begin());
   }
-  timer_.Tock("MH-gating");
+  profiler_.End();
 
   LOG(INFO) << "MH rejected " << num_mh_rejected << " features";
+  telemetry_.num_mh_rejected += num_mh_rejected;
 
   if (use_1pt_RANSAC_) {
     inliers = OnePointRANSAC(inliers, needs_new_gauge_features);
@@ -128,6 +132,9 @@ void Estimator::Update(std::vector<GroupPtr>& needs_new_gauge_features) {
   }
 
   int total_size = 2 * inliers.size() + total_oos_jac_size;
+  telemetry_.num_oos_features += active_oos_features.size();
+  telemetry_.num_oos_rows += total_oos_jac_size;
+  telemetry_.num_update_rows += total_size;
   H_.setZero(total_size, err_.size());
   inn_.setZero(total_size);
   diagR_.resize(total_size);
@@ -169,14 +176,14 @@ void Estimator::Update(std::vector<GroupPtr>& needs_new_gauge_features) {
       diagR_ = diagR_.head(rows); // FIXME: this does not seem right
     }
   }
+  telemetry_.num_compressed_rows += H_.rows();
 
-  timer_.Tick("actual-update");
+  profiler_.Begin(XIVO_PROFILE_ID("actual-update"));
   UpdateJosephForm();
-  timer_.Tock("actual-update");
+  profiler_.End();
 
   // absorb error
   AbsorbError();
-  timer_.Tock("update");
 
   LOG(INFO) << "Error state absorbed";
 
@@ -188,11 +195,32 @@ void Estimator::Update(std::vector<GroupPtr>& needs_new_gauge_features) {
 
 void Estimator::CloseLoop() {
 #ifdef USE_MAPPER
+  auto mapper = Mapper::instance();
   std::vector<FeaturePtr> instate_features =
     Graph::instance()->GetInstateFeatures();
+
+  if (mapper->AsyncLoopClosure()) {
+    // Loop closures found by the loop closure thread since the last frame are
+    // applied as a measurement now ...
+    LCResult result;
+    if (mapper->PollLoopClosures(result)) {
+      std::vector<LCMatch> matches = mapper->ResolveLoopClosures(result);
+      // some matches might be gone, re-apply the threshold of the mapper
+      if (matches.size() > 4) {
+        CloseLoopInternal(Graph::instance()->GetGroup(result.gid), matches);
+      }
+    }
+    // ... and the search for the current frame is queued.
+    if (instate_features.size() > 0) {
+      mapper->SubmitLoopClosureQuery(MakeLCQuery(
+        instate_features, Graph::instance()->LastAddedGroup()->id()));
+    }
+    return;
+  }
+
   std::vector<LCMatch> matches;
   if (instate_features.size() > 0) {
-    matches = Mapper::instance()->DetectLoopClosures(instate_features, gbc());
+    matches = mapper->DetectLoopClosures(instate_features, gbc());
   }
 
   if (matches.size() > 0) {
@@ -278,8 +306,9 @@ Estimator::OnePointRANSAC(const std::vector<FeaturePtr> &mh_inliers,
     ++selected_counter;
 
     inliers.clear();
+    Feature::PredictBatch(mh_inliers, gsb(), gbc());
     for (auto f : mh_inliers) {
-      auto res = f->xp() - f->Predict(gsb(), gbc());
+      auto res = f->xp() - f->pred();
       if (res.norm() < ransac_thresh_) {
         inliers.insert(f);
       }
@@ -294,6 +323,7 @@ Estimator::OnePointRANSAC(const std::vector<FeaturePtr> &mh_inliers,
                              n_hyp, max_inliers.size(), mh_inliers.size());
 
   LOG(INFO) << str;
+  telemetry_.num_ransac_hypotheses += selected_counter;
 
   // If everything is a low-innovation inlier, we don't need to do anything more.
   if (max_inliers.size() == mh_inliers.size()) {
@@ -388,10 +418,11 @@ Estimator::OnePointRANSAC(const std::vector<FeaturePtr> &mh_inliers,
         } else {
           if (f->status() == FeatureStatus::GAUGE) {
             needs_new_gauge_features.push_back(f->ref());
-            LOG(INFO) << "Group # " << f->ref()->id() << " just lost a guage feature rejected by one-pt ransac";
+            XIVO_TRACE_FEATURE("update/ransac-lost-gauge", f->id(), f->ref()->id());
           }
           f->SetStatus(FeatureStatus::REJECTED_BY_FILTER);
-          LOG(INFO) << "feature #" << f->id() << " rejected by one-pt ransac";
+          ++telemetry_.num_ransac_rejected;
+          XIVO_TRACE_FEATURE("update/ransac-reject", f->id());
         }
       }
     }
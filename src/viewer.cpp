@@ -111,8 +111,7 @@ void Viewer::Update(const cv::Mat &image) {
   if (image.empty())
     return;
 
-  image_ = image.clone();
-  cv::cvtColor(image_, image_, CV_RGB2BGR);
+  cv::cvtColor(image, image_, CV_RGB2BGR);
   cv::flip(image_, image_, 0);
 
   int rows(image_.rows);
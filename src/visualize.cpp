@@ -6,14 +6,15 @@
 #include "opencv2/opencv.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
 
+#include "context.h"
 #include "feature.h"
+#include "frame_pool.h"
 #include "visualize.h"
 #include "param.h"
+#include "process.h"
 
 namespace xivo {
 
-std::unique_ptr<Canvas> Canvas::instance_ = nullptr;
-
 // BGR
 static cv::Scalar kColorPink(203, 192, 255);
 static cv::Scalar kColorCyan(255, 192, 203);
@@ -27,36 +28,77 @@ static cv::Scalar kColorBlack(0, 0, 0);
 
 
 
+/** Draws the frames submitted to the canvas on its own thread. */
+class CanvasRenderer : public Process<RenderRecord> {
+public:
+  CanvasRenderer(Canvas *canvas, OverflowPolicy policy)
+      : Process{Canvas::kRenderQueueSize, policy}, canvas_{canvas},
+        context_{EstimatorContext::current()} {
+    Start();
+  }
+  ~CanvasRenderer() { Stop(); }
+
+private:
+  bool Handle(RenderRecord *record) override {
+    // rendering acquires from the frame pool of the canvas' system
+    EstimatorContext::Scope scope{context_};
+    canvas_->Render(*record);
+    return true;
+  }
+  Canvas *canvas_;
+  EstimatorContext *context_;
+};
+
+
 Canvas::Canvas() {
-  save_frames_ =
-    ParameterServer::instance()->get("save_frames", false).asBool();
+  auto cfg = ParameterServer::instance();
+  use_debug_view_ = cfg->get("use_debug_view", false).asBool();
+  draw_OOS_ = cfg->get("draw_OOS", true).asBool();
+  print_bias_info_ = cfg->get("print_bias_info", false).asBool();
 
+  save_frames_ = cfg->get("save_frames", false).asBool();
   if (save_frames_) {
-    save_folder_ =
-      ParameterServer::instance()->get("save_folder", "xivo_frames").asString();
+    save_folder_ = cfg->get("save_folder", "xivo_frames").asString();
     frame_number_ = 0;
 
     if (!std::filesystem::exists(save_folder_)) {
       std::filesystem::create_directory(save_folder_);
     }
   }
+
+  if (cfg->get("render_thread", true).asBool()) {
+    // a slow renderer drops frames, unless they are all saved
+    renderer_ = std::make_unique<CanvasRenderer>(
+        this, save_frames_ ? OverflowPolicy::BLOCK
+                           : OverflowPolicy::DROP_OLDEST);
+  }
+}
+
+Canvas::~Canvas() {
+  // the renderer draws on this canvas
+  renderer_.reset();
 }
 
 
 CanvasPtr Canvas::instance() {
-  if (instance_ == nullptr) {
-    instance_ = std::unique_ptr<Canvas>(new Canvas());
+  auto &instance = EstimatorContext::current()->canvas_;
+  if (instance == nullptr) {
+    instance = std::unique_ptr<Canvas>(new Canvas());
   }
-  return instance_.get();
+  return instance.get();
 }
 
-const void Canvas::SaveFrame() {
+void Canvas::Delete() {
+  EstimatorContext::current()->canvas_.reset();
+}
+
+void Canvas::SaveFrame(const cv::Mat &disp) {
   if (save_frames_) {
     std::filesystem::path folder = save_folder_;
     std::filesystem::path filename = folder /=
       ("frame_" + std::to_string(frame_number_) + ".png");
     try {
-      cv::imwrite(filename.string(), disp_);
+      cv::imwrite(filename.string(), disp);
     }
     catch (const cv::Exception& ex) {
       fprintf(stderr, "Exception converting image to PNG format :%s\n",
@@ -66,191 +108,252 @@ const void Canvas::SaveFrame() {
   }
 }
 
-void Canvas::Update(const cv::Mat &img) {
+void Canvas::Update(const cv::Mat &img, const timestamp_t &ts) {
   if (img.empty()) {
     return;
   }
-  if (img.channels() == 1) {
-    cv::cvtColor(img, disp_, CV_GRAY2RGB);
-  } else {
-    img.copyTo(disp_);
-  }
+  pending_ = std::make_unique<RenderRecord>();
+  pending_->ts = ts;
+  pending_->image = img;
+  pending_->has_state = false;
 }
 
 
-void Canvas::UpdatePointCloud(const MatX2 &px) {
+void Canvas::UpdatePointCloud(const MatX2 &px, const timestamp_t &ts) {
   if (px.size() == 0) {
     return;
   }
+  pending_ = std::make_unique<RenderRecord>();
+  pending_->ts = ts;
+  pending_->point_cloud = px;
+  pending_->has_state = false;
+}
 
-  int nrows = CameraManager::instance()->rows();
-  int ncols = CameraManager::instance()->cols();
-  cv::Mat point_cloud_image(nrows, ncols, CV_8UC3, kColorBlack);
 
-  for (int i = 0; i < px.rows(); i++) {
-    cv::Point2d pt(px(i,0), px(i,1));
-    cv::circle(point_cloud_image, pt, 2, kColorWhite);
+void Canvas::Draw(const FeaturePtr f) {
+  if (!pending_) {
+    return;
   }
-
-  point_cloud_image.copyTo(disp_);
+  RenderFeature rf;
+  Vec2 pos(f->xp());
+  Vec2 last_pos(f->front());
+  for (auto p : *f) {
+    if (p != f->xp()) {
+      last_pos = p;
+    } else
+      break;
+  }
+  rf.xp = cv::Point2d(pos[0], pos[1]);
+  rf.last_xp = cv::Point2d(last_pos[0], last_pos[1]);
+  rf.track_status = f->track_status();
+  rf.status = f->status();
+  rf.instate = f->instate();
+  pending_->features.push_back(rf);
 }
 
+void Canvas::OverlayStateInfo(const State &X, const IMUState &IMU,
+                              const Vec9 &Cam) {
+  if (!pending_) {
+    return;
+  }
+  pending_->has_state = true;
+  pending_->X = X;
+  pending_->IMU = IMU;
+  pending_->Cam = Cam;
+}
 
-void Canvas::Draw(const FeaturePtr f) {
-  if (disp_.empty()) {
+void Canvas::Submit() {
+  if (!pending_) {
     return;
   }
+  if (renderer_) {
+    renderer_->Enqueue(std::move(pending_));
+  } else {
+    Render(*pending_);
+    pending_.reset();
+  }
+}
 
-  bool use_debug_view{ParameterServer::instance()->get("use_debug_view", false).asBool()};
-  bool draw_OOS{ParameterServer::instance()->get("draw_OOS", true).asBool()};
+void Canvas::Flush() {
+  if (renderer_) {
+    renderer_->Wait();
+  }
+}
 
-  auto pos(f->xp());
-  cv::Scalar color;
-  if (f->track_status() == TrackStatus::TRACKED
-      && (f->instate() || draw_OOS) ) {
+cv::Mat Canvas::display() const {
+  std::scoped_lock lck(mtx_);
+  return disp_;
+}
 
-    Vec2 last_pos(f->front());
-    for (auto pos : *f) {
-      if (pos != f->xp()) {
-        last_pos = pos;
-      } else
-        break;
+void Canvas::Render(const RenderRecord &record) {
+  // Draw on a fresh pooled buffer instead of the incoming frame, which must
+  // stay pristine, and instead of the previous display image, which may still
+  // be referenced by a publisher.
+  cv::Mat disp;
+  if (!record.image.empty()) {
+    const cv::Mat &img = record.image;
+    disp = FramePool::instance()->Acquire(
+        img.rows, img.cols, img.channels() == 1 ? CV_8UC3 : img.type());
+    if (img.channels() == 1) {
+      cv::cvtColor(img, disp, CV_GRAY2RGB);
+    } else {
+      img.copyTo(disp);
+    }
+  } else if (record.point_cloud.size() > 0) {
+    int nrows = CameraManager::instance()->rows();
+    int ncols = CameraManager::instance()->cols();
+    disp = FramePool::instance()->Acquire(nrows, ncols, CV_8UC3);
+    disp.setTo(kColorBlack);
+
+    const MatX2 &px = record.point_cloud;
+    for (int i = 0; i < px.rows(); i++) {
+      cv::Point2d pt(px(i,0), px(i,1));
+      cv::circle(disp, pt, 2, kColorWhite);
     }
+  } else {
+    return;
+  }
 
+  for (const auto &f : record.features) {
+    Draw(disp, f);
+  }
+  if (record.has_state) {
+    OverlayStateInfo(disp, record.X, record.IMU, record.Cam);
+  }
+  SaveFrame(disp);
+
+  std::scoped_lock lck(mtx_);
+  disp_ = disp;
+}
+
+
+void Canvas::Draw(cv::Mat &disp, const RenderFeature &f) const {
+  const cv::Point2d &pos = f.xp;
+  if (f.track_status == TrackStatus::TRACKED && (f.instate || draw_OOS_)) {
     // draw the trace
-    cv::line(disp_, cv::Point2d(pos[0], pos[1]),
-             cv::Point2d(last_pos[0], last_pos[1]), kColorYellow, 1);
+    cv::line(disp, pos, f.last_xp, kColorYellow, 1);
 
-    if (f->instate()) {
-      cv::drawMarker(disp_, cv::Point2d(pos[0], pos[1]), kColorGreen,
-                     cv::MARKER_CROSS, 10, 2);
+    if (f.instate) {
+      cv::drawMarker(disp, pos, kColorGreen, cv::MARKER_CROSS, 10, 2);
     } else {
-      cv::circle(disp_, cv::Point2d(pos[0], pos[1]), 2, kColorRed, -1);
+      cv::circle(disp, pos, 2, kColorRed, -1);
     }
-  } else if (f->track_status() == TrackStatus::REJECTED ||
-             f->track_status() == TrackStatus::DROPPED) {
+  } else if (f.track_status == TrackStatus::REJECTED ||
+             f.track_status == TrackStatus::DROPPED) {
 
-    if (use_debug_view) {
-      cv::drawMarker(disp_, cv::Point2d(pos[0], pos[1]), kColorPink,
-          cv::MARKER_TRIANGLE_UP, 20, 5);
+    if (use_debug_view_) {
+      cv::drawMarker(disp, pos, kColorPink, cv::MARKER_TRIANGLE_UP, 20, 5);
     }
 
-  } else if (f->track_status() == TrackStatus::CREATED) {
-    cv::circle(disp_, cv::Point2d(pos[0], pos[1]), 3, kColorYellow, -1);
+  } else if (f.track_status == TrackStatus::CREATED) {
+    cv::circle(disp, pos, 3, kColorYellow, -1);
   } else {
     // LOG(WARNING) << "Feature status NOT recognized.";
   }
 
-  if (use_debug_view) {
+  if (use_debug_view_) {
     // overwrite rejected features
-    // if (f->status() == FeatureStatus::REJECTED_BY_TRACKER) {
-    //   cv::drawMarker(disp_, cv::Point2d(pos[0], pos[1]), kColorPink,
-    //   cv::MARKER_TRIANGLE_UP, 20, 5);
+    // if (f.status == FeatureStatus::REJECTED_BY_TRACKER) {
+    //   cv::drawMarker(disp, pos, kColorPink, cv::MARKER_TRIANGLE_UP, 20, 5);
     // } else
 
-    if (f->status() == FeatureStatus::REJECTED_BY_FILTER) {
-      cv::drawMarker(disp_, cv::Point2d(pos[0], pos[1]), kColorCyan,
-          cv::MARKER_DIAMOND, 20, 5);
+    if (f.status == FeatureStatus::REJECTED_BY_FILTER) {
+      cv::drawMarker(disp, pos, kColorCyan, cv::MARKER_DIAMOND, 20, 5);
     }
   }
 }
 
-void Canvas::OverlayStateInfo(const State &X, const IMUState &IMU,
-                              const Vec9 &Cam, int vspace, int hspace,
-                              int thickness, double font_scale) {
-  if (disp_.empty()) {
-    return;
-  }
-
-  bool print_bias_info{ParameterServer::instance()->get("print_bias_info", false).asBool()};
-
+void Canvas::OverlayStateInfo(cv::Mat &disp, const State &X,
+                              const IMUState &IMU, const Vec9 &Cam, int vspace,
+                              int hspace, int thickness,
+                              double font_scale) const {
   int line_counter{0};
 
-  cv::putText(disp_, StrFormat("Tsb=[%0.4f, %0.4f, %0.4f]", X.Tsb(0),
+  cv::putText(disp, StrFormat("Tsb=[%0.4f, %0.4f, %0.4f]", X.Tsb(0),
                                      X.Tsb(1), X.Tsb(2)),
               cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
               kColorLakeBlue, thickness);
 
-  cv::putText(disp_, StrFormat("Vsb=[%0.4f, %0.4f, %0.4f]", X.Vsb(0),
+  cv::putText(disp, StrFormat("Vsb=[%0.4f, %0.4f, %0.4f]", X.Vsb(0),
                                      X.Vsb(1), X.Vsb(2)),
               cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
               kColorLakeBlue, thickness);
 
   auto Wsb{X.Rsb.log()};
-  cv::putText(disp_, StrFormat("Wsb=[%0.4f, %0.4f, %0.4f]", Wsb(0),
+  cv::putText(disp, StrFormat("Wsb=[%0.4f, %0.4f, %0.4f]", Wsb(0),
                                      Wsb(1), Wsb(2)),
               cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
               kColorLakeBlue, thickness);
 
-  cv::putText(disp_, StrFormat("Tbc=[%0.4f, %0.4f, %0.4f]", X.Tbc(0),
+  cv::putText(disp, StrFormat("Tbc=[%0.4f, %0.4f, %0.4f]", X.Tbc(0),
                                      X.Tbc(1), X.Tbc(2)),
               cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
               kColorLakeBlue, thickness);
 
   auto Wbc{X.Rbc.log()};
-  cv::putText(disp_, StrFormat("Wbc=[%0.4f, %0.4f, %0.4f]", Wbc(0),
+  cv::putText(disp, StrFormat("Wbc=[%0.4f, %0.4f, %0.4f]", Wbc(0),
                                      Wbc(1), Wbc(2)),
               cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
               kColorLakeBlue, thickness);
 
   auto Wsg{X.Rsg.log()};
-  cv::putText(disp_, StrFormat("Wsg=[%0.4f, %0.4f, %0.4f]", Wsg(0),
+  cv::putText(disp, StrFormat("Wsg=[%0.4f, %0.4f, %0.4f]", Wsg(0),
                                       Wsg(1), Wsg(2)),
               cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
               kColorLakeBlue, thickness);
 
-  if (print_bias_info) {
-    cv::putText(disp_, StrFormat("bg=[%0.4f, %0.4f, %0.4f]", X.bg(0),
+  if (print_bias_info_) {
+    cv::putText(disp, StrFormat("bg=[%0.4f, %0.4f, %0.4f]", X.bg(0),
           X.bg(1), X.bg(2)),
         cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
         kColorLakeBlue, thickness);
 
-    cv::putText(disp_, StrFormat("ba=[%0.4f, %0.4f, %0.4f]", X.ba(0),
+    cv::putText(disp, StrFormat("ba=[%0.4f, %0.4f, %0.4f]", X.ba(0),
           X.ba(1), X.ba(2)),
         cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
         kColorLakeBlue, thickness);
   }
 
-  cv::putText(disp_, StrFormat("td=%0.4f", X.td),
+  cv::putText(disp, StrFormat("td=%0.4f", X.td),
       cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
       kColorLakeBlue, thickness);
 
-  cv::putText(disp_, StrFormat("Ca=[[%0.4f, %0.4f, %0.4f]", IMU.Ca(0,0),
+  cv::putText(disp, StrFormat("Ca=[[%0.4f, %0.4f, %0.4f]", IMU.Ca(0,0),
                                IMU.Ca(0,1), IMU.Ca(0,2)),
       cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
       kColorLakeBlue, thickness);
 
-  cv::putText(disp_, StrFormat("    [%0.4f, %0.4f, %0.4f]", IMU.Ca(1,0),
+  cv::putText(disp, StrFormat("    [%0.4f, %0.4f, %0.4f]", IMU.Ca(1,0),
                                IMU.Ca(1,1), IMU.Ca(1,2)),
       cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
       kColorLakeBlue, thickness);
 
-  cv::putText(disp_, StrFormat("    [%0.4f, %0.4f, %0.4f]]", IMU.Ca(2,0),
+  cv::putText(disp, StrFormat("    [%0.4f, %0.4f, %0.4f]]", IMU.Ca(2,0),
                                IMU.Ca(2,1), IMU.Ca(2,2)),
       cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
       kColorLakeBlue, thickness);
 
-  cv::putText(disp_, StrFormat("Cg=[[%0.4f, %0.4f, %0.4f]", IMU.Cg(0,0),
+  cv::putText(disp, StrFormat("Cg=[[%0.4f, %0.4f, %0.4f]", IMU.Cg(0,0),
                                IMU.Cg(0,1), IMU.Cg(0,2)),
       cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
       kColorLakeBlue, thickness);
 
-  cv::putText(disp_, StrFormat("    [%0.4f, %0.4f, %0.4f]", IMU.Cg(1,0),
+  cv::putText(disp, StrFormat("    [%0.4f, %0.4f, %0.4f]", IMU.Cg(1,0),
                                IMU.Cg(1,1), IMU.Cg(1,2)),
       cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
       kColorLakeBlue, thickness);
 
-  cv::putText(disp_, StrFormat("    [%0.4f, %0.4f, %0.4f]]", IMU.Cg(2,0),
+  cv::putText(disp, StrFormat("    [%0.4f, %0.4f, %0.4f]]", IMU.Cg(2,0),
                                IMU.Cg(2,1), IMU.Cg(2,2)),
       cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
       kColorLakeBlue, thickness);
 
-  cv::putText(disp_, StrFormat("Cam=[[%0.4f, %0.4f, %0.4f, %0.4f]",
+  cv::putText(disp, StrFormat("Cam=[[%0.4f, %0.4f, %0.4f, %0.4f]",
                                Cam(0), Cam(1), Cam(2), Cam(3)),
       cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
       kColorLakeBlue, thickness);
 
-  cv::putText(disp_, StrFormat("Cam=[[%0.4f, %0.4f, %0.4f, %0.4f, %0.4f]",
+  cv::putText(disp, StrFormat("Cam=[[%0.4f, %0.4f, %0.4f, %0.4f, %0.4f]",
                                Cam(4), Cam(5), Cam(6), Cam(7), Cam(8)),
       cv::Point(hspace, vspace * ++line_counter), CV_FONT_HERSHEY_PLAIN, font_scale,
       kColorLakeBlue, thickness);
@@ -4,6 +4,9 @@
 #pragma once
 #include <filesystem>
 #include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include "opencv2/core/core.hpp"
 
@@ -14,29 +17,84 @@ namespace xivo {
 
 class Canvas;
 using CanvasPtr = Canvas *;
+class CanvasRenderer;
 
+/** What is drawn of one feature, copied out of the feature so that drawing
+ * does not touch estimator data. */
+struct RenderFeature {
+  cv::Point2d xp, last_xp;  // current position and the one before on the track
+  TrackStatus track_status;
+  FeatureStatus status;
+  bool instate;
+};
+
+/** Everything drawn for one frame. */
+struct RenderRecord {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  timestamp_t ts;
+  cv::Mat image;      // input image (shallow, never drawn on) ...
+  MatX2 point_cloud;  // ... or the simulated point cloud
+  std::vector<RenderFeature> features;
+  bool has_state;
+  State X;
+  IMUState IMU;
+  Vec9 Cam;
+};
+
+/** The estimator thread only records what to draw: `Update` (or
+ * `UpdatePointCloud`) starts the record of a frame, `Draw` and
+ * `OverlayStateInfo` add to it, and `Submit` hands it to the renderer thread,
+ * which draws the display image and saves it if "save_frames" is set. With
+ * "render_thread": false, `Submit` renders in the calling thread instead. */
 class Canvas {
 public:
   static CanvasPtr instance();
+  ~Canvas();
 
   static void Delete();
-  void Update(const cv::Mat &img);
-  void UpdatePointCloud(const MatX2 &px);
+  void Update(const cv::Mat &img, const timestamp_t &ts = timestamp_t{0});
+  void UpdatePointCloud(const MatX2 &px,
+                        const timestamp_t &ts = timestamp_t{0});
   void Draw(const FeaturePtr f);
-  void OverlayStateInfo(const State &X, const IMUState &IMU, const Vec9 &Cam,
-                        int vspace = 12, int hspace = 12,
-                        int thickness = 1, double font_scale = 0.9);
-  const cv::Mat &display() const { return disp_; }
-  const void SaveFrame();
+  void OverlayStateInfo(const State &X, const IMUState &IMU, const Vec9 &Cam);
+  void Submit();
+  /** Block until every submitted frame is drawn. */
+  void Flush();
+
+  /** Capacity of the queue of the renderer thread. */
+  static constexpr int kRenderQueueSize = 8;
+  /** Most input images the canvas references at once: those queued for the
+   *  renderer, as many set aside when the queue overflows, the one being
+   *  drawn and the one being recorded. */
+  static constexpr int kMaxInputImages = 2 * (kRenderQueueSize - 1) + 2;
+  /** Most display images at once: the latest, the one being drawn, and one
+   *  still held by a publisher. */
+  static constexpr int kMaxDisplayImages = 3;
+
+  /** The most recently drawn image; never drawn on again. */
+  cv::Mat display() const;
+  /** Draw the frame, in whatever thread calls it. */
+  void Render(const RenderRecord &record);
 
 private:
   Canvas(const Canvas &) = delete;
   Canvas &operator=(const Canvas &) = delete;
   Canvas();
-  static std::unique_ptr<Canvas> instance_;
 
+  void Draw(cv::Mat &disp, const RenderFeature &f) const;
+  void OverlayStateInfo(cv::Mat &disp, const State &X, const IMUState &IMU,
+                        const Vec9 &Cam, int vspace = 12, int hspace = 12,
+                        int thickness = 1, double font_scale = 0.9) const;
+  void SaveFrame(const cv::Mat &disp);
+
+  std::unique_ptr<RenderRecord> pending_;  // frame being recorded
+  std::unique_ptr<CanvasRenderer> renderer_;
+
+  mutable std::mutex mtx_;  // guards disp_
   cv::Mat disp_;
 
+  bool use_debug_view_, draw_OOS_, print_bias_info_;
+
   // Parameters for saving each file
   bool save_frames_;
   std::filesystem::path save_folder_;
@@ -0,0 +1,251 @@
+#include <chrono>
+#include <iostream>
+
+// 3rdparty
+#include "glog/logging.h"
+
+// xivo
+#include "context.h"
+#include "optimizer.h"
+#include "window_optimizer.h"
+#include "utils.h"
+
+namespace xivo {
+
+WindowOptimizerPtr WindowOptimizer::Create(const Json::Value &cfg) {
+  auto &instance = EstimatorContext::current()->window_optimizer_;
+  if (instance) {
+    LOG(WARNING) <<
+      "WindowOptimizer instance already created! Returning existing one ...";
+  } else {
+    instance = std::shared_ptr<WindowOptimizer>(new WindowOptimizer(cfg));
+  }
+  return instance.get();
+}
+
+WindowOptimizerPtr WindowOptimizer::instance() {
+  auto &instance = EstimatorContext::current()->window_optimizer_;
+  CHECK(instance != nullptr);
+  return instance.get();
+}
+
+WindowOptimizer::~WindowOptimizer() {
+  if (worker_.joinable()) {
+    {
+      std::scoped_lock lck(mtx_);
+      quit_ = true;
+    }
+    cv_.notify_one();
+    worker_.join();
+  }
+}
+
+WindowOptimizer::WindowOptimizer(const Json::Value &cfg)
+  : profiler_{"window-ba"}, rounds_{0}, stop_{false}, quit_{false}
+{
+  enabled_ = cfg.get("enabled", false).asBool();
+  verbose_ = cfg.get("verbose", false).asBool();
+  solver_type_ = cfg.get("solver", "csparse").asString();
+  use_robust_kernel_ = cfg.get("use_robust_kernel", true).asBool();
+  window_size_ = cfg.get("window_size", 10).asInt();
+  period_ = cfg.get("period", 5).asInt();
+  max_iters_ = cfg.get("max_iters", 5).asInt();
+  time_budget_ms_ = cfg.get("time_budget_ms", 10.0).asDouble();
+  prior_weight_ = cfg.get("prior_weight", 1.0).asDouble();
+  profiler_.set_budget_ms(time_budget_ms_);
+
+  if (window_size_ < 2) {
+    throw std::invalid_argument("window_size of the window optimizer must be at least 2");
+  }
+  if (period_ < 1) {
+    throw std::invalid_argument("period of the window optimizer must be positive");
+  }
+
+  if (enabled_) {
+    worker_ = std::thread([this, context = EstimatorContext::current()]() {
+      EstimatorContext::Scope scope{context};
+      Run();
+    });
+  }
+}
+
+
+void WindowOptimizer::Submit(WindowProblem problem) {
+  {
+    std::scoped_lock lck(mtx_);
+    problem_ = std::move(problem);
+  }
+  cv_.notify_one();
+}
+
+
+std::optional<WindowResult> WindowOptimizer::Poll() {
+  std::scoped_lock lck(mtx_);
+  std::optional<WindowResult> result;
+  std::swap(result, result_);
+  return result;
+}
+
+
+void WindowOptimizer::Run() {
+  while (true) {
+    WindowProblem problem;
+    {
+      std::unique_lock lck(mtx_);
+      cv_.wait(lck, [this]() { return quit_ || problem_.has_value(); });
+      if (quit_) break;
+      problem = std::move(*problem_);
+      problem_.reset();
+    }
+
+    WindowResult result = Solve(problem);
+    Publish(result, problem.gbc);
+
+    std::scoped_lock lck(mtx_);
+    result_ = std::move(result);
+  }
+}
+
+
+void WindowOptimizer::Publish(const WindowResult &result, const SE3 &gbc) {
+  SE3 gcb = gbc.inv();
+  std::unordered_map<int, SE3> poses;
+  for (const auto &g : result.groups) {
+    poses[g.id] = g.gsb * gcb;
+  }
+  refined_poses_.Publish(std::move(poses));
+}
+
+
+WindowResult WindowOptimizer::Solve(const WindowProblem &problem) {
+  auto start = std::chrono::steady_clock::now();
+  XIVO_PROFILE_FRAME(profiler_, "window-ba");
+
+  g2o::SparseOptimizer optimizer;
+  optimizer.setAlgorithm(CreateAlgorithm(solver_type_));
+  TimeBudget budget{&stop_, &quit_};
+  optimizer.setForceStopFlag(&stop_);
+  optimizer.addPostIterationAction(&budget);
+
+  // vertices, initialized from the previous refinement where available
+  std::unordered_map<int, GroupVertex*> gvertices;
+  for (const auto &g : problem.groups) {
+    auto gv = new GroupVertex();
+    gv->setId(g.id);
+    auto it = refined_groups_.find(g.id);
+    gv->setEstimate(it != refined_groups_.end() ? it->second : g.gsb);
+    gvertices[g.id] = gv;
+    optimizer.addVertex(gv);
+  }
+  std::unordered_map<int, FeatureVertex*> fvertices;
+  for (const auto &f : problem.features) {
+    auto fv = new FeatureVertex();
+    fv->setId(f.id);
+    fv->setMarginalized(true);
+    auto it = refined_features_.find(f.id);
+    fv->setEstimate(it != refined_features_.end() ? it->second : f.Xs);
+    fvertices[f.id] = fv;
+    optimizer.addVertex(fv);
+  }
+
+  for (const auto &[fid, gid, xc] : problem.obs) {
+    auto fit = fvertices.find(fid);
+    auto git = gvertices.find(gid);
+    if (fit == fvertices.end() || git == gvertices.end()) continue;
+    auto e = new Edge();
+    e->setVertex(0, fit->second);
+    e->setVertex(1, git->second);
+    e->setMeasurement(xc);
+    e->setInformation(Mat2::Identity());
+    if (use_robust_kernel_) {
+      e->setRobustKernel(new g2o::RobustKernelHuber());
+    }
+    optimizer.addEdge(e);
+  }
+
+  // the oldest pose which carries a marginal from the last window anchors
+  // this one; without any, the oldest pose is held fixed
+  bool anchored = false;
+  for (const auto &g : problem.groups) {
+    auto it = priors_.find(g.id);
+    if (it == priors_.end()) continue;
+    auto e = new GroupPriorEdge();
+    e->setVertex(0, gvertices.at(g.id));
+    e->setMeasurement(it->second.gsc);
+    e->setInformation(prior_weight_ * it->second.info);
+    optimizer.addEdge(e);
+    anchored = true;
+    break;
+  }
+  if (!anchored && !problem.groups.empty()) {
+    gvertices.at(problem.groups.front().id)->setFixed(true);
+  }
+
+  WindowResult result;
+  optimizer.initializeOptimization();
+  optimizer.computeActiveErrors();
+  result.init_chi2 = optimizer.chi2();
+
+  stop_ = false;
+  budget.Start(time_budget_ms_);
+  result.iterations = optimizer.optimize(max_iters_);
+  result.out_of_time = stop_ && !quit_;
+  result.chi2 = optimizer.chi2();
+
+  // marginalize: the covariance of every free pose summarizes the window for
+  // whichever of them is the oldest next time. Correlations between poses
+  // are dropped.
+  priors_.clear();
+  std::vector<std::pair<int, int>> blocks;
+  for (const auto &[gid, gv] : gvertices) {
+    if (gv->hessianIndex() >= 0) {
+      blocks.emplace_back(gv->hessianIndex(), gv->hessianIndex());
+    }
+  }
+  g2o::SparseBlockMatrix<g2o::MatrixX> spinv;
+  if (result.iterations > 0 && !blocks.empty() &&
+      optimizer.computeMarginals(spinv, blocks)) {
+    for (const auto &[gid, gv] : gvertices) {
+      int index = gv->hessianIndex();
+      if (index < 0) continue;
+      const g2o::MatrixX *cov = spinv.block(index, index);
+      if (cov == nullptr) continue;
+      Mat6 info = cov->inverse();
+      if (info.allFinite()) {
+        priors_[gid] = Prior{gv->estimate(), info};
+      }
+    }
+  }
+
+  refined_groups_.clear();
+  refined_features_.clear();
+  for (const auto &g : problem.groups) {
+    const SE3 &gsc = gvertices.at(g.id)->estimate();
+    result.groups.push_back(GroupAdapter{g.id, gsc});
+    refined_groups_[g.id] = gsc;
+  }
+  for (const auto &f : problem.features) {
+    const Vec3 &Xs = fvertices.at(f.id)->estimate();
+    result.features.push_back(FeatureAdapter{f.id, Xs});
+    refined_features_[f.id] = Xs;
+  }
+
+  optimizer.removePostIterationAction(&budget);
+  result.elapsed_ms = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+
+  if (verbose_) {
+    LOG(INFO) << StrFormat("window BA: %d groups, %d features, %d iters, "
+                           "chi2 %0.2f -> %0.2f, %0.2f ms%s",
+                           (int)problem.groups.size(), (int)problem.features.size(),
+                           result.iterations, result.init_chi2, result.chi2,
+                           result.elapsed_ms,
+                           result.out_of_time ? " (out of time)" : "");
+    if (++rounds_ % 50 == 0) {
+      std::cout << profiler_;
+    }
+  }
+  return result;
+}
+
+} // namespace xivo
@@ -0,0 +1,123 @@
+// Fixed-lag bundle adjustment over the latest groups of the visibility graph.
+// The filter thread submits snapshots of the window; a worker refines them
+// under a per-invocation time budget and carries the marginals of the poses
+// into the next window as priors, so older states are summarized rather than
+// re-optimized. The refined poses are published for consumers of the
+// trajectory; they are not fed back into the filter state.
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "json/json.h"
+
+#include "optimizer_types.h"
+#include "profiler.h"
+
+namespace xivo {
+
+/** Snapshot of a window: camera-to-spatial poses of the groups (oldest
+ * first), the features they observe and the observations in normalized
+ * coordinates. */
+struct WindowProblem {
+  std::vector<GroupAdapter> groups;
+  std::vector<FeatureAdapter> features;
+  std::vector<std::tuple<int, int, Vec2>> obs;  // feature id, group id, xc
+  SE3 gbc;  // camera-to-body the poses are composed with
+};
+
+struct WindowResult {
+  std::vector<GroupAdapter> groups;
+  std::vector<FeatureAdapter> features;
+  number_t init_chi2, chi2;
+  int iterations;
+  double elapsed_ms;
+  bool out_of_time;  // stopped by the time budget
+};
+
+
+class WindowOptimizer;
+using WindowOptimizerPtr = WindowOptimizer*;
+
+class WindowOptimizer {
+public:
+  ~WindowOptimizer();
+  static WindowOptimizerPtr Create(const Json::Value &cfg);
+  static WindowOptimizerPtr instance();
+
+  bool enabled() const { return enabled_; }
+  int window_size() const { return window_size_; }
+  int period() const { return period_; }
+
+  /** Queue a window for refinement. A window still waiting is replaced. */
+  void Submit(WindowProblem problem);
+  /** Result of the latest refinement, if it has not been collected yet. */
+  std::optional<WindowResult> Poll();
+
+  /** Body-to-spatial poses of the groups of the last refined window, keyed
+   * by group id. `version`, if given, receives the version of the poses. */
+  std::unordered_map<int, SE3> GetRefinedPoses(int *version=nullptr) const {
+    return refined_poses_.Get(version);
+  }
+  bool GetRefinedPose(int gid, SE3 &gsb) const {
+    return refined_poses_.Get(gid, gsb);
+  }
+  /** Incremented every time the worker publishes new poses. */
+  int refined_poses_version() const { return refined_poses_.version(); }
+
+  /** Refine a window on the calling thread. Must not run concurrently with
+   * the worker. */
+  WindowResult Solve(const WindowProblem &problem);
+
+private:
+  WindowOptimizer() = delete;
+  WindowOptimizer(const WindowOptimizer &) = delete;
+  WindowOptimizer &operator=(const WindowOptimizer &) = delete;
+
+  WindowOptimizer(const Json::Value &cfg);
+
+  void Run();
+  void Publish(const WindowResult &result, const SE3 &gbc);
+
+  bool enabled_;
+  bool verbose_;
+  std::string solver_type_;
+  bool use_robust_kernel_;
+  int window_size_;
+  int period_;  // submit a window every this many frames
+  int max_iters_;
+  double time_budget_ms_;
+  number_t prior_weight_;
+
+  struct Prior {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    SE3 gsc;
+    Mat6 info;
+  };
+  // marginals of the last window, keyed by group id
+  std::unordered_map<int, Prior> priors_;
+  // refined estimates of the last window, used as initial values
+  std::unordered_map<int, SE3> refined_groups_;
+  std::unordered_map<int, Vec3> refined_features_;
+
+  Profiler profiler_;
+  int rounds_;
+
+  bool stop_;
+  std::atomic<bool> quit_;
+  std::thread worker_;
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  std::optional<WindowProblem> problem_;
+  std::optional<WindowResult> result_;
+
+  PublishedPoses refined_poses_;
+};
+
+} // namespace xivo